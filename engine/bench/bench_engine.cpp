@@ -0,0 +1,554 @@
+// Engine benchmark suite. Builds synthetic outlines of a given shape and
+// size, times every command and the navigation queries, and prints one JSON
+// document: per-operation latency percentiles, allocations per operation and
+// peak resident size, so builds can be compared over time.
+//
+//   engine_bench [--shapes wide,deep,balanced] [--nodes 1000,10000,100000]
+//                [--suites command,query,memory,scan,host,tree] [--iterations 200]
+//                [--budget-ms 2000] [--out results.json]
+//
+// wide: one root with every other node as its child. deep: a single chain.
+// balanced: a complete tree with eight children per node. The host suite
+// runs text edits on many copies of the outline through a DocumentHost, and
+// the tree suite runs validate() and subtree_stats(), each with one worker
+// and with one per core.
+
+#include "bullet_engine/host.hpp"
+#include "bullet_engine/instrument.hpp"
+#include "bullet_engine/parallel.hpp"
+#include "bullet_engine/pool.hpp"
+#include "bullet_engine/scan.hpp"
+#include "bullet_engine/snapshot.hpp"
+#include "bullet_engine/state_builder.hpp"
+#include "bullet_engine/state_utils.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+using namespace bullet;
+
+// Every operator new in the process (the library included) is counted. The
+// whole replaceable set is defined, array, sized, nothrow and aligned forms
+// alike, so each allocation is released by the matching counterpart.
+static std::atomic<size_t> g_allocs{ 0 };
+static std::atomic<size_t> g_allocBytes{ 0 };
+
+static void* counted_alloc(size_t n, size_t align) noexcept {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    g_allocBytes.fetch_add(n, std::memory_order_relaxed);
+    if (n == 0) n = 1;
+    if (align <= alignof(std::max_align_t)) return std::malloc(n);
+    return std::aligned_alloc(align, (n + align - 1) & ~(align - 1));
+}
+
+static void* counted_new(size_t n, size_t align) {
+    if (void* p = counted_alloc(n, align)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t n) { return counted_new(n, 0); }
+void* operator new[](size_t n) { return counted_new(n, 0); }
+void* operator new(size_t n, std::align_val_t a) { return counted_new(n, static_cast<size_t>(a)); }
+void* operator new[](size_t n, std::align_val_t a) { return counted_new(n, static_cast<size_t>(a)); }
+void* operator new(size_t n, const std::nothrow_t&) noexcept { return counted_alloc(n, 0); }
+void* operator new[](size_t n, const std::nothrow_t&) noexcept { return counted_alloc(n, 0); }
+void* operator new(size_t n, std::align_val_t a, const std::nothrow_t&) noexcept { return counted_alloc(n, static_cast<size_t>(a)); }
+void* operator new[](size_t n, std::align_val_t a, const std::nothrow_t&) noexcept { return counted_alloc(n, static_cast<size_t>(a)); }
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+
+// Resident set size in bytes (0 where /proc is not available).
+static size_t rss_bytes() {
+#if defined(__linux__)
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#else
+    return 0;
+#endif
+}
+
+static size_t peak_rss_bytes() {
+#if defined(__linux__) || defined(__APPLE__)
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return static_cast<size_t>(usage.ru_maxrss); // bytes
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024; // KiB
+#endif
+#else
+    return 0;
+#endif
+}
+
+using Clock = std::chrono::steady_clock;
+
+struct Config {
+    std::vector<std::string> shapes{ "wide", "deep", "balanced" };
+    std::vector<size_t> nodes{ 1000, 10000, 100000 };
+    std::vector<std::string> suites{ "command", "query", "memory", "scan", "host", "tree" };
+    size_t iterations = 200;
+    double budgetMs = 2000;
+    std::string out;
+
+    bool runs(const char* suite) const { return std::find(suites.begin(), suites.end(), suite) != suites.end(); }
+};
+
+struct Result {
+    std::string suite;
+    std::string name;
+    std::string shape;
+    size_t nodes = 0;
+    std::vector<double> us; // one sample per iteration
+    size_t allocs = 0;
+    size_t allocBytes = 0;
+    std::vector<std::pair<std::string, double>> extra;
+};
+
+// Brackets the measured part of one iteration; allocations are counted only
+// between start() and stop().
+class Stopwatch {
+public:
+    explicit Stopwatch(Result& r) : r_(r) {}
+
+    void start() {
+        a0_ = g_allocs.load(std::memory_order_relaxed);
+        b0_ = g_allocBytes.load(std::memory_order_relaxed);
+        t0_ = Clock::now();
+    }
+    void stop() {
+        const auto t1 = Clock::now();
+        r_.us.push_back(std::chrono::duration<double, std::micro>(t1 - t0_).count());
+        r_.allocs += g_allocs.load(std::memory_order_relaxed) - a0_;
+        r_.allocBytes += g_allocBytes.load(std::memory_order_relaxed) - b0_;
+    }
+
+private:
+    Result& r_;
+    size_t a0_ = 0;
+    size_t b0_ = 0;
+    Clock::time_point t0_;
+};
+
+// Runs op(i, stopwatch) up to `iterations` times, stopping early once the
+// time budget is spent (after at least three samples).
+template <class Op>
+static Result sample(const Config& cfg, Result r, size_t iterations, Op&& op) {
+    r.us.reserve(iterations); // keep the sample vector's growth out of the counts
+    Stopwatch sw(r);
+    const auto deadline = Clock::now() + std::chrono::duration<double, std::milli>(cfg.budgetMs);
+    for (size_t i = 0; i < iterations; ++i) {
+        op(i, sw);
+        if (i >= 2 && Clock::now() > deadline) break;
+    }
+    return r;
+}
+
+// ---- Synthetic outlines ---------------------------------------------------
+
+static std::string sentence(std::mt19937& rng, size_t i) {
+    static const char* words[] = { "review", "draft", "alpha", "beta", "notes", "Todo", "meeting", "plan",
+                                   "ship", "fix", "bug", "report", "weekly", "design", "ideas", "backlog" };
+    std::string text;
+    for (int w = 0; w < 6; ++w) {
+        text += words[rng() % 16];
+        text += ' ';
+    }
+    return text + std::to_string(i);
+}
+
+static State build_shape(const std::string& shape, size_t n) {
+    StateBuilder b;
+    std::mt19937 rng(1);
+    auto add = [&](size_t depth, size_t i) { b.add(make_new_id(b.state()), sentence(rng, i), depth); };
+    if (shape == "wide") {
+        for (size_t i = 0; i < n; ++i) add(i == 0 ? 0 : 1, i);
+    } else if (shape == "deep") {
+        for (size_t i = 0; i < n; ++i) add(i, i);
+    } else {
+        // complete 8-ary tree: node k's children are 8k+1 .. 8k+8, emitted in preorder
+        std::vector<std::pair<size_t, size_t>> stack{ { 0, 0 } };
+        for (size_t i = 0; !stack.empty(); ++i) {
+            const auto [k, depth] = stack.back();
+            stack.pop_back();
+            add(depth, i);
+            for (size_t c = 8; c >= 1; --c) {
+                if (8 * k + c < n) stack.emplace_back(8 * k + c, depth + 1);
+            }
+        }
+    }
+    State s = b.finish();
+    s.focusedId = root_ids(s).front();
+    return s;
+}
+
+// ---- Suites ---------------------------------------------------------------
+
+// The command, plus any untimed preparation of `pre` it needs to do work.
+static Command command_for(CommandType type, State& pre, const std::string& id) {
+    Command cmd{ type, id };
+    const int len = static_cast<int>(text_of(pre, id).size());
+    switch (type) {
+    case CommandType::SplitAtCaret: cmd.caret = len / 2; break;
+    case CommandType::DeleteEmptyAtId: apply_command_inplace(pre, Command{ CommandType::SetText, id, 0, std::nullopt, "" }); break;
+    case CommandType::SetFocus: cmd.caret = 0; break;
+    case CommandType::SetScopeRoot: cmd.scopeRootId = id; break;
+    case CommandType::InsertLinesAfter: cmd.text = "one\ntwo\nthree\nfour\nfive\nsix\nseven\neight"; break;
+    case CommandType::SetText: cmd.text = "replaced text"; break;
+    case CommandType::InsertText: cmd.caret = std::min(len, 3); cmd.text = "x"; break;
+    case CommandType::DeleteText: cmd.caret = 0; cmd.length = 1; break;
+    default: break;
+    }
+    return cmd;
+}
+
+// Each sample applies one command to the base state through the pure API, so
+// it includes the path copy; the result is dropped outside the timing.
+static void bench_commands(const Config& cfg, const State& base, const std::vector<std::string>& ids,
+                           const std::string& shape, std::vector<Result>& out) {
+    for (size_t t = 0; t < kCommandTypeCount; ++t) {
+        const CommandType type = static_cast<CommandType>(t);
+        std::mt19937 rng(static_cast<unsigned>(t + 1));
+        out.push_back(sample(cfg, Result{ "command", command_type_name(type), shape, ids.size() }, cfg.iterations,
+                             [&](size_t, Stopwatch& sw) {
+                                 State pre = base;
+                                 const Command cmd = command_for(type, pre, ids[rng() % ids.size()]);
+                                 sw.start();
+                                 State next = apply_command(pre, cmd);
+                                 sw.stop();
+                             }));
+    }
+}
+
+static void bench_queries(const Config& cfg, const State& base, const std::vector<std::string>& ids,
+                          const std::string& shape, std::vector<Result>& out) {
+    std::mt19937 rng(99);
+    out.push_back(sample(cfg, Result{ "query", "visible_order_ids", shape, ids.size() }, cfg.iterations,
+                         [&](size_t, Stopwatch& sw) {
+                             sw.start();
+                             std::vector<std::string> order = visible_order_ids(base);
+                             sw.stop();
+                         }));
+    out.push_back(sample(cfg, Result{ "query", "prev_visible_id", shape, ids.size() }, cfg.iterations,
+                         [&](size_t, Stopwatch& sw) {
+                             const std::string& id = ids[rng() % ids.size()];
+                             sw.start();
+                             std::string prev = prev_visible_id(base, id);
+                             sw.stop();
+                         }));
+    out.push_back(sample(cfg, Result{ "query", "next_visible_id", shape, ids.size() }, cfg.iterations,
+                         [&](size_t, Stopwatch& sw) {
+                             const std::string& id = ids[rng() % ids.size()];
+                             sw.start();
+                             std::string next = next_visible_id(base, id);
+                             sw.stop();
+                         }));
+    out.push_back(sample(cfg, Result{ "query", "ancestors_to_root", shape, ids.size() }, cfg.iterations,
+                         [&](size_t, Stopwatch& sw) {
+                             const std::string& id = ids[rng() % ids.size()];
+                             sw.start();
+                             std::vector<std::string> path = ancestors_to_root(base, id);
+                             sw.stop();
+                         }));
+}
+
+// Whole-state costs: building, loading a snapshot and dropping, with the
+// resident growth and the slab pool's footprint (see BULLET_ENGINE_POOL).
+static void bench_memory(const Config& cfg, const std::string& shape, size_t n, std::vector<Result>& out) {
+    auto once = [&](const char* name, auto&& op) {
+        const size_t r0 = rss_bytes();
+        Result r = sample(cfg, Result{ "memory", name, shape, n }, 1, [&](size_t, Stopwatch& sw) { op(sw); });
+        const PoolStats pool = pool_stats();
+        r.extra = { { "rssDelta", static_cast<double>(rss_bytes()) - static_cast<double>(r0) },
+                    { "poolSlabBytes", static_cast<double>(pool.slabBytes) },
+                    { "poolUsedBytes", static_cast<double>(pool.usedBytes) } };
+        out.push_back(std::move(r));
+    };
+    State built;
+    once("build", [&](Stopwatch& sw) {
+        sw.start();
+        built = build_shape(shape, n);
+        sw.stop();
+    });
+    const std::string snapshot = encode_snapshot(built);
+    State loaded;
+    once("materialize", [&](Stopwatch& sw) {
+        sw.start();
+        loaded = SnapshotView::from_bytes(snapshot).materialize();
+        sw.stop();
+    });
+    once("drop", [&](Stopwatch& sw) {
+        sw.start();
+        loaded = State{};
+        sw.stop();
+    });
+}
+
+// The SIMD scan over packed texts against a per-node std::string::find.
+static void bench_scan(const Config& cfg, const State& base, const std::string& shape, std::vector<Result>& out) {
+    const size_t n = node_count(base);
+    PackedTexts packed;
+    out.push_back(sample(cfg, Result{ "scan", "pack", shape, n }, 5, [&](size_t, Stopwatch& sw) {
+        sw.start();
+        packed = PackedTexts::from_state(base);
+        sw.stop();
+    }));
+    for (const char* q : { "todo", "weekly design", "4242" }) {
+        size_t hits = 0;
+        Result naive = sample(cfg, Result{ "scan", std::string("naive_find ") + q, shape, n }, 5, [&](size_t, Stopwatch& sw) {
+            sw.start();
+            hits = 0;
+            base.nodes.for_each([&](NodeHandle, const Node& node) {
+                const std::string t = node.text.str();
+                for (size_t at = t.find(q); at != std::string::npos; at = t.find(q, at + 1)) ++hits;
+            });
+            sw.stop();
+        });
+        naive.extra = { { "hits", static_cast<double>(hits) } };
+        out.push_back(std::move(naive));
+        for (ScanKernel k : { ScanKernel::Scalar, ScanKernel::Sse2, ScanKernel::Avx2 }) {
+            for (bool fold : { false, true }) {
+                ScanOptions o;
+                o.kernel = k;
+                o.caseInsensitive = fold;
+                const std::string name = std::string(fold ? "scan_ci " : "scan ") + scan_kernel_name(k) + " " + q;
+                Result r = sample(cfg, Result{ "scan", name, shape, n }, 5, [&](size_t, Stopwatch& sw) {
+                    sw.start();
+                    hits = scan(packed, q, o).size();
+                    sw.stop();
+                });
+                r.extra = { { "hits", static_cast<double>(hits) } };
+                out.push_back(std::move(r));
+            }
+        }
+    }
+}
+
+// Multi-document throughput: each iteration submits kHostEdits text edits to
+// each of kHostDocs documents and waits for all of them.
+static void bench_host(const Config& cfg, const State& base, const std::vector<std::string>& ids,
+                       const std::string& shape, std::vector<Result>& out) {
+    constexpr size_t kHostDocs = 64, kHostEdits = 32;
+    std::vector<size_t> threads{ 1 };
+    if (std::thread::hardware_concurrency() > 1) threads.push_back(std::thread::hardware_concurrency());
+    for (size_t t : threads) {
+        TaskPool pool(t);
+        DocumentHost host(pool);
+        std::vector<std::shared_ptr<Document>> docs;
+        for (size_t d = 0; d < kHostDocs; ++d) docs.push_back(host.open("doc" + std::to_string(d), base));
+        std::mt19937 rng(7);
+        Result r = sample(cfg, Result{ "host", "edits threads=" + std::to_string(t), shape, ids.size() }, cfg.iterations,
+                          [&](size_t, Stopwatch& sw) {
+                              sw.start();
+                              for (size_t k = 0; k < kHostEdits; ++k) {
+                                  for (const auto& doc : docs) {
+                                      const std::string& id = ids[rng() % ids.size()];
+                                      host.submit(doc, { Command{ CommandType::InsertText, id, 0, std::nullopt, "x" } });
+                                  }
+                              }
+                              host.drain();
+                              sw.stop();
+                          });
+        double sum = 0;
+        for (double us : r.us) sum += us;
+        r.extra = { { "threads", static_cast<double>(t) },
+                    { "commandsPerSec", static_cast<double>(kHostDocs * kHostEdits * r.us.size()) / (sum / 1e6) } };
+        out.push_back(std::move(r));
+    }
+}
+
+// Whole-tree walks on the calling thread and split across a pool.
+static void bench_tree(const Config& cfg, const State& base, const std::string& shape, std::vector<Result>& out) {
+    const size_t n = node_count(base);
+    std::vector<size_t> threads{ 0 };
+    if (std::thread::hardware_concurrency() > 1) threads.push_back(std::thread::hardware_concurrency());
+    for (size_t t : threads) {
+        std::unique_ptr<TaskPool> pool = t ? std::make_unique<TaskPool>(t) : nullptr;
+        const std::string suffix = t ? " threads=" + std::to_string(t) : " inline";
+        size_t found = 0;
+        Result v = sample(cfg, Result{ "tree", "validate" + suffix, shape, n }, 20, [&](size_t, Stopwatch& sw) {
+            sw.start();
+            found = validate(base, pool.get()).size();
+            sw.stop();
+        });
+        v.extra = { { "violations", static_cast<double>(found) } };
+        out.push_back(std::move(v));
+        out.push_back(sample(cfg, Result{ "tree", "subtree_stats" + suffix, shape, n }, 20, [&](size_t, Stopwatch& sw) {
+            sw.start();
+            found = subtree_stats(base, {}, pool.get()).nodes;
+            sw.stop();
+        }));
+    }
+}
+
+// ---- Output ---------------------------------------------------------------
+
+static void put_string(std::ostream& os, const std::string& s) {
+    os << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') os << '\\' << c;
+        else if (static_cast<unsigned char>(c) < 0x20) os << ' ';
+        else os << c;
+    }
+    os << '"';
+}
+
+// Nearest-rank percentile of sorted samples.
+static double percentile(const std::vector<double>& sorted, double p) {
+    const size_t rank = static_cast<size_t>(p / 100.0 * static_cast<double>(sorted.size()) + 0.999999);
+    return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+}
+
+static void put_result(std::ostream& os, const Result& r) {
+    std::vector<double> us = r.us;
+    std::sort(us.begin(), us.end());
+    double sum = 0;
+    for (double x : us) sum += x;
+    const double n = static_cast<double>(us.size());
+    os << "{\"suite\":";
+    put_string(os, r.suite);
+    os << ",\"name\":";
+    put_string(os, r.name);
+    os << ",\"shape\":";
+    put_string(os, r.shape);
+    os << ",\"nodes\":" << r.nodes << ",\"iterations\":" << us.size() << ",\"meanUs\":" << sum / n
+       << ",\"p50Us\":" << percentile(us, 50) << ",\"p90Us\":" << percentile(us, 90)
+       << ",\"p99Us\":" << percentile(us, 99) << ",\"maxUs\":" << us.back()
+       << ",\"allocsPerOp\":" << static_cast<double>(r.allocs) / n
+       << ",\"allocBytesPerOp\":" << static_cast<double>(r.allocBytes) / n;
+    for (const auto& [key, value] : r.extra) {
+        os << ',';
+        put_string(os, key);
+        os << ':' << value;
+    }
+    os << '}';
+}
+
+static std::vector<std::string> split_list(const char* arg) {
+    std::vector<std::string> out;
+    std::stringstream ss(arg);
+    for (std::string item; std::getline(ss, item, ',');) {
+        if (!item.empty()) out.push_back(item);
+    }
+    return out;
+}
+
+static bool parse_args(int argc, char** argv, Config& cfg) {
+    for (int i = 1; i < argc; i += 2) {
+        const char* arg = argv[i];
+        if (i + 1 >= argc) return false;
+        const char* value = argv[i + 1];
+        if (std::strcmp(arg, "--shapes") == 0) {
+            cfg.shapes = split_list(value);
+            for (const auto& s : cfg.shapes) {
+                if (s != "wide" && s != "deep" && s != "balanced") return false;
+            }
+        } else if (std::strcmp(arg, "--nodes") == 0) {
+            cfg.nodes.clear();
+            for (const auto& s : split_list(value)) cfg.nodes.push_back(std::max<size_t>(2, std::stoul(s)));
+        } else if (std::strcmp(arg, "--suites") == 0) {
+            cfg.suites = split_list(value);
+        } else if (std::strcmp(arg, "--iterations") == 0) {
+            cfg.iterations = std::max<size_t>(1, std::stoul(value));
+        } else if (std::strcmp(arg, "--budget-ms") == 0) {
+            cfg.budgetMs = std::stod(value);
+        } else if (std::strcmp(arg, "--out") == 0) {
+            cfg.out = value;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Config cfg;
+    if (!parse_args(argc, argv, cfg)) {
+        std::fprintf(stderr,
+                     "usage: engine_bench [--shapes wide,deep,balanced] [--nodes 1000,10000,100000]\n"
+                     "                    [--suites command,query,memory,scan,host,tree] [--iterations N] [--budget-ms MS]\n"
+                     "                    [--out FILE]\n");
+        return 2;
+    }
+
+    std::vector<Result> results;
+    for (const auto& shape : cfg.shapes) {
+        for (size_t n : cfg.nodes) {
+            std::fprintf(stderr, "%s %zu\n", shape.c_str(), n);
+            if (cfg.runs("memory")) bench_memory(cfg, shape, n, results);
+            const State base = build_shape(shape, n);
+            const std::vector<std::string> ids = node_ids(base);
+            if (cfg.runs("command")) bench_commands(cfg, base, ids, shape, results);
+            if (cfg.runs("query")) bench_queries(cfg, base, ids, shape, results);
+            if (cfg.runs("scan")) bench_scan(cfg, base, shape, results);
+            if (cfg.runs("host")) bench_host(cfg, base, ids, shape, results);
+            if (cfg.runs("tree")) bench_tree(cfg, base, shape, results);
+        }
+    }
+
+    std::ostringstream os;
+    os << "{\"pool\":";
+#ifdef BULLET_ENGINE_NO_POOL
+    os << "false";
+#else
+    os << "true";
+#endif
+    os << ",\"instrumentation\":" << (kInstrumentationEnabled ? "true" : "false");
+    os << ",\"assertions\":";
+#ifdef NDEBUG
+    os << "false";
+#else
+    os << "true";
+#endif
+    os << ",\"scanKernel\":";
+    put_string(os, scan_kernel_name());
+    os << ",\"iterations\":" << cfg.iterations << ",\"budgetMs\":" << cfg.budgetMs << ",\"results\":[";
+    for (size_t i = 0; i < results.size(); ++i) {
+        os << (i ? ",\n" : "\n");
+        put_result(os, results[i]);
+    }
+    os << "\n],\"peakRssBytes\":" << peak_rss_bytes() << "}\n";
+
+    if (cfg.out.empty()) {
+        std::fputs(os.str().c_str(), stdout);
+    } else {
+        std::ofstream f(cfg.out, std::ios::binary);
+        f << os.str();
+        if (!f) {
+            std::fprintf(stderr, "engine_bench: cannot write %s\n", cfg.out.c_str());
+            return 1;
+        }
+    }
+    return 0;
+}
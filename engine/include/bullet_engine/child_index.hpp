@@ -0,0 +1,70 @@
+#pragma once
+
+#include "bullet_engine/node_handle.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace bullet {
+
+// Persistent order-statistic treap over one sibling container. Entries are
+// keyed by the siblings' order-maintenance labels, so a node's index is found
+// from its own label in O(log n) without scanning. Each entry also carries a
+// weight (the sibling's visible subtree size) and every tree node caches the
+// weight sum below it, so visible-row offsets map to siblings in O(log n).
+// Entries also carry the sibling's subtree height, and tree nodes the maximum
+// below them, so a parent's height is known without visiting its children.
+// Updates path-copy; copies of the index share all untouched tree nodes.
+class ChildIndex {
+public:
+    struct Entry {
+        uint64_t label;
+        NodeHandle node;
+        size_t weight = 1;
+        uint32_t height = 1;
+    };
+
+    size_t size() const;
+    bool empty() const { return !root_; }
+
+    size_t weight() const;             // sum of all entry weights
+    uint32_t max_height() const;       // largest entry height, 0 when empty
+
+    size_t rank(uint64_t label) const; // number of entries with a smaller label
+    Entry at(size_t i) const;          // requires i < size()
+
+    size_t weight_before(uint64_t label) const; // weight sum of entries with a smaller label
+    // Entry whose weight range [before, before + weight) holds `offset`;
+    // `within` receives offset - before. Requires offset < weight().
+    Entry find_weight(size_t offset, size_t& within) const;
+
+    void insert(const Entry& e);       // e.label must not be present
+    // Insert a run of entries with increasing labels that all fall between the
+    // same two neighbours: O(run + log n).
+    void insert_run(const std::vector<Entry>& run);
+    void erase(uint64_t label);        // label must be present
+    void add_weight(uint64_t label, long long delta); // label must be present
+    // Add delta to the entry's weight and set its height; label must be present.
+    void update(uint64_t label, long long delta, uint32_t height);
+    // Give entries [first, first + labels.size()) new labels; order must be kept.
+    void relabel(size_t first, const std::vector<uint64_t>& labels);
+
+    // Approximate bytes one update() path-copies out of a shared index of
+    // `n` entries (an expected-depth treap path); used by history estimates.
+    static size_t bytes_per_update(size_t n);
+
+private:
+    struct TNode;
+    using Ptr = std::shared_ptr<const TNode>;
+
+    static Ptr merge(const Ptr& a, const Ptr& b);
+    static void split_label(const Ptr& t, uint64_t label, Ptr& lo, Ptr& hi);
+    static void split_rank(const Ptr& t, size_t k, Ptr& lo, Ptr& hi);
+    static Ptr update(const Ptr& t, uint64_t label, long long delta, uint32_t height); // height 0 keeps it
+    static Ptr build(const std::vector<Entry>& entries); // Cartesian tree of a sorted run in O(m)
+
+    Ptr root_;
+};
+
+} // namespace bullet
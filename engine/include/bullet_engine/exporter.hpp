@@ -0,0 +1,47 @@
+#pragma once
+
+#include "bullet_engine/types.hpp"
+#include <cstddef>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace bullet {
+
+// Single-pass export of a State (or of the scope root's subtree) to text
+// formats:
+//   IndentedText  one line per node, `indent` repeated per level
+//   Markdown      the same as "- " list items
+//   Opml          OPML 2.0 with nested <outline text="..."> elements
+//   Json          the spec's state shape: { nodes: { id: { id, parentId,
+//                 text, children, collapsed? } }, rootOrder, focusedId,
+//                 caret, scopeRootId? }
+// The walk follows child, sibling and parent links, so it does not recurse
+// and handles any depth. Output is escaped straight into a buffer that is
+// handed to the sink every `chunkBytes`; no per-node strings are built.
+// Line breaks inside a node's text become spaces in the line formats.
+class ExportError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+enum class ExportFormat { IndentedText, Markdown, Opml, Json };
+
+struct ExportOptions {
+    ExportFormat format = ExportFormat::IndentedText;
+    bool wholeTree = false;      // ignore scopeRootId and export every root
+    bool visibleOnly = false;    // leave out the children of collapsed nodes
+    std::string indent = "  ";   // one nesting level (Opml: cosmetic, may be empty)
+    std::string title;           // Opml: <head><title>
+    size_t chunkBytes = 64 << 10;
+};
+
+// Receives the output in order, in chunks of about chunkBytes.
+using ExportSink = std::function<void(std::string_view chunk)>;
+
+void export_outline(const State& s, const ExportSink& sink, const ExportOptions& opts = {});
+std::string export_outline_string(const State& s, const ExportOptions& opts = {});
+void export_outline_file(const State& s, const std::string& path, const ExportOptions& opts = {}); // throws ExportError
+
+} // namespace bullet
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "bullet_engine/types.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace bullet {
+
+// Undo/redo over persistent states. Each step keeps the State from before
+// (or, on the redo side, after) the command; copies share all untouched
+// storage, so a step costs roughly the nodes it touched. Structural commands
+// are discrete steps; consecutive text edits (SetText, InsertText, DeleteText)
+// on the same node within the coalesce window fold into one. Focus and scope changes are not steps.
+// Retained memory is estimated per step and the oldest steps are evicted once
+// the byte budget is exceeded.
+class History {
+public:
+    static constexpr size_t kDefaultByteBudget = 64u << 20;
+    static constexpr uint64_t kDefaultCoalesceMs = 1000;
+
+    explicit History(size_t byteBudget = kDefaultByteBudget, uint64_t coalesceMs = kDefaultCoalesceMs);
+
+    // Apply cmd to `s` in place and record the step. `nowMs` is any
+    // monotonic clock in milliseconds; it only drives text-edit coalescing.
+    ChangeSet apply(State& s, const Command& cmd, uint64_t nowMs);
+    ChangeSet apply(State& s, const Command& cmd); // uses a steady clock
+    // Apply a batch (e.g. a paste script) as a single discrete step.
+    ChangeSet apply_batch(State& s, const std::vector<Command>& cmds);
+
+    // Step back/forward. The returned change record describes the edit from
+    // the current state to the restored one (empty when there is nothing to do).
+    ChangeSet undo(State& s);
+    ChangeSet redo(State& s);
+
+    bool can_undo() const { return !undo_.empty(); }
+    bool can_redo() const { return !redo_.empty(); }
+    size_t undo_depth() const { return undo_.size(); }
+    size_t redo_depth() const { return redo_.size(); }
+    size_t bytes() const { return bytes_; } // estimated memory retained by all steps
+
+    void set_byte_budget(size_t budget);
+    void set_coalesce_window(uint64_t ms) { coalesceMs_ = ms; }
+    void clear();
+
+private:
+    struct Step {
+        State state;        // state to restore
+        ChangeSet changes;  // what the step changed, in the forward direction
+        bool textEdit;      // a coalescable text-edit step
+        std::string textId; // node edited by a text step
+        uint64_t lastMs;
+        size_t bytes;
+    };
+
+    static size_t estimate(const State& before, const State& after, const ChangeSet& ch);
+    void record(State before, const State& after, const ChangeSet& ch, bool textEdit, const std::string& textId,
+                uint64_t nowMs);
+    ChangeSet restore(State& s, std::deque<Step>& from, std::deque<Step>& to, bool forward);
+    void evict();
+
+    std::deque<Step> undo_;
+    std::deque<Step> redo_;
+    size_t budget_;
+    uint64_t coalesceMs_;
+    size_t bytes_ = 0;
+};
+
+} // namespace bullet
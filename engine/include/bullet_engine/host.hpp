@@ -0,0 +1,147 @@
+#pragma once
+
+#include "bullet_engine/state_handle.hpp"
+#include "bullet_engine/types.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace bullet {
+
+// Fixed set of worker threads with one task deque each. A task posted from a
+// worker goes to that worker's deque (and is popped LIFO, while it is still
+// warm); tasks posted from elsewhere are dealt round-robin. An idle worker
+// steals from the front of the other deques before going to sleep.
+// Tasks must not throw.
+class TaskPool {
+public:
+    // threads == 0 uses std::thread::hardware_concurrency() (at least 1).
+    explicit TaskPool(size_t threads = 0);
+    // Runs the tasks already posted, then joins the workers.
+    ~TaskPool();
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+
+    void post(std::function<void()> task);
+    // Block until every posted task (including tasks they posted) finished.
+    void wait_idle();
+    size_t size() const { return workers_.size(); }
+
+private:
+    struct Queue {
+        std::mutex mu;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void run(size_t self);
+    bool take(size_t self, std::function<void()>& task);
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> next_{ 0 };
+    // Posting and running tasks only touch the deques and these counters;
+    // mu_ is taken to park or wake a thread, and only when one is parked.
+    std::atomic<size_t> queued_{ 0 };      // posted, not yet taken
+    std::atomic<size_t> pending_{ 0 };     // posted, not yet finished
+    std::atomic<size_t> sleepers_{ 0 };    // workers parked on wake_
+    std::atomic<size_t> idleWaiters_{ 0 }; // wait_idle() callers parked on idle_
+    std::mutex mu_;                        // guards stop_ and the parking
+    std::condition_variable wake_;         // work was posted, or stopping
+    std::condition_variable idle_;         // pending_ dropped to zero
+    bool stop_ = false;
+};
+
+// One document of a DocumentHost. Commands run on the document's strand: at
+// most one pool task works on a document at a time, in submission order, as
+// the single writer of the document's StateHandle. Each drained batch is
+// published as one version, so readers never wait for a running command.
+class Document {
+public:
+    using Completion = std::function<void(const ChangeSet&)>;
+
+    explicit Document(std::string id, State initial);
+
+    const std::string& id() const { return id_; }
+    // Pin the latest published version (see StateHandle). Any thread.
+    StateHandle::ReadGuard read() const { return state_.read(); }
+    // O(1) copy of the latest published version. Any thread.
+    State snapshot() const { return state_.snapshot(); }
+    // Commands applied and published so far.
+    uint64_t version() const { return version_.load(std::memory_order_acquire); }
+
+private:
+    friend class DocumentHost;
+
+    struct Job {
+        std::vector<Command> cmds;
+        Completion done;
+    };
+
+    const std::string id_;
+    StateHandle state_;                       // written by the strand only
+    std::atomic<uint64_t> version_{ 0 };
+    std::mutex mu_;                           // guards queue_ and scheduled_
+    std::deque<Job> queue_;
+    bool scheduled_ = false;
+};
+
+// Many documents keyed by id over one shared TaskPool. Commands for
+// different documents run in parallel; commands for one document are
+// serialized by its strand. All members are thread-safe.
+class DocumentHost {
+public:
+    using Completion = Document::Completion;
+
+    // Commands drained per strand turn before the document yields the worker.
+    static constexpr size_t kStrandBatch = 64;
+
+    explicit DocumentHost(TaskPool& pool);
+    // Waits for the submitted commands to finish.
+    ~DocumentHost();
+    DocumentHost(const DocumentHost&) = delete;
+    DocumentHost& operator=(const DocumentHost&) = delete;
+
+    // Returns nullptr when the id is already open.
+    std::shared_ptr<Document> open(const std::string& docId, State initial);
+    // Forget the document; commands already submitted still run.
+    bool close(const std::string& docId);
+    std::shared_ptr<Document> find(const std::string& docId) const;
+    size_t document_count() const;
+
+    // O(1) copy of the latest published version; nullopt for an unknown id.
+    std::optional<State> snapshot(const std::string& docId) const;
+
+    // Queue a command (or a batch, applied and reported as one change set).
+    // `done` runs on a pool thread after the result is published. Returns
+    // false for an unknown id.
+    bool submit(const std::string& docId, Command cmd, Completion done = {});
+    bool submit(const std::string& docId, std::vector<Command> cmds, Completion done = {});
+    void submit(const std::shared_ptr<Document>& doc, std::vector<Command> cmds, Completion done = {});
+
+    // Block until every command submitted so far has been applied.
+    void drain();
+
+private:
+    void run_strand(const std::shared_ptr<Document>& doc);
+    void strand_done();
+
+    TaskPool& pool_;
+    mutable std::shared_mutex docsMu_;
+    std::unordered_map<std::string, std::shared_ptr<Document>> docs_;
+    std::mutex activeMu_;
+    std::condition_variable activeCv_;
+    size_t active_ = 0; // scheduled strands
+};
+
+} // namespace bullet
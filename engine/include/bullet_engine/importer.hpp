@@ -0,0 +1,65 @@
+#pragma once
+
+#include "bullet_engine/state_builder.hpp"
+#include "bullet_engine/types.hpp"
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bullet {
+
+// Streaming import of outlines written as text, one node per line:
+//   IndentedText  nesting follows indentation; the rest of the line is the text
+//   Markdown      list items ("-", "*", "+", "1." or "1)") nest by indentation
+//                 and lose their marker; "#" headings nest by level, and the
+//                 lines below a heading become its children
+// A line indented deeper than the previous one is its child; a shallower line
+// closes every level indented at least as far. Blank lines are skipped, tabs
+// advance to the next multiple of tabWidth and CRLF endings are accepted.
+//
+// Input may arrive in chunks of any size. Nodes go straight into a
+// StateBuilder with fresh ids (make_new_id), so an import is one linear pass
+// and the memory beyond the state is one partial line plus the open levels,
+// each holding at most a short run of finished children not yet linked.
+class ImportError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+enum class OutlineFormat { IndentedText, Markdown };
+
+struct ImportOptions {
+    OutlineFormat format = OutlineFormat::IndentedText;
+    size_t tabWidth = 4;
+};
+
+class OutlineImporter {
+public:
+    explicit OutlineImporter(ImportOptions opts = {});
+
+    void feed(std::string_view chunk);
+    // Returns the imported state, focused on the first node (caret 0). Input
+    // without any node gives initial_state().
+    State finish();
+
+    size_t node_count() const { return nodes_; }
+
+private:
+    void line(std::string_view text);
+    void add(std::string_view text, size_t depth);
+
+    ImportOptions opts_;
+    StateBuilder builder_;
+    std::string carry_;            // an incomplete line from the previous chunk
+    std::vector<size_t> indents_;  // indentation column of each open list level
+    std::vector<size_t> headings_; // Markdown: levels of the open headings
+    size_t nodes_ = 0;
+    std::string firstId_;
+};
+
+State import_outline(std::string_view text, ImportOptions opts = {});
+State import_outline_file(const std::string& path, ImportOptions opts = {}); // throws ImportError
+
+} // namespace bullet
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+// Opt-in command instrumentation. Configure with BULLET_ENGINE_INSTRUMENT=ON
+// (defines BULLET_ENGINE_INSTRUMENT=1) to have apply_command and
+// apply_command_inplace report one CommandSample per command to the installed
+// observer. Without it the hooks and counters compile to nothing; the types
+// below stay available so callers need no #ifdefs, but no sample is produced.
+#ifndef BULLET_ENGINE_INSTRUMENT
+#define BULLET_ENGINE_INSTRUMENT 0
+#endif
+
+namespace bullet {
+
+enum class CommandType;
+constexpr size_t kCommandTypeCount = 15;
+constexpr bool kInstrumentationEnabled = BULLET_ENGINE_INSTRUMENT != 0;
+
+struct CommandSample {
+    CommandType type;
+    uint64_t cloneNs = 0;      // copying the state (pure apply_command only)
+    uint64_t transformNs = 0;  // running the command
+    size_t cloneBytes = 0;     // shared storage copied on write: store leaves, map branches, vectors
+    size_t nodesTouched = 0;   // ids in the change set (touched + created + removed)
+    size_t allocations = 0;    // persistent storage blocks allocated (pool or operator new)
+};
+
+class CommandObserver {
+public:
+    virtual ~CommandObserver() = default;
+    // Called on the thread that ran the command, after it finished.
+    virtual void on_command(const CommandSample& sample) = 0;
+};
+
+// Install the process-wide observer (nullptr detaches it) and return the
+// previous one. The observer must outlive its installation.
+CommandObserver* set_command_observer(CommandObserver* observer);
+CommandObserver* command_observer();
+
+// Latency histogram buckets: bucket 0 is under 1 us, bucket b holds
+// [2^(b-1), 2^b) us, and the last bucket everything above.
+constexpr size_t kLatencyBuckets = 24;
+
+struct CommandStats {
+    uint64_t count = 0;
+    uint64_t totalNs = 0; // clone + transform
+    uint64_t maxNs = 0;
+    uint64_t cloneNs = 0;
+    uint64_t cloneBytes = 0;
+    uint64_t nodesTouched = 0;
+    uint64_t allocations = 0;
+    std::array<uint64_t, kLatencyBuckets> latency{};
+};
+
+// Observer that aggregates samples per command type. Thread-safe.
+class CommandMetrics : public CommandObserver {
+public:
+    void on_command(const CommandSample& sample) override;
+
+    CommandStats stats(CommandType type) const;
+    void reset();
+    // {"SplitAtCaret":{"count":..,"totalNs":..,...,"latency":[..]},...} for
+    // the types seen so far.
+    std::string to_json() const;
+
+private:
+    mutable std::mutex mu_;
+    std::array<CommandStats, kCommandTypeCount> stats_{};
+};
+
+namespace instrument_detail {
+
+// Per-thread running totals the probes in the storage layer add to; a
+// command's share is the difference across its run.
+struct Counters {
+    size_t copiedBytes = 0;
+    size_t allocations = 0;
+};
+inline thread_local Counters counters;
+
+} // namespace instrument_detail
+
+} // namespace bullet
+
+#if BULLET_ENGINE_INSTRUMENT
+#define BULLET_COUNT_COPY(bytes) (::bullet::instrument_detail::counters.copiedBytes += (bytes))
+#define BULLET_COUNT_ALLOC() (++::bullet::instrument_detail::counters.allocations)
+#else
+#define BULLET_COUNT_COPY(bytes) ((void)0)
+#define BULLET_COUNT_ALLOC() ((void)0)
+#endif
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "bullet_engine/types.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace bullet {
+
+// Append-only command journal (write-ahead log) over a binary snapshot.
+// A document lives in two files: `<base>.snap` (see snapshot.hpp) and
+// `<base>.log`. Commands are deterministic, so the log records the commands
+// themselves; recovery loads the snapshot and replays the log on top of it.
+//
+// Log layout: a 24-byte header (magic "BLTJRNL\0", version, and a hash of the
+// snapshot it extends), then commit records [u32 length][u32 crc32][payload],
+// each payload a varint command count followed by compact command encodings.
+// A record is one commit: a single command or a whole batch.
+class JournalError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+enum class SyncPolicy {
+    Always,  // write and fsync every commit
+    Batched, // group commits; write and fsync once per group or on flush()
+    Never    // group commits; write without fsync (the OS decides)
+};
+
+struct JournalOptions {
+    SyncPolicy sync = SyncPolicy::Batched;
+    size_t groupCommit = 64;           // commits buffered before a write (Batched/Never)
+    uint64_t compactBytes = 64u << 20; // log size that triggers a new snapshot
+};
+
+class Journal {
+public:
+    explicit Journal(std::string basePath, JournalOptions opts = {});
+    ~Journal(); // flushes; errors are swallowed here, call flush() to observe them
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    // Load `<base>.snap` (or initial_state() when absent), replay the log and
+    // open it for appending. A torn or corrupt tail (e.g. after a crash) ends
+    // the replay and is cut off. A log left behind by an interrupted
+    // compaction is recognised by its snapshot hash and discarded. A log with
+    // a short header, bad magic or another version throws JournalError and is
+    // left untouched.
+    State recover();
+
+    // Apply to `s` in place and log the commit; compacts past compactBytes.
+    ChangeSet apply(State& s, const Command& cmd);
+    ChangeSet apply_batch(State& s, const std::vector<Command>& cmds);
+
+    void flush(); // write buffered commits and fsync (unless SyncPolicy::Never)
+    // Snapshot `s` and start an empty log. Also use this after changing the
+    // state by other means than commands (e.g. undo/redo).
+    void compact(const State& s);
+
+    uint64_t log_bytes() const { return logBytes_ + pending_.size(); }
+    std::string snapshot_path() const { return base_ + ".snap"; }
+    std::string log_path() const { return base_ + ".log"; }
+
+private:
+    void commit(const std::vector<const Command*>& cmds, const State& s);
+    void write_pending(bool sync);
+    void close_log();
+    void start_log(uint64_t snapshotHash); // replace the log with an empty one and open it
+
+    std::string base_;
+    JournalOptions opts_;
+    std::FILE* log_ = nullptr;
+    uint64_t logBytes_ = 0;   // bytes on disk
+    std::string pending_;     // encoded commits not yet written
+    size_t pendingCommits_ = 0;
+};
+
+} // namespace bullet
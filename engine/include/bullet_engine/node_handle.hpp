@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+
+namespace bullet {
+
+// Dense handle into a NodeStore slot. Index 0 is the null handle; the
+// generation detects handles whose slot has since been freed and reused.
+struct NodeHandle {
+    uint32_t index = 0;
+    uint32_t gen = 0;
+
+    bool valid() const { return index != 0; }
+    explicit operator bool() const { return valid(); }
+    friend bool operator==(NodeHandle a, NodeHandle b) { return a.index == b.index && a.gen == b.gen; }
+    friend bool operator!=(NodeHandle a, NodeHandle b) { return !(a == b); }
+};
+
+} // namespace bullet
@@ -0,0 +1,122 @@
+#pragma once
+
+#include "bullet_engine/child_index.hpp"
+#include "bullet_engine/node_handle.hpp"
+#include "bullet_engine/persistent.hpp"
+#include "bullet_engine/text.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace bullet {
+
+// Ordered sibling container (a node's children, or the roots). Siblings are
+// doubly linked through Node::prev/next for O(1) neighbour access and splicing;
+// `index` maps each sibling's order label to its position in O(log n).
+struct SiblingList {
+    NodeHandle first;
+    NodeHandle last;
+    ChildIndex index;
+
+    size_t size() const { return index.size(); }
+    bool empty() const { return !first.valid(); }
+};
+
+// Internal node record. Structure refers to other nodes by handle; the
+// string id lives only in the store's slot for the node.
+struct Node {
+    NodeHandle parent; // null handle denotes root
+    NodeHandle prev;   // previous sibling
+    NodeHandle next;   // next sibling
+    uint64_t order = 0; // order-maintenance label, increasing along the sibling list; 0 while unlinked
+    size_t visibleSize = 1; // visible rows in this subtree (the node included); its weight in the parent's index
+    // Subtree aggregates, hidden children included, kept current by the
+    // linking and text helpers in state_utils.hpp.
+    size_t subtreeSize = 1;  // nodes in this subtree, the node included
+    size_t subtreeBytes = 0; // text bytes in this subtree
+    uint32_t height = 1;     // levels in this subtree, 1 for a leaf; its height in the parent's index
+    bool collapsed = false; // children hidden from the visible order (visibleSize is then 1)
+    Text text;
+    SiblingList children;
+};
+
+// Persistent slot array of nodes plus an id -> handle index.
+// Slots live in fixed-size leaves under a radix trie; copies share every
+// leaf and a mutation copies only the trie path to the touched slot. Each
+// id is stored once, in its slot; the index files handles under the id's
+// hash and compares through the slot, so it holds no key strings.
+class NodeStore {
+public:
+    NodeStore() = default;
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    // One past the highest slot index ever used; live handles have index < slot_limit().
+    uint32_t slot_limit() const { return next_; }
+
+    // Boundary: string id <-> handle
+    NodeHandle find(const std::string& id) const;
+    const std::string& id_of(NodeHandle h) const;
+
+    bool contains(NodeHandle h) const;
+    const Node& get(NodeHandle h) const;
+    Node& mut(NodeHandle h); // copies the path to the slot if shared
+
+    // Live handle stored at slot `index`, or the null handle.
+    NodeHandle handle_at(uint32_t index) const;
+
+    NodeHandle insert(const std::string& id, Node node); // id must not exist yet
+    void erase(NodeHandle h);
+
+    // Visit every live node in slot order: f(NodeHandle, const Node&).
+    template <class F>
+    void for_each(F&& f) const {
+        for (uint32_t i = 1; i < next_; ++i) {
+            const Slot* slot = find_slot(i);
+            if (slot && slot->live()) f(NodeHandle{ i, slot->gen }, slot->node);
+        }
+    }
+
+    bool shares_storage_with(const NodeStore& o) const { return root_ == o.root_; }
+    // Bytes the first writes to the given slots copy out of a store whose
+    // storage is all shared: each distinct leaf and inner node on their paths
+    // once, so neighbouring slots (a chain's ancestors) share one copy. Used
+    // to estimate what a retained older state costs.
+    size_t bytes_for_writes(std::vector<uint32_t> indices) const;
+
+private:
+    static constexpr unsigned kLeafBits = 4;
+    static constexpr unsigned kInnerBits = 5;
+    static constexpr uint32_t kLeafSize = 1u << kLeafBits;
+    static constexpr uint32_t kInnerSize = 1u << kInnerBits;
+    static constexpr uint32_t kLive = UINT32_MAX; // slot indices stay below it
+
+    struct Slot {
+        uint32_t gen = 0;
+        uint32_t nextFree = 0; // free-list link, or kLive while the slot holds a node
+        std::string id;
+        bool live() const { return nextFree == kLive; }
+        Node node;
+    };
+    struct Leaf {
+        Slot slots[kLeafSize];
+    };
+    // Children are Inner nodes above height 1 and Leaf objects at height 1.
+    struct Inner {
+        std::shared_ptr<void> kids[kInnerSize];
+    };
+
+    const Slot* find_slot(uint32_t index) const;
+    Slot& mut_slot(uint32_t index);
+    uint32_t capacity() const;
+
+    std::shared_ptr<void> root_; // Leaf when height_ == 0, else Inner
+    unsigned height_ = 0;
+    uint32_t next_ = 1;          // slot 0 is reserved for the null handle
+    uint32_t freeHead_ = 0;
+    size_t size_ = 0;
+    PersistentHashIndex<NodeHandle> ids_;
+};
+
+} // namespace bullet
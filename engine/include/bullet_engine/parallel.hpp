@@ -0,0 +1,57 @@
+#pragma once
+
+#include "bullet_engine/state_utils.hpp"
+#include "bullet_engine/types.hpp"
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace bullet {
+
+class TaskPool;
+
+// Whole-tree operations split across a TaskPool. The forest is cut into
+// runs of siblings: the root list, and any child list whose subtrees hold at
+// least kTaskRows visible rows, go to pool tasks in runs of kTaskSiblings.
+// Everything smaller is walked by the task that reached it, so a wide or
+// bushy tree spreads over the workers while small subtrees cost no task.
+// With a null pool the same walk runs on the calling thread.
+//
+// The calls block until the walk is done and must not be made from a task
+// running on the same pool.
+constexpr size_t kTaskRows = size_t(1) << 13;
+constexpr size_t kTaskSiblings = size_t(1) << 11;
+
+// Visit every node once, concurrently on the pool's workers. `depth` is 0
+// for roots. The order is unspecified.
+void parallel_for_each_node(const State& s, TaskPool* pool,
+                            const std::function<void(NodeHandle, const Node&, size_t depth)>& visit);
+
+// Recompute the aggregates of the subtree at `root`, or of the whole forest
+// for the null handle, by walking it, with one partial result per task
+// reduced at the end. subtree_aggregates() reads the cached values in O(1);
+// this recomputes them independently.
+SubtreeStats subtree_stats(const State& s, NodeHandle root = {}, TaskPool* pool = nullptr);
+
+struct Violation {
+    std::string id;      // offending node, its container's parent, or empty for state-level problems
+    std::string message;
+};
+
+// Check the structural invariants every state must hold and report each
+// violation (empty when the state is valid), sorted by id:
+//   - there is at least one root; every node is reached exactly once from
+//     the roots, through live handles, and its parent link names its container
+//   - sibling links (first, last, prev, next) agree with each container's
+//     index, order labels increase, and index entries carry each node's
+//     visibleSize (weight) and height
+//   - visibleSize is 1 plus the children's rows (1 when collapsed); the
+//     cached node count, height and text bytes match the children's
+//   - ids resolve to their nodes; focusedId and scopeRootId exist and the
+//     caret lies within the focused text
+// Corrupted links are reported rather than followed, so the walk ends on
+// any input.
+std::vector<Violation> validate(const State& s, TaskPool* pool = nullptr);
+
+} // namespace bullet
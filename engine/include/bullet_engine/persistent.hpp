@@ -0,0 +1,227 @@
+#pragma once
+
+#include "bullet_engine/pool.hpp"
+#include <atomic>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace bullet {
+
+// Copy-on-write helper: detach `p` from any other owner before mutating it.
+// Fresh copies come from the slab pool. When `p` is already the sole owner,
+// the acquire fence orders the in-place write after the reads of any thread
+// that released its reference (e.g. a reader dropping a published snapshot).
+template <class T>
+T& make_unique_mut(std::shared_ptr<T>& p) {
+    if (!p) {
+        p = make_pooled<T>();
+    } else if (p.use_count() != 1) {
+        BULLET_COUNT_COPY(sizeof(T));
+        p = make_pooled<T>(*p);
+    } else {
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    return *p;
+}
+
+// Persistent hash array mapped trie of values filed under a caller-supplied
+// hash. Keys are not stored: lookups take the hash plus an equality test on
+// the value, so a table whose keys already live elsewhere (NodeStore's slots
+// hold every id) keeps no second copy. Copies share every trie node; a
+// mutation copies only the path from the root to the touched entry (path
+// copying), so older versions stay valid and untouched entries are never
+// duplicated. Trie nodes carry their own reference count, which makes a
+// child one tagged pointer (low bit set for a branch).
+template <class V>
+class PersistentHashIndex {
+public:
+    PersistentHashIndex() = default;
+    PersistentHashIndex(const PersistentHashIndex& o) : root_(o.root_), size_(o.size_) { retain(root_); }
+    PersistentHashIndex(PersistentHashIndex&& o) noexcept : root_(o.root_), size_(o.size_) {
+        o.root_ = 0;
+        o.size_ = 0;
+    }
+    PersistentHashIndex& operator=(PersistentHashIndex o) noexcept {
+        std::swap(root_, o.root_);
+        std::swap(size_, o.size_);
+        return *this;
+    }
+    ~PersistentHashIndex() { release(root_); }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    // The value filed under `hash` that eq(value) accepts, or nullptr.
+    template <class Eq>
+    const V* find(size_t hash, Eq&& eq) const {
+        const Branch* b = root_ ? branch(root_) : nullptr;
+        for (unsigned shift = 0; b; shift += kBits) {
+            if (shift >= kHashBits) {
+                for (uintptr_t c : b->kids) {
+                    if (eq(entry(c)->value)) return &entry(c)->value;
+                }
+                return nullptr;
+            }
+            const uint32_t bit = 1u << ((hash >> shift) & 31u);
+            if (!(b->bitmap & bit)) return nullptr;
+            const uintptr_t c = b->kids[popcount(b->bitmap & (bit - 1))];
+            if (is_branch(c)) {
+                b = branch(c);
+                continue;
+            }
+            return entry(c)->hash == hash && eq(entry(c)->value) ? &entry(c)->value : nullptr;
+        }
+        return nullptr;
+    }
+
+    // File `value` under `hash`; the caller guarantees no equal value is present.
+    void insert(size_t hash, V value) {
+        if (!root_) root_ = tag(create<Branch>());
+        uintptr_t* slot = &root_;
+        for (unsigned shift = 0;; shift += kBits) {
+            Branch& b = own(*slot);
+            if (shift >= kHashBits) {
+                b.kids.push_back(make_entry(hash, std::move(value)));
+                break;
+            }
+            const uint32_t bit = 1u << ((hash >> shift) & 31u);
+            const size_t pos = popcount(b.bitmap & (bit - 1));
+            if (!(b.bitmap & bit)) {
+                b.bitmap |= bit;
+                b.kids.insert(b.kids.begin() + static_cast<std::ptrdiff_t>(pos), make_entry(hash, std::move(value)));
+                break;
+            }
+            uintptr_t& c = b.kids[pos];
+            if (!is_branch(c)) {
+                // Two hashes share this prefix: push the existing entry one level down.
+                Branch* nb = create<Branch>();
+                const unsigned nshift = shift + kBits;
+                if (nshift < kHashBits) nb->bitmap = 1u << ((entry(c)->hash >> nshift) & 31u);
+                nb->kids.push_back(c);
+                c = tag(nb);
+            }
+            slot = &c;
+        }
+        ++size_;
+    }
+
+    // Remove the value filed under `hash` that eq(value) accepts, if any.
+    template <class Eq>
+    bool erase(size_t hash, Eq&& eq) {
+        if (!find(hash, eq)) return false; // avoid copying a path for a missing value
+        erase_in(root_, hash, eq, 0);
+        --size_;
+        if (branch(root_)->kids.empty()) {
+            release(root_);
+            root_ = 0;
+        }
+        return true;
+    }
+
+    // True when both indexes share the same root (used by tests).
+    bool shares_storage_with(const PersistentHashIndex& o) const { return root_ == o.root_; }
+
+private:
+    static constexpr unsigned kBits = 5;
+    static constexpr unsigned kHashBits = sizeof(size_t) * 8;
+
+    struct Counted {
+        Counted() = default;
+        Counted(const Counted&) {} // a copy starts with its own single owner
+        mutable std::atomic<uint32_t> refs{ 1 };
+    };
+    struct Entry : Counted {
+        Entry(size_t h, V v) : hash(h), value(std::move(v)) {}
+        size_t hash;
+        V value;
+    };
+    // Below kHashBits the children are indexed by popcount(bitmap); past the
+    // last hash bit a branch is a plain collision bucket of entries.
+    struct Branch : Counted {
+        Branch() = default;
+        Branch(const Branch& o) : Counted(), bitmap(o.bitmap), kids(o.kids) {
+            for (uintptr_t c : kids) retain(c);
+        }
+        ~Branch() {
+            for (uintptr_t c : kids) release(c);
+        }
+        uint32_t bitmap = 0;
+        std::vector<uintptr_t, PoolAllocator<uintptr_t>> kids;
+    };
+
+    static unsigned popcount(uint32_t x) { return static_cast<unsigned>(std::bitset<32>(x).count()); }
+    static bool is_branch(uintptr_t c) { return (c & 1u) != 0; }
+    static Branch* branch(uintptr_t c) { return reinterpret_cast<Branch*>(c & ~uintptr_t(1)); }
+    static Entry* entry(uintptr_t c) { return reinterpret_cast<Entry*>(c); }
+    static uintptr_t tag(Branch* b) { return reinterpret_cast<uintptr_t>(b) | 1u; }
+    static const Counted* counted(uintptr_t c) {
+        return is_branch(c) ? static_cast<const Counted*>(branch(c)) : static_cast<const Counted*>(entry(c));
+    }
+
+    template <class T, class... Args>
+    static T* create(Args&&... args) {
+        BULLET_COUNT_ALLOC();
+        return new (pool_detail::allocate(sizeof(T))) T(std::forward<Args>(args)...);
+    }
+    template <class T>
+    static void destroy(T* p) {
+        p->~T();
+        pool_detail::deallocate(p, sizeof(T));
+    }
+    static uintptr_t make_entry(size_t h, V v) { return reinterpret_cast<uintptr_t>(create<Entry>(h, std::move(v))); }
+
+    static void retain(uintptr_t c) {
+        if (c) counted(c)->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    static void release(uintptr_t c) {
+        if (!c || counted(c)->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+        if (is_branch(c)) destroy(branch(c));
+        else destroy(entry(c));
+    }
+
+    // Copy-on-write for the branch at `c`, as make_unique_mut: the acquire
+    // load orders an in-place write after other owners' released reads.
+    static Branch& own(uintptr_t& c) {
+        Branch* b = branch(c);
+        if (b->refs.load(std::memory_order_acquire) == 1) return *b;
+        BULLET_COUNT_COPY(sizeof(Branch) + b->kids.size() * sizeof(uintptr_t));
+        Branch* copy = create<Branch>(*b);
+        release(c);
+        c = tag(copy);
+        return *copy;
+    }
+
+    template <class Eq>
+    static void erase_in(uintptr_t& slot, size_t h, Eq& eq, unsigned shift) {
+        Branch& b = own(slot);
+        if (shift >= kHashBits) {
+            for (auto it = b.kids.begin(); it != b.kids.end(); ++it) {
+                if (eq(entry(*it)->value)) {
+                    release(*it);
+                    b.kids.erase(it);
+                    return;
+                }
+            }
+            return;
+        }
+        const uint32_t bit = 1u << ((h >> shift) & 31u);
+        const size_t pos = popcount(b.bitmap & (bit - 1));
+        uintptr_t& c = b.kids[pos];
+        if (is_branch(c)) {
+            erase_in(c, h, eq, shift + kBits);
+            if (!branch(c)->kids.empty()) return;
+        }
+        release(c);
+        b.bitmap &= ~bit;
+        b.kids.erase(b.kids.begin() + static_cast<std::ptrdiff_t>(pos));
+    }
+
+    uintptr_t root_ = 0; // tagged Branch, or 0 when empty
+    size_t size_ = 0;
+};
+
+} // namespace bullet
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "bullet_engine/instrument.hpp"
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace bullet {
+
+// Slab pool for the small, fixed-size blocks behind the persistent
+// structures: trie and treap nodes, map entries and their control blocks.
+// Blocks are rounded up to 16-byte classes (up to kPoolMaxBlock) and carved
+// from 64 KiB slabs, so building a large state costs one system allocation
+// per slab instead of several per node. Each thread allocates from and frees
+// to its own cache, which trades blocks with the shared classes in batches,
+// so threads editing different documents rarely meet on a lock. A slab
+// whose blocks have all come back is released (one spare per class is
+// kept). Larger requests go to operator new.
+//
+// Building with BULLET_ENGINE_NO_POOL (CMake option BULLET_ENGINE_POOL=OFF)
+// serves everything from operator new, for comparing footprints.
+constexpr size_t kPoolMaxBlock = 256;
+
+struct PoolStats {
+    size_t slabs = 0;       // slabs currently reserved
+    size_t slabBytes = 0;   // bytes reserved from the system
+    size_t usedBytes = 0;   // bytes in blocks handed out and not returned (exact once threads are idle)
+};
+PoolStats pool_stats();
+
+namespace pool_detail {
+void* allocate(size_t bytes);
+void deallocate(void* p, size_t bytes) noexcept;
+} // namespace pool_detail
+
+template <class T>
+class PoolAllocator {
+public:
+    using value_type = T;
+    static_assert(alignof(T) <= 16, "pool blocks are 16-byte aligned");
+
+    PoolAllocator() noexcept = default;
+    template <class U>
+    PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n) {
+        BULLET_COUNT_ALLOC();
+        return static_cast<T*>(pool_detail::allocate(n * sizeof(T)));
+    }
+    void deallocate(T* p, size_t n) noexcept { pool_detail::deallocate(p, n * sizeof(T)); }
+};
+
+template <class T, class U>
+bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&) { return true; }
+template <class T, class U>
+bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&) { return false; }
+
+// make_shared with the object and its control block in one pool block.
+template <class T, class... Args>
+std::shared_ptr<std::remove_const_t<T>> make_pooled(Args&&... args) {
+    using U = std::remove_const_t<T>;
+#ifdef BULLET_ENGINE_NO_POOL
+    BULLET_COUNT_ALLOC();
+    return std::make_shared<U>(std::forward<Args>(args)...);
+#else
+    return std::allocate_shared<U>(PoolAllocator<U>(), std::forward<Args>(args)...);
+#endif
+}
+
+} // namespace bullet
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "bullet_engine/types.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace bullet {
+
+class SnapshotView;
+
+// Node texts packed back to back in preorder, for brute-force scans that need
+// no index (one-off finds, exact-case queries, or a cross-check of
+// SearchIndex). Node i's text is the byte range [start(i), start(i + 1));
+// depths let a scan restrict itself to one subtree, which is a contiguous run
+// of the preorder.
+class PackedTexts {
+public:
+    PackedTexts() = default;
+
+    // Every node of the state (all roots, ignoring scopeRootId and collapse).
+    static PackedTexts from_state(const State& s);
+    // Every node of the snapshot, read straight from its string table.
+    // Throws SnapshotError when the node table is corrupt.
+    static PackedTexts from_snapshot(const SnapshotView& v);
+
+    size_t node_count() const { return ids_.size(); }
+    size_t text_bytes() const { return bytes_.size(); }
+    const std::string& id(size_t i) const { return ids_[i]; }
+    uint32_t depth(size_t i) const { return depths_[i]; }
+    size_t start(size_t i) const { return starts_[i]; } // i == node_count() gives text_bytes()
+    std::string_view text(size_t i) const { return std::string_view(bytes_).substr(starts_[i], starts_[i + 1] - starts_[i]); }
+    const std::string& bytes() const { return bytes_; }
+    // Preorder range [first, last) of `id`'s subtree; nullopt when absent.
+    // Finding the id is a linear pass over the ids, like the scan itself.
+    std::optional<std::pair<size_t, size_t>> subtree(std::string_view id) const;
+
+private:
+    template <class F>
+    void add(std::string id, uint32_t depth, F&& append_text) {
+        ids_.push_back(std::move(id));
+        depths_.push_back(depth);
+        append_text(bytes_);
+        starts_.push_back(bytes_.size());
+    }
+
+    std::string bytes_;
+    std::vector<size_t> starts_{ 0 }; // node_count() + 1 entries
+    std::vector<uint32_t> depths_;
+    std::vector<std::string> ids_;
+};
+
+enum class ScanKernel { Auto, Scalar, Sse2, Avx2 };
+
+struct ScanOptions {
+    bool caseInsensitive = false;        // ASCII case folding
+    std::optional<std::string> scopeId;  // only this node's subtree
+    size_t limit = SIZE_MAX;             // at most this many matches
+    ScanKernel kernel = ScanKernel::Auto; // unsupported choices fall back to the next one down
+};
+
+struct ScanMatch {
+    std::string id;
+    size_t offset; // byte offset of the match in the node's text
+};
+
+// Every occurrence of `pattern` (overlapping ones included) in preorder, then
+// by offset. Matches never span two nodes. An empty pattern matches nothing.
+//
+// The kernel loads 16 or 32 bytes at a time and compares them with the
+// pattern's first and last byte (both cases when folding); only positions
+// where both agree are verified. AVX2 is chosen at run time when the CPU has
+// it, SSE2 otherwise on x86-64, and a portable memchr loop elsewhere.
+std::vector<ScanMatch> scan(const PackedTexts& packed, std::string_view pattern, const ScanOptions& opts = {});
+
+// The kernel a choice resolves to on this CPU: "avx2", "sse2" or "scalar".
+const char* scan_kernel_name(ScanKernel kernel = ScanKernel::Auto);
+
+} // namespace bullet
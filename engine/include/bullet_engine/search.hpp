@@ -0,0 +1,60 @@
+#pragma once
+
+#include "bullet_engine/types.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace bullet {
+
+struct SearchOptions {
+    bool scoped = false;        // only the subtree under scopeRootId (when set)
+    bool includeHidden = true;  // also match nodes inside collapsed subtrees
+    size_t limit = SIZE_MAX;    // at most this many ids, from the start of the order
+};
+
+// Case-insensitive (ASCII) substring search over node texts, backed by a
+// trigram inverted index. Posting lists hold node slot indices in sorted
+// order; a query intersects the lists of its trigrams, smallest first, and
+// verifies the few candidates against their text. Queries shorter than three
+// bytes have no trigram and scan every indexed node.
+//
+// The index follows a State through the ChangeSets its commands return:
+// update() re-indexes touched and created nodes, adjusting only the postings
+// whose trigrams changed. Removed nodes are dropped lazily: their slot's
+// generation no longer matches, and the slot is cleaned when it is reused.
+class SearchIndex {
+public:
+    SearchIndex() = default;
+    explicit SearchIndex(const State& s) { rebuild(s); }
+
+    void rebuild(const State& s);
+    void update(const State& s, const ChangeSet& ch);
+
+    // Matching ids in document order (preorder; the visible order for visible
+    // nodes). `s` must be the state the index is current with.
+    std::vector<std::string> search(const State& s, std::string_view query, const SearchOptions& opts = {}) const;
+
+    // Indexed slots, including removed nodes whose slot has not been reused.
+    size_t indexed_count() const { return live_; }
+    size_t memory_bytes() const; // postings, per-node trigram lists and table overhead
+
+private:
+    struct Doc {
+        uint32_t gen = 0;
+        bool live = false;
+        std::vector<uint32_t> grams; // sorted, distinct
+    };
+
+    void index_node(const State& s, NodeHandle h);
+    void drop(uint32_t index);
+
+    std::unordered_map<uint32_t, std::vector<uint32_t>> postings_; // trigram -> sorted slot indices
+    std::vector<Doc> docs_; // by slot index
+    size_t live_ = 0;
+};
+
+} // namespace bullet
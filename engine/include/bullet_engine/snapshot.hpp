@@ -0,0 +1,109 @@
+#pragma once
+
+#include "bullet_engine/types.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bullet {
+
+// Versioned binary snapshot of a State (little-endian):
+//   header      magic "BLTSNAP\0", version, counts, idCounter, caret, and the
+//               focus/scope ids as string-table references
+//   node table  one fixed 32-byte record per node in preorder: parent,
+//               first child and next sibling as node indices, child count,
+//               flags (collapsed), and id/text as string-table references
+//   id hash     open-addressing table of node indices keyed by id
+//   strings     ids and texts, back to back
+// Roots are the chain of next-sibling links from the header's first root.
+// A snapshot opens in O(1): queries read records straight from the mapping.
+class SnapshotError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+std::string encode_snapshot(const State& s);
+// Writes to a synced temporary file next to `path`, renames it into place
+// and syncs the directory, so a crash leaves the old or the new snapshot.
+void write_snapshot(const State& s, const std::string& path);
+
+// Read-only view over a snapshot, memory-mapped from a file or held in a
+// buffer. Copies share the mapping. Node indices follow the file's preorder;
+// node accessors throw SnapshotError for an index out of range or a record
+// whose links break the preorder.
+class SnapshotView {
+public:
+    static constexpr uint32_t kNone = 0xFFFFFFFFu;
+
+    static SnapshotView open(const std::string& path); // throws SnapshotError
+    static SnapshotView from_bytes(std::string bytes);  // throws SnapshotError
+
+    size_t node_count() const { return nodeCount_; }
+    unsigned long long id_counter() const;
+    std::string_view focused_id() const;
+    int caret() const;
+    std::optional<std::string_view> scope_root_id() const;
+
+    uint32_t find(std::string_view id) const; // kNone when absent; O(1) expected
+    std::string_view id(uint32_t i) const;
+    std::string_view text(uint32_t i) const;
+    uint32_t parent(uint32_t i) const;
+    uint32_t first_child(uint32_t i) const;
+    uint32_t next_sibling(uint32_t i) const;
+    size_t child_count(uint32_t i) const;
+    bool collapsed(uint32_t i) const;
+    uint32_t first_root() const;
+    size_t root_count() const;
+
+    // Build a full persistent State from the snapshot in one linear pass.
+    // Throws SnapshotError for a duplicate id, a parent that is no longer
+    // open in the preorder, or a focus or scope id with no node.
+    State materialize() const;
+
+private:
+    struct Mapping;
+    struct Record;
+
+    explicit SnapshotView(std::shared_ptr<const Mapping> map);
+    Record record(uint32_t i) const;
+    std::string_view str(uint64_t offset, uint64_t length) const;
+
+    std::shared_ptr<const Mapping> map_;
+    const char* base_ = nullptr;
+    size_t nodeCount_ = 0;
+    const char* nodes_ = nullptr;
+    const char* hash_ = nullptr;
+    uint64_t hashSlots_ = 0;
+    const char* strings_ = nullptr;
+    uint64_t stringBytes_ = 0;
+};
+
+// A document opened from a snapshot: reads are served from the mapping until
+// the first mutation, which materializes the State once.
+class SnapshotDocument {
+public:
+    explicit SnapshotDocument(SnapshotView view) : view_(std::move(view)) {}
+
+    bool materialized() const { return state_.has_value(); }
+    const SnapshotView& view() const { return view_; }
+
+    size_t node_count() const;
+    std::string focused_id() const;
+    std::string text_of(const std::string& id) const;
+    std::vector<std::string> child_ids(const std::string& id) const;
+    std::vector<std::string> root_ids() const;
+
+    State& state(); // materializes on first use
+    ChangeSet apply(const Command& cmd) { return apply_command_inplace(state(), cmd); }
+
+private:
+    SnapshotView view_;
+    std::optional<State> state_;
+};
+
+} // namespace bullet
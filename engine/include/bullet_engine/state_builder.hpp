@@ -0,0 +1,48 @@
+#pragma once
+
+#include "bullet_engine/types.hpp"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace bullet {
+
+// Builds a State from nodes that arrive in preorder with their depth, in one
+// linear pass. Open nodes stay detached on a stack until their subtree is
+// complete, so splicing children into them never has to propagate sizes
+// further up. Finished children are spliced in runs of up to kRun, which
+// keeps the builder's own memory at O(depth * kRun) handles however wide the
+// outline is. Used by snapshot loading and importers.
+class StateBuilder {
+public:
+    StateBuilder() = default;
+
+    // The state under construction (e.g. for make_new_id). Its nodes are not
+    // all linked until finish().
+    State& state() { return s_; }
+
+    // Add a node at `depth` (0 = root). A depth more than one below the
+    // previous node is clamped to a child of it.
+    NodeHandle add(const std::string& id, std::string text, size_t depth, bool collapsed = false);
+
+    // Link all still-open nodes and return the state. Focus, caret and scope
+    // are left for the caller to set.
+    State finish();
+
+private:
+    static constexpr size_t kRun = 1024;
+
+    void close_top();
+
+    struct Open {
+        NodeHandle node;
+        std::vector<NodeHandle> children; // finished children not yet linked under `node`
+    };
+
+    State s_;
+    std::vector<Open> open_;
+    size_t depth_ = 0; // open_[0, depth_) are in use; deeper entries keep their buffers
+    std::vector<NodeHandle> roots_;
+};
+
+} // namespace bullet
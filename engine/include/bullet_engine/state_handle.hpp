@@ -0,0 +1,113 @@
+#pragma once
+
+#include "bullet_engine/types.hpp"
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace bullet {
+
+// Single-writer, many-reader publication of persistent states with
+// epoch-based reclamation.
+//
+// The writer edits a private working State and publishes it as a new
+// immutable version: one O(1) State copy and one atomic pointer exchange.
+// A reader pins the current version by announcing the global epoch in a
+// reader slot and loading the version pointer; neither side takes a lock or
+// waits for the other. A replaced version is retired with the epoch that
+// followed its replacement and freed by the writer once no pinned reader
+// announced an earlier epoch.
+//
+// A pinned version is read in place (no copy). Readers that keep a version
+// for long should take snapshot() instead, an O(1) State copy sharing all
+// nodes, since a pin holds back the reclamation of every later version.
+class StateHandle {
+    struct Version {
+        State state;
+        uint64_t number;
+    };
+
+public:
+    // Concurrent pins per handle. More readers than this may call read() at
+    // once: the extra ones wait, pausing and then yielding, until a pin is
+    // released, so a reader holding a pin while waiting for another thread's
+    // read() can deadlock once all slots are taken.
+    static constexpr size_t kReaderSlots = 32;
+
+    explicit StateHandle(State initial = State{});
+    // No reader may still hold a ReadGuard.
+    ~StateHandle();
+    StateHandle(const StateHandle&) = delete;
+    StateHandle& operator=(const StateHandle&) = delete;
+
+    // ---- Writer side (one thread at a time) ----
+
+    // The writer's private state: edits are invisible to readers until
+    // publish().
+    State& working() { return working_; }
+    const State& working() const { return working_; }
+    void publish();
+    void publish(State next);
+    // apply_command(s)_inplace on the working state, then publish().
+    ChangeSet apply(const Command& cmd);
+    ChangeSet apply(const std::vector<Command>& cmds);
+    // Replaced versions not yet freed (pinned by some reader).
+    size_t retired() const { return retired_.size(); }
+
+    // ---- Readers (any thread) ----
+
+    class ReadGuard {
+    public:
+        ReadGuard(ReadGuard&& o) noexcept : slot_(std::exchange(o.slot_, nullptr)), version_(o.version_) {}
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+        ReadGuard& operator=(ReadGuard&&) = delete;
+        ~ReadGuard() {
+            if (slot_) slot_->store(0, std::memory_order_release);
+        }
+
+        const State& operator*() const { return version_->state; }
+        const State* operator->() const { return &version_->state; }
+        // Publication number: 0 for the initial state, then 1, 2, ...
+        uint64_t version() const { return version_->number; }
+
+    private:
+        friend class StateHandle;
+        ReadGuard(std::atomic<uint64_t>* slot, const Version* v) : slot_(slot), version_(v) {}
+
+        std::atomic<uint64_t>* slot_;
+        const Version* version_;
+    };
+
+    // Pin the current version until the guard is destroyed. Lock-free while
+    // fewer than kReaderSlots pins are held; otherwise waits for a free slot.
+    ReadGuard read() const;
+    // O(1) copy of the current version that outlives any pin.
+    State snapshot() const;
+    // Number of the current version.
+    uint64_t version() const { return read().version(); }
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{ 0 }; // 0: free
+    };
+    struct Retired {
+        const Version* version;
+        uint64_t epoch;
+    };
+
+    void reclaim();
+
+    State working_;
+    uint64_t published_ = 0; // writer's count of versions
+    std::atomic<const Version*> current_;
+    std::atomic<uint64_t> epoch_{ 1 };
+    mutable std::array<Slot, kReaderSlots> slots_;
+    std::vector<Retired> retired_;
+};
+
+} // namespace bullet
@@ -1,24 +1,147 @@
 #pragma once
 
 #include "bullet_engine/types.hpp"
+#include <cstddef>
+#include <iterator>
+#include <optional>
 #include <string>
 #include <vector>
 
 namespace bullet {
 
-// Sibling container helpers
-std::vector<std::string>& siblings_ref(State& s, const std::string& id);
-const std::vector<std::string>& siblings_cref(const State& s, const std::string& id);
-size_t index_in_siblings(const State& s, const std::string& id);
+// Boundary accessors: string ids in, string ids out. Each id is resolved
+// through the intern table once; everything below works on handles.
+NodeHandle find_node(const State& s, const std::string& id);
+bool has_node(const State& s, const std::string& id);
+const std::string& id_of(const State& s, NodeHandle h);
+size_t node_count(const State& s);
+std::vector<std::string> node_ids(const State& s);
+std::string text_of(const State& s, const std::string& id);
+bool is_collapsed(const State& s, const std::string& id);
+void set_text(State& s, const std::string& id, std::string text);
+std::string parent_id(const State& s, const std::string& id);
+std::vector<std::string> child_ids(const State& s, const std::string& id);
+std::vector<std::string> root_ids(const State& s);
 
-// ID + container editing helpers
+// Sibling container helpers. siblings_ref returns the container holding h
+// (its parent's children, or rootOrder) ready for mutation.
+SiblingList& siblings_ref(State& s, NodeHandle h);
+const SiblingList& siblings_cref(const State& s, NodeHandle h);
+size_t index_in_siblings(const State& s, NodeHandle h); // O(log n)
+NodeHandle sibling_at(const SiblingList& list, size_t i); // O(log n)
+
+// ID + container editing helpers. Linking and unlinking touch only h and its
+// neighbours: O(1) plus an O(log n) update of the container's index.
 std::string make_new_id(State& s);
-void insert_after(std::vector<std::string>& vec, const std::string& existing, const std::string& newcomer);
-void insert_before(std::vector<std::string>& vec, const std::string& existing, const std::string& newcomer);
-void erase_from(std::vector<std::string>& vec, const std::string& id);
+NodeHandle create_node(State& s, std::string text); // fresh id, not yet linked
+NodeHandle create_node(State& s, Text text);
+void insert_after(State& s, NodeHandle existing, NodeHandle newcomer);
+void insert_before(State& s, NodeHandle existing, NodeHandle newcomer);
+// Splice unlinked nodes in after `existing`, in order, as one O(m + log n) edit.
+void insert_run_after(State& s, NodeHandle existing, const std::vector<NodeHandle>& run);
+void append_child(State& s, NodeHandle parent, NodeHandle newcomer); // null parent appends a root
+void append_children(State& s, NodeHandle parent, const std::vector<NodeHandle>& run); // bulk append_child
+void erase_from(State& s, NodeHandle h); // unlink h (with its subtree) from its container
+void move_children(State& s, NodeHandle from, NodeHandle to); // `to` must have no children
+void set_collapsed(State& s, NodeHandle h, bool collapsed); // updates visible sizes up the ancestor path
+
+// Subtree aggregates. Every node caches its subtree's node count, height and
+// text bytes (hidden children included); the linking helpers above update
+// them along the ancestor path in O(depth * log n). Code that edits a node's
+// text directly reports the size change with add_text_bytes, O(depth).
+struct SubtreeStats {
+    size_t nodes = 0;     // nodes in the subtree, its root included
+    size_t depth = 0;     // levels: 1 for a leaf, 0 for an empty forest
+    size_t textBytes = 0; // sum of the nodes' text sizes
+};
+void add_text_bytes(State& s, NodeHandle h, long long delta);
+// Cached aggregates of id's subtree in O(1), zeros for an unknown id; the
+// empty id gives the whole forest (summed over the roots).
+SubtreeStats subtree_aggregates(const State& s, const std::string& id);
+size_t descendant_count(const State& s, const std::string& id); // nodes below id
 
-// Visibility and ancestry helpers
+// Visibility and ancestry helpers. The visible order is the preorder of the
+// roots (or of the scope root's subtree when scopeRootId is set), skipping the
+// children of collapsed nodes other than the scope root. Every node
+// caches its visible subtree size, so rank/position queries descend the tree
+// in O(depth * log n) and prev/next follow links in O(depth).
+std::vector<NodeHandle> visible_order(const State& s);
 std::vector<std::string> visible_order_ids(const State& s);
+
+// Lazy visible-order traversal. Iteration is stackless (it follows child,
+// sibling and parent links), so it neither recurses nor allocates and works
+// at any nesting depth. Rows carry their depth: 0 for roots, or for the scope
+// root when scoped. The state must outlive the range and stay unmodified.
+struct VisibleRow {
+    NodeHandle node;
+    size_t depth;
+};
+
+class VisibleRange {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = VisibleRow;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const VisibleRow*;
+        using reference = const VisibleRow&;
+
+        iterator() = default;
+        const VisibleRow& operator*() const { return row_; }
+        const VisibleRow* operator->() const { return &row_; }
+        iterator& operator++();
+        iterator operator++(int) { iterator it = *this; ++*this; return it; }
+        bool operator==(const iterator& o) const { return row_.node == o.row_.node; }
+        bool operator!=(const iterator& o) const { return !(*this == o); }
+
+    private:
+        friend class VisibleRange;
+        iterator(const State* s, NodeHandle scope, VisibleRow row) : s_(s), scope_(scope), row_(row) {}
+
+        const State* s_ = nullptr;
+        NodeHandle scope_;
+        VisibleRow row_{ NodeHandle{}, 0 };
+    };
+
+    iterator begin() const { return iterator(s_, scope_, first_); }
+    iterator end() const { return iterator(s_, scope_, VisibleRow{ NodeHandle{}, 0 }); }
+    bool empty() const { return !first_.node; }
+
+private:
+    friend VisibleRange visible_rows(const State& s);
+    friend VisibleRange visible_rows_from(const State& s, NodeHandle start);
+    VisibleRange(const State* s, NodeHandle scope, VisibleRow first) : s_(s), scope_(scope), first_(first) {}
+
+    const State* s_;
+    NodeHandle scope_;
+    VisibleRow first_;
+};
+
+VisibleRange visible_rows(const State& s);
+// Rows from `start` (inclusive) to the end of the visible order; empty when
+// start is not visible. Finding start's depth costs O(depth).
+VisibleRange visible_rows_from(const State& s, NodeHandle start);
+size_t visible_count(const State& s);
+std::optional<size_t> visible_rank(const State& s, NodeHandle h); // nullopt when h is not visible
+NodeHandle visible_at(const State& s, size_t i); // null handle when i >= visible_count(s)
+NodeHandle prev_visible(const State& s, NodeHandle h);
+NodeHandle next_visible(const State& s, NodeHandle h);
 std::vector<std::string> ancestors_to_root(const State& s, const std::string& id);
 
+// Viewport windowing: the rows a virtualized list needs to draw visible rows
+// [offset, offset + count), clamped to the end of the visible order. Locating
+// the first row costs O(depth * log n); each further row is O(1) amortized.
+struct ViewRow {
+    std::string id;
+    size_t depth;
+    std::string text;
+    size_t childCount;
+    size_t descendantCount; // e.g. for a collapsed row's badge
+    bool collapsed;
+};
+std::vector<ViewRow> visible_window(const State& s, size_t offset, size_t count);
+// Window starting at anchorId's row; empty when the anchor is not visible.
+std::vector<ViewRow> visible_window_from(const State& s, const std::string& anchorId, size_t count);
+
 } // namespace bullet
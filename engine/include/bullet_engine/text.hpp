@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace bullet {
+
+// Node text. Short texts are stored inline as a std::string. From kRopeMin
+// bytes on, a text is a persistent rope: a treap of pieces (slices of shared,
+// immutable buffers) ordered by byte offset, each tree node caching its
+// subtree's byte count. Split, concatenation and caret-local insert/erase
+// then cost O(log pieces) and copy no text; copies of a Text share every
+// buffer and tree node. Small insertions next to a small piece are folded
+// into it so typing does not fragment the rope. Offsets are in bytes.
+class Text {
+public:
+    static constexpr size_t npos = std::string::npos;
+    static constexpr size_t kRopeMin = 1024;
+
+    Text() = default;
+    explicit Text(std::string s);
+    Text& operator=(std::string s);
+
+    size_t size() const;
+    bool empty() const { return size() == 0; }
+    std::string str() const;
+
+    Text substr(size_t pos, size_t n = npos) const; // pos <= size()
+    void insert(size_t pos, std::string_view s);   // pos <= size()
+    void erase(size_t pos, size_t n = npos);        // pos <= size()
+    void append(const Text& t);
+    void clear();
+
+    // Calls f(std::string_view) for each stored chunk, in order.
+    template <class F>
+    void for_each_chunk(F&& f) const {
+        if (root_) visit(std::ref(f));
+        else if (!small_.empty()) f(std::string_view(small_));
+    }
+
+    bool is_rope() const { return root_ != nullptr; }
+    size_t piece_count() const; // 1 for a non-empty inline text
+    // True when both ropes share their root (used by tests).
+    bool shares_storage_with(const Text& o) const { return root_ && root_ == o.root_; }
+
+    friend bool operator==(const Text& a, std::string_view b) { return a.equals(b); }
+    friend bool operator!=(const Text& a, std::string_view b) { return !a.equals(b); }
+    friend bool operator==(const Text& a, const Text& b);
+    friend bool operator!=(const Text& a, const Text& b) { return !(a == b); }
+
+private:
+    struct TNode;
+    using Ptr = std::shared_ptr<const TNode>;
+
+    bool equals(std::string_view s) const;
+    void visit(const std::function<void(std::string_view)>& f) const;
+    void set_root(Ptr root); // adopts a rope, falling back to inline when it got short
+    Ptr as_rope() const;
+
+    std::string small_; // used while root_ is null
+    Ptr root_;
+};
+
+} // namespace bullet
@@ -1,22 +1,22 @@
 #pragma once
 
+#include "bullet_engine/node_store.hpp"
+#include "bullet_engine/persistent.hpp"
 #include <string>
 #include <vector>
-#include <unordered_map>
 #include <optional>
 
 namespace bullet {
 
-struct Node {
-    std::string id;
-    std::string parentId; // empty string denotes root
-    std::string text;
-    std::vector<std::string> children; // ordered
-};
-
+// States are persistent: copying one is O(1) and shares every node. Commands
+// copy only the nodes and sibling containers they touch (path copying), so
+// older states remain valid and cheap to keep around.
+//
+// Storage and traversal use NodeHandle; string ids (focusedId, scopeRootId,
+// the accessors in state_utils.hpp) exist only at the API boundary.
 struct State {
-    std::unordered_map<std::string, Node> nodes;
-    std::vector<std::string> rootOrder; // ordered root ids
+    NodeStore nodes;
+    SiblingList rootOrder; // ordered roots
     std::string focusedId;
     int caret = 0; // caret offset within focused node text
     std::optional<std::string> scopeRootId; // nullopt means full tree
@@ -34,7 +34,12 @@ enum class CommandType {
     DeleteEmptyAtId,
     MergeNextSiblingIntoCurrent,
     SetFocus,
-    SetScopeRoot
+    SetScopeRoot,
+    ToggleCollapse,
+    InsertLinesAfter,
+    SetText,
+    InsertText,
+    DeleteText
 };
 
 struct Command {
@@ -42,18 +47,45 @@ struct Command {
     // target node id (defaults to state.focusedId if empty)
     std::string id;
     // Additional fields used by specific commands
-    int caret = -1; // used by SplitAtCaret/SetFocus
+    int caret = -1; // used by SplitAtCaret/SetFocus/SetText/InsertText/DeleteText
     std::optional<std::string> scopeRootId; // used by SetScopeRoot
+    std::string text; // used by InsertLinesAfter (one sibling per line), SetText and InsertText
+    int length = 0; // used by DeleteText: bytes removed from the caret on
+};
+
+// Compact record of what a command changed, so views can re-render incrementally.
+struct ChangeSet {
+    std::vector<std::string> touched; // surviving nodes whose text, parent or children changed
+    std::vector<std::string> created; // nodes added by the command
+    std::vector<std::string> removed; // nodes deleted by the command
+    bool rootOrderChanged = false;
+    bool focusChanged = false; // focusedId or caret
+    bool scopeChanged = false;
+
+    bool empty() const {
+        return touched.empty() && created.empty() && removed.empty() && !rootOrderChanged && !focusChanged && !scopeChanged;
+    }
 };
 
 // Engine API
+// Pure: returns the new state; `s` is left untouched and stays valid.
 State apply_command(const State& s, const Command& cmd);
+// Mutating: applies the same transform to `s` directly, skipping the copy.
+ChangeSet apply_command_inplace(State& s, const Command& cmd);
+// Batched: apply cmds in order as one transition. The pure form copies `s`
+// once; both return one change record for the whole batch, in which nodes
+// created and removed inside the batch do not appear at all.
+State apply_commands(const State& s, const std::vector<Command>& cmds, ChangeSet* changes = nullptr);
+ChangeSet apply_commands_inplace(State& s, const std::vector<Command>& cmds);
 
 // Utilities useful to UIs
 // Return the previous/next visible node id in preorder under current scope, or empty if none.
 std::string prev_visible_id(const State& s, const std::string& id);
 std::string next_visible_id(const State& s, const std::string& id);
 
+// The enumerator's name, e.g. "SplitAtCaret"; empty for an unknown value.
+const char* command_type_name(CommandType type);
+
 // Helper: create an initial state with a single empty root node focused.
 State initial_state();
 
@@ -0,0 +1,33 @@
+#pragma once
+
+// Internal spin-wait helper shared by the pool's class locks and
+// StateHandle's reader slots; not part of the public headers.
+
+#include <thread>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define BULLET_BACKOFF_X86 1
+#include <immintrin.h>
+#endif
+
+namespace bullet {
+namespace backoff_detail {
+
+constexpr int kSpinsBeforeYield = 64;
+
+// One step of a wait for something another thread holds briefly: a CPU pause
+// for the first kSpinsBeforeYield steps, then a yield, since the holder may
+// have been preempted (e.g. with more threads than cores).
+inline void pause(int& spins) {
+    if (spins < kSpinsBeforeYield) {
+        ++spins;
+#ifdef BULLET_BACKOFF_X86
+        _mm_pause();
+#endif
+    } else {
+        std::this_thread::yield();
+    }
+}
+
+} // namespace backoff_detail
+} // namespace bullet
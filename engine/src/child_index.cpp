@@ -0,0 +1,236 @@
+#include "bullet_engine/child_index.hpp"
+#include "bullet_engine/pool.hpp"
+#include <algorithm>
+#include <cassert>
+
+namespace bullet {
+
+struct ChildIndex::TNode {
+    Entry entry;
+    uint32_t priority;
+    uint32_t maxHeight; // largest entry height in this subtree
+    size_t size;
+    size_t sum; // weight sum of this subtree
+    Ptr left;
+    Ptr right;
+};
+
+size_t ChildIndex::bytes_per_update(size_t n) {
+    size_t depth = 1;
+    for (; n > 1; n >>= 1) depth += 2; // a random treap's expected depth is about 1.39 log2 n
+    return depth * (sizeof(TNode) + 16); // each node plus its in-place control block
+}
+
+// Deterministic priority so equal histories build equal trees.
+static uint32_t priority_for(const ChildIndex::Entry& e) {
+    uint64_t x = (static_cast<uint64_t>(e.node.index) << 32) ^ e.node.gen ^ 0x9E3779B97F4A7C15ull;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    return static_cast<uint32_t>(x);
+}
+
+template <class P>
+static size_t tsize(const P& t) { return t ? t->size : 0; }
+
+template <class P>
+static size_t tsum(const P& t) { return t ? t->sum : 0; }
+
+template <class P>
+static uint32_t theight(const P& t) { return t ? t->maxHeight : 0; }
+
+template <class P>
+static P make(const ChildIndex::Entry& e, uint32_t priority, P left, P right) {
+    size_t n = 1 + tsize(left) + tsize(right);
+    size_t w = e.weight + tsum(left) + tsum(right);
+    uint32_t h = std::max(e.height, std::max(theight(left), theight(right)));
+    using T = typename P::element_type;
+    return make_pooled<T>(T{ e, priority, h, n, w, std::move(left), std::move(right) });
+}
+
+size_t ChildIndex::size() const { return tsize(root_); }
+
+size_t ChildIndex::weight() const { return tsum(root_); }
+
+uint32_t ChildIndex::max_height() const { return theight(root_); }
+
+size_t ChildIndex::rank(uint64_t label) const {
+    size_t r = 0;
+    const TNode* t = root_.get();
+    while (t) {
+        if (label <= t->entry.label) {
+            t = t->left.get();
+        } else {
+            r += tsize(t->left) + 1;
+            t = t->right.get();
+        }
+    }
+    return r;
+}
+
+ChildIndex::Entry ChildIndex::at(size_t i) const {
+    const TNode* t = root_.get();
+    assert(i < tsize(root_));
+    for (;;) {
+        size_t ls = tsize(t->left);
+        if (i < ls) { t = t->left.get(); continue; }
+        if (i == ls) return t->entry;
+        i -= ls + 1;
+        t = t->right.get();
+    }
+}
+
+size_t ChildIndex::weight_before(uint64_t label) const {
+    size_t w = 0;
+    const TNode* t = root_.get();
+    while (t) {
+        if (label <= t->entry.label) {
+            t = t->left.get();
+        } else {
+            w += tsum(t->left) + t->entry.weight;
+            t = t->right.get();
+        }
+    }
+    return w;
+}
+
+ChildIndex::Entry ChildIndex::find_weight(size_t offset, size_t& within) const {
+    const TNode* t = root_.get();
+    assert(offset < tsum(root_));
+    for (;;) {
+        size_t ls = tsum(t->left);
+        if (offset < ls) { t = t->left.get(); continue; }
+        offset -= ls;
+        if (offset < t->entry.weight) { within = offset; return t->entry; }
+        offset -= t->entry.weight;
+        t = t->right.get();
+    }
+}
+
+ChildIndex::Ptr ChildIndex::merge(const Ptr& a, const Ptr& b) {
+    if (!a) return b;
+    if (!b) return a;
+    if (a->priority >= b->priority) {
+        return make(a->entry, a->priority, a->left, merge(a->right, b));
+    }
+    return make(b->entry, b->priority, merge(a, b->left), b->right);
+}
+
+void ChildIndex::split_label(const Ptr& t, uint64_t label, Ptr& lo, Ptr& hi) {
+    if (!t) { lo = hi = nullptr; return; }
+    if (t->entry.label < label) {
+        Ptr l, h;
+        split_label(t->right, label, l, h);
+        lo = make(t->entry, t->priority, t->left, l);
+        hi = h;
+    } else {
+        Ptr l, h;
+        split_label(t->left, label, l, h);
+        lo = l;
+        hi = make(t->entry, t->priority, h, t->right);
+    }
+}
+
+void ChildIndex::split_rank(const Ptr& t, size_t k, Ptr& lo, Ptr& hi) {
+    if (!t) { lo = hi = nullptr; return; }
+    size_t ls = tsize(t->left);
+    if (k <= ls) {
+        Ptr l, h;
+        split_rank(t->left, k, l, h);
+        lo = l;
+        hi = make(t->entry, t->priority, h, t->right);
+    } else {
+        Ptr l, h;
+        split_rank(t->right, k - ls - 1, l, h);
+        lo = make(t->entry, t->priority, t->left, l);
+        hi = h;
+    }
+}
+
+void ChildIndex::insert(const Entry& e) {
+    Ptr lo, hi;
+    split_label(root_, e.label, lo, hi);
+    root_ = merge(merge(lo, make(e, priority_for(e), Ptr(), Ptr())), hi);
+}
+
+void ChildIndex::erase(uint64_t label) {
+    Ptr lo, rest, mid, hi;
+    split_label(root_, label, lo, rest);
+    split_rank(rest, 1, mid, hi);
+    assert(mid && mid->entry.label == label);
+    root_ = merge(lo, hi);
+}
+
+ChildIndex::Ptr ChildIndex::update(const Ptr& t, uint64_t label, long long delta, uint32_t height) {
+    assert(t);
+    if (label == t->entry.label) {
+        Entry e = t->entry;
+        e.weight = static_cast<size_t>(static_cast<long long>(e.weight) + delta);
+        if (height != 0) e.height = height;
+        return make(e, t->priority, t->left, t->right);
+    }
+    if (label < t->entry.label) return make(t->entry, t->priority, update(t->left, label, delta, height), t->right);
+    return make(t->entry, t->priority, t->left, update(t->right, label, delta, height));
+}
+
+void ChildIndex::add_weight(uint64_t label, long long delta) {
+    if (delta != 0) root_ = update(root_, label, delta, 0);
+}
+
+void ChildIndex::update(uint64_t label, long long delta, uint32_t height) {
+    root_ = update(root_, label, delta, height);
+}
+
+ChildIndex::Ptr ChildIndex::build(const std::vector<Entry>& entries) {
+    struct Build { Entry entry; uint32_t priority; Ptr left; Ptr right; };
+    std::vector<Build> spine;
+    auto finish = [](Build& b) { return make(b.entry, b.priority, std::move(b.left), std::move(b.right)); };
+    for (const Entry& e : entries) {
+        Build cur{ e, priority_for(e), nullptr, nullptr };
+        Ptr last;
+        while (!spine.empty() && spine.back().priority < cur.priority) {
+            spine.back().right = last;
+            last = finish(spine.back());
+            spine.pop_back();
+        }
+        cur.left = last;
+        spine.push_back(std::move(cur));
+    }
+    Ptr built;
+    while (!spine.empty()) {
+        spine.back().right = built;
+        built = finish(spine.back());
+        spine.pop_back();
+    }
+    return built;
+}
+
+void ChildIndex::insert_run(const std::vector<Entry>& run) {
+    if (run.empty()) return;
+    Ptr lo, hi;
+    split_label(root_, run.front().label, lo, hi);
+    root_ = merge(merge(lo, build(run)), hi);
+}
+
+void ChildIndex::relabel(size_t first, const std::vector<uint64_t>& labels) {
+    if (labels.empty()) return;
+    Ptr lo, rest, mid, hi;
+    split_rank(root_, first, lo, rest);
+    split_rank(rest, labels.size(), mid, hi);
+    // in-order walk of the window, then rebuild it as a Cartesian tree in O(m)
+    std::vector<Entry> entries;
+    entries.reserve(labels.size());
+    std::vector<const TNode*> stack;
+    for (const TNode* t = mid.get(); t || !stack.empty();) {
+        while (t) { stack.push_back(t); t = t->left.get(); }
+        t = stack.back();
+        stack.pop_back();
+        entries.push_back(t->entry);
+        entries.back().label = labels[entries.size() - 1];
+        t = t->right.get();
+    }
+    assert(entries.size() == labels.size());
+    root_ = merge(merge(lo, build(entries)), hi);
+}
+
+} // namespace bullet
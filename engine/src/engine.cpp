@@ -1,253 +1,484 @@
 #include "bullet_engine/types.hpp"
+#include "bullet_engine/instrument.hpp"
 #include "bullet_engine/state_utils.hpp"
 #include <algorithm>
 #include <cassert>
+#include <unordered_set>
+#if BULLET_ENGINE_INSTRUMENT
+#include <chrono>
+#endif
 
 namespace bullet {
 
-static bool has_prev_sibling(const State& s, const std::string& id) {
-    const auto& sibs = siblings_cref(s, id);
-    return index_in_siblings(s, id) > 0;
+static NodeHandle prev_sibling(const State& s, NodeHandle h) {
+    return s.nodes.get(h).prev;
 }
 
-static bool has_next_sibling(const State& s, const std::string& id) {
-    const auto& sibs = siblings_cref(s, id);
-    return index_in_siblings(s, id) + 1 < sibs.size();
+static NodeHandle next_sibling(const State& s, NodeHandle h) {
+    return s.nodes.get(h).next;
 }
 
-static std::string prev_sibling_id(const State& s, const std::string& id) {
-    const auto& sibs = siblings_cref(s, id);
-    auto idx = index_in_siblings(s, id);
-    if (idx == 0) return std::string();
-    return sibs[idx - 1];
+// O(1): State shares all of its storage; commands copy what they touch.
+static State clone(const State& s) { return s; }
+
+// Change recording (ids are resolved here, at the boundary)
+static void add_unique(std::vector<std::string>& ids, const std::string& id) {
+    if (std::find(ids.begin(), ids.end(), id) == ids.end()) ids.push_back(id);
 }
 
-static std::string next_sibling_id(const State& s, const std::string& id) {
-    const auto& sibs = siblings_cref(s, id);
-    auto idx = index_in_siblings(s, id);
-    if (idx + 1 >= sibs.size()) return std::string();
-    return sibs[idx + 1];
+static void mark_touched(const State& s, ChangeSet& ch, NodeHandle h) {
+    add_unique(ch.touched, s.nodes.id_of(h));
 }
 
-static State clone(const State& s) { return s; }
+// Record every child of parent as touched (they are being reparented). Call
+// before anything else is recorded: siblings are distinct, so the ids are
+// appended without the linear duplicate check, keeping wide splits and merges
+// O(children).
+static void mark_children_touched(const State& s, ChangeSet& ch, NodeHandle parent) {
+    assert(ch.touched.empty());
+    const SiblingList& children = s.nodes.get(parent).children;
+    ch.touched.reserve(children.size() + 2);
+    for (NodeHandle cid = children.first; cid; cid = s.nodes.get(cid).next) ch.touched.push_back(s.nodes.id_of(cid));
+}
 
-static void ensure_min_one_root(State& s) {
-    if (s.rootOrder.empty()) {
-        // create a new empty root
-        Node root{ make_new_id(s), "", "", {} };
-        s.nodes[root.id] = root;
-        s.rootOrder.push_back(root.id);
-        s.focusedId = root.id;
-        s.caret = 0;
-    }
+// Record that the sibling container owned by parent (rootOrder when null) changed.
+static void mark_container(const State& s, ChangeSet& ch, NodeHandle parent) {
+    if (!parent) ch.rootOrderChanged = true;
+    else mark_touched(s, ch, parent);
+}
+
+static void mark_created(const State& s, ChangeSet& ch, NodeHandle h) {
+    add_unique(ch.created, s.nodes.id_of(h));
 }
 
-static void set_focus(State& s, const std::string& id, int caret) {
+// Call before erasing h from the store.
+static void mark_removed(const State& s, ChangeSet& ch, NodeHandle h) {
+    const std::string& id = s.nodes.id_of(h);
+    ch.touched.erase(std::remove(ch.touched.begin(), ch.touched.end(), id), ch.touched.end());
+    add_unique(ch.removed, id);
+}
+
+static void set_focus(State& s, ChangeSet& ch, NodeHandle h, int caret) {
+    int clamped = caret < 0 ? 0 : caret;
+    const std::string& id = s.nodes.id_of(h);
+    if (s.focusedId == id && s.caret == clamped) return;
     s.focusedId = id;
-    s.caret = caret < 0 ? 0 : caret;
+    s.caret = clamped;
+    ch.focusChanged = true;
 }
 
-static void insert_empty_sibling_after(State& s, const std::string& id) {
-    Node newNode{ make_new_id(s), s.nodes[id].parentId, "", {} };
-    s.nodes[newNode.id] = newNode;
-    auto& sibs = siblings_ref(s, id);
-    insert_after(sibs, id, newNode.id);
-    set_focus(s, newNode.id, 0);
+static void clear_scope_if(State& s, ChangeSet& ch, NodeHandle h) {
+    if (s.scopeRootId.has_value() && *s.scopeRootId == s.nodes.id_of(h)) {
+        s.scopeRootId = std::nullopt;
+        ch.scopeChanged = true;
+    }
+}
+
+static void ensure_min_one_root(State& s, ChangeSet& ch) {
+    if (s.rootOrder.empty()) {
+        // create a new empty root
+        NodeHandle root = create_node(s, "");
+        append_child(s, NodeHandle{}, root);
+        mark_created(s, ch, root);
+        ch.rootOrderChanged = true;
+        set_focus(s, ch, root, 0);
+    }
 }
 
-static void split_at_caret(State& s, const std::string& id, int caret) {
-    auto& node = s.nodes[id];
+static void insert_empty_sibling_after(State& s, ChangeSet& ch, NodeHandle h) {
+    NodeHandle parent = s.nodes.get(h).parent;
+    NodeHandle fresh = create_node(s, "");
+    insert_after(s, h, fresh);
+    mark_created(s, ch, fresh);
+    mark_container(s, ch, parent);
+    set_focus(s, ch, fresh, 0);
+}
+
+static void split_at_caret(State& s, ChangeSet& ch, NodeHandle h, int caret) {
+    const Node& cur = s.nodes.get(h);
     if (caret < 0) caret = s.caret;
     if (caret < 0) caret = 0;
-    if (caret > static_cast<int>(node.text.size())) caret = static_cast<int>(node.text.size());
-    Node newNode{ make_new_id(s), node.parentId, node.text.substr(static_cast<size_t>(caret)), {} };
-    // second node receives all children; reparent their parentId to new node
-    newNode.children = std::move(node.children);
-    for (const auto& cid : newNode.children) {
-        s.nodes[cid].parentId = newNode.id;
-    }
-    node.children.clear();
-    node.text.erase(static_cast<size_t>(caret));
-    s.nodes[newNode.id] = newNode;
-    auto& sibs = siblings_ref(s, id);
-    insert_after(sibs, id, newNode.id);
-    set_focus(s, newNode.id, 0);
-}
-
-static void indent(State& s, const std::string& id) {
-    if (!has_prev_sibling(s, id)) return; // no previous sibling → no-op
-    std::string prevId = prev_sibling_id(s, id);
-    // Remove from current siblings
-    auto& curSibs = siblings_ref(s, id);
-    erase_from(curSibs, id);
-    // Reparent under prev sibling
-    s.nodes[id].parentId = prevId;
-    s.nodes[prevId].children.push_back(id);
-}
-
-static void outdent(State& s, const std::string& id) {
-    auto& node = s.nodes[id];
-    if (node.parentId.empty()) return; // already root
-    std::string parentId = node.parentId;
-    std::string grandParentId = s.nodes[parentId].parentId; // may be empty
+    if (caret > static_cast<int>(cur.text.size())) caret = static_cast<int>(cur.text.size());
+    NodeHandle parent = cur.parent;
+    NodeHandle fresh = create_node(s, cur.text.substr(static_cast<size_t>(caret)));
+    const size_t tail = s.nodes.get(fresh).text.size();
+    s.nodes.mut(h).text.erase(static_cast<size_t>(caret));
+    add_text_bytes(s, h, -static_cast<long long>(tail));
+    // second node receives all children; reparent them to the new node
+    mark_children_touched(s, ch, h);
+    move_children(s, h, fresh);
+    // the children keep their collapsed/expanded presentation
+    set_collapsed(s, fresh, s.nodes.get(h).collapsed);
+    set_collapsed(s, h, false);
+    insert_after(s, h, fresh);
+    mark_touched(s, ch, h);
+    mark_created(s, ch, fresh);
+    mark_container(s, ch, parent);
+    set_focus(s, ch, fresh, 0);
+}
+
+static void indent(State& s, ChangeSet& ch, NodeHandle h) {
+    NodeHandle prev = prev_sibling(s, h);
+    if (!prev) return; // no previous sibling → no-op
+    mark_container(s, ch, s.nodes.get(h).parent);
+    // Remove from current siblings, then append as prev sibling's last child;
+    // a collapsed target expands so the moved node stays visible
+    erase_from(s, h);
+    set_collapsed(s, prev, false);
+    append_child(s, prev, h);
+    mark_touched(s, ch, h);
+    mark_touched(s, ch, prev);
+}
+
+// Detach h from its parent's children and attach it next to that parent in
+// the grandparent's list (or rootOrder): after it when `after`, else before.
+static void reparent_beside_parent(State& s, ChangeSet& ch, NodeHandle h, bool after) {
+    NodeHandle parent = s.nodes.get(h).parent;
+    NodeHandle grandParent = s.nodes.get(parent).parent; // may be null
     // remove from parent's children
-    auto& pchildren = s.nodes[parentId].children;
-    erase_from(pchildren, id);
+    erase_from(s, h);
+    if (after) insert_after(s, parent, h);
+    else insert_before(s, parent, h);
+    mark_touched(s, ch, h);
+    mark_touched(s, ch, parent);
+    mark_container(s, ch, grandParent);
+}
+
+static void outdent(State& s, ChangeSet& ch, NodeHandle h) {
+    if (!s.nodes.get(h).parent) return; // already root
     // insert as next sibling after parent in grandparent's list (or root)
-    if (grandParentId.empty()) {
-        insert_after(s.rootOrder, parentId, id);
-        node.parentId.clear();
-    } else {
-        auto& gpsibs = s.nodes[grandParentId].children;
-        insert_after(gpsibs, parentId, id);
-        node.parentId = grandParentId;
-    }
-}
-
-static void move_up(State& s, const std::string& id) {
-    auto& node = s.nodes[id];
-    auto& sibs = siblings_ref(s, id);
-    auto idx = index_in_siblings(s, id);
-    if (idx > 0) {
-        std::swap(sibs[idx - 1], sibs[idx]);
+    reparent_beside_parent(s, ch, h, true);
+}
+
+static void move_up(State& s, ChangeSet& ch, NodeHandle h) {
+    NodeHandle prev = prev_sibling(s, h);
+    if (prev) {
+        erase_from(s, h);
+        insert_before(s, prev, h);
+        mark_container(s, ch, s.nodes.get(h).parent);
         return;
     }
-    // At first position, hoist if possible
-    if (node.parentId.empty()) return; // root and first → no-op
-    std::string parentId = node.parentId;
-    std::string grandParentId = s.nodes[parentId].parentId;
-    // remove from parent's children
-    erase_from(s.nodes[parentId].children, id);
-    if (grandParentId.empty()) {
-        // insert before parent in rootOrder
-        insert_before(s.rootOrder, parentId, id);
-        node.parentId.clear();
-    } else {
-        auto& gpsibs = s.nodes[grandParentId].children;
-        insert_before(gpsibs, parentId, id);
-        node.parentId = grandParentId;
-    }
-}
-
-static void move_down(State& s, const std::string& id) {
-    auto& node = s.nodes[id];
-    auto& sibs = siblings_ref(s, id);
-    auto idx = index_in_siblings(s, id);
-    if (idx + 1 < sibs.size()) {
-        std::swap(sibs[idx], sibs[idx + 1]);
+    // At first position, hoist if possible: insert before parent
+    if (!s.nodes.get(h).parent) return; // root and first → no-op
+    reparent_beside_parent(s, ch, h, false);
+}
+
+static void move_down(State& s, ChangeSet& ch, NodeHandle h) {
+    NodeHandle next = next_sibling(s, h);
+    if (next) {
+        erase_from(s, h);
+        insert_after(s, next, h);
+        mark_container(s, ch, s.nodes.get(h).parent);
         return;
     }
-    // At last position, sink if possible
-    if (node.parentId.empty()) return; // root and last → no-op
-    std::string parentId = node.parentId;
-    std::string grandParentId = s.nodes[parentId].parentId;
-    // remove from parent's children
-    erase_from(s.nodes[parentId].children, id);
-    if (grandParentId.empty()) {
-        // insert after parent in rootOrder
-        insert_after(s.rootOrder, parentId, id);
-        node.parentId.clear();
-    } else {
-        auto& gpsibs = s.nodes[grandParentId].children;
-        insert_after(gpsibs, parentId, id);
-        node.parentId = grandParentId;
-    }
-}
-
-static void delete_empty_at_id(State& s, const std::string& id) {
-    auto it = s.nodes.find(id);
-    if (it == s.nodes.end()) return;
-    if (!it->second.text.empty()) return; // only delete when text is empty
-    if (!it->second.children.empty()) return; // has children → no-op
+    // At last position, sink if possible: insert after parent
+    if (!s.nodes.get(h).parent) return; // root and last → no-op
+    reparent_beside_parent(s, ch, h, true);
+}
+
+static void delete_empty_at_id(State& s, ChangeSet& ch, NodeHandle h) {
+    const Node& node = s.nodes.get(h);
+    if (!node.text.empty()) return; // only delete when text is empty
+    if (!node.children.empty()) return; // has children → no-op
     // compute preferred new focus before mutation
-    std::string prev = prev_visible_id(s, id);
-    std::string next = next_visible_id(s, id);
-    // if last remaining root and it's root → clear text instead
-    bool isRoot = it->second.parentId.empty();
-    if (isRoot && s.rootOrder.size() == 1) {
-        it->second.text.clear();
-        s.focusedId = it->second.id;
-        s.caret = 0;
+    NodeHandle prev = prev_visible(s, h);
+    NodeHandle next = next_visible(s, h);
+    // if last remaining root and it's root → keep it (already empty) and focus it
+    NodeHandle parent = node.parent;
+    if (!parent && s.rootOrder.size() == 1) {
+        set_focus(s, ch, h, 0);
         return;
     }
     // remove from siblings container
-    auto& sibs = siblings_ref(s, id);
-    erase_from(sibs, id);
-    s.nodes.erase(it);
-    // clear scope if it pointed to deleted id
-    if (s.scopeRootId.has_value() && s.scopeRootId == id) {
-        s.scopeRootId = std::nullopt;
-    }
+    erase_from(s, h);
+    clear_scope_if(s, ch, h);
+    mark_removed(s, ch, h);
+    mark_container(s, ch, parent);
+    s.nodes.erase(h);
     // ensure at least one root remains
-    ensure_min_one_root(s);
+    ensure_min_one_root(s, ch);
     // set new focus: prefer previous visible, else next, else first root
-    std::string newFocus = !prev.empty() ? prev : (!next.empty() ? next : (s.rootOrder.empty() ? std::string() : s.rootOrder.front()));
-    if (!newFocus.empty()) {
-        int caret = static_cast<int>(s.nodes[newFocus].text.size());
-        set_focus(s, newFocus, caret);
+    NodeHandle newFocus = prev ? prev : (next ? next : (s.rootOrder.empty() ? NodeHandle{} : s.rootOrder.first));
+    if (newFocus) {
+        int caret = static_cast<int>(s.nodes.get(newFocus).text.size());
+        set_focus(s, ch, newFocus, caret);
     }
 }
 
-static void merge_next_sibling_into_current(State& s, const std::string& id) {
-    auto& node = s.nodes[id];
-    if (!node.children.empty()) return; // precondition: current has no children
-    std::string nextId = next_sibling_id(s, id);
-    if (nextId.empty()) return; // no next sibling
-    auto& nextNode = s.nodes[nextId];
-    // Append text and children
-    node.text += nextNode.text;
-    node.children.insert(node.children.end(), nextNode.children.begin(), nextNode.children.end());
-    for (const auto& cid : nextNode.children) {
-        s.nodes[cid].parentId = id;
-    }
+static void merge_next_sibling_into_current(State& s, ChangeSet& ch, NodeHandle h) {
+    if (!s.nodes.get(h).children.empty()) return; // precondition: current has no children
+    NodeHandle nextH = next_sibling(s, h);
+    if (!nextH) return; // no next sibling
+    // Append text and children (current has none, so adopt next's list as is)
+    Text tail = s.nodes.get(nextH).text; // shares the rope
+    s.nodes.mut(h).text.append(tail);
+    add_text_bytes(s, h, static_cast<long long>(tail.size()));
+    mark_children_touched(s, ch, nextH);
+    move_children(s, nextH, h);
+    set_collapsed(s, h, s.nodes.get(nextH).collapsed);
+    mark_touched(s, ch, h);
     // remove next from siblings and nodes
-    auto& sibs = siblings_ref(s, id);
-    erase_from(sibs, nextId);
-    s.nodes.erase(nextId);
-    if (s.scopeRootId.has_value() && s.scopeRootId == nextId) {
-        s.scopeRootId = std::nullopt;
-    }
+    NodeHandle parent = s.nodes.get(nextH).parent;
+    erase_from(s, nextH);
+    clear_scope_if(s, ch, nextH);
+    mark_removed(s, ch, nextH);
+    mark_container(s, ch, parent);
+    s.nodes.erase(nextH);
     // focus remains on current; caret moves to end
-    set_focus(s, id, static_cast<int>(node.text.size()));
+    set_focus(s, ch, h, static_cast<int>(s.nodes.get(h).text.size()));
 }
 
-State apply_command(const State& s0, const Command& cmd) {
-    State s = clone(s0);
-    std::string target = cmd.id.empty() ? s.focusedId : cmd.id;
-    if (s.nodes.find(target) == s.nodes.end()) return s; // invalid id → no-op
+// Paste: one new sibling per line of `text` (CRLF/CR normalised), spliced in
+// after h in a single edit. Ids are reserved as one block from idCounter.
+static void insert_lines_after(State& s, ChangeSet& ch, NodeHandle h, const std::string& text) {
+    std::vector<std::string> lines(1);
+    for (size_t i = 0; i < text.size(); ++i) {
+        char c = text[i];
+        if (c == '\r' || c == '\n') {
+            if (c == '\r' && i + 1 < text.size() && text[i + 1] == '\n') ++i;
+            lines.emplace_back();
+        } else {
+            lines.back().push_back(c);
+        }
+    }
+    const unsigned long long base = s.idCounter;
+    s.idCounter += lines.size();
+    std::vector<NodeHandle> run;
+    run.reserve(lines.size());
+    ch.created.reserve(ch.created.size() + lines.size());
+    for (size_t i = 0; i < lines.size(); ++i) {
+        Node node;
+        node.text = std::move(lines[i]);
+        node.subtreeBytes = node.text.size();
+        run.push_back(s.nodes.insert("n" + std::to_string(base + i + 1), std::move(node)));
+        ch.created.push_back(s.nodes.id_of(run.back())); // fresh ids: no dedupe needed
+    }
+    insert_run_after(s, h, run);
+    mark_container(s, ch, s.nodes.get(h).parent);
+    set_focus(s, ch, run.back(), static_cast<int>(s.nodes.get(run.back()).text.size()));
+}
+
+// Replace h's text (typing). A caret >= 0 also moves the focus there.
+static void set_node_text(State& s, ChangeSet& ch, NodeHandle h, const std::string& text, int caret) {
+    if (s.nodes.get(h).text != text) {
+        const long long delta = static_cast<long long>(text.size()) - static_cast<long long>(s.nodes.get(h).text.size());
+        s.nodes.mut(h).text = text;
+        add_text_bytes(s, h, delta);
+        mark_touched(s, ch, h);
+    }
+    // the caret stays inside the new text: the given one, or the current one
+    // when h keeps focus
+    const int size = static_cast<int>(s.nodes.get(h).text.size());
+    if (caret >= 0) set_focus(s, ch, h, std::min(caret, size));
+    else if (s.focusedId == s.nodes.id_of(h) && s.caret > size) set_focus(s, ch, h, size);
+}
+
+// Caret-based edits of long texts: O(log n) on a rope, and only the edited
+// node is copied. A negative caret means the current caret, as for split.
+static size_t text_caret(const State& s, NodeHandle h, int caret) {
+    if (caret < 0) caret = s.caret;
+    return std::min(static_cast<size_t>(std::max(caret, 0)), s.nodes.get(h).text.size());
+}
+
+static void insert_text(State& s, ChangeSet& ch, NodeHandle h, int caret, const std::string& text) {
+    const size_t at = text_caret(s, h, caret);
+    if (!text.empty()) {
+        s.nodes.mut(h).text.insert(at, text);
+        add_text_bytes(s, h, static_cast<long long>(text.size()));
+        mark_touched(s, ch, h);
+    }
+    set_focus(s, ch, h, static_cast<int>(at + text.size()));
+}
+
+static void delete_text(State& s, ChangeSet& ch, NodeHandle h, int caret, int length) {
+    const size_t at = text_caret(s, h, caret);
+    const size_t n = std::min(static_cast<size_t>(std::max(length, 0)), s.nodes.get(h).text.size() - at);
+    if (n > 0) {
+        s.nodes.mut(h).text.erase(at, n);
+        add_text_bytes(s, h, -static_cast<long long>(n));
+        mark_touched(s, ch, h);
+    }
+    set_focus(s, ch, h, static_cast<int>(at));
+}
+
+static void toggle_collapse(State& s, ChangeSet& ch, NodeHandle h) {
+    const bool collapse = !s.nodes.get(h).collapsed;
+    set_collapsed(s, h, collapse);
+    mark_touched(s, ch, h);
+    if (!collapse) return;
+    // focus inside the hidden subtree moves up to the collapsed node
+    NodeHandle focus = s.nodes.find(s.focusedId);
+    for (NodeHandle x = focus ? s.nodes.get(focus).parent : NodeHandle{}; x; x = s.nodes.get(x).parent) {
+        if (x == h) {
+            set_focus(s, ch, h, 0);
+            break;
+        }
+    }
+}
+
+static ChangeSet run_command(State& s, const Command& cmd) {
+    ChangeSet ch;
+    NodeHandle target = s.nodes.find(cmd.id.empty() ? s.focusedId : cmd.id);
+    if (!target) return ch; // invalid id → no-op
 
     switch (cmd.type) {
         case CommandType::InsertEmptySiblingAfter:
-            insert_empty_sibling_after(s, target);
+            insert_empty_sibling_after(s, ch, target);
             break;
         case CommandType::SplitAtCaret:
-            split_at_caret(s, target, cmd.caret);
+            split_at_caret(s, ch, target, cmd.caret);
             break;
         case CommandType::Indent:
-            indent(s, target);
+            indent(s, ch, target);
             break;
         case CommandType::Outdent:
-            outdent(s, target);
+            outdent(s, ch, target);
             break;
         case CommandType::MoveUp:
-            move_up(s, target);
+            move_up(s, ch, target);
             break;
         case CommandType::MoveDown:
-            move_down(s, target);
+            move_down(s, ch, target);
             break;
         case CommandType::DeleteEmptyAtId:
-            delete_empty_at_id(s, target);
+            delete_empty_at_id(s, ch, target);
             break;
         case CommandType::MergeNextSiblingIntoCurrent:
-            merge_next_sibling_into_current(s, target);
+            merge_next_sibling_into_current(s, ch, target);
             break;
         case CommandType::SetFocus:
-            set_focus(s, target, cmd.caret);
+            set_focus(s, ch, target, cmd.caret);
             break;
         case CommandType::SetScopeRoot:
-            s.scopeRootId = cmd.scopeRootId;
+            if (s.scopeRootId != cmd.scopeRootId) {
+                s.scopeRootId = cmd.scopeRootId;
+                ch.scopeChanged = true;
+            }
+            break;
+        case CommandType::ToggleCollapse:
+            toggle_collapse(s, ch, target);
+            break;
+        case CommandType::InsertLinesAfter:
+            insert_lines_after(s, ch, target, cmd.text);
+            break;
+        case CommandType::SetText:
+            set_node_text(s, ch, target, cmd.text, cmd.caret);
+            break;
+        case CommandType::InsertText:
+            insert_text(s, ch, target, cmd.caret, cmd.text);
+            break;
+        case CommandType::DeleteText:
+            delete_text(s, ch, target, cmd.caret, cmd.length);
             break;
     }
+    return ch;
+}
+
+#if BULLET_ENGINE_INSTRUMENT
+using Clock = std::chrono::steady_clock;
+
+static uint64_t nanos(Clock::duration d) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+}
+
+// run_command plus a sample for the observer; the storage counters are
+// per-thread, so their difference is this command's share.
+static ChangeSet run_observed(State& s, const Command& cmd, CommandObserver* obs, uint64_t cloneNs) {
+    const instrument_detail::Counters before = instrument_detail::counters;
+    const auto t0 = Clock::now();
+    ChangeSet ch = run_command(s, cmd);
+    const auto t1 = Clock::now();
+    CommandSample sample;
+    sample.type = cmd.type;
+    sample.cloneNs = cloneNs;
+    sample.transformNs = nanos(t1 - t0);
+    sample.cloneBytes = instrument_detail::counters.copiedBytes - before.copiedBytes;
+    sample.allocations = instrument_detail::counters.allocations - before.allocations;
+    sample.nodesTouched = ch.touched.size() + ch.created.size() + ch.removed.size();
+    obs->on_command(sample);
+    return ch;
+}
+#endif
+
+ChangeSet apply_command_inplace(State& s, const Command& cmd) {
+#if BULLET_ENGINE_INSTRUMENT
+    if (CommandObserver* obs = command_observer()) return run_observed(s, cmd, obs, 0);
+#endif
+    return run_command(s, cmd);
+}
+
+State apply_command(const State& s0, const Command& cmd) {
+#if BULLET_ENGINE_INSTRUMENT
+    if (CommandObserver* obs = command_observer()) {
+        const auto t0 = Clock::now();
+        State s = clone(s0);
+        run_observed(s, cmd, obs, nanos(Clock::now() - t0));
+        return s;
+    }
+#endif
+    State s = clone(s0);
+    run_command(s, cmd);
+    return s;
+}
+
+const char* command_type_name(CommandType type) {
+    static const char* const names[] = { "InsertEmptySiblingAfter", "SplitAtCaret", "Indent", "Outdent", "MoveUp",
+                                         "MoveDown", "DeleteEmptyAtId", "MergeNextSiblingIntoCurrent", "SetFocus",
+                                         "SetScopeRoot", "ToggleCollapse", "InsertLinesAfter", "SetText",
+                                         "InsertText", "DeleteText" };
+    static_assert(sizeof(names) / sizeof(names[0]) == kCommandTypeCount, "one name per CommandType");
+    static_assert(static_cast<size_t>(CommandType::DeleteText) + 1 == kCommandTypeCount, "kCommandTypeCount is current");
+    const size_t t = static_cast<size_t>(type);
+    return t < kCommandTypeCount ? names[t] : "";
+}
+
+// Folds per-command change records into one for a batch. Membership sets keep
+// the merge O(total ids) however long the batch is.
+class BatchChanges {
+public:
+    void add(const ChangeSet& ch) {
+        for (const auto& id : ch.created) {
+            if (created_.insert(id).second) out_.created.push_back(id);
+        }
+        for (const auto& id : ch.touched) {
+            if (!created_.count(id) && touched_.insert(id).second) out_.touched.push_back(id);
+        }
+        for (const auto& id : ch.removed) {
+            if (created_.erase(id)) continue; // born and gone within the batch
+            touched_.erase(id);
+            if (removed_.insert(id).second) out_.removed.push_back(id);
+        }
+        out_.rootOrderChanged |= ch.rootOrderChanged;
+        out_.focusChanged |= ch.focusChanged;
+        out_.scopeChanged |= ch.scopeChanged;
+    }
+
+    ChangeSet finish() {
+        auto keep = [](std::vector<std::string>& ids, const std::unordered_set<std::string>& live) {
+            ids.erase(std::remove_if(ids.begin(), ids.end(), [&](const std::string& id) { return !live.count(id); }), ids.end());
+        };
+        keep(out_.created, created_);
+        keep(out_.touched, touched_);
+        return std::move(out_);
+    }
+
+private:
+    ChangeSet out_;
+    std::unordered_set<std::string> created_;
+    std::unordered_set<std::string> touched_;
+    std::unordered_set<std::string> removed_;
+};
+
+ChangeSet apply_commands_inplace(State& s, const std::vector<Command>& cmds) {
+    BatchChanges batch;
+    for (const Command& cmd : cmds) batch.add(apply_command_inplace(s, cmd));
+    return batch.finish();
+}
+
+State apply_commands(const State& s0, const std::vector<Command>& cmds, ChangeSet* changes) {
+    State s = clone(s0);
+    ChangeSet ch = apply_commands_inplace(s, cmds);
+    if (changes) *changes = std::move(ch);
     return s;
 }
 
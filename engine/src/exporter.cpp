@@ -0,0 +1,252 @@
+#include "bullet_engine/exporter.hpp"
+#include "bullet_engine/state_utils.hpp"
+#include <cstdio>
+#include <memory>
+
+namespace bullet {
+
+namespace {
+
+// Output buffer that hands full chunks to the sink.
+class ChunkWriter {
+public:
+    ChunkWriter(const ExportSink& sink, size_t chunkBytes) : sink_(sink), chunk_(chunkBytes ? chunkBytes : 1) {
+        buf_.reserve(chunk_);
+    }
+
+    void put(char c) {
+        buf_.push_back(c);
+        if (buf_.size() >= chunk_) flush();
+    }
+    void put(std::string_view s) {
+        buf_.append(s.data(), s.size());
+        if (buf_.size() >= chunk_) flush();
+    }
+    void flush() {
+        if (!buf_.empty()) sink_(buf_);
+        buf_.clear();
+    }
+
+private:
+    const ExportSink& sink_;
+    size_t chunk_;
+    std::string buf_;
+};
+
+// Copy `s`, passing runs of ordinary characters through in one append and
+// `escape` the rest (it returns the replacement, or empty to keep the char).
+template <class Escape>
+void put_escaped(ChunkWriter& out, std::string_view s, Escape escape) {
+    size_t run = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+        std::string_view rep = escape(s[i]);
+        if (rep.empty()) continue;
+        out.put(s.substr(run, i - run));
+        out.put(rep);
+        run = i + 1;
+    }
+    out.put(s.substr(run));
+}
+
+template <class Escape>
+void put_escaped(ChunkWriter& out, const Text& t, Escape escape) {
+    t.for_each_chunk([&](std::string_view chunk) { put_escaped(out, chunk, escape); });
+}
+
+std::string_view line_escape(char c) {
+    return (c == '\n' || c == '\r') ? std::string_view(" ") : std::string_view();
+}
+
+std::string_view xml_escape(char c) {
+    switch (c) {
+    case '&': return "&amp;";
+    case '<': return "&lt;";
+    case '>': return "&gt;";
+    case '"': return "&quot;";
+    case '\n': return "&#10;";
+    case '\r': return "&#13;";
+    case '\t': return "&#9;";
+    default: return {};
+    }
+}
+
+std::string_view json_escape(char c) {
+    static const char* const kControl[32] = {
+        "\\u0000", "\\u0001", "\\u0002", "\\u0003", "\\u0004", "\\u0005", "\\u0006", "\\u0007",
+        "\\b",     "\\t",     "\\n",     "\\u000b", "\\f",     "\\r",     "\\u000e", "\\u000f",
+        "\\u0010", "\\u0011", "\\u0012", "\\u0013", "\\u0014", "\\u0015", "\\u0016", "\\u0017",
+        "\\u0018", "\\u0019", "\\u001a", "\\u001b", "\\u001c", "\\u001d", "\\u001e", "\\u001f",
+    };
+    if (c == '"') return "\\\"";
+    if (c == '\\') return "\\\\";
+    const auto u = static_cast<unsigned char>(c);
+    return u < 32 ? std::string_view(kControl[u]) : std::string_view();
+}
+
+template <class S>
+void put_json_string(ChunkWriter& out, const S& s) {
+    out.put('"');
+    put_escaped(out, s, json_escape);
+    out.put('"');
+}
+
+// Per-format output around the preorder walk: open() for every node on the
+// way down, close() once its subtree is done.
+class Emitter {
+public:
+    Emitter(const State& s, const ExportOptions& opts, ChunkWriter& out) : s_(s), opts_(opts), out_(out) {}
+
+    void begin() {
+        if (opts_.format == ExportFormat::Opml) {
+            out_.put("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<opml version=\"2.0\">\n<head><title>");
+            put_escaped(out_, opts_.title, xml_escape);
+            out_.put("</title></head>\n<body>\n");
+        } else if (opts_.format == ExportFormat::Json) {
+            out_.put("{\"nodes\":{");
+        }
+    }
+
+    void open(NodeHandle h, const Node& node, size_t depth, bool top, bool descend) {
+        switch (opts_.format) {
+        case ExportFormat::IndentedText:
+        case ExportFormat::Markdown:
+            put_indent(depth);
+            if (opts_.format == ExportFormat::Markdown) out_.put("- ");
+            put_escaped(out_, node.text, line_escape);
+            out_.put('\n');
+            break;
+        case ExportFormat::Opml:
+            put_indent(depth + 1);
+            out_.put("<outline text=\"");
+            put_escaped(out_, node.text, xml_escape);
+            out_.put(descend ? "\">\n" : "\"/>\n");
+            break;
+        case ExportFormat::Json: {
+            if (!firstNode_) out_.put(',');
+            firstNode_ = false;
+            const std::string& id = s_.nodes.id_of(h);
+            put_json_string(out_, id);
+            out_.put(":{\"id\":");
+            put_json_string(out_, id);
+            out_.put(",\"parentId\":");
+            if (top || !node.parent) out_.put("null");
+            else put_json_string(out_, s_.nodes.id_of(node.parent));
+            out_.put(",\"text\":");
+            put_json_string(out_, node.text);
+            out_.put(",\"children\":[");
+            if (descend) {
+                for (NodeHandle c = node.children.first; c; c = s_.nodes.get(c).next) {
+                    if (c != node.children.first) out_.put(',');
+                    put_json_string(out_, s_.nodes.id_of(c));
+                }
+            }
+            out_.put(node.collapsed ? "],\"collapsed\":true}" : "]}");
+            break;
+        }
+        }
+    }
+
+    void close(size_t depth) {
+        if (opts_.format != ExportFormat::Opml) return;
+        put_indent(depth + 1);
+        out_.put("</outline>\n");
+    }
+
+    // `scope`: top of the exported subtree (null for the whole tree);
+    // `focus`: the focused node when it was exported, else null.
+    void end(NodeHandle scope, NodeHandle focus) {
+        if (opts_.format == ExportFormat::Opml) {
+            out_.put("</body>\n</opml>\n");
+        } else if (opts_.format == ExportFormat::Json) {
+            out_.put("},\"rootOrder\":[");
+            if (scope) {
+                put_json_string(out_, s_.nodes.id_of(scope));
+            } else {
+                for (NodeHandle r = s_.rootOrder.first; r; r = s_.nodes.get(r).next) {
+                    if (r != s_.rootOrder.first) out_.put(',');
+                    put_json_string(out_, s_.nodes.id_of(r));
+                }
+            }
+            out_.put("],\"focusedId\":");
+            // a subtree export stands alone: focus falls back to its top node
+            NodeHandle f = focus ? focus : (scope ? scope : s_.rootOrder.first);
+            put_json_string(out_, s_.nodes.id_of(f));
+            out_.put(",\"caret\":");
+            out_.put(std::to_string(focus ? s_.caret : 0));
+            if (!scope && s_.scopeRootId) {
+                out_.put(",\"scopeRootId\":");
+                put_json_string(out_, *s_.scopeRootId);
+            }
+            out_.put("}\n");
+        }
+    }
+
+private:
+    void put_indent(size_t levels) {
+        if (opts_.indent.empty()) return;
+        for (size_t i = 0; i < levels; ++i) out_.put(opts_.indent);
+    }
+
+    const State& s_;
+    const ExportOptions& opts_;
+    ChunkWriter& out_;
+    bool firstNode_ = true;
+};
+
+} // namespace
+
+void export_outline(const State& s, const ExportSink& sink, const ExportOptions& opts) {
+    ChunkWriter out(sink, opts.chunkBytes);
+    Emitter emit(s, opts, out);
+
+    NodeHandle scope;
+    if (!opts.wholeTree && s.scopeRootId) scope = s.nodes.find(*s.scopeRootId);
+    const NodeHandle focusHandle = s.nodes.find(s.focusedId);
+    NodeHandle focus;
+
+    emit.begin();
+    size_t depth = 0;
+    for (NodeHandle h = scope ? scope : s.rootOrder.first; h;) {
+        const Node& node = s.nodes.get(h);
+        const bool descend = node.children.first && (!opts.visibleOnly || !node.collapsed || h == scope);
+        emit.open(h, node, depth, h == scope, descend);
+        if (h == focusHandle) focus = h;
+        if (descend) {
+            ++depth;
+            h = node.children.first;
+            continue;
+        }
+        // climb until a node has a next sibling, closing finished parents
+        NodeHandle x = h;
+        h = NodeHandle{};
+        while (x != scope) {
+            const Node& cur = s.nodes.get(x);
+            if (cur.next) {
+                h = cur.next;
+                break;
+            }
+            x = cur.parent;
+            if (!x) break;
+            emit.close(--depth);
+        }
+    }
+    emit.end(scope, focus);
+    out.flush();
+}
+
+std::string export_outline_string(const State& s, const ExportOptions& opts) {
+    std::string out;
+    export_outline(s, [&out](std::string_view chunk) { out.append(chunk.data(), chunk.size()); }, opts);
+    return out;
+}
+
+void export_outline_file(const State& s, const std::string& path, const ExportOptions& opts) {
+    std::unique_ptr<std::FILE, int (*)(std::FILE*)> f(std::fopen(path.c_str(), "wb"), &std::fclose);
+    if (!f) throw ExportError("export: cannot create " + path);
+    export_outline(s, [&](std::string_view chunk) {
+        if (std::fwrite(chunk.data(), 1, chunk.size(), f.get()) != chunk.size()) throw ExportError("export: cannot write " + path);
+    }, opts);
+    if (std::fclose(f.release()) != 0) throw ExportError("export: cannot write " + path);
+}
+
+} // namespace bullet
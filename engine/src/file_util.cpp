@@ -0,0 +1,55 @@
+#include "file_util.hpp"
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#define BULLET_HAVE_FSYNC 1
+#endif
+
+namespace bullet {
+namespace file_detail {
+
+namespace {
+
+// Sync the directory holding `path`, so a rename into it survives a crash.
+void sync_dir(const std::string& path) {
+#ifdef BULLET_HAVE_FSYNC
+    std::string dir = std::filesystem::path(path).parent_path().string();
+    if (dir.empty()) dir = ".";
+    const int fd = ::open(dir.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("cannot open " + dir);
+    const bool ok = ::fsync(fd) == 0;
+    ::close(fd);
+    if (!ok) throw std::runtime_error("fsync failed on " + dir);
+#else
+    (void)path;
+#endif
+}
+
+} // namespace
+
+void replace_file(const std::string& path, const std::string& bytes) {
+    const std::string tmp = path + ".tmp";
+    std::FILE* f = std::fopen(tmp.c_str(), "wb");
+    if (!f) throw std::runtime_error("cannot create " + tmp);
+    bool ok = std::fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size() && std::fflush(f) == 0;
+#ifdef BULLET_HAVE_FSYNC
+    ok = ok && ::fsync(fileno(f)) == 0;
+#endif
+    ok = std::fclose(f) == 0 && ok;
+    if (!ok) {
+        std::remove(tmp.c_str());
+        throw std::runtime_error("cannot write " + tmp);
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        throw std::runtime_error("cannot replace " + path);
+    }
+    sync_dir(path);
+}
+
+} // namespace file_detail
+} // namespace bullet
@@ -0,0 +1,30 @@
+#pragma once
+
+// Internal helpers shared by the snapshot and journal writers; not part of
+// the public headers.
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace bullet {
+namespace file_detail {
+
+// 64-bit FNV-1a: the snapshot's id hash and the journal's snapshot checksum.
+inline uint64_t fnv1a(std::string_view bytes) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (unsigned char c : bytes) {
+        h ^= c;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+// Write `bytes` to `path` via a synced temporary file and an atomic rename,
+// then sync the directory so the rename itself is durable: a crash leaves
+// either the old file or the complete new one. Throws std::runtime_error
+// with an unprefixed message; callers rethrow it as their own error type.
+void replace_file(const std::string& path, const std::string& bytes);
+
+} // namespace file_detail
+} // namespace bullet
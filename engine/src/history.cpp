@@ -0,0 +1,172 @@
+#include "bullet_engine/history.hpp"
+#include "bullet_engine/state_utils.hpp"
+#include <chrono>
+#include <unordered_set>
+#include <utility>
+
+namespace bullet {
+
+History::History(size_t byteBudget, uint64_t coalesceMs) : budget_(byteBudget), coalesceMs_(coalesceMs) {}
+
+// Text a step keeps alive. An edited rope shares its buffers with the new
+// text, so only a few tree nodes and a small piece are retained.
+static size_t text_bytes(const State& s, const std::string& id, bool edited) {
+    NodeHandle h = s.nodes.find(id);
+    if (!h) return 0;
+    const Text& t = s.nodes.get(h).text;
+    return edited && t.is_rope() ? Text::kRopeMin : t.size();
+}
+
+// A retained state costs what the following edit path-copied away from it:
+// the text the changed nodes held, and the slot-trie nodes over every slot
+// the edit wrote. Those are the changed nodes plus each ancestor whose cached
+// aggregates it updated; an ancestor also copies the path to its entry in
+// its container's index. A deep outline makes every text edit copy its whole
+// ancestor chain, though neighbouring slots share one leaf copy.
+size_t History::estimate(const State& before, const State& after, const ChangeSet& ch) {
+    size_t bytes = sizeof(Step);
+    for (const auto& id : ch.touched) bytes += text_bytes(before, id, true);
+    for (const auto& id : ch.removed) bytes += text_bytes(before, id, false);
+
+    // Handles are stable across the edit. Walk each changed node's ancestors
+    // in the state where it has a parent, both for a node that moved.
+    std::vector<uint32_t> written;
+    std::vector<std::pair<const State*, NodeHandle>> walks;
+    for (const auto& id : ch.touched) {
+        const NodeHandle h = after.nodes.find(id);
+        if (!h) continue;
+        written.push_back(h.index);
+        const NodeHandle up = after.nodes.get(h).parent;
+        walks.emplace_back(&after, up);
+        if (before.nodes.contains(h) && before.nodes.get(h).parent != up) walks.emplace_back(&before, before.nodes.get(h).parent);
+    }
+    for (const auto& id : ch.created) {
+        if (const NodeHandle h = after.nodes.find(id)) {
+            written.push_back(h.index);
+            walks.emplace_back(&after, after.nodes.get(h).parent);
+        }
+    }
+    for (const auto& id : ch.removed) {
+        if (const NodeHandle h = before.nodes.find(id)) {
+            written.push_back(h.index);
+            walks.emplace_back(&before, before.nodes.get(h).parent);
+        }
+    }
+    // several walks meet at a common ancestor; charge its chain once
+    std::unordered_set<uint64_t> walked;
+    for (const auto& w : walks) {
+        const State& s = *w.first;
+        for (NodeHandle p = w.second; p; p = s.nodes.get(p).parent) {
+            if (walks.size() > 1 && !walked.insert((static_cast<uint64_t>(p.index) << 32) | p.gen).second) break;
+            bytes += ChildIndex::bytes_per_update(siblings_cref(s, p).size());
+            written.push_back(p.index);
+        }
+    }
+    return bytes + before.nodes.bytes_for_writes(std::move(written));
+}
+
+ChangeSet History::apply(State& s, const Command& cmd) {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return apply(s, cmd, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now).count()));
+}
+
+ChangeSet History::apply(State& s, const Command& cmd, uint64_t nowMs) {
+    // focus and scope are view state: never a step of their own
+    if (cmd.type == CommandType::SetFocus || cmd.type == CommandType::SetScopeRoot) {
+        return apply_command_inplace(s, cmd);
+    }
+    State before = s; // O(1); shares storage until the command writes
+    ChangeSet ch = apply_command_inplace(s, cmd);
+    const bool textEdit = cmd.type == CommandType::SetText || cmd.type == CommandType::InsertText ||
+                          cmd.type == CommandType::DeleteText;
+    record(std::move(before), s, ch, textEdit, cmd.id.empty() ? s.focusedId : cmd.id, nowMs);
+    return ch;
+}
+
+ChangeSet History::apply_batch(State& s, const std::vector<Command>& cmds) {
+    State before = s;
+    ChangeSet ch = apply_commands_inplace(s, cmds);
+    record(std::move(before), s, ch, false, std::string(), 0);
+    return ch;
+}
+
+void History::record(State before, const State& after, const ChangeSet& ch, bool textEdit, const std::string& textId,
+                     uint64_t nowMs) {
+    if (ch.touched.empty() && ch.created.empty() && ch.removed.empty() && !ch.rootOrderChanged) {
+        return; // no-op or focus-only change
+    }
+    for (const Step& step : redo_) bytes_ -= step.bytes;
+    redo_.clear();
+
+    if (textEdit && !undo_.empty()) {
+        Step& top = undo_.back();
+        if (top.textEdit && top.textId == textId && nowMs >= top.lastMs && nowMs - top.lastMs <= coalesceMs_) {
+            top.lastMs = nowMs; // the burst keeps restoring to the state before its first keystroke
+            return;
+        }
+    }
+    size_t bytes = estimate(before, after, ch);
+    undo_.push_back(Step{ std::move(before), ch, textEdit, textEdit ? textId : std::string(), nowMs, bytes });
+    bytes_ += bytes;
+    evict();
+}
+
+ChangeSet History::restore(State& s, std::deque<Step>& from, std::deque<Step>& to, bool forward) {
+    ChangeSet ch;
+    if (from.empty()) return ch;
+    Step step = std::move(from.back());
+    from.pop_back();
+    bytes_ -= step.bytes;
+
+    State current = std::move(s);
+    s = std::move(step.state);
+    // scope is a view filter: keep the current one while its node still exists
+    if (!current.scopeRootId || current.scopeRootId->empty() || has_node(s, *current.scopeRootId)) {
+        s.scopeRootId = current.scopeRootId;
+    } else {
+        s.scopeRootId = std::nullopt;
+    }
+
+    ch.touched = step.changes.touched;
+    ch.created = forward ? step.changes.created : step.changes.removed;
+    ch.removed = forward ? step.changes.removed : step.changes.created;
+    ch.rootOrderChanged = step.changes.rootOrderChanged;
+    ch.focusChanged = s.focusedId != current.focusedId || s.caret != current.caret;
+    ch.scopeChanged = s.scopeRootId != current.scopeRootId;
+
+    // the opposite stack restores `current`; it never coalesces with new typing
+    to.push_back(Step{ std::move(current), std::move(step.changes), false, std::string(), 0, step.bytes });
+    bytes_ += step.bytes;
+    evict();
+    return ch;
+}
+
+ChangeSet History::undo(State& s) { return restore(s, undo_, redo_, false); }
+
+ChangeSet History::redo(State& s) { return restore(s, redo_, undo_, true); }
+
+void History::set_byte_budget(size_t budget) {
+    budget_ = budget;
+    evict();
+}
+
+void History::clear() {
+    undo_.clear();
+    redo_.clear();
+    bytes_ = 0;
+}
+
+// Drop the steps farthest from the present first: the oldest undo steps,
+// then the far end of the redo stack.
+void History::evict() {
+    while (bytes_ > budget_ && !undo_.empty()) {
+        bytes_ -= undo_.front().bytes;
+        undo_.pop_front();
+    }
+    while (bytes_ > budget_ && !redo_.empty()) {
+        bytes_ -= redo_.front().bytes;
+        redo_.pop_front();
+    }
+}
+
+} // namespace bullet
@@ -0,0 +1,211 @@
+#include "bullet_engine/host.hpp"
+#include <algorithm>
+
+namespace bullet {
+
+// The pool the current thread works for, so post() from inside a task can
+// use the worker's own deque.
+static thread_local const TaskPool* t_pool = nullptr;
+static thread_local size_t t_worker = 0;
+
+TaskPool::TaskPool(size_t threads) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < threads; ++i) queues_.push_back(std::make_unique<Queue>());
+    workers_.reserve(threads);
+    for (size_t i = 0; i < threads; ++i) workers_.emplace_back([this, i] { run(i); });
+}
+
+TaskPool::~TaskPool() {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread& t : workers_) t.join();
+}
+
+// A parking thread registers in sleepers_ (or idleWaiters_) and then checks
+// its condition under mu_; the other side changes the counter and then reads
+// the registration. Both are sequentially consistent, so either the parker
+// sees the change or the other side sees the parker and notifies under mu_.
+void TaskPool::post(std::function<void()> task) {
+    const size_t q = t_pool == this ? t_worker : next_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+    // counted before the push, so a worker that takes it at once cannot
+    // drive the counters below zero
+    pending_.fetch_add(1);
+    queued_.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> qlock(queues_[q]->mu);
+        queues_[q]->tasks.push_back(std::move(task));
+    }
+    if (sleepers_.load() > 0) {
+        std::lock_guard<std::mutex> lock(mu_);
+        wake_.notify_one();
+    }
+}
+
+void TaskPool::wait_idle() {
+    std::unique_lock<std::mutex> lock(mu_);
+    idleWaiters_.fetch_add(1);
+    idle_.wait(lock, [this] { return pending_.load() == 0; });
+    idleWaiters_.fetch_sub(1);
+}
+
+// Own deque from the back, then the others from the front.
+bool TaskPool::take(size_t self, std::function<void()>& task) {
+    const size_t n = queues_.size();
+    for (size_t k = 0; k < n; ++k) {
+        Queue& q = *queues_[(self + k) % n];
+        std::lock_guard<std::mutex> lock(q.mu);
+        if (q.tasks.empty()) continue;
+        if (k == 0) {
+            task = std::move(q.tasks.back());
+            q.tasks.pop_back();
+        } else {
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+void TaskPool::run(size_t self) {
+    t_pool = this;
+    t_worker = self;
+    std::function<void()> task;
+    for (;;) {
+        if (take(self, task)) {
+            queued_.fetch_sub(1);
+            task();
+            task = nullptr;
+            if (pending_.fetch_sub(1) == 1 && idleWaiters_.load() > 0) {
+                std::lock_guard<std::mutex> lock(mu_);
+                idle_.notify_all();
+            }
+            continue;
+        }
+        // queued_ may count a task whose push is still under way; take() is
+        // then retried instead of parking
+        std::unique_lock<std::mutex> lock(mu_);
+        sleepers_.fetch_add(1);
+        wake_.wait(lock, [this] { return stop_ || queued_.load() > 0; });
+        sleepers_.fetch_sub(1);
+        if (stop_ && queued_.load() == 0) return;
+    }
+}
+
+Document::Document(std::string id, State initial) : id_(std::move(id)), state_(std::move(initial)) {}
+
+DocumentHost::DocumentHost(TaskPool& pool) : pool_(pool) {}
+
+DocumentHost::~DocumentHost() {
+    drain();
+}
+
+std::shared_ptr<Document> DocumentHost::open(const std::string& docId, State initial) {
+    auto doc = std::make_shared<Document>(docId, std::move(initial));
+    std::unique_lock<std::shared_mutex> lock(docsMu_);
+    return docs_.emplace(docId, doc).second ? doc : nullptr;
+}
+
+bool DocumentHost::close(const std::string& docId) {
+    std::unique_lock<std::shared_mutex> lock(docsMu_);
+    return docs_.erase(docId) > 0;
+}
+
+std::shared_ptr<Document> DocumentHost::find(const std::string& docId) const {
+    std::shared_lock<std::shared_mutex> lock(docsMu_);
+    auto it = docs_.find(docId);
+    return it == docs_.end() ? nullptr : it->second;
+}
+
+size_t DocumentHost::document_count() const {
+    std::shared_lock<std::shared_mutex> lock(docsMu_);
+    return docs_.size();
+}
+
+std::optional<State> DocumentHost::snapshot(const std::string& docId) const {
+    auto doc = find(docId);
+    if (!doc) return std::nullopt;
+    return doc->snapshot();
+}
+
+bool DocumentHost::submit(const std::string& docId, Command cmd, Completion done) {
+    std::vector<Command> cmds;
+    cmds.push_back(std::move(cmd));
+    return submit(docId, std::move(cmds), std::move(done));
+}
+
+bool DocumentHost::submit(const std::string& docId, std::vector<Command> cmds, Completion done) {
+    auto doc = find(docId);
+    if (!doc) return false;
+    submit(doc, std::move(cmds), std::move(done));
+    return true;
+}
+
+void DocumentHost::submit(const std::shared_ptr<Document>& doc, std::vector<Command> cmds, Completion done) {
+    bool schedule;
+    {
+        std::lock_guard<std::mutex> lock(doc->mu_);
+        doc->queue_.push_back(Document::Job{ std::move(cmds), std::move(done) });
+        schedule = !doc->scheduled_;
+        doc->scheduled_ = true;
+    }
+    if (!schedule) return;
+    {
+        std::lock_guard<std::mutex> lock(activeMu_);
+        ++active_;
+    }
+    pool_.post([this, doc] { run_strand(doc); });
+}
+
+// One strand turn: apply up to kStrandBatch queued commands to the working
+// state, publish once, report, and either yield the worker (re-posting the
+// strand behind other documents' work) or go idle.
+void DocumentHost::run_strand(const std::shared_ptr<Document>& doc) {
+    std::vector<Document::Job> jobs;
+    size_t count = 0;
+    {
+        std::lock_guard<std::mutex> lock(doc->mu_);
+        while (!doc->queue_.empty() && count < kStrandBatch) {
+            count += doc->queue_.front().cmds.size();
+            jobs.push_back(std::move(doc->queue_.front()));
+            doc->queue_.pop_front();
+        }
+    }
+
+    std::vector<ChangeSet> changes;
+    changes.reserve(jobs.size());
+    for (const Document::Job& job : jobs) changes.push_back(apply_commands_inplace(doc->state_.working(), job.cmds));
+
+    doc->state_.publish();
+    doc->version_.fetch_add(count, std::memory_order_release);
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        if (jobs[i].done) jobs[i].done(changes[i]);
+    }
+
+    bool more;
+    {
+        std::lock_guard<std::mutex> lock(doc->mu_);
+        more = !doc->queue_.empty();
+        if (!more) doc->scheduled_ = false;
+    }
+    if (more) {
+        pool_.post([this, doc] { run_strand(doc); });
+    } else {
+        strand_done();
+    }
+}
+
+void DocumentHost::strand_done() {
+    std::lock_guard<std::mutex> lock(activeMu_);
+    if (--active_ == 0) activeCv_.notify_all();
+}
+
+void DocumentHost::drain() {
+    std::unique_lock<std::mutex> lock(activeMu_);
+    activeCv_.wait(lock, [this] { return active_ == 0; });
+}
+
+} // namespace bullet
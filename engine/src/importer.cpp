@@ -0,0 +1,123 @@
+#include "bullet_engine/importer.hpp"
+#include "bullet_engine/state_utils.hpp"
+#include <cstdio>
+#include <memory>
+
+namespace bullet {
+
+// Length of a list marker (including the space after it) at the start of
+// `s`, or 0 when `s` is not a list item.
+static size_t list_marker(std::string_view s) {
+    size_t n = 0;
+    if (!s.empty() && (s[0] == '-' || s[0] == '*' || s[0] == '+')) {
+        n = 1;
+    } else {
+        while (n < s.size() && n < 9 && s[n] >= '0' && s[n] <= '9') ++n;
+        if (n == 0 || n >= s.size() || (s[n] != '.' && s[n] != ')')) return 0;
+        ++n;
+    }
+    if (n == s.size()) return n; // bare marker: an empty item
+    return (s[n] == ' ' || s[n] == '\t') ? n + 1 : 0;
+}
+
+// Heading level (1-6) of a Markdown ATX heading, 0 otherwise.
+static size_t heading_level(std::string_view s) {
+    size_t n = 0;
+    while (n < s.size() && n < 7 && s[n] == '#') ++n;
+    if (n == 0 || n > 6) return 0;
+    return (n == s.size() || s[n] == ' ' || s[n] == '\t') ? n : 0;
+}
+
+OutlineImporter::OutlineImporter(ImportOptions opts) : opts_(opts) {
+    if (opts_.tabWidth == 0) opts_.tabWidth = 1;
+}
+
+void OutlineImporter::add(std::string_view text, size_t depth) {
+    std::string id = make_new_id(builder_.state());
+    builder_.add(id, std::string(text), depth);
+    if (nodes_++ == 0) firstId_ = std::move(id);
+}
+
+void OutlineImporter::line(std::string_view text) {
+    if (!text.empty() && text.back() == '\r') text.remove_suffix(1);
+    if (nodes_ == 0 && text.substr(0, 3) == "\xEF\xBB\xBF") text.remove_prefix(3); // UTF-8 BOM
+    size_t column = 0, i = 0;
+    for (; i < text.size(); ++i) {
+        if (text[i] == ' ') ++column;
+        else if (text[i] == '\t') column += opts_.tabWidth - column % opts_.tabWidth;
+        else break;
+    }
+    if (i == text.size()) return; // blank
+    text.remove_prefix(i);
+
+    size_t base = 0;
+    if (opts_.format == OutlineFormat::Markdown) {
+        if (size_t level = heading_level(text)) {
+            while (!headings_.empty() && headings_.back() >= level) headings_.pop_back();
+            size_t depth = headings_.size();
+            headings_.push_back(level);
+            indents_.clear(); // a heading starts a new list
+            text.remove_prefix(level);
+            while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) text.remove_prefix(1);
+            while (!text.empty() && text.back() == '#') text.remove_suffix(1); // closing sequence
+            while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) text.remove_suffix(1);
+            add(text, depth);
+            return;
+        }
+        base = headings_.size();
+        text.remove_prefix(list_marker(text));
+    }
+    while (!indents_.empty() && indents_.back() >= column) indents_.pop_back();
+    size_t depth = base + indents_.size();
+    indents_.push_back(column);
+    add(text, depth);
+}
+
+void OutlineImporter::feed(std::string_view chunk) {
+    size_t start = 0;
+    if (!carry_.empty()) {
+        size_t nl = chunk.find('\n');
+        if (nl == std::string_view::npos) {
+            carry_.append(chunk);
+            return;
+        }
+        carry_.append(chunk.data(), nl);
+        line(carry_);
+        carry_.clear();
+        start = nl + 1;
+    }
+    for (size_t nl; (nl = chunk.find('\n', start)) != std::string_view::npos; start = nl + 1) {
+        line(chunk.substr(start, nl - start));
+    }
+    carry_.append(chunk.substr(start));
+}
+
+State OutlineImporter::finish() {
+    if (!carry_.empty()) {
+        line(carry_);
+        carry_.clear();
+    }
+    if (nodes_ == 0) return initial_state();
+    State s = builder_.finish();
+    s.focusedId = std::move(firstId_);
+    s.caret = 0;
+    return s;
+}
+
+State import_outline(std::string_view text, ImportOptions opts) {
+    OutlineImporter importer(opts);
+    importer.feed(text);
+    return importer.finish();
+}
+
+State import_outline_file(const std::string& path, ImportOptions opts) {
+    std::unique_ptr<std::FILE, int (*)(std::FILE*)> f(std::fopen(path.c_str(), "rb"), &std::fclose);
+    if (!f) throw ImportError("import: cannot open " + path);
+    OutlineImporter importer(opts);
+    std::unique_ptr<char[]> buf(new char[1 << 16]);
+    while (size_t n = std::fread(buf.get(), 1, 1 << 16, f.get())) importer.feed(std::string_view(buf.get(), n));
+    if (std::ferror(f.get())) throw ImportError("import: cannot read " + path);
+    return importer.finish();
+}
+
+} // namespace bullet
@@ -0,0 +1,77 @@
+#include "bullet_engine/instrument.hpp"
+#include "bullet_engine/types.hpp"
+#include <atomic>
+
+namespace bullet {
+
+static std::atomic<CommandObserver*> g_observer{ nullptr };
+
+CommandObserver* set_command_observer(CommandObserver* observer) {
+    return g_observer.exchange(observer, std::memory_order_acq_rel);
+}
+
+CommandObserver* command_observer() {
+    return g_observer.load(std::memory_order_acquire);
+}
+
+static size_t latency_bucket(uint64_t ns) {
+    size_t b = 0;
+    for (uint64_t us = ns / 1000; us > 0 && b + 1 < kLatencyBuckets; us >>= 1) ++b;
+    return b;
+}
+
+void CommandMetrics::on_command(const CommandSample& sample) {
+    const size_t t = static_cast<size_t>(sample.type);
+    if (t >= kCommandTypeCount) return;
+    const uint64_t ns = sample.cloneNs + sample.transformNs;
+    std::lock_guard<std::mutex> lock(mu_);
+    CommandStats& st = stats_[t];
+    ++st.count;
+    st.totalNs += ns;
+    if (ns > st.maxNs) st.maxNs = ns;
+    st.cloneNs += sample.cloneNs;
+    st.cloneBytes += sample.cloneBytes;
+    st.nodesTouched += sample.nodesTouched;
+    st.allocations += sample.allocations;
+    ++st.latency[latency_bucket(ns)];
+}
+
+CommandStats CommandMetrics::stats(CommandType type) const {
+    const size_t t = static_cast<size_t>(type);
+    std::lock_guard<std::mutex> lock(mu_);
+    return t < kCommandTypeCount ? stats_[t] : CommandStats{};
+}
+
+void CommandMetrics::reset() {
+    std::lock_guard<std::mutex> lock(mu_);
+    stats_ = {};
+}
+
+std::string CommandMetrics::to_json() const {
+    std::array<CommandStats, kCommandTypeCount> snap;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        snap = stats_;
+    }
+    std::string out = "{";
+    for (size_t t = 0; t < kCommandTypeCount; ++t) {
+        const CommandStats& st = snap[t];
+        if (st.count == 0) continue;
+        if (out.size() > 1) out += ',';
+        out += '"';
+        out += command_type_name(static_cast<CommandType>(t));
+        out += "\":{\"count\":" + std::to_string(st.count) + ",\"totalNs\":" + std::to_string(st.totalNs) +
+               ",\"maxNs\":" + std::to_string(st.maxNs) + ",\"cloneNs\":" + std::to_string(st.cloneNs) +
+               ",\"cloneBytes\":" + std::to_string(st.cloneBytes) + ",\"nodesTouched\":" + std::to_string(st.nodesTouched) +
+               ",\"allocations\":" + std::to_string(st.allocations) + ",\"latency\":[";
+        for (size_t b = 0; b < kLatencyBuckets; ++b) {
+            if (b) out += ',';
+            out += std::to_string(st.latency[b]);
+        }
+        out += "]}";
+    }
+    out += '}';
+    return out;
+}
+
+} // namespace bullet
@@ -0,0 +1,287 @@
+#include "bullet_engine/journal.hpp"
+#include "bullet_engine/snapshot.hpp"
+#include "file_util.hpp"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#define BULLET_HAVE_FSYNC 1
+#endif
+
+namespace bullet {
+
+namespace {
+
+constexpr char kMagic[8] = { 'B', 'L', 'T', 'J', 'R', 'N', 'L', '\0' };
+constexpr uint32_t kVersion = 1;
+constexpr size_t kHeaderSize = 24; // magic, version, reserved, snapshot hash
+constexpr size_t kFrameSize = 8;   // length, crc32
+
+uint32_t crc32(const char* data, size_t n) {
+    static const auto table = [] {
+        std::vector<uint32_t> t(256);
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    uint32_t c = 0xFFFFFFFFu;
+    for (size_t i = 0; i < n; ++i) c = table[(c ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+void put_u32(std::string& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) out.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+}
+
+void put_u64(std::string& out, uint64_t v) {
+    for (int i = 0; i < 8; ++i) out.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+}
+
+uint64_t get_le(const char* p, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; ++i) v |= static_cast<uint64_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+    return v;
+}
+
+void put_varint(std::string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+void put_string(std::string& out, const std::string& s) {
+    put_varint(out, s.size());
+    out += s;
+}
+
+// Bounds-checked reader over one record payload.
+struct Reader {
+    const char* p;
+    const char* end;
+
+    bool varint(uint64_t& v) {
+        v = 0;
+        for (int shift = 0; shift < 64 && p < end; shift += 7) {
+            unsigned char b = static_cast<unsigned char>(*p++);
+            v |= static_cast<uint64_t>(b & 0x7F) << shift;
+            if (!(b & 0x80)) return true;
+        }
+        return false;
+    }
+    bool string(std::string& s) {
+        uint64_t n;
+        if (!varint(n) || n > static_cast<uint64_t>(end - p)) return false;
+        s.assign(p, static_cast<size_t>(n));
+        p += n;
+        return true;
+    }
+};
+
+void encode_command(std::string& out, const Command& cmd) {
+    put_varint(out, static_cast<uint64_t>(cmd.type));
+    const int64_t caret = cmd.caret;
+    put_varint(out, (static_cast<uint64_t>(caret) << 1) ^ static_cast<uint64_t>(caret >> 63)); // zigzag
+    put_string(out, cmd.id);
+    out.push_back(cmd.scopeRootId ? 1 : 0);
+    if (cmd.scopeRootId) put_string(out, *cmd.scopeRootId);
+    put_string(out, cmd.text);
+    if (cmd.type == CommandType::DeleteText) put_varint(out, static_cast<uint32_t>(cmd.length));
+}
+
+bool decode_command(Reader& in, Command& cmd) {
+    uint64_t type, caret;
+    if (!in.varint(type) || type > static_cast<uint64_t>(CommandType::DeleteText)) return false;
+    if (!in.varint(caret)) return false;
+    cmd.type = static_cast<CommandType>(type);
+    cmd.caret = static_cast<int>(static_cast<int64_t>(caret >> 1) ^ -static_cast<int64_t>(caret & 1));
+    if (!in.string(cmd.id) || in.p == in.end) return false;
+    const char hasScope = *in.p++;
+    if (hasScope) {
+        std::string scope;
+        if (!in.string(scope)) return false;
+        cmd.scopeRootId = std::move(scope);
+    }
+    if (!in.string(cmd.text)) return false;
+    if (cmd.type != CommandType::DeleteText) return true;
+    uint64_t length;
+    if (!in.varint(length)) return false;
+    cmd.length = static_cast<int>(static_cast<uint32_t>(length));
+    return true;
+}
+
+std::string read_file(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) throw JournalError("journal: cannot read " + path);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+void sync_file(std::FILE* f) {
+    if (std::fflush(f) != 0) throw JournalError("journal: write failed");
+#ifdef BULLET_HAVE_FSYNC
+    if (::fsync(fileno(f)) != 0) throw JournalError("journal: fsync failed");
+#endif
+}
+
+// Journal errors keep their prefix for the shared file helper's failures.
+void replace_file(const std::string& path, const std::string& bytes) {
+    try {
+        file_detail::replace_file(path, bytes);
+    } catch (const std::runtime_error& e) {
+        throw JournalError(std::string("journal: ") + e.what());
+    }
+}
+
+} // namespace
+
+Journal::Journal(std::string basePath, JournalOptions opts) : base_(std::move(basePath)), opts_(opts) {}
+
+Journal::~Journal() {
+    try {
+        flush();
+    } catch (...) {
+    }
+    close_log();
+}
+
+void Journal::close_log() {
+    if (log_) std::fclose(log_);
+    log_ = nullptr;
+}
+
+void Journal::start_log(uint64_t snapshotHash) {
+    close_log();
+    std::string header(kMagic, sizeof(kMagic));
+    put_u32(header, kVersion);
+    put_u32(header, 0);
+    put_u64(header, snapshotHash);
+    replace_file(log_path(), header);
+    log_ = std::fopen(log_path().c_str(), "ab");
+    if (!log_) throw JournalError("journal: cannot open " + log_path());
+    logBytes_ = header.size();
+}
+
+State Journal::recover() {
+    close_log();
+    pending_.clear();
+    pendingCommits_ = 0;
+
+    State s;
+    uint64_t snapshotHash = 0;
+    if (std::filesystem::exists(snapshot_path())) {
+        std::string bytes = read_file(snapshot_path());
+        snapshotHash = file_detail::fnv1a(bytes);
+        s = SnapshotView::from_bytes(std::move(bytes)).materialize();
+    } else {
+        s = initial_state();
+    }
+
+    if (!std::filesystem::exists(log_path())) {
+        start_log(snapshotHash);
+        return s;
+    }
+    const std::string log = read_file(log_path());
+    // The log is only ever replaced whole (start_log), so a damaged header is
+    // not a crash artifact: refuse it rather than drop committed commands.
+    if (log.size() < kHeaderSize) throw JournalError("journal: truncated header in " + log_path());
+    if (std::memcmp(log.data(), kMagic, sizeof(kMagic)) != 0) throw JournalError("journal: bad magic in " + log_path());
+    const uint64_t version = get_le(log.data() + 8, 4);
+    if (version != kVersion) throw JournalError("journal: unsupported version " + std::to_string(version));
+    if (get_le(log.data() + 16, 8) != snapshotHash) {
+        // written against an older snapshot whose compaction finished: every
+        // command in it is already part of the snapshot
+        start_log(snapshotHash);
+        return s;
+    }
+    size_t good = kHeaderSize;
+    std::vector<Command> cmds;
+    while (log.size() - good >= kFrameSize) {
+        const uint64_t length = get_le(log.data() + good, 4);
+        const uint32_t crc = static_cast<uint32_t>(get_le(log.data() + good + 4, 4));
+        const char* payload = log.data() + good + kFrameSize;
+        if (length > log.size() - good - kFrameSize || crc32(payload, length) != crc) break;
+        Reader in{ payload, payload + length };
+        uint64_t count;
+        bool ok = in.varint(count) && count <= length;
+        cmds.clear();
+        for (uint64_t i = 0; ok && i < count; ++i) {
+            cmds.emplace_back();
+            ok = decode_command(in, cmds.back());
+        }
+        if (!ok || in.p != in.end) break;
+        for (const Command& cmd : cmds) apply_command_inplace(s, cmd);
+        good += kFrameSize + length;
+    }
+    if (good < log.size()) std::filesystem::resize_file(log_path(), good); // drop the torn tail
+    log_ = std::fopen(log_path().c_str(), "ab");
+    if (!log_) throw JournalError("journal: cannot open " + log_path());
+    logBytes_ = good;
+    return s;
+}
+
+ChangeSet Journal::apply(State& s, const Command& cmd) {
+    ChangeSet ch = apply_command_inplace(s, cmd);
+    if (!ch.empty()) commit({ &cmd }, s); // a no-op leaves nothing to replay
+    return ch;
+}
+
+ChangeSet Journal::apply_batch(State& s, const std::vector<Command>& cmds) {
+    ChangeSet ch = apply_commands_inplace(s, cmds);
+    std::vector<const Command*> ptrs;
+    ptrs.reserve(cmds.size());
+    for (const Command& cmd : cmds) ptrs.push_back(&cmd);
+    if (!ptrs.empty()) commit(ptrs, s);
+    return ch;
+}
+
+void Journal::commit(const std::vector<const Command*>& cmds, const State& s) {
+    if (!log_) throw JournalError("journal: recover() must be called before logging");
+    std::string payload;
+    put_varint(payload, cmds.size());
+    for (const Command* cmd : cmds) encode_command(payload, *cmd);
+    put_u32(pending_, static_cast<uint32_t>(payload.size()));
+    put_u32(pending_, crc32(payload.data(), payload.size()));
+    pending_ += payload;
+    ++pendingCommits_;
+    if (opts_.sync == SyncPolicy::Always) {
+        write_pending(true);
+    } else if (pendingCommits_ >= opts_.groupCommit) {
+        write_pending(opts_.sync == SyncPolicy::Batched);
+    }
+    if (log_bytes() > opts_.compactBytes) compact(s);
+}
+
+void Journal::write_pending(bool sync) {
+    if (!log_ || pending_.empty()) return;
+    if (std::fwrite(pending_.data(), 1, pending_.size(), log_) != pending_.size()) {
+        throw JournalError("journal: write failed");
+    }
+    if (sync) sync_file(log_);
+    else if (std::fflush(log_) != 0) throw JournalError("journal: write failed");
+    logBytes_ += pending_.size();
+    pending_.clear();
+    pendingCommits_ = 0;
+}
+
+void Journal::flush() {
+    write_pending(opts_.sync != SyncPolicy::Never);
+}
+
+// Order matters for crash safety: the new snapshot is in place before the
+// log is replaced, and the old log no longer matches the new snapshot's hash.
+void Journal::compact(const State& s) {
+    pending_.clear(); // everything buffered is already reflected in `s`
+    pendingCommits_ = 0;
+    const std::string bytes = encode_snapshot(s);
+    replace_file(snapshot_path(), bytes);
+    start_log(file_detail::fnv1a(bytes));
+}
+
+} // namespace bullet
@@ -0,0 +1,138 @@
+#include "bullet_engine/node_store.hpp"
+#include "bullet_engine/instrument.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <functional>
+
+namespace bullet {
+
+// Copy-on-write for type-erased trie children.
+template <class T>
+static T& own(std::shared_ptr<void>& p) {
+    if (!p) {
+        BULLET_COUNT_ALLOC();
+        p = std::make_shared<T>();
+    } else if (p.use_count() != 1) {
+        BULLET_COUNT_ALLOC();
+        BULLET_COUNT_COPY(sizeof(T));
+        p = std::make_shared<T>(*static_cast<const T*>(p.get()));
+    } else {
+        std::atomic_thread_fence(std::memory_order_acquire); // see make_unique_mut
+    }
+    return *static_cast<T*>(p.get());
+}
+
+uint32_t NodeStore::capacity() const {
+    uint64_t cap = kLeafSize;
+    for (unsigned h = 0; h < height_; ++h) cap <<= kInnerBits;
+    return cap > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(cap);
+}
+
+const NodeStore::Slot* NodeStore::find_slot(uint32_t index) const {
+    if (index == 0 || index >= next_) return nullptr;
+    const void* cur = root_.get();
+    for (unsigned h = height_; h > 0 && cur; --h) {
+        unsigned shift = kLeafBits + (h - 1) * kInnerBits;
+        cur = static_cast<const Inner*>(cur)->kids[(index >> shift) & (kInnerSize - 1)].get();
+    }
+    if (!cur) return nullptr;
+    return &static_cast<const Leaf*>(cur)->slots[index & (kLeafSize - 1)];
+}
+
+NodeStore::Slot& NodeStore::mut_slot(uint32_t index) {
+    while (index >= capacity()) {
+        // grow by one level; the old root becomes the first child
+        BULLET_COUNT_ALLOC();
+        auto grown = std::make_shared<Inner>();
+        grown->kids[0] = std::move(root_);
+        root_ = std::move(grown);
+        ++height_;
+    }
+    std::shared_ptr<void>* cur = &root_;
+    for (unsigned h = height_; h > 0; --h) {
+        unsigned shift = kLeafBits + (h - 1) * kInnerBits;
+        cur = &own<Inner>(*cur).kids[(index >> shift) & (kInnerSize - 1)];
+    }
+    return own<Leaf>(*cur).slots[index & (kLeafSize - 1)];
+}
+
+size_t NodeStore::bytes_for_writes(std::vector<uint32_t> indices) const {
+    std::sort(indices.begin(), indices.end());
+    size_t bytes = 0;
+    unsigned shift = kLeafBits;
+    for (unsigned level = 0; level <= height_; ++level, shift += kInnerBits) {
+        // distinct prefixes at this level are the distinct trie nodes copied
+        size_t nodes = 0;
+        for (size_t i = 0; i < indices.size(); ++i) {
+            if (i == 0 || (indices[i] >> shift) != (indices[i - 1] >> shift)) ++nodes;
+        }
+        bytes += nodes * (level == 0 ? sizeof(Leaf) : sizeof(Inner));
+    }
+    return bytes;
+}
+
+NodeHandle NodeStore::find(const std::string& id) const {
+    const NodeHandle* h = ids_.find(std::hash<std::string>{}(id), [&](NodeHandle c) { return id_of(c) == id; });
+    return h ? *h : NodeHandle{};
+}
+
+const std::string& NodeStore::id_of(NodeHandle h) const {
+    static const std::string none;
+    const Slot* slot = find_slot(h.index);
+    return (slot && slot->live() && slot->gen == h.gen) ? slot->id : none;
+}
+
+bool NodeStore::contains(NodeHandle h) const {
+    const Slot* slot = find_slot(h.index);
+    return slot && slot->live() && slot->gen == h.gen;
+}
+
+const Node& NodeStore::get(NodeHandle h) const {
+    const Slot* slot = find_slot(h.index);
+    assert(slot && slot->live() && slot->gen == h.gen);
+    return slot->node;
+}
+
+Node& NodeStore::mut(NodeHandle h) {
+    assert(contains(h));
+    return mut_slot(h.index).node;
+}
+
+NodeHandle NodeStore::handle_at(uint32_t index) const {
+    const Slot* slot = find_slot(index);
+    return (slot && slot->live()) ? NodeHandle{ index, slot->gen } : NodeHandle{};
+}
+
+NodeHandle NodeStore::insert(const std::string& id, Node node) {
+    assert(!find(id).valid());
+    uint32_t index;
+    if (freeHead_ != 0) {
+        index = freeHead_;
+        freeHead_ = find_slot(index)->nextFree;
+    } else {
+        index = next_++;
+    }
+    Slot& slot = mut_slot(index);
+    slot.nextFree = kLive;
+    slot.id = id;
+    slot.node = std::move(node);
+    NodeHandle h{ index, slot.gen };
+    ids_.insert(std::hash<std::string>{}(id), h);
+    ++size_;
+    return h;
+}
+
+void NodeStore::erase(NodeHandle h) {
+    assert(contains(h));
+    Slot& slot = mut_slot(h.index);
+    ids_.erase(std::hash<std::string>{}(slot.id), [&](NodeHandle c) { return c == h; });
+    ++slot.gen; // invalidates outstanding handles to this slot
+    slot.id.clear();
+    slot.node = Node{};
+    slot.nextFree = freeHead_;
+    freeHead_ = h.index;
+    --size_;
+}
+
+} // namespace bullet
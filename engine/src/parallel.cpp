@@ -0,0 +1,263 @@
+#include "bullet_engine/parallel.hpp"
+#include "bullet_engine/host.hpp"
+#include "bullet_engine/state_utils.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+namespace bullet {
+
+namespace {
+
+// `count` siblings of `list` from position `pos` (node `first`) on, all at
+// `depth`.
+struct Range {
+    const SiblingList* list;
+    NodeHandle parent;
+    NodeHandle first;
+    size_t pos;
+    size_t count;
+    size_t depth;
+};
+
+// Queue the children of `parent`: as one range on the walking task's own
+// stack, or as pool tasks when the list carries enough rows to be worth it.
+template <class Push, class Spawn>
+void split(const SiblingList& list, NodeHandle parent, size_t depth, bool parallel, Push&& push, Spawn&& spawn) {
+    const size_t n = list.size();
+    if (n == 0) return;
+    if (!parallel || list.index.weight() < kTaskRows) {
+        push(Range{ &list, parent, list.first, 0, n, depth });
+        return;
+    }
+    for (size_t i = 0; i < n; i += kTaskSiblings) {
+        spawn(Range{ &list, parent, list.index.at(i).node, i, std::min(kTaskSiblings, n - i), depth });
+    }
+}
+
+// Fork-join over ranges: walk(range, spawn) handles one range, passing large
+// child lists to spawn. Returns once every spawned range is done.
+template <class Walk>
+void fork_join(TaskPool* pool, const std::vector<Range>& seeds, Walk& walk) {
+    if (!pool) {
+        std::vector<Range> todo(seeds);
+        const auto spawn = [&todo](const Range& r) { todo.push_back(r); };
+        while (!todo.empty()) {
+            const Range r = todo.back();
+            todo.pop_back();
+            walk(r, spawn);
+        }
+        return;
+    }
+    std::mutex mu;
+    std::condition_variable done;
+    size_t outstanding = 0;
+    std::function<void(const Range&)> spawn = [&](const Range& r) {
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            ++outstanding;
+        }
+        pool->post([&, r] {
+            walk(r, spawn);
+            std::lock_guard<std::mutex> lock(mu);
+            if (--outstanding == 0) done.notify_all();
+        });
+    };
+    for (const Range& r : seeds) spawn(r);
+    std::unique_lock<std::mutex> lock(mu);
+    done.wait(lock, [&] { return outstanding == 0; });
+}
+
+// The root list in task-sized runs, or the single node `root`.
+std::vector<Range> seeds(const State& s, NodeHandle root, bool parallel) {
+    std::vector<Range> out;
+    if (root) {
+        const SiblingList& list = siblings_cref(s, root);
+        out.push_back(Range{ &list, s.nodes.get(root).parent, root, list.index.rank(s.nodes.get(root).order), 1, 0 });
+    } else {
+        const auto push = [&out](const Range& r) { out.push_back(r); };
+        split(s.rootOrder, NodeHandle{}, 0, parallel, push, push);
+    }
+    return out;
+}
+
+// Walk a range and every subtree below it that is not spawned, trusting the
+// links: visit(h, node, depth) per node.
+template <class Visit, class Spawn>
+void walk_trusted(const State& s, const Range& seed, bool parallel, Visit&& visit, Spawn&& spawn) {
+    std::vector<Range> stack{ seed };
+    const auto push = [&stack](const Range& r) { stack.push_back(r); };
+    while (!stack.empty()) {
+        const Range r = stack.back();
+        stack.pop_back();
+        NodeHandle h = r.first;
+        for (size_t i = 0; i < r.count && h; ++i) {
+            const Node& n = s.nodes.get(h);
+            visit(h, n, r.depth);
+            split(n.children, h, r.depth + 1, parallel, push, spawn);
+            h = n.next;
+        }
+    }
+}
+
+const char* const kNoRoots = "no roots";
+const char* const kShortList = "sibling list shorter than its index";
+const char* const kLongList = "sibling list longer than its index";
+const char* const kDangling = "sibling list links a dead handle";
+const char* const kReachedTwice = "node reached more than once";
+const char* const kUnreachable = "node unreachable from the roots";
+const char* const kParentLink = "parent link does not name its container";
+const char* const kPrevLink = "prev or first link does not match the sibling order";
+const char* const kLastLink = "container's last link is not its last sibling";
+const char* const kEmptyLinks = "empty container has first or last links";
+const char* const kOrder = "order labels do not increase along the siblings";
+const char* const kIndexPosition = "sibling index disagrees with the sibling order";
+const char* const kIndexWeight = "sibling index weight differs from visibleSize";
+const char* const kIndexHeight = "sibling index height differs from the node's height";
+const char* const kVisibleSize = "visibleSize does not match the children";
+const char* const kSubtreeSize = "subtreeSize does not match the children";
+const char* const kSubtreeBytes = "subtreeBytes does not match the texts";
+const char* const kHeight = "height does not match the children";
+const char* const kIdTable = "id does not resolve to its node";
+const char* const kFocus = "focusedId does not exist";
+const char* const kCaret = "caret outside the focused text";
+const char* const kScope = "scopeRootId does not exist";
+
+} // namespace
+
+void parallel_for_each_node(const State& s, TaskPool* pool,
+                            const std::function<void(NodeHandle, const Node&, size_t)>& visit) {
+    const bool parallel = pool != nullptr;
+    auto walk = [&](const Range& r, const auto& spawn) { walk_trusted(s, r, parallel, visit, spawn); };
+    fork_join(pool, seeds(s, NodeHandle{}, parallel), walk);
+}
+
+SubtreeStats subtree_stats(const State& s, NodeHandle root, TaskPool* pool) {
+    const bool parallel = pool != nullptr;
+    std::mutex mu;
+    SubtreeStats total;
+    auto walk = [&](const Range& r, const auto& spawn) {
+        SubtreeStats part;
+        walk_trusted(s, r, parallel, [&part](NodeHandle, const Node& n, size_t depth) {
+            ++part.nodes;
+            part.textBytes += n.text.size();
+            part.depth = std::max(part.depth, depth + 1);
+        }, spawn);
+        std::lock_guard<std::mutex> lock(mu);
+        total.nodes += part.nodes;
+        total.textBytes += part.textBytes;
+        total.depth = std::max(total.depth, part.depth);
+    };
+    fork_join(pool, seeds(s, root, parallel), walk);
+    return total;
+}
+
+std::vector<Violation> validate(const State& s, TaskPool* pool) {
+    const bool parallel = pool != nullptr;
+    const NodeStore& nodes = s.nodes;
+    std::vector<Violation> out;
+    std::mutex mu;
+    std::vector<std::atomic<uint8_t>> seen(nodes.slot_limit());
+    std::atomic<size_t> reached{ 0 };
+
+    // Like walk_trusted, but every link is checked before it is followed and
+    // a node is entered only once, so corrupted links cannot loop.
+    auto walk = [&](const Range& seed, const auto& spawn) {
+        std::vector<Violation> local;
+        size_t count = 0;
+        const auto report = [&](NodeHandle h, const char* what) {
+            local.push_back(Violation{ h && nodes.contains(h) ? nodes.id_of(h) : std::string(), what });
+        };
+        std::vector<Range> stack{ seed };
+        const auto push = [&stack](const Range& r) { stack.push_back(r); };
+        while (!stack.empty()) {
+            const Range r = stack.back();
+            stack.pop_back();
+            const SiblingList& list = *r.list;
+            NodeHandle prev = r.pos == 0 ? NodeHandle{} : list.index.at(r.pos - 1).node;
+            NodeHandle h = r.first;
+            for (size_t i = 0; i < r.count; ++i) {
+                const size_t pos = r.pos + i;
+                if (!h) {
+                    report(r.parent, kShortList);
+                    break;
+                }
+                if (!nodes.contains(h) || h.index >= seen.size()) {
+                    report(r.parent, kDangling);
+                    break;
+                }
+                if (seen[h.index].exchange(1, std::memory_order_relaxed)) {
+                    report(h, kReachedTwice);
+                    break;
+                }
+                ++count;
+                const Node& n = nodes.get(h);
+                if (n.parent != r.parent) report(h, kParentLink);
+                if (pos == 0 ? (n.prev || list.first != h) : n.prev != prev) report(h, kPrevLink);
+                if (pos > 0 && nodes.contains(prev) && !(nodes.get(prev).order < n.order)) report(h, kOrder);
+                const ChildIndex::Entry e = list.index.at(pos);
+                if (e.node != h || list.index.rank(n.order) != pos) {
+                    report(h, kIndexPosition);
+                } else {
+                    if (e.weight != n.visibleSize) report(h, kIndexWeight);
+                    if (e.height != n.height) report(h, kIndexHeight);
+                }
+                if (n.visibleSize != (n.collapsed ? 1 : 1 + n.children.index.weight())) report(h, kVisibleSize);
+                size_t below = 0, bytes = n.text.size();
+                uint32_t height = 0;
+                NodeHandle c = n.children.first;
+                for (size_t k = 0; k < n.children.size() && c && nodes.contains(c); ++k) {
+                    const Node& child = nodes.get(c);
+                    below += child.subtreeSize;
+                    bytes += child.subtreeBytes;
+                    height = std::max(height, child.height);
+                    c = child.next;
+                }
+                if (n.subtreeSize != 1 + below) report(h, kSubtreeSize);
+                if (n.subtreeBytes != bytes) report(h, kSubtreeBytes);
+                if (n.height != 1 + height) report(h, kHeight);
+                if (nodes.find(nodes.id_of(h)) != h) report(h, kIdTable);
+                if (n.children.size() == 0 && (n.children.first || n.children.last)) report(h, kEmptyLinks);
+                if (pos + 1 == list.size()) {
+                    if (list.last != h) report(h, kLastLink);
+                    if (n.next) report(h, kLongList);
+                }
+                split(n.children, h, r.depth + 1, parallel, push, spawn);
+                prev = h;
+                h = n.next;
+            }
+        }
+        reached.fetch_add(count, std::memory_order_relaxed);
+        if (local.empty()) return;
+        std::lock_guard<std::mutex> lock(mu);
+        out.insert(out.end(), local.begin(), local.end());
+    };
+
+    if (s.rootOrder.size() == 0) {
+        out.push_back(Violation{ "", kNoRoots });
+        if (s.rootOrder.first || s.rootOrder.last) out.push_back(Violation{ "", kEmptyLinks });
+    }
+    fork_join(pool, seeds(s, NodeHandle{}, parallel), walk);
+
+    if (reached.load() != nodes.size()) {
+        nodes.for_each([&](NodeHandle h, const Node&) {
+            if (!seen[h.index].load(std::memory_order_relaxed)) out.push_back(Violation{ nodes.id_of(h), kUnreachable });
+        });
+    }
+    const NodeHandle focus = nodes.find(s.focusedId);
+    if (!focus) {
+        out.push_back(Violation{ s.focusedId, kFocus });
+    } else if (s.caret < 0 || static_cast<size_t>(s.caret) > nodes.get(focus).text.size()) {
+        out.push_back(Violation{ s.focusedId, kCaret });
+    }
+    if (s.scopeRootId && !s.scopeRootId->empty() && !nodes.find(*s.scopeRootId)) {
+        out.push_back(Violation{ *s.scopeRootId, kScope });
+    }
+    std::sort(out.begin(), out.end(), [](const Violation& a, const Violation& b) {
+        return a.id != b.id ? a.id < b.id : a.message < b.message;
+    });
+    return out;
+}
+
+} // namespace bullet
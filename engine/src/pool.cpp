@@ -0,0 +1,262 @@
+#include "bullet_engine/pool.hpp"
+#include "backoff.hpp"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+namespace bullet {
+
+namespace {
+
+#ifndef BULLET_ENGINE_NO_POOL
+constexpr size_t kGrain = 16;
+constexpr size_t kClasses = kPoolMaxBlock / kGrain;
+constexpr size_t kSlabBytes = size_t(64) << 10;
+constexpr size_t kSlabHeader = 64;
+constexpr uint32_t kBatch = 16; // blocks a thread cache takes or hands back at a time
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+// Slabs are aligned to their size, so a block finds its slab by masking its
+// address. A slab serves one size class and keeps its own free list and
+// count of blocks out, which tells when the whole slab can go back.
+struct Slab {
+    Slab* prev = nullptr; // neighbours in the class's list of slabs with room
+    Slab* next = nullptr;
+    FreeBlock* free = nullptr;
+    char* bump = nullptr; // start of the never-used tail
+    uint32_t live = 0;    // blocks out of this slab, in use or in a thread cache
+    bool open = false;    // on the class's list
+};
+static_assert(sizeof(Slab) <= kSlabHeader, "slab header fits its reserved block");
+
+// The slabs of one size class that still have room. The lock is a spin flag:
+// it is taken once per batch for a few pointer moves per block, so a waiter
+// spins briefly with a CPU pause and then yields its thread (the holder may
+// have been preempted, e.g. with more host workers than cores).
+struct SizeClass {
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+    Slab* open = nullptr;
+    size_t live = 0; // blocks out of this class's slabs
+};
+
+class Guard {
+public:
+    explicit Guard(std::atomic_flag& f) : f_(f) {
+        for (int spins = 0; f_.test_and_set(std::memory_order_acquire);) backoff_detail::pause(spins);
+    }
+    ~Guard() { f_.clear(std::memory_order_release); }
+
+private:
+    std::atomic_flag& f_;
+};
+
+SizeClass g_classes[kClasses];
+std::atomic<size_t> g_slabCount{ 0 };
+
+size_t class_of(size_t bytes) { return (bytes + kGrain - 1) / kGrain - 1; }
+
+Slab* slab_of(void* p) {
+    return reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(p) & ~(uintptr_t(kSlabBytes) - 1));
+}
+
+void link(SizeClass& c, Slab* s) {
+    s->prev = nullptr;
+    s->next = c.open;
+    if (c.open) c.open->prev = s;
+    c.open = s;
+    s->open = true;
+}
+
+void unlink(SizeClass& c, Slab* s) {
+    if (s->prev) s->prev->next = s->next;
+    else c.open = s->next;
+    if (s->next) s->next->prev = s->prev;
+    s->prev = s->next = nullptr;
+    s->open = false;
+}
+
+void reset(Slab* s) {
+    s->free = nullptr;
+    s->bump = reinterpret_cast<char*>(s) + kSlabHeader;
+}
+
+// Take `n` blocks of class `cls` from its slabs, chained through FreeBlock.
+FreeBlock* take(size_t cls, uint32_t n) {
+    const size_t size = (cls + 1) * kGrain;
+    SizeClass& c = g_classes[cls];
+    Guard g(c.lock);
+    FreeBlock* chain = nullptr;
+    for (uint32_t i = 0; i < n; ++i) {
+        Slab* s = c.open;
+        if (!s) {
+            s = new (::operator new(kSlabBytes, std::align_val_t(kSlabBytes))) Slab;
+            reset(s);
+            g_slabCount.fetch_add(1, std::memory_order_relaxed);
+            link(c, s);
+        }
+        FreeBlock* b = s->free;
+        if (b) {
+            s->free = b->next;
+        } else {
+            b = reinterpret_cast<FreeBlock*>(s->bump);
+            s->bump += size;
+        }
+        ++s->live;
+        const char* end = reinterpret_cast<const char*>(s) + kSlabBytes;
+        if (!s->free && static_cast<size_t>(end - s->bump) < size) unlink(c, s);
+        b->next = chain;
+        chain = b;
+    }
+    c.live += n;
+    return chain;
+}
+
+// Return a chain of `n` blocks of class `cls` to their slabs. A slab that
+// empties goes back to the system unless it is the class's only one with
+// room, which is kept (reset) so a class that drains and refills does not
+// allocate a slab each time.
+void give(size_t cls, FreeBlock* chain, uint32_t n) {
+    SizeClass& c = g_classes[cls];
+    Guard g(c.lock);
+    while (chain) {
+        FreeBlock* b = chain;
+        chain = chain->next;
+        Slab* s = slab_of(b);
+        b->next = s->free;
+        s->free = b;
+        if (!s->open) link(c, s);
+        if (--s->live != 0) continue;
+        if (c.open == s && !s->next) {
+            reset(s);
+            continue;
+        }
+        unlink(c, s);
+        s->~Slab();
+        ::operator delete(s, std::align_val_t(kSlabBytes));
+        g_slabCount.fetch_sub(1, std::memory_order_relaxed);
+    }
+    c.live -= n;
+}
+
+// Per-thread free lists in front of the size classes. Allocation and release
+// touch only the calling thread's lists and take a class lock once per
+// kBatch blocks, to refill an empty list or hand back a surplus; a thread
+// hands back everything it holds when it exits.
+struct ThreadCache {
+    FreeBlock* head[kClasses] = {};
+    std::atomic<uint32_t> count[kClasses] = {}; // written by the owner, summed by pool_stats()
+    ThreadCache* next = nullptr;                // in the registry
+
+    ThreadCache();
+    ~ThreadCache();
+};
+
+std::mutex g_cachesMu;
+ThreadCache* g_caches = nullptr;
+thread_local bool t_cacheGone = false; // releases during thread teardown bypass the cache
+thread_local ThreadCache t_cache;
+
+ThreadCache::ThreadCache() {
+    std::lock_guard<std::mutex> lock(g_cachesMu);
+    next = g_caches;
+    g_caches = this;
+}
+
+ThreadCache::~ThreadCache() {
+    {
+        std::lock_guard<std::mutex> lock(g_cachesMu);
+        ThreadCache** p = &g_caches;
+        while (*p != this) p = &(*p)->next;
+        *p = next;
+    }
+    for (size_t cls = 0; cls < kClasses; ++cls) {
+        if (head[cls]) give(cls, head[cls], count[cls].load(std::memory_order_relaxed));
+    }
+    t_cacheGone = true;
+}
+#endif
+
+} // namespace
+
+PoolStats pool_stats() {
+    PoolStats st;
+#ifndef BULLET_ENGINE_NO_POOL
+    st.slabs = g_slabCount.load(std::memory_order_relaxed);
+    st.slabBytes = st.slabs * kSlabBytes;
+    size_t cached = 0;
+    for (size_t cls = 0; cls < kClasses; ++cls) {
+        Guard g(g_classes[cls].lock);
+        st.usedBytes += g_classes[cls].live * (cls + 1) * kGrain;
+    }
+    {
+        std::lock_guard<std::mutex> lock(g_cachesMu);
+        for (const ThreadCache* tc = g_caches; tc; tc = tc->next) {
+            for (size_t cls = 0; cls < kClasses; ++cls) cached += tc->count[cls].load(std::memory_order_relaxed) * (cls + 1) * kGrain;
+        }
+    }
+    st.usedBytes = st.usedBytes > cached ? st.usedBytes - cached : 0; // threads may move blocks meanwhile
+#endif
+    return st;
+}
+
+namespace pool_detail {
+
+void* allocate(size_t bytes) {
+#ifndef BULLET_ENGINE_NO_POOL
+    if (bytes != 0 && bytes <= kPoolMaxBlock) {
+        const size_t cls = class_of(bytes);
+        if (t_cacheGone) return take(cls, 1);
+        ThreadCache& tc = t_cache;
+        uint32_t n = tc.count[cls].load(std::memory_order_relaxed);
+        if (n == 0) {
+            tc.head[cls] = take(cls, kBatch);
+            n = kBatch;
+        }
+        FreeBlock* b = tc.head[cls];
+        tc.head[cls] = b->next;
+        tc.count[cls].store(n - 1, std::memory_order_relaxed);
+        return b;
+    }
+#endif
+    return ::operator new(bytes);
+}
+
+void deallocate(void* p, size_t bytes) noexcept {
+#ifndef BULLET_ENGINE_NO_POOL
+    if (bytes != 0 && bytes <= kPoolMaxBlock) {
+        const size_t cls = class_of(bytes);
+        FreeBlock* b = static_cast<FreeBlock*>(p);
+        if (t_cacheGone) {
+            b->next = nullptr;
+            give(cls, b, 1);
+            return;
+        }
+        ThreadCache& tc = t_cache;
+        b->next = tc.head[cls];
+        tc.head[cls] = b;
+        uint32_t n = tc.count[cls].load(std::memory_order_relaxed) + 1;
+        if (n == 2 * kBatch) {
+            // hand the older half back: cut the list after the newest kBatch blocks
+            FreeBlock* keep = b;
+            for (uint32_t i = 1; i < kBatch; ++i) keep = keep->next;
+            FreeBlock* surplus = keep->next;
+            keep->next = nullptr;
+            n = kBatch;
+            give(cls, surplus, kBatch);
+        }
+        tc.count[cls].store(n, std::memory_order_relaxed);
+        return;
+    }
+#else
+    (void)bytes;
+#endif
+    ::operator delete(p);
+}
+
+} // namespace pool_detail
+
+} // namespace bullet
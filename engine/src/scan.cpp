@@ -0,0 +1,250 @@
+#include "bullet_engine/scan.hpp"
+#include "bullet_engine/snapshot.hpp"
+#include "bullet_engine/state_utils.hpp"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BULLET_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+namespace bullet {
+
+PackedTexts PackedTexts::from_state(const State& s) {
+    PackedTexts out;
+    const size_t n = bullet::node_count(s);
+    out.ids_.reserve(n);
+    out.depths_.reserve(n);
+    out.starts_.reserve(n + 1);
+    uint32_t depth = 0;
+    for (NodeHandle h = s.rootOrder.first; h;) {
+        const Node& node = s.nodes.get(h);
+        out.add(s.nodes.id_of(h), depth, [&node](std::string& bytes) {
+            node.text.for_each_chunk([&bytes](std::string_view chunk) { bytes.append(chunk); });
+        });
+        if (node.children.first) {
+            h = node.children.first;
+            ++depth;
+            continue;
+        }
+        NodeHandle x = h;
+        h = NodeHandle{};
+        while (x) {
+            const Node& cur = s.nodes.get(x);
+            if (cur.next) {
+                h = cur.next;
+                break;
+            }
+            x = cur.parent;
+            if (x) --depth;
+        }
+    }
+    return out;
+}
+
+PackedTexts PackedTexts::from_snapshot(const SnapshotView& v) {
+    PackedTexts out;
+    const size_t n = v.node_count();
+    out.ids_.reserve(n);
+    out.depths_.reserve(n);
+    out.starts_.reserve(n + 1);
+    for (uint32_t i = 0; i < n; ++i) {
+        const uint32_t parent = v.parent(i); // < i, or SnapshotError: its depth is known
+        const uint32_t depth = parent == SnapshotView::kNone ? 0 : out.depths_[parent] + 1;
+        out.add(std::string(v.id(i)), depth, [&](std::string& bytes) { bytes.append(v.text(i)); });
+    }
+    return out;
+}
+
+std::optional<std::pair<size_t, size_t>> PackedTexts::subtree(std::string_view id) const {
+    const auto it = std::find(ids_.begin(), ids_.end(), id);
+    if (it == ids_.end()) return std::nullopt;
+    const size_t first = static_cast<size_t>(it - ids_.begin());
+    size_t last = first + 1;
+    while (last < ids_.size() && depths_[last] > depths_[first]) ++last;
+    return std::make_pair(first, last);
+}
+
+namespace {
+
+char fold(char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+char upper(char c) {
+    return (c >= 'a' && c <= 'z') ? static_cast<char>(c - 'a' + 'A') : c;
+}
+
+// The pattern, folded when the scan ignores case, and the two spellings of
+// its first and last byte that the kernels filter on.
+struct Needle {
+    std::string pat;
+    bool fold;
+    char first[2];
+    char last[2];
+
+    Needle(std::string_view p, bool ci) : pat(p), fold(ci) {
+        if (fold) std::transform(pat.begin(), pat.end(), pat.begin(), bullet::fold);
+        first[0] = first[1] = pat.front();
+        last[0] = last[1] = pat.back();
+        if (fold) {
+            first[1] = upper(first[0]);
+            last[1] = upper(last[0]);
+        }
+    }
+
+    // Bytes between the first and last, which the filter already matched.
+    bool inner_matches(const char* at) const {
+        const size_t m = pat.size();
+        if (m <= 2) return true;
+        if (!fold) return std::memcmp(at + 1, pat.data() + 1, m - 2) == 0;
+        for (size_t k = 1; k + 1 < m; ++k) {
+            if (bullet::fold(at[k]) != pat[k]) return false;
+        }
+        return true;
+    }
+};
+
+// A kernel appends every p in [0, count) where the pattern occurs at
+// data + p; data must be readable for count + size - 1 bytes.
+using Kernel = void (*)(const char* data, size_t count, const Needle& nd, std::vector<size_t>& hits);
+
+void scan_scalar(const char* data, size_t count, const Needle& nd, std::vector<size_t>& hits) {
+    const size_t tail = nd.pat.size() - 1;
+    if (!nd.fold) {
+        for (size_t p = 0; p < count;) {
+            const void* hit = std::memchr(data + p, nd.first[0], count - p);
+            if (!hit) return;
+            p = static_cast<size_t>(static_cast<const char*>(hit) - data);
+            if (data[p + tail] == nd.last[0] && nd.inner_matches(data + p)) hits.push_back(p);
+            ++p;
+        }
+        return;
+    }
+    for (size_t p = 0; p < count; ++p) {
+        if (fold(data[p]) == nd.first[0] && fold(data[p + tail]) == nd.last[0] && nd.inner_matches(data + p)) {
+            hits.push_back(p);
+        }
+    }
+}
+
+#if BULLET_SCAN_X86
+
+inline void verify_mask(const char* data, size_t p, unsigned mask, const Needle& nd, std::vector<size_t>& hits) {
+    while (mask) {
+        const unsigned bit = static_cast<unsigned>(__builtin_ctz(mask));
+        if (nd.inner_matches(data + p + bit)) hits.push_back(p + bit);
+        mask &= mask - 1;
+    }
+}
+
+// SSE2 is part of x86-64, so this kernel needs no run-time check.
+void scan_sse2(const char* data, size_t count, const Needle& nd, std::vector<size_t>& hits) {
+    const size_t tail = nd.pat.size() - 1;
+    const __m128i f0 = _mm_set1_epi8(nd.first[0]), f1 = _mm_set1_epi8(nd.first[1]);
+    const __m128i l0 = _mm_set1_epi8(nd.last[0]), l1 = _mm_set1_epi8(nd.last[1]);
+    size_t p = 0;
+    for (; p + 16 <= count; p += 16) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + p));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + p + tail));
+        const __m128i ea = _mm_or_si128(_mm_cmpeq_epi8(a, f0), _mm_cmpeq_epi8(a, f1));
+        const __m128i eb = _mm_or_si128(_mm_cmpeq_epi8(b, l0), _mm_cmpeq_epi8(b, l1));
+        verify_mask(data, p, static_cast<unsigned>(_mm_movemask_epi8(_mm_and_si128(ea, eb))), nd, hits);
+    }
+    const size_t before = hits.size();
+    scan_scalar(data + p, count - p, nd, hits);
+    for (size_t i = before; i < hits.size(); ++i) hits[i] += p;
+}
+
+__attribute__((target("avx2")))
+void scan_avx2(const char* data, size_t count, const Needle& nd, std::vector<size_t>& hits) {
+    const size_t tail = nd.pat.size() - 1;
+    const __m256i f0 = _mm256_set1_epi8(nd.first[0]), f1 = _mm256_set1_epi8(nd.first[1]);
+    const __m256i l0 = _mm256_set1_epi8(nd.last[0]), l1 = _mm256_set1_epi8(nd.last[1]);
+    size_t p = 0;
+    for (; p + 32 <= count; p += 32) {
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + p));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + p + tail));
+        const __m256i ea = _mm256_or_si256(_mm256_cmpeq_epi8(a, f0), _mm256_cmpeq_epi8(a, f1));
+        const __m256i eb = _mm256_or_si256(_mm256_cmpeq_epi8(b, l0), _mm256_cmpeq_epi8(b, l1));
+        verify_mask(data, p, static_cast<unsigned>(_mm256_movemask_epi8(_mm256_and_si256(ea, eb))), nd, hits);
+    }
+    const size_t before = hits.size();
+    scan_sse2(data + p, count - p, nd, hits);
+    for (size_t i = before; i < hits.size(); ++i) hits[i] += p;
+}
+
+bool has_avx2() {
+    static const bool yes = __builtin_cpu_supports("avx2");
+    return yes;
+}
+
+#endif
+
+ScanKernel resolve(ScanKernel k) {
+#if BULLET_SCAN_X86
+    if (k == ScanKernel::Auto || k == ScanKernel::Avx2) return has_avx2() ? ScanKernel::Avx2 : ScanKernel::Sse2;
+    return k;
+#else
+    (void)k;
+    return ScanKernel::Scalar;
+#endif
+}
+
+Kernel kernel_for(ScanKernel k) {
+    switch (resolve(k)) {
+#if BULLET_SCAN_X86
+    case ScanKernel::Avx2: return scan_avx2;
+    case ScanKernel::Sse2: return scan_sse2;
+#endif
+    default: return scan_scalar;
+    }
+}
+
+// Bytes handed to the kernel per call, so a limited scan stops early.
+constexpr size_t kBlock = size_t(1) << 16;
+
+} // namespace
+
+const char* scan_kernel_name(ScanKernel kernel) {
+    switch (resolve(kernel)) {
+    case ScanKernel::Avx2: return "avx2";
+    case ScanKernel::Sse2: return "sse2";
+    default: return "scalar";
+    }
+}
+
+std::vector<ScanMatch> scan(const PackedTexts& packed, std::string_view pattern, const ScanOptions& opts) {
+    std::vector<ScanMatch> out;
+    if (pattern.empty() || opts.limit == 0) return out;
+    size_t node = 0, last = packed.node_count();
+    if (opts.scopeId) {
+        const auto range = packed.subtree(*opts.scopeId);
+        if (!range) return out;
+        node = range->first;
+        last = range->second;
+    }
+    const Needle nd(pattern, opts.caseInsensitive);
+    const Kernel kernel = kernel_for(opts.kernel);
+    const char* base = packed.bytes().data();
+    const size_t m = pattern.size();
+    const size_t end = packed.start(last);
+    std::vector<size_t> hits;
+    for (size_t at = packed.start(node); at + m <= end;) {
+        const size_t count = std::min(kBlock, end - m + 1 - at);
+        hits.clear();
+        kernel(base + at, count, nd, hits);
+        for (size_t hit : hits) {
+            const size_t pos = at + hit;
+            while (packed.start(node + 1) <= pos) ++node;
+            if (pos + m > packed.start(node + 1)) continue; // runs into the next node
+            out.push_back(ScanMatch{ packed.id(node), pos - packed.start(node) });
+            if (out.size() >= opts.limit) return out;
+        }
+        at += count;
+    }
+    return out;
+}
+
+} // namespace bullet
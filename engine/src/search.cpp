@@ -0,0 +1,281 @@
+#include "bullet_engine/search.hpp"
+#include "bullet_engine/state_utils.hpp"
+#include <algorithm>
+
+namespace bullet {
+
+static char fold(char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+static uint32_t gram(char a, char b, char c) {
+    return (static_cast<uint32_t>(static_cast<unsigned char>(a)) << 16) |
+           (static_cast<uint32_t>(static_cast<unsigned char>(b)) << 8) | static_cast<unsigned char>(c);
+}
+
+// Distinct trigrams of the folded text, sorted. Windows span rope chunks.
+static std::vector<uint32_t> grams_of(const Text& text) {
+    std::vector<uint32_t> out;
+    if (text.size() < 3) return out;
+    out.reserve(text.size() - 2);
+    char a = 0, b = 0;
+    size_t seen = 0;
+    text.for_each_chunk([&](std::string_view chunk) {
+        for (char c : chunk) {
+            c = fold(c);
+            if (++seen >= 3) out.push_back(gram(a, b, c));
+            a = b;
+            b = c;
+        }
+    });
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    return out;
+}
+
+static std::string folded(const Text& text) {
+    std::string out;
+    out.reserve(text.size());
+    text.for_each_chunk([&out](std::string_view chunk) {
+        for (char c : chunk) out.push_back(fold(c));
+    });
+    return out;
+}
+
+static void posting_insert(std::vector<uint32_t>& list, uint32_t index) {
+    if (list.empty() || list.back() < index) {
+        list.push_back(index);
+        return;
+    }
+    auto it = std::lower_bound(list.begin(), list.end(), index);
+    if (it == list.end() || *it != index) list.insert(it, index);
+}
+
+static void posting_erase(std::vector<uint32_t>& list, uint32_t index) {
+    auto it = std::lower_bound(list.begin(), list.end(), index);
+    if (it != list.end() && *it == index) list.erase(it);
+}
+
+void SearchIndex::rebuild(const State& s) {
+    postings_.clear();
+    docs_.assign(s.nodes.slot_limit(), Doc{});
+    live_ = 0;
+    // slot order keeps every posting list sorted as it is appended to
+    s.nodes.for_each([&](NodeHandle h, const Node& node) {
+        Doc& doc = docs_[h.index];
+        doc.gen = h.gen;
+        doc.live = true;
+        doc.grams = grams_of(node.text);
+        for (uint32_t g : doc.grams) postings_[g].push_back(h.index);
+        ++live_;
+    });
+}
+
+void SearchIndex::drop(uint32_t index) {
+    if (index >= docs_.size() || !docs_[index].live) return;
+    Doc& doc = docs_[index];
+    for (uint32_t g : doc.grams) {
+        auto it = postings_.find(g);
+        if (it == postings_.end()) continue;
+        posting_erase(it->second, index);
+        if (it->second.empty()) postings_.erase(it);
+    }
+    doc = Doc{};
+    --live_;
+}
+
+void SearchIndex::index_node(const State& s, NodeHandle h) {
+    if (h.index >= docs_.size()) docs_.resize(s.nodes.slot_limit());
+    Doc& doc = docs_[h.index];
+    if (doc.live && doc.gen != h.gen) drop(h.index); // the slot held a removed node
+    std::vector<uint32_t> grams = grams_of(s.nodes.get(h).text);
+    if (!doc.live) {
+        doc.gen = h.gen;
+        doc.live = true;
+        ++live_;
+    }
+    // apply only the difference between the old and new trigram sets
+    auto oldIt = doc.grams.begin();
+    auto newIt = grams.begin();
+    while (oldIt != doc.grams.end() || newIt != grams.end()) {
+        if (newIt == grams.end() || (oldIt != doc.grams.end() && *oldIt < *newIt)) {
+            auto it = postings_.find(*oldIt++);
+            if (it == postings_.end()) continue;
+            posting_erase(it->second, h.index);
+            if (it->second.empty()) postings_.erase(it);
+        } else if (oldIt == doc.grams.end() || *newIt < *oldIt) {
+            posting_insert(postings_[*newIt++], h.index);
+        } else {
+            ++oldIt;
+            ++newIt;
+        }
+    }
+    doc.grams = std::move(grams);
+}
+
+void SearchIndex::update(const State& s, const ChangeSet& ch) {
+    for (const auto* ids : { &ch.created, &ch.touched }) {
+        for (const auto& id : *ids) {
+            if (NodeHandle h = s.nodes.find(id)) index_node(s, h);
+        }
+    }
+}
+
+// Dense candidate sets (above kWalkThreshold and 1/kWalkDensity of the nodes)
+// are ordered by walking the document, which stops once `limit` matches are
+// found; sparser ones sort their ancestor paths instead.
+// When even the rarest trigram is in more than kProbeMin nodes, intersecting
+// is expensive, so a limited query first checks up to kProbeNodes nodes
+// directly: broad queries finish there without touching the postings.
+static constexpr size_t kWalkThreshold = 1024;
+static constexpr size_t kWalkDensity = 32;
+static constexpr size_t kProbeMin = 32768;
+static constexpr size_t kProbeNodes = 4096;
+
+// Whether `text` contains the folded query, comparing in place for inline texts.
+static bool contains(const Text& text, const std::string& q) {
+    if (text.size() < q.size()) return false;
+    if (text.is_rope()) return folded(text).find(q) != std::string::npos;
+    bool found = false;
+    text.for_each_chunk([&](std::string_view t) {
+        for (size_t i = 0; !found && i + q.size() <= t.size(); ++i) {
+            size_t k = 0;
+            while (k < q.size() && fold(t[i + k]) == q[k]) ++k;
+            found = k == q.size();
+        }
+    });
+    return found;
+}
+
+// Intersect sorted posting lists (smallest first), galloping through the
+// larger ones: near-linear for similar sizes, logarithmic for skewed ones.
+static std::vector<uint32_t> intersect(const std::vector<const std::vector<uint32_t>*>& lists) {
+    std::vector<uint32_t> out = *lists[0];
+    for (size_t l = 1; l < lists.size() && !out.empty(); ++l) {
+        const std::vector<uint32_t>& other = *lists[l];
+        auto from = other.begin();
+        size_t kept = 0;
+        for (uint32_t c : out) {
+            size_t step = 1;
+            auto hi = from;
+            while (hi != other.end() && *hi < c) {
+                from = hi;
+                hi = static_cast<size_t>(other.end() - hi) > step ? hi + static_cast<std::ptrdiff_t>(step) : other.end();
+                step <<= 1;
+            }
+            from = std::lower_bound(from, hi, c);
+            if (from == other.end()) break;
+            if (*from == c) out[kept++] = c;
+        }
+        out.resize(kept);
+    }
+    return out;
+}
+
+std::vector<std::string> SearchIndex::search(const State& s, std::string_view query, const SearchOptions& opts) const {
+    std::vector<std::string> out;
+    if (query.empty() || opts.limit == 0) return out;
+    std::string q(query);
+    for (char& c : q) c = fold(c);
+
+    std::vector<const std::vector<uint32_t>*> lists; // posting lists of the query's trigrams
+    for (size_t i = 0; i + 2 < q.size(); ++i) {
+        auto it = postings_.find(gram(q[i], q[i + 1], q[i + 2]));
+        if (it == postings_.end()) return out;
+        lists.push_back(&it->second);
+    }
+    std::sort(lists.begin(), lists.end(), [](auto* a, auto* b) { return a->size() < b->size(); });
+    lists.erase(std::unique(lists.begin(), lists.end()), lists.end());
+
+    const NodeHandle view = s.scopeRootId ? s.nodes.find(*s.scopeRootId) : NodeHandle{};
+    const NodeHandle scope = opts.scoped ? view : NodeHandle{};
+    auto matches = [&](NodeHandle h) {
+        const uint32_t index = h.index;
+        return index < docs_.size() && docs_[index].live && docs_[index].gen == h.gen && contains(s.nodes.get(h).text, q);
+    };
+
+    // stackless preorder over the searched part of the tree
+    const NodeHandle top = scope ? scope : (!opts.includeHidden ? view : NodeHandle{});
+    auto next = [&](NodeHandle h) {
+        const Node& node = s.nodes.get(h);
+        if (node.children.first && (opts.includeHidden || !node.collapsed || h == view)) return node.children.first;
+        for (NodeHandle x = h; x != top;) {
+            const Node& cur = s.nodes.get(x);
+            if (cur.next) return cur.next;
+            x = cur.parent;
+            if (!x) break;
+        }
+        return NodeHandle{};
+    };
+    NodeHandle walk = top ? top : s.rootOrder.first;
+
+    const size_t rarest = lists.empty() ? live_ : lists[0]->size();
+    const bool probe = rarest > kProbeMin && opts.limit < rarest;
+    if (probe) {
+        for (size_t visited = 0; walk && out.size() < opts.limit && visited < kProbeNodes; ++visited, walk = next(walk)) {
+            if (matches(walk)) out.push_back(s.nodes.id_of(walk));
+        }
+        if (!walk || out.size() >= opts.limit) return out;
+    }
+
+    std::vector<uint32_t> candidates;
+    if (!lists.empty()) {
+        candidates = intersect(lists);
+    } else {
+        for (uint32_t i = 0; i < docs_.size(); ++i) {
+            if (docs_[i].live) candidates.push_back(i);
+        }
+    }
+
+    if (candidates.size() > kWalkThreshold && candidates.size() * kWalkDensity > live_) {
+        // continue from where the probe stopped
+        std::vector<char> isCandidate(s.nodes.slot_limit(), 0);
+        for (uint32_t index : candidates) {
+            if (index < isCandidate.size()) isCandidate[index] = 1;
+        }
+        for (; walk && out.size() < opts.limit; walk = next(walk)) {
+            if (isCandidate[walk.index] && matches(walk)) out.push_back(s.nodes.id_of(walk));
+        }
+        return out;
+    }
+
+    // few candidates: verify, filter by placement, and key each match by its
+    // path of sibling labels from the root, whose lexicographic order is the
+    // preorder. This finds the probe's matches again, in the same order.
+    out.clear();
+    std::vector<std::pair<std::vector<uint64_t>, NodeHandle>> found;
+    std::vector<uint64_t> path;
+    for (uint32_t index : candidates) {
+        NodeHandle h = s.nodes.handle_at(index);
+        if (!h || !matches(h)) continue; // removed since indexed, or only the trigrams match
+        path.clear();
+        bool inScope = !scope, pastView = false, shown = true;
+        for (NodeHandle x = h; x; x = s.nodes.get(x).parent) {
+            const Node& cur = s.nodes.get(x);
+            path.push_back(cur.order);
+            if (x == scope) inScope = true;
+            if (x == view) pastView = true; // the view root shows its children even when collapsed
+            if (x != h && !pastView && cur.collapsed) shown = false;
+        }
+        if (view && !pastView) shown = false; // outside the viewed subtree
+        if (!inScope || (!opts.includeHidden && !shown)) continue;
+        std::reverse(path.begin(), path.end());
+        found.emplace_back(path, h);
+    }
+    std::sort(found.begin(), found.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    const size_t n = std::min(found.size(), opts.limit);
+    out.reserve(n);
+    for (size_t i = 0; i < n; ++i) out.push_back(s.nodes.id_of(found[i].second));
+    return out;
+}
+
+size_t SearchIndex::memory_bytes() const {
+    size_t bytes = sizeof(*this) + docs_.capacity() * sizeof(Doc);
+    for (const Doc& doc : docs_) bytes += doc.grams.capacity() * sizeof(uint32_t);
+    // hash node plus bucket per trigram
+    bytes += postings_.bucket_count() * sizeof(void*);
+    for (const auto& entry : postings_) bytes += sizeof(entry) + 2 * sizeof(void*) + entry.second.capacity() * sizeof(uint32_t);
+    return bytes;
+}
+
+} // namespace bullet
@@ -0,0 +1,386 @@
+#include "bullet_engine/snapshot.hpp"
+#include "bullet_engine/state_builder.hpp"
+#include "bullet_engine/state_utils.hpp"
+#include "file_util.hpp"
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define BULLET_HAVE_MMAP 1
+#endif
+
+namespace bullet {
+
+namespace {
+
+constexpr char kMagic[8] = { 'B', 'L', 'T', 'S', 'N', 'A', 'P', '\0' };
+constexpr uint32_t kVersion = 1;
+constexpr uint32_t kFlagCollapsed = 1u;
+constexpr uint32_t kFlagHasScope = 1u;
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t nodeCount;
+    uint64_t idCounter;
+    uint64_t hashSlots;
+    uint64_t stringBytes;
+    uint32_t firstRoot;
+    uint32_t rootCount;
+    int32_t caret;
+    uint32_t flags; // kFlagHasScope
+    uint32_t focusOffset;
+    uint32_t focusLength;
+    uint32_t scopeOffset;
+    uint32_t scopeLength;
+};
+static_assert(sizeof(Header) == 80, "snapshot header layout");
+
+bool little_endian() {
+    const uint32_t probe = 1;
+    char first;
+    std::memcpy(&first, &probe, 1);
+    return first == 1;
+}
+
+uint32_t checked_u32(size_t v) {
+    if (v > UINT32_MAX) throw SnapshotError("snapshot: string table exceeds 4 GiB");
+    return static_cast<uint32_t>(v);
+}
+
+} // namespace
+
+struct SnapshotView::Record {
+    uint32_t parent;
+    uint32_t firstChild;
+    uint32_t nextSibling;
+    uint32_t childCount;
+    uint32_t flags; // kFlagCollapsed
+    uint32_t strOffset; // id, then text
+    uint32_t idLength;
+    uint32_t textLength;
+};
+
+std::string encode_snapshot(const State& s) {
+    if (!little_endian()) throw SnapshotError("snapshot: big-endian hosts are not supported");
+    // preorder over the whole forest, following links (no recursion)
+    std::vector<NodeHandle> order;
+    order.reserve(s.nodes.size());
+    for (NodeHandle h = s.rootOrder.first; h;) {
+        order.push_back(h);
+        const Node& node = s.nodes.get(h);
+        if (node.children.first) { h = node.children.first; continue; }
+        while (h && !s.nodes.get(h).next) h = s.nodes.get(h).parent;
+        if (h) h = s.nodes.get(h).next;
+    }
+    const uint32_t kNone = SnapshotView::kNone;
+    std::vector<uint32_t> index(s.nodes.slot_limit(), kNone);
+    for (size_t i = 0; i < order.size(); ++i) index[order[i].index] = static_cast<uint32_t>(i);
+    auto ref = [&](NodeHandle h) { return h ? index[h.index] : kNone; };
+
+    const size_t n = order.size();
+    uint64_t slots = 2;
+    while (slots < 2 * static_cast<uint64_t>(n)) slots <<= 1;
+
+    std::string strings;
+    std::vector<uint32_t> records(n * 8); // Record layout, field by field
+    std::vector<uint32_t> hash(slots, 0);
+    for (size_t i = 0; i < n; ++i) {
+        const Node& node = s.nodes.get(order[i]);
+        const std::string& id = s.nodes.id_of(order[i]);
+        uint32_t* r = &records[i * 8];
+        r[0] = ref(node.parent);
+        r[1] = ref(node.children.first);
+        r[2] = ref(node.next);
+        r[3] = checked_u32(node.children.size());
+        r[4] = node.collapsed ? kFlagCollapsed : 0;
+        r[5] = checked_u32(strings.size());
+        r[6] = checked_u32(id.size());
+        r[7] = checked_u32(node.text.size());
+        strings += id;
+        node.text.for_each_chunk([&strings](std::string_view chunk) { strings.append(chunk.data(), chunk.size()); });
+        uint64_t slot = file_detail::fnv1a(id) & (slots - 1);
+        while (hash[slot]) slot = (slot + 1) & (slots - 1);
+        hash[slot] = static_cast<uint32_t>(i + 1);
+    }
+
+    Header h{};
+    std::memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = kVersion;
+    h.headerSize = sizeof(Header);
+    h.nodeCount = n;
+    h.idCounter = s.idCounter;
+    h.hashSlots = slots;
+    h.firstRoot = ref(s.rootOrder.first);
+    h.rootCount = checked_u32(s.rootOrder.size());
+    h.caret = s.caret;
+    h.focusOffset = checked_u32(strings.size());
+    h.focusLength = checked_u32(s.focusedId.size());
+    strings += s.focusedId;
+    if (s.scopeRootId.has_value()) {
+        h.flags |= kFlagHasScope;
+        h.scopeOffset = checked_u32(strings.size());
+        h.scopeLength = checked_u32(s.scopeRootId->size());
+        strings += *s.scopeRootId;
+    }
+    h.stringBytes = strings.size();
+
+    std::string out;
+    out.reserve(sizeof(Header) + records.size() * 4 + hash.size() * 4 + strings.size());
+    out.append(reinterpret_cast<const char*>(&h), sizeof(Header));
+    out.append(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(uint32_t));
+    out.append(reinterpret_cast<const char*>(hash.data()), hash.size() * sizeof(uint32_t));
+    out.append(strings);
+    return out;
+}
+
+void write_snapshot(const State& s, const std::string& path) {
+    const std::string bytes = encode_snapshot(s);
+    try {
+        file_detail::replace_file(path, bytes);
+    } catch (const std::runtime_error& e) {
+        throw SnapshotError(std::string("snapshot: ") + e.what());
+    }
+}
+
+// Owns the snapshot bytes: a read-only mapping where available, else a buffer.
+struct SnapshotView::Mapping {
+    std::string owned;
+    void* mapped = nullptr;
+    size_t length = 0;
+
+    Mapping() = default;
+    Mapping(const Mapping&) = delete;
+    Mapping& operator=(const Mapping&) = delete;
+    ~Mapping() {
+#ifdef BULLET_HAVE_MMAP
+        if (mapped) munmap(mapped, length);
+#endif
+    }
+
+    const char* data() const { return mapped ? static_cast<const char*>(mapped) : owned.data(); }
+    size_t size() const { return mapped ? length : owned.size(); }
+};
+
+SnapshotView SnapshotView::open(const std::string& path) {
+    auto map = std::make_shared<Mapping>();
+#ifdef BULLET_HAVE_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw SnapshotError("snapshot: cannot open " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw SnapshotError("snapshot: cannot stat " + path);
+    }
+    if (st.st_size > 0) {
+        void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            ::close(fd);
+            throw SnapshotError("snapshot: cannot map " + path);
+        }
+        map->mapped = p;
+        map->length = static_cast<size_t>(st.st_size);
+    }
+    ::close(fd);
+#else
+    std::ifstream in(path, std::ios::binary);
+    if (!in) throw SnapshotError("snapshot: cannot open " + path);
+    map->owned.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+#endif
+    return SnapshotView(std::move(map));
+}
+
+SnapshotView SnapshotView::from_bytes(std::string bytes) {
+    auto map = std::make_shared<Mapping>();
+    map->owned = std::move(bytes);
+    return SnapshotView(std::move(map));
+}
+
+// Validates the header and section sizes only; node records are read on demand.
+SnapshotView::SnapshotView(std::shared_ptr<const Mapping> map) : map_(std::move(map)) {
+    if (!little_endian()) throw SnapshotError("snapshot: big-endian hosts are not supported");
+    base_ = map_->data();
+    const size_t size = map_->size();
+    if (size < sizeof(Header)) throw SnapshotError("snapshot: truncated header");
+    Header h;
+    std::memcpy(&h, base_, sizeof(Header));
+    if (std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0) throw SnapshotError("snapshot: bad magic");
+    if (h.version != kVersion) throw SnapshotError("snapshot: unsupported version " + std::to_string(h.version));
+    if (h.headerSize != sizeof(Header)) throw SnapshotError("snapshot: bad header size");
+    if (h.nodeCount >= kNone || h.hashSlots == 0 || (h.hashSlots & (h.hashSlots - 1)) != 0 || h.hashSlots < h.nodeCount) {
+        throw SnapshotError("snapshot: bad table sizes");
+    }
+    // bound each section by the file before summing, so the sum cannot wrap
+    const uint64_t rem = size - sizeof(Header);
+    if (h.nodeCount > rem / sizeof(Record) || h.hashSlots > rem / sizeof(uint32_t) || h.stringBytes > rem) {
+        throw SnapshotError("snapshot: size mismatch");
+    }
+    const uint64_t need = sizeof(Header) + h.nodeCount * sizeof(Record) + h.hashSlots * sizeof(uint32_t) + h.stringBytes;
+    if (need != size) throw SnapshotError("snapshot: size mismatch");
+    if ((h.nodeCount == 0) != (h.firstRoot == kNone) || (h.firstRoot != kNone && h.firstRoot >= h.nodeCount) ||
+        h.rootCount > h.nodeCount) {
+        throw SnapshotError("snapshot: bad root");
+    }
+    nodeCount_ = static_cast<size_t>(h.nodeCount);
+    nodes_ = base_ + sizeof(Header);
+    hash_ = nodes_ + nodeCount_ * sizeof(Record);
+    hashSlots_ = h.hashSlots;
+    strings_ = hash_ + hashSlots_ * sizeof(uint32_t);
+    stringBytes_ = h.stringBytes;
+    str(h.focusOffset, h.focusLength);
+    if (h.flags & kFlagHasScope) str(h.scopeOffset, h.scopeLength);
+}
+
+// Every record is checked as it is read: links stay in the table and follow
+// the preorder (parent before the node, first child and next sibling after
+// it), so a corrupt or hostile file cannot index out of bounds, and walking
+// child or sibling links always terminates.
+SnapshotView::Record SnapshotView::record(uint32_t i) const {
+    static_assert(sizeof(Record) == 8 * sizeof(uint32_t), "snapshot record layout");
+    if (i >= nodeCount_) throw SnapshotError("snapshot: node index out of range");
+    Record r;
+    std::memcpy(&r, nodes_ + static_cast<size_t>(i) * sizeof(Record), sizeof(Record));
+    const auto after = [&](uint32_t link) { return link == kNone || (link > i && link < nodeCount_); };
+    if ((r.parent != kNone && r.parent >= i) || !after(r.firstChild) || !after(r.nextSibling) ||
+        r.childCount >= nodeCount_ - i) {
+        throw SnapshotError("snapshot: node table not in preorder");
+    }
+    return r;
+}
+
+std::string_view SnapshotView::str(uint64_t offset, uint64_t length) const {
+    if (offset > stringBytes_ || length > stringBytes_ - offset) throw SnapshotError("snapshot: string out of range");
+    return std::string_view(strings_ + offset, static_cast<size_t>(length));
+}
+
+static Header header_of(const char* base) {
+    Header h;
+    std::memcpy(&h, base, sizeof(Header));
+    return h;
+}
+
+unsigned long long SnapshotView::id_counter() const { return header_of(base_).idCounter; }
+
+std::string_view SnapshotView::focused_id() const {
+    Header h = header_of(base_);
+    return str(h.focusOffset, h.focusLength);
+}
+
+int SnapshotView::caret() const { return header_of(base_).caret; }
+
+std::optional<std::string_view> SnapshotView::scope_root_id() const {
+    Header h = header_of(base_);
+    if (!(h.flags & kFlagHasScope)) return std::nullopt;
+    return str(h.scopeOffset, h.scopeLength);
+}
+
+uint32_t SnapshotView::find(std::string_view id) const {
+    uint64_t slot = file_detail::fnv1a(id) & (hashSlots_ - 1);
+    for (uint64_t probes = 0; probes < hashSlots_; ++probes) {
+        uint32_t entry;
+        std::memcpy(&entry, hash_ + slot * sizeof(uint32_t), sizeof(uint32_t));
+        if (entry == 0) return kNone;
+        if (entry - 1 < nodeCount_ && this->id(entry - 1) == id) return entry - 1;
+        slot = (slot + 1) & (hashSlots_ - 1);
+    }
+    return kNone;
+}
+
+std::string_view SnapshotView::id(uint32_t i) const {
+    Record r = record(i);
+    return str(r.strOffset, r.idLength);
+}
+
+std::string_view SnapshotView::text(uint32_t i) const {
+    Record r = record(i);
+    return str(static_cast<uint64_t>(r.strOffset) + r.idLength, r.textLength);
+}
+
+uint32_t SnapshotView::parent(uint32_t i) const { return record(i).parent; }
+uint32_t SnapshotView::first_child(uint32_t i) const { return record(i).firstChild; }
+uint32_t SnapshotView::next_sibling(uint32_t i) const { return record(i).nextSibling; }
+size_t SnapshotView::child_count(uint32_t i) const { return record(i).childCount; }
+bool SnapshotView::collapsed(uint32_t i) const { return (record(i).flags & kFlagCollapsed) != 0; }
+uint32_t SnapshotView::first_root() const { return header_of(base_).firstRoot; }
+size_t SnapshotView::root_count() const { return header_of(base_).rootCount; }
+
+// The builder trusts ids to be unique and depths to follow the open path, so
+// both are checked here: a node's parent must be the deepest open node at or
+// above it (the one the builder would attach it to), and focus and scope must
+// name nodes that exist.
+State SnapshotView::materialize() const {
+    // records are in preorder, so the open path is a stack of indices by depth
+    StateBuilder builder;
+    std::vector<uint32_t> path;
+    for (uint32_t i = 0; i < nodeCount_; ++i) {
+        Record r = record(i);
+        if (r.parent == kNone) {
+            path.clear();
+        } else {
+            while (!path.empty() && path.back() != r.parent) path.pop_back();
+            if (path.empty()) throw SnapshotError("snapshot: parent not on the open path");
+        }
+        std::string nodeId(id(i));
+        if (builder.state().nodes.find(nodeId)) throw SnapshotError("snapshot: duplicate id " + nodeId);
+        builder.add(nodeId, std::string(text(i)), path.size(), (r.flags & kFlagCollapsed) != 0);
+        path.push_back(i);
+    }
+    State s = builder.finish();
+    s.idCounter = id_counter();
+    s.focusedId = std::string(focused_id());
+    s.caret = caret();
+    if (auto scope = scope_root_id()) s.scopeRootId = std::string(*scope);
+    if (nodeCount_ != 0 ? !s.nodes.find(s.focusedId) : !s.focusedId.empty()) {
+        throw SnapshotError("snapshot: focused node missing");
+    }
+    if (s.scopeRootId && !s.scopeRootId->empty() && !s.nodes.find(*s.scopeRootId)) {
+        throw SnapshotError("snapshot: scope root missing");
+    }
+    return s;
+}
+
+size_t SnapshotDocument::node_count() const {
+    return state_ ? bullet::node_count(*state_) : view_.node_count();
+}
+
+std::string SnapshotDocument::focused_id() const {
+    return state_ ? state_->focusedId : std::string(view_.focused_id());
+}
+
+std::string SnapshotDocument::text_of(const std::string& id) const {
+    if (state_) return bullet::text_of(*state_, id);
+    uint32_t i = view_.find(id);
+    return i == SnapshotView::kNone ? std::string() : std::string(view_.text(i));
+}
+
+std::vector<std::string> SnapshotDocument::child_ids(const std::string& id) const {
+    if (state_) return bullet::child_ids(*state_, id);
+    std::vector<std::string> out;
+    uint32_t i = view_.find(id);
+    if (i == SnapshotView::kNone) return out;
+    out.reserve(view_.child_count(i));
+    for (uint32_t c = view_.first_child(i); c != SnapshotView::kNone; c = view_.next_sibling(c)) out.emplace_back(view_.id(c));
+    return out;
+}
+
+std::vector<std::string> SnapshotDocument::root_ids() const {
+    if (state_) return bullet::root_ids(*state_);
+    std::vector<std::string> out;
+    out.reserve(view_.root_count());
+    for (uint32_t r = view_.first_root(); r != SnapshotView::kNone; r = view_.next_sibling(r)) out.emplace_back(view_.id(r));
+    return out;
+}
+
+State& SnapshotDocument::state() {
+    if (!state_) state_ = view_.materialize();
+    return *state_;
+}
+
+} // namespace bullet
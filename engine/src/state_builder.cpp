@@ -0,0 +1,41 @@
+#include "bullet_engine/state_builder.hpp"
+#include "bullet_engine/state_utils.hpp"
+
+namespace bullet {
+
+// The top of the stack is complete: splice in its remaining children (it is
+// still detached, so the size update stops there) and hand it to the level
+// below, which splices its own finished children every kRun of them.
+void StateBuilder::close_top() {
+    Open& top = open_[--depth_];
+    append_children(s_, top.node, top.children);
+    top.children.clear();
+    const NodeHandle parent = depth_ > 0 ? open_[depth_ - 1].node : NodeHandle{};
+    std::vector<NodeHandle>& run = depth_ > 0 ? open_[depth_ - 1].children : roots_;
+    run.push_back(top.node);
+    if (run.size() >= kRun) {
+        append_children(s_, parent, run);
+        run.clear();
+    }
+}
+
+NodeHandle StateBuilder::add(const std::string& id, std::string text, size_t depth, bool collapsed) {
+    while (depth_ > depth) close_top();
+    Node node;
+    node.text = std::move(text);
+    node.subtreeBytes = node.text.size();
+    node.collapsed = collapsed;
+    NodeHandle h = s_.nodes.insert(id, std::move(node));
+    if (open_.size() == depth_) open_.emplace_back();
+    open_[depth_++].node = h;
+    return h;
+}
+
+State StateBuilder::finish() {
+    while (depth_ > 0) close_top();
+    append_children(s_, NodeHandle{}, roots_);
+    roots_.clear();
+    return std::move(s_);
+}
+
+} // namespace bullet
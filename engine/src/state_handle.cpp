@@ -0,0 +1,81 @@
+#include "bullet_engine/state_handle.hpp"
+#include "backoff.hpp"
+#include <functional>
+#include <thread>
+
+namespace bullet {
+
+StateHandle::StateHandle(State initial)
+    : working_(initial), current_(new Version{ std::move(initial), 0 }) {}
+
+StateHandle::~StateHandle() {
+    for (const Retired& r : retired_) delete r.version;
+    delete current_.load(std::memory_order_relaxed);
+}
+
+// Announce the epoch, then load the version. A version replaced after the
+// epoch was read is retired with a later epoch, so it stays alive while the
+// slot holds this one. Both steps are sequentially consistent, which orders
+// them against the writer's exchange, epoch bump and slot scan.
+// When every slot is pinned, the reader backs off after each full sweep
+// (pausing, then yielding) until some pin is released.
+StateHandle::ReadGuard StateHandle::read() const {
+    static thread_local const size_t hint = std::hash<std::thread::id>{}(std::this_thread::get_id());
+    int spins = 0;
+    for (size_t i = hint;; ++i) {
+        std::atomic<uint64_t>& slot = slots_[i % kReaderSlots].epoch;
+        uint64_t expected = 0;
+        if (slot.load(std::memory_order_relaxed) == 0 && slot.compare_exchange_strong(expected, epoch_.load())) {
+            return ReadGuard(&slot, current_.load());
+        }
+        if ((i - hint) % kReaderSlots == kReaderSlots - 1) backoff_detail::pause(spins);
+    }
+}
+
+State StateHandle::snapshot() const {
+    return *read();
+}
+
+void StateHandle::publish() {
+    const Version* old = current_.exchange(new Version{ working_, ++published_ });
+    retired_.push_back(Retired{ old, epoch_.fetch_add(1) + 1 });
+    reclaim();
+}
+
+void StateHandle::publish(State next) {
+    working_ = std::move(next);
+    publish();
+}
+
+ChangeSet StateHandle::apply(const Command& cmd) {
+    ChangeSet ch = apply_command_inplace(working_, cmd);
+    publish();
+    return ch;
+}
+
+ChangeSet StateHandle::apply(const std::vector<Command>& cmds) {
+    ChangeSet ch = apply_commands_inplace(working_, cmds);
+    publish();
+    return ch;
+}
+
+// Free the retired versions no pinned reader can hold: those retired at or
+// before the oldest epoch a reader announced.
+void StateHandle::reclaim() {
+    uint64_t oldest = UINT64_MAX;
+    for (const Slot& s : slots_) {
+        const uint64_t e = s.epoch.load();
+        if (e != 0 && e < oldest) oldest = e;
+    }
+    size_t kept = 0;
+    for (const Retired& r : retired_) {
+        if (r.epoch <= oldest) {
+            delete r.version;
+        } else {
+            retired_[kept++] = r;
+        }
+    }
+    retired_.resize(kept);
+}
+
+} // namespace bullet
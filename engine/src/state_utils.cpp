@@ -2,34 +2,94 @@
 #include "bullet_engine/state_utils.hpp"
 #include <cassert>
 #include <algorithm>
+#include <cstdint>
 
 namespace bullet {
 
-std::vector<std::string>& siblings_ref(State& s, const std::string& id) {
-    auto it = s.nodes.find(id);
-    assert(it != s.nodes.end());
-    const std::string& parentId = it->second.parentId;
-    if (parentId.empty()) {
-        return s.rootOrder;
-    }
-    return s.nodes[parentId].children;
+NodeHandle find_node(const State& s, const std::string& id) {
+    return s.nodes.find(id);
 }
 
-const std::vector<std::string>& siblings_cref(const State& s, const std::string& id) {
-    auto it = s.nodes.find(id);
-    assert(it != s.nodes.end());
-    const std::string& parentId = it->second.parentId;
-    if (parentId.empty()) {
-        return s.rootOrder;
-    }
-    return s.nodes.at(parentId).children;
+bool has_node(const State& s, const std::string& id) {
+    return s.nodes.find(id).valid();
+}
+
+const std::string& id_of(const State& s, NodeHandle h) {
+    return s.nodes.id_of(h);
+}
+
+size_t node_count(const State& s) {
+    return s.nodes.size();
+}
+
+std::vector<std::string> node_ids(const State& s) {
+    std::vector<std::string> out;
+    out.reserve(s.nodes.size());
+    s.nodes.for_each([&](NodeHandle h, const Node&) { out.push_back(s.nodes.id_of(h)); });
+    return out;
+}
+
+std::string text_of(const State& s, const std::string& id) {
+    NodeHandle h = s.nodes.find(id);
+    return h ? s.nodes.get(h).text.str() : std::string();
+}
+
+bool is_collapsed(const State& s, const std::string& id) {
+    NodeHandle h = s.nodes.find(id);
+    return h && s.nodes.get(h).collapsed;
+}
+
+void set_text(State& s, const std::string& id, std::string text) {
+    NodeHandle h = s.nodes.find(id);
+    if (!h) return;
+    const long long delta = static_cast<long long>(text.size()) - static_cast<long long>(s.nodes.get(h).text.size());
+    s.nodes.mut(h).text = std::move(text);
+    add_text_bytes(s, h, delta);
+}
+
+std::string parent_id(const State& s, const std::string& id) {
+    NodeHandle h = s.nodes.find(id);
+    return h ? s.nodes.id_of(s.nodes.get(h).parent) : std::string();
+}
+
+static std::vector<std::string> to_ids(const State& s, const SiblingList& list) {
+    std::vector<std::string> out;
+    out.reserve(list.size());
+    for (NodeHandle h = list.first; h; h = s.nodes.get(h).next) out.push_back(s.nodes.id_of(h));
+    return out;
+}
+
+std::vector<std::string> child_ids(const State& s, const std::string& id) {
+    NodeHandle h = s.nodes.find(id);
+    return h ? to_ids(s, s.nodes.get(h).children) : std::vector<std::string>();
+}
+
+std::vector<std::string> root_ids(const State& s) {
+    return to_ids(s, s.rootOrder);
+}
+
+static SiblingList& container_of(State& s, NodeHandle parent) {
+    return parent ? s.nodes.mut(parent).children : s.rootOrder;
+}
+
+static const SiblingList& container_cref(const State& s, NodeHandle parent) {
+    return parent ? s.nodes.get(parent).children : s.rootOrder;
+}
+
+SiblingList& siblings_ref(State& s, NodeHandle h) {
+    return container_of(s, s.nodes.get(h).parent);
+}
+
+const SiblingList& siblings_cref(const State& s, NodeHandle h) {
+    return container_cref(s, s.nodes.get(h).parent);
+}
+
+size_t index_in_siblings(const State& s, NodeHandle h) {
+    return siblings_cref(s, h).index.rank(s.nodes.get(h).order);
 }
 
-size_t index_in_siblings(const State& s, const std::string& id) {
-    const auto& sibs = siblings_cref(s, id);
-    auto it = std::find(sibs.begin(), sibs.end(), id);
-    assert(it != sibs.end());
-    return static_cast<size_t>(std::distance(sibs.begin(), it));
+NodeHandle sibling_at(const SiblingList& list, size_t i) {
+    return i < list.size() ? list.index.at(i).node : NodeHandle{};
 }
 
 std::string make_new_id(State& s) {
@@ -37,67 +97,441 @@ std::string make_new_id(State& s) {
     return std::string("n") + std::to_string(s.idCounter);
 }
 
-void insert_after(std::vector<std::string>& vec, const std::string& existing, const std::string& newcomer) {
-    auto it = std::find(vec.begin(), vec.end(), existing);
-    assert(it != vec.end());
-    vec.insert(it + 1, newcomer);
+NodeHandle create_node(State& s, std::string text) {
+    return create_node(s, Text(std::move(text)));
 }
 
-void insert_before(std::vector<std::string>& vec, const std::string& existing, const std::string& newcomer) {
-    auto it = std::find(vec.begin(), vec.end(), existing);
-    assert(it != vec.end());
-    vec.insert(it, newcomer);
+NodeHandle create_node(State& s, Text text) {
+    Node node;
+    node.text = std::move(text);
+    node.subtreeBytes = node.text.size();
+    return s.nodes.insert(make_new_id(s), std::move(node));
 }
 
-void erase_from(std::vector<std::string>& vec, const std::string& id) {
-    auto it = std::find(vec.begin(), vec.end(), id);
-    assert(it != vec.end());
-    vec.erase(it);
+// Order-maintenance labels. Appends step by kLabelGap; inserts take the
+// midpoint of their neighbours. When a gap is exhausted, the smallest window
+// around the insertion point whose label range leaves kMinRelabelGap per
+// element is spread out evenly (growing to the whole list if needed).
+static constexpr uint64_t kLabelGap = 1ull << 32;
+static constexpr uint64_t kMinRelabelGap = 1ull << 16;
+static constexpr uint64_t kLabelMax = UINT64_MAX;
+
+static bool label_between(const State& s, NodeHandle prev, NodeHandle next, uint64_t& out) {
+    uint64_t lo = prev ? s.nodes.get(prev).order : 0;
+    uint64_t hi = next ? s.nodes.get(next).order : kLabelMax;
+    if (hi - lo < 2) return false;
+    out = (!next && hi - lo > kLabelGap) ? lo + kLabelGap : lo + (hi - lo) / 2;
+    return true;
 }
 
-static void preorder_collect(const State& s, const std::string& root, std::vector<std::string>& out) {
-    out.push_back(root);
-    const auto& node = s.nodes.at(root);
-    for (const auto& cid : node.children) {
-        preorder_collect(s, cid, out);
+// Spread the labels of a window around `anchor`, leaving `reserve` extra
+// label slots free right after it so a run of that many nodes fits there.
+static void relabel_around(State& s, NodeHandle parent, NodeHandle anchor, size_t reserve = 0) {
+    NodeHandle left = anchor;
+    NodeHandle right = anchor;
+    size_t m = 1;
+    uint64_t lo = 0;
+    uint64_t hi = kLabelMax;
+    for (;;) {
+        NodeHandle before = s.nodes.get(left).prev;
+        NodeHandle after = s.nodes.get(right).next;
+        lo = before ? s.nodes.get(before).order : 0;
+        hi = after ? s.nodes.get(after).order : kLabelMax;
+        if ((!before && !after) || (hi - lo) / (m + reserve + 2) >= kMinRelabelGap) break;
+        size_t grow = m;
+        for (size_t i = 0; i < grow && s.nodes.get(left).prev; ++i, ++m) left = s.nodes.get(left).prev;
+        for (size_t i = 0; i < grow && s.nodes.get(right).next; ++i, ++m) right = s.nodes.get(right).next;
     }
+    const uint64_t step = (hi - lo) / (m + reserve + 1);
+    SiblingList& list = container_of(s, parent);
+    size_t first = list.index.rank(s.nodes.get(left).order);
+    std::vector<uint64_t> labels;
+    labels.reserve(m);
+    size_t skip = 0;
+    for (NodeHandle h = left;; h = s.nodes.get(h).next) {
+        uint64_t label = lo + step * (labels.size() + skip + 1);
+        s.nodes.mut(h).order = label;
+        labels.push_back(label);
+        if (h == anchor) skip = reserve;
+        if (h == right) break;
+    }
+    list.index.relabel(first, labels);
+}
+
+static size_t add(size_t value, long long delta) {
+    return static_cast<size_t>(static_cast<long long>(value) + delta);
+}
+
+// The subtree below `parent` changed by `visible` rows, `nodes` nodes and
+// `bytes` text bytes: fold that into every ancestor, recompute each one's
+// height from its children's index, and refresh its entry (weight and
+// height) in its own container. O(depth * log n). Visible rows stop at a
+// collapsed ancestor, whose size stays 1 (its children's weights are already
+// current for when it expands); the walk ends early once nothing changes, and
+// at a detached subtree (order 0), which has no container to update yet.
+static void update_ancestors(State& s, NodeHandle parent, long long visible, long long nodes, long long bytes) {
+    for (NodeHandle p = parent; p;) {
+        const Node& cur = s.nodes.get(p);
+        if (cur.collapsed) visible = 0;
+        const uint32_t height = 1 + cur.children.index.max_height();
+        const bool heightChanged = height != cur.height;
+        if (visible == 0 && nodes == 0 && bytes == 0 && !heightChanged) return;
+        Node& node = s.nodes.mut(p);
+        node.visibleSize = add(node.visibleSize, visible);
+        node.subtreeSize = add(node.subtreeSize, nodes);
+        node.subtreeBytes = add(node.subtreeBytes, bytes);
+        node.height = height;
+        if (node.order == 0) return;
+        const NodeHandle up = node.parent;
+        if (visible != 0 || heightChanged) container_of(s, up).index.update(node.order, visible, height);
+        p = up;
+    }
+}
+
+void add_text_bytes(State& s, NodeHandle h, long long delta) {
+    if (delta == 0) return;
+    Node& node = s.nodes.mut(h);
+    node.subtreeBytes = add(node.subtreeBytes, delta);
+    update_ancestors(s, node.parent, 0, 0, delta);
+}
+
+SubtreeStats subtree_aggregates(const State& s, const std::string& id) {
+    SubtreeStats st;
+    if (id.empty()) {
+        for (NodeHandle r = s.rootOrder.first; r; r = s.nodes.get(r).next) st.textBytes += s.nodes.get(r).subtreeBytes;
+        st.nodes = s.nodes.size();
+        st.depth = s.rootOrder.index.max_height();
+        return st;
+    }
+    const NodeHandle h = s.nodes.find(id);
+    if (!h) return st;
+    const Node& node = s.nodes.get(h);
+    st.nodes = node.subtreeSize;
+    st.depth = node.height;
+    st.textBytes = node.subtreeBytes;
+    return st;
+}
+
+size_t descendant_count(const State& s, const std::string& id) {
+    const NodeHandle h = s.nodes.find(id);
+    return h ? s.nodes.get(h).subtreeSize - 1 : 0;
+}
+
+static void link_between(State& s, NodeHandle parent, NodeHandle prev, NodeHandle next, NodeHandle h) {
+    uint64_t label = 0;
+    if (!label_between(s, prev, next, label)) {
+        relabel_around(s, parent, prev ? prev : next);
+        label_between(s, prev, next, label);
+    }
+    const Node& cur = s.nodes.get(h);
+    const size_t weight = cur.visibleSize;
+    const size_t nodes = cur.subtreeSize;
+    const size_t bytes = cur.subtreeBytes;
+    const uint32_t height = cur.height;
+    SiblingList& list = container_of(s, parent);
+    list.index.insert(ChildIndex::Entry{ label, h, weight, height });
+    if (prev) s.nodes.mut(prev).next = h; else list.first = h;
+    if (next) s.nodes.mut(next).prev = h; else list.last = h;
+    Node& node = s.nodes.mut(h);
+    node.parent = parent;
+    node.prev = prev;
+    node.next = next;
+    node.order = label;
+    update_ancestors(s, parent, static_cast<long long>(weight), static_cast<long long>(nodes), static_cast<long long>(bytes));
+}
+
+void insert_run_after(State& s, NodeHandle existing, const std::vector<NodeHandle>& run) {
+    if (run.empty()) return;
+    const NodeHandle parent = s.nodes.get(existing).parent;
+    const size_t m = run.size();
+    NodeHandle next = s.nodes.get(existing).next;
+    uint64_t lo = s.nodes.get(existing).order;
+    uint64_t hi = next ? s.nodes.get(next).order : kLabelMax;
+    if ((hi - lo) / (m + 1) < 1) {
+        relabel_around(s, parent, existing, m);
+        lo = s.nodes.get(existing).order;
+        hi = next ? s.nodes.get(next).order : kLabelMax;
+    }
+    uint64_t step = (hi - lo) / (m + 1);
+    if (!next && step > kLabelGap) step = kLabelGap; // appends keep the usual spacing
+    std::vector<ChildIndex::Entry> entries;
+    entries.reserve(m);
+    size_t weight = 0, nodes = 0, bytes = 0;
+    NodeHandle prev = existing;
+    for (size_t i = 0; i < m; ++i) {
+        const NodeHandle h = run[i];
+        Node& node = s.nodes.mut(h);
+        node.parent = parent;
+        node.prev = prev;
+        node.next = i + 1 < m ? run[i + 1] : next;
+        node.order = lo + step * (i + 1);
+        entries.push_back(ChildIndex::Entry{ node.order, h, node.visibleSize, node.height });
+        weight += node.visibleSize;
+        nodes += node.subtreeSize;
+        bytes += node.subtreeBytes;
+        prev = h;
+    }
+    s.nodes.mut(existing).next = run.front();
+    SiblingList& list = container_of(s, parent);
+    if (next) s.nodes.mut(next).prev = run.back(); else list.last = run.back();
+    list.index.insert_run(entries);
+    update_ancestors(s, parent, static_cast<long long>(weight), static_cast<long long>(nodes), static_cast<long long>(bytes));
+}
+
+void append_children(State& s, NodeHandle parent, const std::vector<NodeHandle>& run) {
+    if (run.empty()) return;
+    const SiblingList& list = container_cref(s, parent);
+    if (list.last) {
+        insert_run_after(s, list.last, run);
+        return;
+    }
+    std::vector<ChildIndex::Entry> entries;
+    entries.reserve(run.size());
+    const uint64_t step = std::min<uint64_t>(kLabelGap, kLabelMax / (run.size() + 1));
+    size_t weight = 0, nodes = 0, bytes = 0;
+    for (size_t i = 0; i < run.size(); ++i) {
+        Node& node = s.nodes.mut(run[i]);
+        node.parent = parent;
+        node.prev = i > 0 ? run[i - 1] : NodeHandle{};
+        node.next = i + 1 < run.size() ? run[i + 1] : NodeHandle{};
+        node.order = step * (i + 1);
+        entries.push_back(ChildIndex::Entry{ node.order, run[i], node.visibleSize, node.height });
+        weight += node.visibleSize;
+        nodes += node.subtreeSize;
+        bytes += node.subtreeBytes;
+    }
+    SiblingList& dest = container_of(s, parent);
+    dest.first = run.front();
+    dest.last = run.back();
+    dest.index.insert_run(entries);
+    update_ancestors(s, parent, static_cast<long long>(weight), static_cast<long long>(nodes), static_cast<long long>(bytes));
+}
+
+void insert_after(State& s, NodeHandle existing, NodeHandle newcomer) {
+    const Node& node = s.nodes.get(existing);
+    link_between(s, node.parent, existing, node.next, newcomer);
+}
+
+void insert_before(State& s, NodeHandle existing, NodeHandle newcomer) {
+    const Node& node = s.nodes.get(existing);
+    link_between(s, node.parent, node.prev, existing, newcomer);
+}
+
+void append_child(State& s, NodeHandle parent, NodeHandle newcomer) {
+    link_between(s, parent, container_cref(s, parent).last, NodeHandle{}, newcomer);
+}
+
+void erase_from(State& s, NodeHandle h) {
+    const Node& node = s.nodes.get(h);
+    const NodeHandle parent = node.parent;
+    const NodeHandle prev = node.prev;
+    const NodeHandle next = node.next;
+    const uint64_t order = node.order;
+    const long long weight = static_cast<long long>(node.visibleSize);
+    const long long nodes = static_cast<long long>(node.subtreeSize);
+    const long long bytes = static_cast<long long>(node.subtreeBytes);
+    SiblingList& list = container_of(s, parent);
+    list.index.erase(order);
+    if (prev) s.nodes.mut(prev).next = next; else list.first = next;
+    if (next) s.nodes.mut(next).prev = prev; else list.last = prev;
+    Node& detached = s.nodes.mut(h);
+    detached.parent = NodeHandle{};
+    detached.prev = NodeHandle{};
+    detached.next = NodeHandle{};
+    detached.order = 0;
+    update_ancestors(s, parent, -weight, -nodes, -bytes);
+}
+
+void move_children(State& s, NodeHandle from, NodeHandle to) {
+    assert(s.nodes.get(to).children.empty());
+    SiblingList moved = std::move(s.nodes.mut(from).children);
+    s.nodes.mut(from).children = SiblingList{};
+    for (NodeHandle c = moved.first; c; c = s.nodes.get(c).next) {
+        s.nodes.mut(c).parent = to;
+    }
+    const Node& src = s.nodes.get(from);
+    const long long weight = static_cast<long long>(moved.index.weight());
+    const long long nodes = static_cast<long long>(src.subtreeSize) - 1;
+    const long long bytes = static_cast<long long>(src.subtreeBytes - src.text.size());
+    s.nodes.mut(to).children = std::move(moved);
+    update_ancestors(s, from, -weight, -nodes, -bytes);
+    update_ancestors(s, to, weight, nodes, bytes);
+}
+
+void set_collapsed(State& s, NodeHandle h, bool collapsed) {
+    const Node& cur = s.nodes.get(h);
+    if (cur.collapsed == collapsed) return;
+    const size_t size = collapsed ? 1 : 1 + cur.children.index.weight();
+    const long long delta = static_cast<long long>(size) - static_cast<long long>(cur.visibleSize);
+    Node& node = s.nodes.mut(h);
+    node.collapsed = collapsed;
+    node.visibleSize = size;
+    if (node.order == 0 || delta == 0) return;
+    const NodeHandle parent = node.parent;
+    container_of(s, parent).index.add_weight(node.order, delta);
+    update_ancestors(s, parent, delta, 0, 0);
+}
+
+// Resolve scopeRootId. Returns false when unscoped; when scoped, `scope` is
+// the scope root, or null if the id no longer exists (nothing is visible).
+static bool scope_of(const State& s, NodeHandle& scope) {
+    if (!s.scopeRootId.has_value() || s.scopeRootId->empty()) return false;
+    scope = s.nodes.find(*s.scopeRootId);
+    return true;
+}
+
+// Children of h are shown unless h is collapsed; a collapsed scope root
+// still shows its children, since drilling in is how they are viewed.
+static bool shows_children(const State& s, NodeHandle h, NodeHandle scope) {
+    return !s.nodes.get(h).collapsed || h == scope;
+}
+
+// Preorder successor of h within the visible order, tracking depth.
+static NodeHandle advance(const State& s, NodeHandle scope, NodeHandle h, size_t& depth) {
+    const Node& node = s.nodes.get(h);
+    if (node.children.first && shows_children(s, h, scope)) {
+        ++depth;
+        return node.children.first;
+    }
+    for (NodeHandle x = h; x;) {
+        if (x == scope) return NodeHandle{};
+        const Node& cur = s.nodes.get(x);
+        if (cur.next) return cur.next;
+        x = cur.parent;
+        --depth;
+    }
+    return NodeHandle{};
+}
+
+VisibleRange::iterator& VisibleRange::iterator::operator++() {
+    row_.node = advance(*s_, scope_, row_.node, row_.depth);
+    if (!row_.node) row_.depth = 0;
+    return *this;
+}
+
+VisibleRange visible_rows(const State& s) {
+    NodeHandle scope;
+    NodeHandle first = scope_of(s, scope) ? scope : s.rootOrder.first;
+    return VisibleRange(&s, scope, VisibleRow{ first, 0 });
+}
+
+std::vector<NodeHandle> visible_order(const State& s) {
+    std::vector<NodeHandle> out;
+    out.reserve(visible_count(s));
+    for (const VisibleRow& row : visible_rows(s)) out.push_back(row.node);
+    return out;
 }
 
 std::vector<std::string> visible_order_ids(const State& s) {
     std::vector<std::string> out;
-    if (s.scopeRootId.has_value() && !s.scopeRootId->empty()) {
-        if (s.nodes.find(*s.scopeRootId) != s.nodes.end()) {
-            preorder_collect(s, *s.scopeRootId, out);
-        }
-        return out;
+    out.reserve(visible_count(s));
+    for (const VisibleRow& row : visible_rows(s)) out.push_back(s.nodes.id_of(row.node));
+    return out;
+}
+
+size_t visible_count(const State& s) {
+    NodeHandle scope;
+    if (!scope_of(s, scope)) return s.rootOrder.index.weight();
+    return scope ? 1 + s.nodes.get(scope).children.index.weight() : 0;
+}
+
+std::optional<size_t> visible_rank(const State& s, NodeHandle h) {
+    if (!s.nodes.contains(h)) return std::nullopt;
+    NodeHandle scope;
+    const bool scoped = scope_of(s, scope);
+    if (scoped && !scope) return std::nullopt;
+    // preorder rank = sum over the ancestor path of (parent row + earlier siblings' subtrees)
+    size_t r = 0;
+    for (NodeHandle x = h;;) {
+        if (scoped && x == scope) return r;
+        const Node& node = s.nodes.get(x);
+        if (node.parent && !shows_children(s, node.parent, scope)) return std::nullopt; // hidden under a collapsed ancestor
+        r += container_cref(s, node.parent).index.weight_before(node.order);
+        if (!node.parent) break;
+        r += 1;
+        x = node.parent;
     }
-    for (const auto& rid : s.rootOrder) {
-        preorder_collect(s, rid, out);
+    if (scoped) return std::nullopt; // reached a root without passing the scope root
+    return r;
+}
+
+NodeHandle visible_at(const State& s, size_t i) {
+    NodeHandle scope;
+    const SiblingList* list = &s.rootOrder;
+    if (scope_of(s, scope)) {
+        if (!scope) return NodeHandle{};
+        if (i == 0) return scope;
+        i -= 1;
+        list = &s.nodes.get(scope).children;
+    }
+    // weights of collapsed entries are 1, so a non-zero remainder only ever
+    // descends into expanded nodes
+    for (;;) {
+        if (i >= list->index.weight()) return NodeHandle{};
+        size_t within = 0;
+        ChildIndex::Entry e = list->index.find_weight(i, within);
+        if (within == 0) return e.node;
+        i = within - 1;
+        list = &s.nodes.get(e.node).children;
+    }
+}
+
+// True when h is part of the visible order: inside the scope, if any, and
+// not hidden under a collapsed ancestor.
+static bool is_visible(const State& s, NodeHandle h, bool scoped, NodeHandle scope) {
+    if (!s.nodes.contains(h)) return false;
+    for (NodeHandle x = h;;) {
+        if (scoped && x == scope) return true;
+        NodeHandle parent = s.nodes.get(x).parent;
+        if (!parent) return !scoped;
+        if (!shows_children(s, parent, scope)) return false;
+        x = parent;
     }
-    return out;
+}
+
+VisibleRange visible_rows_from(const State& s, NodeHandle start) {
+    NodeHandle scope;
+    const bool scoped = scope_of(s, scope);
+    if (!is_visible(s, start, scoped, scope)) return VisibleRange(&s, scope, VisibleRow{ NodeHandle{}, 0 });
+    size_t depth = 0;
+    for (NodeHandle x = start; x != scope && s.nodes.get(x).parent; x = s.nodes.get(x).parent) ++depth;
+    return VisibleRange(&s, scope, VisibleRow{ start, depth });
+}
+
+NodeHandle prev_visible(const State& s, NodeHandle h) {
+    NodeHandle scope;
+    const bool scoped = scope_of(s, scope);
+    if (!is_visible(s, h, scoped, scope) || (scoped && h == scope)) return NodeHandle{};
+    const Node& node = s.nodes.get(h);
+    if (!node.prev) return node.parent;
+    // deepest last visible descendant of the previous sibling
+    NodeHandle x = node.prev;
+    while (!s.nodes.get(x).collapsed && s.nodes.get(x).children.last) x = s.nodes.get(x).children.last;
+    return x;
+}
+
+NodeHandle next_visible(const State& s, NodeHandle h) {
+    NodeHandle scope;
+    const bool scoped = scope_of(s, scope);
+    if (!is_visible(s, h, scoped, scope)) return NodeHandle{};
+    size_t depth = 0;
+    return advance(s, scope, h, depth);
 }
 
 std::string prev_visible_id(const State& s, const std::string& id) {
-    auto order = visible_order_ids(s);
-    auto it = std::find(order.begin(), order.end(), id);
-    if (it == order.end() || it == order.begin()) return std::string();
-    return *(it - 1);
+    return s.nodes.id_of(prev_visible(s, s.nodes.find(id)));
 }
 
 std::string next_visible_id(const State& s, const std::string& id) {
-    auto order = visible_order_ids(s);
-    auto it = std::find(order.begin(), order.end(), id);
-    if (it == order.end() || it + 1 == order.end()) return std::string();
-    return *(it + 1);
+    return s.nodes.id_of(next_visible(s, s.nodes.find(id)));
 }
 
 State initial_state() {
     State s;
     s.idCounter = 0;
-    Node root{ "n1", "", "", {} };
-    s.nodes[root.id] = root;
-    s.rootOrder.push_back(root.id);
-    s.focusedId = root.id;
+    NodeHandle root = s.nodes.insert("n1", Node{});
+    append_child(s, NodeHandle{}, root);
+    s.focusedId = "n1";
     s.caret = 0;
     s.idCounter = 1;
     return s;
@@ -105,18 +539,41 @@ State initial_state() {
 
 std::vector<std::string> ancestors_to_root(const State& s, const std::string& id) {
     std::vector<std::string> rev;
-    auto it = s.nodes.find(id);
-    if (it == s.nodes.end()) return {};
-    std::string cur = id;
-    while (!cur.empty()) {
-        rev.push_back(cur);
-        const auto& node = s.nodes.at(cur);
-        if (node.parentId.empty()) break;
-        cur = node.parentId;
+    NodeHandle cur = s.nodes.find(id);
+    if (!cur) return {};
+    while (cur) {
+        rev.push_back(s.nodes.id_of(cur));
+        cur = s.nodes.get(cur).parent;
     }
     // reverse to be root..id
     std::reverse(rev.begin(), rev.end());
     return rev;
 }
 
+// `count` is already clamped to the rows left, so callers' page sizes never
+// reach the allocation.
+static std::vector<ViewRow> collect_window(const State& s, const VisibleRange& rows, size_t count) {
+    std::vector<ViewRow> out;
+    out.reserve(count);
+    for (auto it = rows.begin(); it != rows.end() && out.size() < count; ++it) {
+        const Node& node = s.nodes.get(it->node);
+        out.push_back(ViewRow{ s.nodes.id_of(it->node), it->depth, node.text.str(), node.children.size(), node.subtreeSize - 1,
+                               node.collapsed });
+    }
+    return out;
+}
+
+std::vector<ViewRow> visible_window(const State& s, size_t offset, size_t count) {
+    const size_t total = visible_count(s);
+    if (count == 0 || offset >= total) return {};
+    return collect_window(s, visible_rows_from(s, visible_at(s, offset)), std::min(count, total - offset));
+}
+
+std::vector<ViewRow> visible_window_from(const State& s, const std::string& anchorId, size_t count) {
+    const NodeHandle anchor = s.nodes.find(anchorId);
+    const std::optional<size_t> row = anchor ? visible_rank(s, anchor) : std::nullopt;
+    if (count == 0 || !row) return {};
+    return collect_window(s, visible_rows_from(s, anchor), std::min(count, visible_count(s) - *row));
+}
+
 } // namespace bullet
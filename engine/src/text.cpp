@@ -0,0 +1,246 @@
+#include "bullet_engine/text.hpp"
+#include "bullet_engine/pool.hpp"
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+namespace bullet {
+
+// Pieces up to this size absorb adjacent small insertions (a fresh copy of
+// at most this many bytes); a rope that shrinks below half of kRopeMin goes
+// back to inline storage.
+static constexpr size_t kFoldMax = 128;
+
+namespace {
+
+struct Piece {
+    std::shared_ptr<const std::string> buf;
+    size_t off;
+    size_t len;
+
+    std::string_view view() const { return std::string_view(*buf).substr(off, len); }
+};
+
+} // namespace
+
+struct Text::TNode {
+    Piece piece;
+    uint32_t priority;
+    size_t bytes; // bytes in this subtree
+    Ptr left;
+    Ptr right;
+};
+
+// Priorities only need to be independent of the text; a per-thread sequence
+// keeps equal edit histories building equal trees.
+static uint32_t next_priority() {
+    thread_local uint64_t seq = 0;
+    uint64_t x = ++seq * 0x9E3779B97F4A7C15ull;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    return static_cast<uint32_t>(x);
+}
+
+template <class P>
+static size_t tbytes(const P& t) { return t ? t->bytes : 0; }
+
+template <class P>
+static P make(Piece piece, uint32_t priority, P left, P right) {
+    size_t bytes = piece.len + tbytes(left) + tbytes(right);
+    using T = typename P::element_type;
+    return make_pooled<T>(T{ std::move(piece), priority, bytes, std::move(left), std::move(right) });
+}
+
+template <class P>
+static P leaf(std::string s) {
+    const size_t len = s.size();
+    return make<P>(Piece{ make_pooled<const std::string>(std::move(s)), 0, len }, next_priority(), nullptr, nullptr);
+}
+
+template <class P>
+static P merge(const P& a, const P& b) {
+    if (!a) return b;
+    if (!b) return a;
+    if (a->priority >= b->priority) return make(a->piece, a->priority, a->left, merge(a->right, b));
+    return make(b->piece, b->priority, merge(a, b->left), b->right);
+}
+
+// lo receives bytes [0, pos), hi the rest; a piece straddling pos is cut in
+// two slices of the same buffer.
+template <class P>
+static void split(const P& t, size_t pos, P& lo, P& hi) {
+    if (!t) {
+        lo = hi = nullptr;
+        return;
+    }
+    const size_t before = tbytes(t->left);
+    if (pos <= before) {
+        P l;
+        split(t->left, pos, lo, l);
+        hi = make(t->piece, t->priority, l, t->right);
+    } else if (pos >= before + t->piece.len) {
+        P r;
+        split(t->right, pos - before - t->piece.len, r, hi);
+        lo = make(t->piece, t->priority, t->left, r);
+    } else {
+        const size_t k = pos - before;
+        const Piece& p = t->piece;
+        lo = make(Piece{ p.buf, p.off, k }, t->priority, t->left, P());
+        hi = make(Piece{ p.buf, p.off + k, p.len - k }, t->priority, P(), t->right);
+    }
+}
+
+template <class P>
+static const Piece& last_piece(const P& t) {
+    const auto* n = t.get();
+    while (n->right) n = n->right.get();
+    return n->piece;
+}
+
+Text::Text(std::string s) {
+    *this = std::move(s);
+}
+
+Text& Text::operator=(std::string s) {
+    root_ = nullptr;
+    small_.clear();
+    if (s.size() >= kRopeMin) root_ = leaf<Ptr>(std::move(s));
+    else small_ = std::move(s);
+    return *this;
+}
+
+size_t Text::size() const {
+    return root_ ? root_->bytes : small_.size();
+}
+
+std::string Text::str() const {
+    if (!root_) return small_;
+    std::string out;
+    out.reserve(root_->bytes);
+    visit([&out](std::string_view chunk) { out.append(chunk.data(), chunk.size()); });
+    return out;
+}
+
+void Text::visit(const std::function<void(std::string_view)>& f) const {
+    // in-order walk with an explicit stack (treap depth is O(log pieces))
+    std::vector<const TNode*> stack;
+    for (const TNode* n = root_.get(); n || !stack.empty();) {
+        if (n) {
+            stack.push_back(n);
+            n = n->left.get();
+            continue;
+        }
+        n = stack.back();
+        stack.pop_back();
+        if (n->piece.len) f(n->piece.view());
+        n = n->right.get();
+    }
+}
+
+size_t Text::piece_count() const {
+    if (!root_) return small_.empty() ? 0 : 1;
+    size_t n = 0;
+    visit([&n](std::string_view) { ++n; });
+    return n;
+}
+
+Text::Ptr Text::as_rope() const {
+    if (root_) return root_;
+    return small_.empty() ? nullptr : leaf<Ptr>(small_);
+}
+
+void Text::set_root(Ptr root) {
+    if (tbytes(root) < kRopeMin / 2) {
+        Text tmp;
+        tmp.root_ = std::move(root);
+        small_ = tmp.str();
+        root_ = nullptr;
+    } else {
+        small_.clear();
+        root_ = std::move(root);
+    }
+}
+
+Text Text::substr(size_t pos, size_t n) const {
+    assert(pos <= size());
+    Text out;
+    if (!root_) {
+        out.small_ = small_.substr(pos, n);
+        return out;
+    }
+    Ptr lo, mid, hi;
+    split(root_, pos, lo, mid);
+    if (n < tbytes(mid)) split(Ptr(mid), n, mid, hi);
+    out.set_root(std::move(mid));
+    return out;
+}
+
+void Text::insert(size_t pos, std::string_view s) {
+    assert(pos <= size());
+    if (s.empty()) return;
+    if (!root_ && small_.size() + s.size() < kRopeMin) {
+        small_.insert(pos, s.data(), s.size());
+        return;
+    }
+    Ptr lo, hi;
+    split(as_rope(), pos, lo, hi);
+    if (lo && last_piece(lo).len + s.size() <= kFoldMax) {
+        // typing: fold into the small piece before the caret
+        const Piece& last = last_piece(lo);
+        std::string folded;
+        folded.reserve(last.len + s.size());
+        folded.append(last.view()).append(s.data(), s.size());
+        Ptr rest, dropped;
+        split(lo, lo->bytes - last.len, rest, dropped);
+        lo = merge(rest, leaf<Ptr>(std::move(folded)));
+    } else {
+        lo = merge(lo, leaf<Ptr>(std::string(s)));
+    }
+    set_root(merge(lo, hi));
+}
+
+void Text::erase(size_t pos, size_t n) {
+    assert(pos <= size());
+    if (!root_) {
+        small_.erase(pos, n);
+        return;
+    }
+    Ptr lo, mid, hi;
+    split(root_, pos, lo, mid);
+    if (n < tbytes(mid)) split(Ptr(mid), n, mid, hi);
+    set_root(merge(lo, hi));
+}
+
+void Text::append(const Text& t) {
+    if (!root_ && !t.root_ && small_.size() + t.small_.size() < kRopeMin) {
+        small_ += t.small_;
+        return;
+    }
+    set_root(merge(as_rope(), t.as_rope()));
+}
+
+void Text::clear() {
+    small_.clear();
+    root_ = nullptr;
+}
+
+bool Text::equals(std::string_view s) const {
+    if (!root_) return small_ == s;
+    if (root_->bytes != s.size()) return false;
+    size_t at = 0;
+    bool same = true;
+    visit([&](std::string_view chunk) {
+        if (same && s.compare(at, chunk.size(), chunk) != 0) same = false;
+        at += chunk.size();
+    });
+    return same;
+}
+
+bool operator==(const Text& a, const Text& b) {
+    if (a.root_ && a.root_ == b.root_) return true;
+    if (a.size() != b.size()) return false;
+    return b.root_ ? a.equals(b.str()) : a.equals(b.small_);
+}
+
+} // namespace bullet
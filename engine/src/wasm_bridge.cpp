@@ -1,6 +1,11 @@
 #ifdef __EMSCRIPTEN__
 #include <emscripten/bind.h>
 #include "bullet_engine/types.hpp"
+#include "bullet_engine/exporter.hpp"
+#include "bullet_engine/history.hpp"
+#include "bullet_engine/importer.hpp"
+#include "bullet_engine/instrument.hpp"
+#include "bullet_engine/search.hpp"
 #include "bullet_engine/state_utils.hpp"
 
 using namespace emscripten;
@@ -10,71 +15,275 @@ using namespace bullet;
 class EngineWasm {
 public:
   EngineWasm() : s_(initial_state()) {}
+  ~EngineWasm() {
+    if (command_observer() == &metrics_) set_command_observer(nullptr);
+  }
 
   std::string focusedId() const { return s_.focusedId; }
   int caret() const { return s_.caret; }
 
   // Apply a command by components; id can be empty to target current focus.
-  void applyCommand(int type, std::string id, int caret, std::string scopeRoot) {
+  // The engine owns the only copy of the state, so it mutates in place
+  // (recording an undo step) and returns the change record: { touched,
+  // created, removed, rootOrderChanged, focusChanged, scopeChanged }.
+  val applyCommand(int type, std::string id, int caret, std::string scopeRoot) {
     Command cmd;
     cmd.type = static_cast<CommandType>(type);
     cmd.id = std::move(id);
     cmd.caret = caret;
     if (!scopeRoot.empty()) cmd.scopeRootId = scopeRoot; else cmd.scopeRootId = std::nullopt;
-    s_ = apply_command(s_, cmd);
+    return changed(history_.apply(s_, cmd));
+  }
+
+  // Paste multi-line plain text as new siblings after id (empty: focus).
+  val insertLinesAfter(std::string id, std::string text) {
+    Command cmd;
+    cmd.type = CommandType::InsertLinesAfter;
+    cmd.id = std::move(id);
+    cmd.text = std::move(text);
+    return changed(history_.apply(s_, cmd));
+  }
+
+  // Apply a packed batch in one call. `ints` is an Int32Array of
+  // kPackedStride-int records [type, caret, idIndex, argIndex]; the indices
+  // point into the `strings` array (-1: empty id / no argument). The argument
+  // is the command's string operand (scopeRoot for SetScopeRoot, the text
+  // for InsertLinesAfter/SetText/InsertText); for DeleteText the slot holds
+  // the byte count instead. The batch is one undo step; returns one change
+  // record merged over the batch.
+  val applyCommands(const val& ints, const val& strings) {
+    const std::vector<int> packed = convertJSArrayToNumberVector<int>(ints);
+    const std::vector<std::string> strs = vecFromJSArray<std::string>(strings);
+    auto str = [&](int i) -> const std::string* {
+      return (i >= 0 && static_cast<size_t>(i) < strs.size()) ? &strs[static_cast<size_t>(i)] : nullptr;
+    };
+    std::vector<Command> cmds;
+    cmds.reserve(packed.size() / kPackedStride);
+    for (size_t i = 0; i + kPackedStride <= packed.size(); i += kPackedStride) {
+      Command cmd;
+      cmd.type = static_cast<CommandType>(packed[i]);
+      cmd.caret = packed[i + 1];
+      if (const std::string* id = str(packed[i + 2])) cmd.id = *id;
+      if (cmd.type == CommandType::DeleteText) {
+        cmd.length = packed[i + 3];
+      } else if (const std::string* arg = str(packed[i + 3])) {
+        if (cmd.type == CommandType::SetScopeRoot && !arg->empty()) cmd.scopeRootId = *arg;
+        if (cmd.type == CommandType::InsertLinesAfter || cmd.type == CommandType::SetText ||
+            cmd.type == CommandType::InsertText) {
+          cmd.text = *arg;
+        }
+      }
+      cmds.push_back(std::move(cmd));
+    }
+    return changed(history_.apply_batch(s_, cmds));
   }
 
   // Minimal accessors for UI to read/update text when needed
   std::string getText(const std::string& id) const {
-    auto it = s_.nodes.find(id);
-    return it == s_.nodes.end() ? std::string() : it->second.text;
+    return text_of(s_, id);
   }
+  // Typing: consecutive edits of one node coalesce into a single undo step.
   void setText(const std::string& id, const std::string& text) {
-    auto it = s_.nodes.find(id);
-    if (it != s_.nodes.end()) it->second.text = text;
+    Command cmd;
+    cmd.type = CommandType::SetText;
+    cmd.id = id;
+    cmd.text = text;
+    changed(history_.apply(s_, cmd));
+  }
+
+  // Caret-based typing: insert text at caret (-1: the current caret), or
+  // delete `length` bytes from caret on. Long texts are ropes, so neither
+  // copies the node's text; consecutive edits coalesce into one undo step.
+  val insertText(std::string id, int caret, std::string text) {
+    Command cmd;
+    cmd.type = CommandType::InsertText;
+    cmd.id = std::move(id);
+    cmd.caret = caret;
+    cmd.text = std::move(text);
+    return changed(history_.apply(s_, cmd));
+  }
+  val deleteText(std::string id, int caret, int length) {
+    Command cmd;
+    cmd.type = CommandType::DeleteText;
+    cmd.id = std::move(id);
+    cmd.caret = caret;
+    cmd.length = length;
+    return changed(history_.apply(s_, cmd));
+  }
+
+  // Replace the document with an outline parsed from indented text (or
+  // Markdown bullets/headings). Starts a fresh undo history.
+  void loadOutline(const std::string& text, bool markdown) {
+    ImportOptions opts;
+    opts.format = markdown ? OutlineFormat::Markdown : OutlineFormat::IndentedText;
+    s_ = import_outline(text, opts);
+    history_.clear();
+    search_.reset();
+  }
+
+  // Serialize the scope root's subtree (or everything when wholeTree is set)
+  // in one pass. format: 0 indented text, 1 Markdown, 2 OPML, 3 JSON.
+  std::string exportOutline(int format, bool wholeTree) const {
+    ExportOptions opts;
+    opts.format = static_cast<ExportFormat>(format);
+    opts.wholeTree = wholeTree;
+    return export_outline_string(s_, opts);
+  }
+
+  // Case-insensitive substring search; matching ids in document order.
+  // The index is built on the first call and then kept current with every
+  // edit. limit <= 0 means no limit.
+  val search(const std::string& query, bool scoped, int limit) {
+    if (!search_) search_.emplace(s_);
+    SearchOptions opts;
+    opts.scoped = scoped;
+    if (limit > 0) opts.limit = static_cast<size_t>(limit);
+    return toArray(search_->search(s_, query, opts));
+  }
+
+  // Per-command metrics, collected only in builds configured with
+  // BULLET_ENGINE_INSTRUMENT. Enabling installs this engine's collector as
+  // the command observer; commandMetrics() returns CommandMetrics::to_json().
+  bool metricsAvailable() const { return kInstrumentationEnabled; }
+  void setMetricsEnabled(bool on) {
+    if (on) set_command_observer(&metrics_);
+    else if (command_observer() == &metrics_) set_command_observer(nullptr);
   }
+  std::string commandMetrics() const { return metrics_.to_json(); }
+  void resetMetrics() { metrics_.reset(); }
+
+  // History
+  val undo() { return changed(history_.undo(s_)); }
+  val redo() { return changed(history_.redo(s_)); }
+  bool canUndo() const { return history_.can_undo(); }
+  bool canRedo() const { return history_.can_redo(); }
+
+  bool isCollapsed(const std::string& id) const { return is_collapsed(s_, id); }
 
   // Navigation helpers
   std::string prevVisible(const std::string& id) const { return prev_visible_id(s_, id); }
   std::string nextVisible(const std::string& id) const { return next_visible_id(s_, id); }
+  // Visible-row positions (respecting scope): row count, row of id (-1 if not visible), id at row
+  int visibleCount() const { return static_cast<int>(visible_count(s_)); }
+  int visibleIndex(const std::string& id) const {
+    auto r = visible_rank(s_, find_node(s_, id));
+    return r ? static_cast<int>(*r) : -1;
+  }
+  std::string visibleAt(int row) const {
+    return row < 0 ? std::string() : id_of(s_, visible_at(s_, static_cast<size_t>(row)));
+  }
+  // Viewport rows for a virtualized list: [{ id, depth, text, childCount, descendantCount, collapsed }, ...]
+  val window(int offset, int count) const {
+    if (offset < 0 || count <= 0) return val::array();
+    return toRows(visible_window(s_, static_cast<size_t>(offset), static_cast<size_t>(count)));
+  }
+  val windowFrom(const std::string& anchorId, int count) const {
+    if (count <= 0) return val::array();
+    return toRows(visible_window_from(s_, anchorId, static_cast<size_t>(count)));
+  }
   val ancestorsToRoot(const std::string& id) const {
-    val arr = val::array();
-    auto chain = ancestors_to_root(s_, id);
-    for (size_t i = 0; i < chain.size(); ++i) arr.set(i, chain[i]);
-    return arr;
+    return toArray(ancestors_to_root(s_, id));
+  }
+
+  // Cached aggregates of id's subtree, or of the whole forest for '': { descendants, depth, textBytes }
+  val subtreeStats(const std::string& id) const {
+    const SubtreeStats st = subtree_aggregates(s_, id);
+    val out = val::object();
+    out.set("descendants", static_cast<double>(st.nodes == 0 || id.empty() ? st.nodes : st.nodes - 1));
+    out.set("depth", static_cast<int>(st.depth));
+    out.set("textBytes", static_cast<double>(st.textBytes));
+    return out;
   }
 
   // Root order snapshot for rendering
   val rootOrder() const {
-    val arr = val::array();
-    for (size_t i = 0; i < s_.rootOrder.size(); ++i) arr.set(i, s_.rootOrder[i]);
-    return arr;
+    return toArray(root_ids(s_));
   }
   // Children of id
   val children(const std::string& id) const {
+    return toArray(child_ids(s_, id));
+  }
+
+private:
+  // Keep the search index (once built) in step with an edit.
+  val changed(const ChangeSet& ch) {
+    if (search_) search_->update(s_, ch);
+    return toChanges(ch);
+  }
+
+  static constexpr size_t kPackedStride = 4;
+
+  static val toChanges(const ChangeSet& ch) {
+    val out = val::object();
+    out.set("touched", toArray(ch.touched));
+    out.set("created", toArray(ch.created));
+    out.set("removed", toArray(ch.removed));
+    out.set("rootOrderChanged", ch.rootOrderChanged);
+    out.set("focusChanged", ch.focusChanged);
+    out.set("scopeChanged", ch.scopeChanged);
+    return out;
+  }
+
+  static val toArray(const std::vector<std::string>& ids) {
     val arr = val::array();
-    auto it = s_.nodes.find(id);
-    if (it == s_.nodes.end()) return arr;
-    const auto& ch = it->second.children;
-    for (size_t i = 0; i < ch.size(); ++i) arr.set(i, ch[i]);
+    for (size_t i = 0; i < ids.size(); ++i) arr.set(i, ids[i]);
+    return arr;
+  }
+
+  static val toRows(const std::vector<ViewRow>& rows) {
+    val arr = val::array();
+    for (size_t i = 0; i < rows.size(); ++i) {
+      val row = val::object();
+      row.set("id", rows[i].id);
+      row.set("depth", static_cast<int>(rows[i].depth));
+      row.set("text", rows[i].text);
+      row.set("childCount", static_cast<int>(rows[i].childCount));
+      row.set("descendantCount", static_cast<double>(rows[i].descendantCount));
+      row.set("collapsed", rows[i].collapsed);
+      arr.set(i, row);
+    }
     return arr;
   }
 
-private:
   State s_;
+  History history_;
+  std::optional<SearchIndex> search_;
+  CommandMetrics metrics_;
 };
 
 EMSCRIPTEN_BINDINGS(bullet_engine_module) {
   class_<EngineWasm>("Engine")
       .constructor<>()
       .function("applyCommand", &EngineWasm::applyCommand)
+      .function("applyCommands", &EngineWasm::applyCommands)
+      .function("insertLinesAfter", &EngineWasm::insertLinesAfter)
       .function("focusedId", &EngineWasm::focusedId)
       .function("caret", &EngineWasm::caret)
       .function("getText", &EngineWasm::getText)
       .function("setText", &EngineWasm::setText)
+      .function("insertText", &EngineWasm::insertText)
+      .function("deleteText", &EngineWasm::deleteText)
+      .function("loadOutline", &EngineWasm::loadOutline)
+      .function("exportOutline", &EngineWasm::exportOutline)
+      .function("search", &EngineWasm::search)
+      .function("metricsAvailable", &EngineWasm::metricsAvailable)
+      .function("setMetricsEnabled", &EngineWasm::setMetricsEnabled)
+      .function("commandMetrics", &EngineWasm::commandMetrics)
+      .function("resetMetrics", &EngineWasm::resetMetrics)
+      .function("isCollapsed", &EngineWasm::isCollapsed)
+      .function("undo", &EngineWasm::undo)
+      .function("redo", &EngineWasm::redo)
+      .function("canUndo", &EngineWasm::canUndo)
+      .function("canRedo", &EngineWasm::canRedo)
       .function("prevVisible", &EngineWasm::prevVisible)
       .function("nextVisible", &EngineWasm::nextVisible)
+      .function("visibleCount", &EngineWasm::visibleCount)
+      .function("visibleIndex", &EngineWasm::visibleIndex)
+      .function("visibleAt", &EngineWasm::visibleAt)
+      .function("window", &EngineWasm::window)
+      .function("windowFrom", &EngineWasm::windowFrom)
       .function("ancestorsToRoot", &EngineWasm::ancestorsToRoot)
+      .function("subtreeStats", &EngineWasm::subtreeStats)
       .function("rootOrder", &EngineWasm::rootOrder)
       .function("children", &EngineWasm::children);
 }
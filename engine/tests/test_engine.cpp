@@ -1,12 +1,32 @@
 #include "bullet_engine/types.hpp"
+#include "bullet_engine/exporter.hpp"
+#include "bullet_engine/history.hpp"
+#include "bullet_engine/host.hpp"
+#include "bullet_engine/importer.hpp"
+#include "bullet_engine/instrument.hpp"
+#include "bullet_engine/journal.hpp"
+#include "bullet_engine/parallel.hpp"
+#include "bullet_engine/pool.hpp"
+#include "bullet_engine/scan.hpp"
+#include "bullet_engine/search.hpp"
+#include "bullet_engine/snapshot.hpp"
+#include "bullet_engine/state_handle.hpp"
 #include "bullet_engine/state_utils.hpp"
+#include <atomic>
 #include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
 #include <vector>
 #include <unordered_set>
 #include <unordered_map>
 #include <random>
 #include <chrono>
+#include <thread>
 
 using namespace bullet;
 
@@ -31,73 +51,145 @@ static void assert_true(bool cond, const char* msg) {
 
 static void reset(State& s) { s = initial_state(); }
 
+// Visible-order queries (count, rank, i-th, prev/next) agree with a full preorder walk
+static void verify_visible_index(const State& s) {
+    auto vis = visible_order(s);
+    assert_eq_size(visible_count(s), vis.size(), "visible_count matches preorder");
+    for (size_t i = 0; i < vis.size(); ++i) {
+        assert_true(visible_at(s, i) == vis[i], "visible_at matches preorder");
+        auto r = visible_rank(s, vis[i]);
+        assert_true(r.has_value() && *r == i, "visible_rank matches preorder");
+        assert_true(prev_visible(s, vis[i]) == (i > 0 ? vis[i - 1] : NodeHandle{}), "prev_visible matches preorder");
+        assert_true(next_visible(s, vis[i]) == (i + 1 < vis.size() ? vis[i + 1] : NodeHandle{}), "next_visible matches preorder");
+    }
+    assert_true(!visible_at(s, vis.size()), "visible_at past the end is null");
+    // lazy rows agree with the materialised order, depth included
+    size_t i = 0;
+    for (const VisibleRow& row : visible_rows(s)) {
+        assert_true(i < vis.size() && row.node == vis[i], "visible_rows matches preorder");
+        size_t depth = 0;
+        for (NodeHandle x = row.node; id_of(s, x) != s.scopeRootId.value_or("") && s.nodes.get(x).parent; x = s.nodes.get(x).parent) ++depth;
+        assert_eq_size(row.depth, depth, "visible row depth");
+        ++i;
+    }
+    assert_eq_size(i, vis.size(), "visible_rows length");
+    if (!vis.empty()) {
+        size_t mid = vis.size() / 2;
+        size_t n = 0;
+        for (const VisibleRow& row : visible_rows_from(s, vis[mid])) {
+            assert_true(row.node == vis[mid + n], "visible_rows_from matches preorder");
+            ++n;
+        }
+        assert_eq_size(mid + n, vis.size(), "visible_rows_from reaches the end");
+    }
+    // cached sizes, hidden subtrees included
+    s.nodes.for_each([&](NodeHandle, const Node& n) {
+        size_t expect = 1;
+        if (!n.collapsed) {
+            for (NodeHandle c = n.children.first; c; c = s.nodes.get(c).next) expect += s.nodes.get(c).visibleSize;
+        }
+        assert_eq_size(n.visibleSize, expect, "visibleSize matches children");
+    });
+}
+
 // Invariant checks: no orphans, correct parent/children linkage, roots have empty parentId, no duplicates
 static void verify_invariants(const State& s) {
     // at least one root
-    assert_true(!s.rootOrder.empty(), "at least one root");
+    auto roots = root_ids(s);
+    assert_true(!roots.empty(), "at least one root");
     // roots exist and have empty parent
     std::unordered_set<std::string> seen;
     std::unordered_set<std::string> roots_set;
-    roots_set.insert(s.rootOrder.begin(), s.rootOrder.end());
-    assert_true(roots_set.size() == s.rootOrder.size(), "no duplicate roots");
-    for (const auto& rid : s.rootOrder) {
-        auto it = s.nodes.find(rid);
-        assert_true(it != s.nodes.end(), "root id exists");
-        assert_true(it->second.parentId.empty(), "root parentId empty");
+    roots_set.insert(roots.begin(), roots.end());
+    assert_true(roots_set.size() == roots.size(), "no duplicate roots");
+    for (const auto& rid : roots) {
+        assert_true(has_node(s, rid), "root id exists");
+        assert_true(parent_id(s, rid).empty(), "root parentId empty");
     }
     // traverse and check children linkage
     std::function<void(const std::string&)> dfs = [&](const std::string& id){
         assert_true(seen.insert(id).second, "no duplicate visit");
-        const auto& node = s.nodes.at(id);
         std::unordered_set<std::string> childset;
-        for (const auto& cid : node.children) {
+        for (const auto& cid : child_ids(s, id)) {
             assert_true(childset.insert(cid).second, "no duplicate children");
-            auto itc = s.nodes.find(cid);
-            assert_true(itc != s.nodes.end(), "child exists");
-            assert_eq(itc->second.parentId, node.id, "child parent link");
+            assert_true(has_node(s, cid), "child exists");
+            assert_eq(parent_id(s, cid), id, "child parent link");
             dfs(cid);
         }
     };
     // also track containment counts
     std::unordered_map<std::string, int> contain_count;
-    for (const auto& rid : s.rootOrder) {
+    for (const auto& rid : roots) {
         dfs(rid);
         contain_count[rid] += 1;
     }
-    for (const auto& kv : s.nodes) {
-        const auto& node = kv.second;
-        for (const auto& cid : node.children) {
+    auto ids = node_ids(s);
+    for (const auto& id : ids) {
+        for (const auto& cid : child_ids(s, id)) {
             contain_count[cid] += 1;
         }
     }
     // ensure all nodes are reachable from roots
-    assert_true(seen.size() == s.nodes.size(), "no orphans reachable from roots");
+    assert_true(seen.size() == node_count(s), "no orphans reachable from roots");
     // ensure every node appears in exactly one container (rootOrder or exactly one parent's children)
-    for (const auto& kv : s.nodes) {
-        auto it = contain_count.find(kv.first);
+    for (const auto& id : ids) {
+        auto it = contain_count.find(id);
         int c = (it == contain_count.end()) ? 0 : it->second;
-        if (kv.second.parentId.empty()) {
+        if (parent_id(s, id).empty()) {
             assert_true(c == 1, "root appears exactly once in rootOrder");
         } else {
             assert_true(c == 1, "child appears exactly once under a parent");
         }
+        // handles round-trip through the intern table
+        assert_eq(id_of(s, find_node(s, id)), id, "id interning round-trips");
     }
+    // sibling index agrees with the linked order of every container
+    auto check_index = [&](const std::vector<std::string>& sibs) {
+        for (size_t i = 0; i < sibs.size(); ++i) {
+            NodeHandle h = find_node(s, sibs[i]);
+            assert_eq_size(index_in_siblings(s, h), i, "index_in_siblings matches position");
+            assert_true(sibling_at(siblings_cref(s, h), i) == h, "sibling_at matches position");
+        }
+        if (!sibs.empty()) assert_eq_size(siblings_cref(s, find_node(s, sibs[0])).size(), sibs.size(), "container size");
+    };
+    check_index(roots);
+    for (const auto& id : ids) check_index(child_ids(s, id));
+    verify_visible_index(s);
     // focusedId exists and caret bounds
-    assert_true(s.nodes.find(s.focusedId) != s.nodes.end(), "focusedId exists");
-    const auto& fnode = s.nodes.at(s.focusedId);
-    assert_true(s.caret >= 0 && s.caret <= (int)fnode.text.size(), "caret within bounds");
+    assert_true(has_node(s, s.focusedId), "focusedId exists");
+    assert_true(s.caret >= 0 && s.caret <= (int)text_of(s, s.focusedId).size(), "caret within bounds");
     // scopeRootId validity if set
     if (s.scopeRootId.has_value() && !s.scopeRootId->empty()) {
-        assert_true(s.nodes.find(*s.scopeRootId) != s.nodes.end(), "scopeRootId exists");
+        assert_true(has_node(s, *s.scopeRootId), "scopeRootId exists");
+    }
+    // the library's validator agrees
+    const std::vector<Violation> violations = validate(s);
+    for (const Violation& v : violations) std::cerr << "violation: " << v.id << ": " << v.message << "\n";
+    assert_true(violations.empty(), "validate() reports no violation");
+}
+
+// Structural equality of two states (node contents, containers and view state)
+static bool same_state(const State& a, const State& b) {
+    if (node_count(a) != node_count(b)) return false;
+    for (const auto& id : node_ids(a)) {
+        if (!has_node(b, id)) return false;
+        if (parent_id(a, id) != parent_id(b, id) || text_of(a, id) != text_of(b, id) || child_ids(a, id) != child_ids(b, id)) return false;
+        if (is_collapsed(a, id) != is_collapsed(b, id)) return false;
     }
+    return root_ids(a) == root_ids(b) && a.focusedId == b.focusedId && a.caret == b.caret &&
+           a.scopeRootId == b.scopeRootId && a.idCounter == b.idCounter;
+}
+
+static bool contains(const std::vector<std::string>& ids, const std::string& id) {
+    return std::find(ids.begin(), ids.end(), id) != ids.end();
 }
 
 static State apply_and_check(State s, const Command& cmd, std::optional<int> expectDelta = std::nullopt) {
-    size_t before = s.nodes.size();
+    size_t before = node_count(s);
     s = apply_command(s, cmd);
     verify_invariants(s);
     if (expectDelta.has_value()) {
-        long delta = static_cast<long>(s.nodes.size()) - static_cast<long>(before);
+        long delta = static_cast<long>(node_count(s)) - static_cast<long>(before);
         assert_true(delta == *expectDelta, "node count delta matches expectation");
     }
     return s;
@@ -107,144 +199,144 @@ int main() {
     // 1) Initial state
     State s = initial_state();
     assert_eq(s.focusedId, "n1", "initial focused id");
-    assert_true(s.nodes.size() == 1 && s.rootOrder.size() == 1, "one root node");
+    assert_true(node_count(s) == 1 && root_ids(s).size() == 1, "one root node");
 
     // 2) Enter split mid-text: second gets children; focus/caret
-    s.nodes[s.focusedId].text = "Hello";
+    set_text(s, s.focusedId, "Hello");
     s.caret = 5;
     s = apply_and_check(s, Command{ CommandType::SplitAtCaret, s.focusedId, 2 }, +1);
-    assert_eq(s.nodes["n1"].text, "He", "n1 text after split");
-    assert_true(s.nodes.find("n2") != s.nodes.end(), "n2 exists");
-    assert_eq(s.nodes["n2"].text, "llo", "n2 text after split");
+    assert_eq(text_of(s, "n1"), "He", "n1 text after split");
+    assert_true(has_node(s, "n2"), "n2 exists");
+    assert_eq(text_of(s, "n2"), "llo", "n2 text after split");
     assert_eq(s.focusedId, "n2", "focus moved to second after split");
     assert_true(s.caret == 0, "caret at start after split");
 
     // Split when original has children: second should receive them
     s = apply_and_check(s, Command{ CommandType::Indent, "n2" });
-    s.nodes["n1"].text = "AB";
+    set_text(s, "n1", "AB");
     s = apply_and_check(s, Command{ CommandType::SplitAtCaret, "n1", 1 }, +1);
     // Now n3 is second half, and gets children, n1 children empty
-    assert_true(s.nodes["n1"].children.empty(), "first segment lost children");
-    assert_true(s.nodes["n3"].children.size() == 1 && s.nodes["n3"].children[0] == "n2", "second segment got children");
-    assert_eq(s.nodes["n1"].text, "A", "n1 text after split 2");
-    assert_eq(s.nodes["n3"].text, "B", "n3 text after split 2");
+    assert_true(child_ids(s, "n1").empty(), "first segment lost children");
+    assert_true(child_ids(s, "n3").size() == 1 && child_ids(s, "n3")[0] == "n2", "second segment got children");
+    assert_eq(text_of(s, "n1"), "A", "n1 text after split 2");
+    assert_eq(text_of(s, "n3"), "B", "n3 text after split 2");
 
     // 3) End-of-text create empty sibling at same level
     s = apply_and_check(s, Command{ CommandType::InsertEmptySiblingAfter, "n3" }, +1);
     std::string n4 = s.focusedId;
-    assert_true(s.nodes[n4].text.empty(), "new sibling empty");
+    assert_true(text_of(s, n4).empty(), "new sibling empty");
 
     // 4) Empty indented Enter (simulate outdent via command) until root; then create empty root sibling
     // Structure: create two roots then indent second under first, then outdent twice
     reset(s);
-    s.nodes[s.focusedId].text = "P"; // n1
+    set_text(s, s.focusedId, "P"); // n1
     s = apply_and_check(s, Command{ CommandType::InsertEmptySiblingAfter, "n1" }, +1); // n2
-    s.nodes[s.focusedId].text = "C";
+    set_text(s, s.focusedId, "C");
     s = apply_command(s, Command{ CommandType::Indent, "n2" }); // n2 under n1
     // Simulate Enter on empty indented: outdent — set n2 empty and outdent repeatedly
-    s.nodes["n2"].text.clear();
+    set_text(s, "n2", "");
     s = apply_and_check(s, Command{ CommandType::Outdent, "n2" }); // becomes sibling of n1
-    assert_true(s.nodes["n2"].parentId.empty(), "n2 outdented to root");
+    assert_true(parent_id(s, "n2").empty(), "n2 outdented to root");
     // At root, Enter creates empty root sibling → simulate by insert after
     s = apply_and_check(s, Command{ CommandType::InsertEmptySiblingAfter, "n2" }, +1);
-    assert_true(s.rootOrder.size() == 3, "root sibling added after outdent");
+    assert_true(root_ids(s).size() == 3, "root sibling added after outdent");
 
     // 5) Tab/Shift+Tab
     reset(s);
     // Two roots
-    s.nodes["n1"].text = "A";
+    set_text(s, "n1", "A");
     s = apply_and_check(s, Command{ CommandType::InsertEmptySiblingAfter, "n1" }, +1); // n2
-    s.nodes["n2"].text = "B";
+    set_text(s, "n2", "B");
     // Tab on first root (no previous sibling) → no-op
     s = apply_command(s, Command{ CommandType::Indent, "n1" });
-    assert_true(s.nodes["n1"].parentId.empty() && s.rootOrder.size() == 2, "Tab on first root no-op");
+    assert_true(parent_id(s, "n1").empty() && root_ids(s).size() == 2, "Tab on first root no-op");
     // Tab on second root → becomes child of first
     s = apply_and_check(s, Command{ CommandType::Indent, "n2" });
-    assert_true(s.nodes["n1"].children.size() == 1 && s.nodes["n1"].children[0] == "n2", "Tab indents under prev sibling");
+    assert_true(child_ids(s, "n1").size() == 1 && child_ids(s, "n1")[0] == "n2", "Tab indents under prev sibling");
     // Shift+Tab on n2 → outdent to become next sibling of n1
     s = apply_and_check(s, Command{ CommandType::Outdent, "n2" });
-    assert_true(s.nodes["n2"].parentId.empty(), "outdent to root");
-    assert_true(s.rootOrder.size() == 2 && s.rootOrder[1] == "n2", "n2 after n1 at root");
+    assert_true(parent_id(s, "n2").empty(), "outdent to root");
+    assert_true(root_ids(s).size() == 2 && root_ids(s)[1] == "n2", "n2 after n1 at root");
     // Shift+Tab on root → no-op
     auto s_before = s;
     s = apply_and_check(s, Command{ CommandType::Outdent, "n2" });
-    assert_true(s.rootOrder == s_before.rootOrder, "outdent at root no-op");
+    assert_true(root_ids(s) == root_ids(s_before), "outdent at root no-op");
 
     // 6) Reorder within siblings; hoist/sink at bounds; subtree preserved
     reset(s);
     // roots: n1, n2, n3
-    s.nodes["n1"].text = "R1";
+    set_text(s, "n1", "R1");
     s = apply_and_check(s, Command{ CommandType::InsertEmptySiblingAfter, "n1" }, +1); // n2
-    s.nodes["n2"].text = "R2";
+    set_text(s, "n2", "R2");
     s = apply_and_check(s, Command{ CommandType::InsertEmptySiblingAfter, "n2" }, +1); // n3
-    s.nodes["n3"].text = "R3";
+    set_text(s, "n3", "R3");
     // moveDown n1 -> n1, n2 swap -> n2, n1, n3
     s = apply_and_check(s, Command{ CommandType::MoveDown, "n1" });
-    assert_true(s.rootOrder[0] == "n2" && s.rootOrder[1] == "n1", "moveDown swap within siblings");
+    assert_true(root_ids(s)[0] == "n2" && root_ids(s)[1] == "n1", "moveDown swap within siblings");
     // moveUp n1 -> swap with n2 back to n1, n2, n3
     s = apply_and_check(s, Command{ CommandType::MoveUp, "n1" });
-    assert_true(s.rootOrder[0] == "n1", "moveUp swap back");
+    assert_true(root_ids(s)[0] == "n1", "moveUp swap back");
     // Bounds: moveUp at first root is no-op
-    auto ro_before = s.rootOrder;
+    auto ro_before = root_ids(s);
     s = apply_and_check(s, Command{ CommandType::MoveUp, "n1" });
-    assert_true(s.rootOrder == ro_before, "moveUp at first root no-op");
+    assert_true(root_ids(s) == ro_before, "moveUp at first root no-op");
     // Create child under n2 and test hoist/sink across levels
     s = apply_and_check(s, Command{ CommandType::Indent, "n3" }); // n3 under n2
     // moveUp n3 at first child position -> hoist before parent (n2)
     s = apply_and_check(s, Command{ CommandType::MoveUp, "n3" });
-    assert_true(s.nodes["n3"].parentId.empty(), "n3 hoisted to root");
-    assert_true(s.rootOrder[1] == "n3" && s.rootOrder[2] == "n2", "n3 before former parent");
+    assert_true(parent_id(s, "n3").empty(), "n3 hoisted to root");
+    assert_true(root_ids(s)[1] == "n3" && root_ids(s)[2] == "n2", "n3 before former parent");
     // Sink: moveDown n3 at last root position -> after parent (n2)
     // Ensure n3 is just before n2, then sink
     s = apply_and_check(s, Command{ CommandType::MoveDown, "n3" });
-    assert_true(s.rootOrder[1] == "n2" && s.rootOrder[2] == "n3", "n3 sunk after parent");
+    assert_true(root_ids(s)[1] == "n2" && root_ids(s)[2] == "n3", "n3 sunk after parent");
 
     // 7) Backspace/Delete behaviors via commands
     reset(s);
     // Create two roots, second has children
-    s.nodes["n1"].text = "A";
+    set_text(s, "n1", "A");
     s = apply_command(s, Command{ CommandType::InsertEmptySiblingAfter, "n1" }); // n2
-    s.nodes["n2"].text = "B";
+    set_text(s, "n2", "B");
     // Delete-empty on non-empty should be no-op (engine only deletes empty w/o children)
-    auto count_before = s.nodes.size();
+    auto count_before = node_count(s);
     s = apply_and_check(s, Command{ CommandType::DeleteEmptyAtId, "n2" });
-    assert_true(s.nodes.size() == count_before, "deleteEmpty no-op on non-empty");
+    assert_true(node_count(s) == count_before, "deleteEmpty no-op on non-empty");
     // Make n2 empty and childless then delete
-    s.nodes["n2"].text.clear();
+    set_text(s, "n2", "");
     s = apply_and_check(s, Command{ CommandType::DeleteEmptyAtId, "n2" }, -1);
-    assert_true(s.nodes.find("n2") == s.nodes.end(), "empty childless deleted");
+    assert_true(!has_node(s, "n2"), "empty childless deleted");
     // Guard last root: deleting last root clears text instead
     reset(s);
-    s.nodes["n1"].text = "X";
-    s.nodes["n1"].text.clear();
+    set_text(s, "n1", "X");
+    set_text(s, "n1", "");
     s = apply_and_check(s, Command{ CommandType::DeleteEmptyAtId, "n1" });
-    assert_true(s.nodes.find("n1") != s.nodes.end(), "last root not deleted");
-    assert_true(s.nodes["n1"].text.empty(), "last root text cleared");
+    assert_true(has_node(s, "n1"), "last root not deleted");
+    assert_true(text_of(s, "n1").empty(), "last root text cleared");
 
     // Delete key at end merge: only when next is sibling and current has no children
     reset(s);
-    s.nodes["n1"].text = "A";
+    set_text(s, "n1", "A");
     s = apply_and_check(s, Command{ CommandType::InsertEmptySiblingAfter, "n1" }, +1); // n2
-    s.nodes["n2"].text = "B";
+    set_text(s, "n2", "B");
     // current has no children → merge next sibling
     s = apply_and_check(s, Command{ CommandType::MergeNextSiblingIntoCurrent, "n1" }, -1);
-    assert_true(s.nodes.find("n2") == s.nodes.end(), "merged sibling removed");
-    assert_eq(s.nodes["n1"].text, "AB", "merged text AB");
-    assert_true(s.caret == (int)s.nodes["n1"].text.size(), "caret at end after merge");
+    assert_true(!has_node(s, "n2"), "merged sibling removed");
+    assert_eq(text_of(s, "n1"), "AB", "merged text AB");
+    assert_true(s.caret == (int)text_of(s, "n1").size(), "caret at end after merge");
     // If current has children → no merge
     s = apply_and_check(s, Command{ CommandType::InsertEmptySiblingAfter, "n1" }, +1); // n3
-    s.nodes["n3"].text = "C";
+    set_text(s, "n3", "C");
     s = apply_and_check(s, Command{ CommandType::Indent, "n3" });
-    auto nodes_before = s.nodes.size();
+    auto nodes_before = node_count(s);
     s = apply_and_check(s, Command{ CommandType::MergeNextSiblingIntoCurrent, "n1" });
-    assert_true(s.nodes.size() == nodes_before, "no merge when current has children");
+    assert_true(node_count(s) == nodes_before, "no merge when current has children");
 
     // 8) Navigation helpers prev/next visible
     reset(s);
     // n1, n2, with n2 having child n3
-    s.nodes["n1"].text = "A";
+    set_text(s, "n1", "A");
     s = apply_and_check(s, Command{ CommandType::InsertEmptySiblingAfter, "n1" }, +1); // n2
-    s.nodes["n2"].text = "B";
+    set_text(s, "n2", "B");
     s = apply_and_check(s, Command{ CommandType::InsertEmptySiblingAfter, "n2" }, +1); // n3
     std::string n3_id = s.focusedId;
     // indent n3 under n2
@@ -255,32 +347,32 @@ int main() {
 
     // 9) Paste composition: simulate multi-line by repeated insert-after
     reset(s);
-    s.nodes["n1"].text = "Line 1";
+    set_text(s, "n1", "Line 1");
     std::vector<std::string> lines = {"Line 2", "Line 3", "Line 4"};
     std::string after = "n1";
     for (const auto& line : lines) {
     s = apply_and_check(s, Command{ CommandType::InsertEmptySiblingAfter, after }, +1);
         std::string nid = s.focusedId;
-        s.nodes[nid].text = line;
+        set_text(s, nid, line);
         after = nid;
     }
-    assert_eq_size(s.rootOrder.size(), 4, "paste produced 3 new roots");
-    assert_eq(s.nodes[s.rootOrder[1]].text, "Line 2", "paste line 2");
-    assert_eq(s.nodes[s.rootOrder[3]].text, "Line 4", "paste line 4");
+    assert_eq_size(root_ids(s).size(), 4, "paste produced 3 new roots");
+    assert_eq(text_of(s, root_ids(s)[1]), "Line 2", "paste line 2");
+    assert_eq(text_of(s, root_ids(s)[3]), "Line 4", "paste line 4");
 
     // 10) Scope/drill-down: visible_order_ids and ancestors_to_root
     reset(s);
     // Build tree: n1(root), n2(sibling), n3(child of n2), n4(child of n3)
-    s.nodes["n1"].text = "Root1";
+    set_text(s, "n1", "Root1");
     s = apply_and_check(s, Command{ CommandType::InsertEmptySiblingAfter, "n1" }, +1); // n2
-    s.nodes["n2"].text = "Root2";
+    set_text(s, "n2", "Root2");
     s = apply_and_check(s, Command{ CommandType::InsertEmptySiblingAfter, "n2" }, +1); // n3
     std::string n3id = s.focusedId;
-    s.nodes[n3id].text = "ChildOfRoot2";
+    set_text(s, n3id, "ChildOfRoot2");
     s = apply_and_check(s, Command{ CommandType::Indent, n3id }); // n3 under n2
     s = apply_and_check(s, Command{ CommandType::InsertEmptySiblingAfter, n3id }, +1); // n4 as sibling of n3 under n2
     std::string n4id = s.focusedId;
-    s.nodes[n4id].text = "GrandChild";
+    set_text(s, n4id, "GrandChild");
     s = apply_and_check(s, Command{ CommandType::Indent, n4id }); // n4 under n3
     // Without scope: order should be [n1, n2, n3, n4]
     auto vis = visible_order_ids(s);
@@ -309,8 +401,7 @@ int main() {
         // seed random
         std::mt19937 rng(static_cast<unsigned>(std::chrono::high_resolution_clock::now().time_since_epoch().count()));
         auto random_id = [&](const State& st) {
-            std::vector<std::string> ids; ids.reserve(st.nodes.size());
-            for (auto& kv : st.nodes) ids.push_back(kv.first);
+            std::vector<std::string> ids = node_ids(st);
             std::uniform_int_distribution<size_t> dist(0, ids.size()-1);
             return ids[dist(rng)];
         };
@@ -318,47 +409,44 @@ int main() {
             // randomly set short text or clear
             std::uniform_int_distribution<int> coin(0, 3);
             int c = coin(rng);
-            if (c == 0) st.nodes[id].text.clear();
-            else if (c == 1) st.nodes[id].text = "x";
-            else if (c == 2) st.nodes[id].text = "xy";
-            else st.nodes[id].text = ""; // treat as empty
+            if (c == 0) set_text(st, id, "");
+            else if (c == 1) set_text(st, id, "x");
+            else if (c == 2) set_text(st, id, "xy");
+            else set_text(st, id, ""); // treat as empty
         };
         auto check_nonfatal = [&](const State& st, const char* label){
             // copy of verify_invariants but non-fatal and with debug
             bool ok = true;
-            if (st.rootOrder.empty()) { std::cerr << "[fuzz] fail: no roots after " << label << "\n"; return false; }
-            for (const auto& rid : st.rootOrder) {
-                auto it = st.nodes.find(rid);
-                if (it == st.nodes.end() || !it->second.parentId.empty()) { std::cerr << "[fuzz] invalid root id="<<rid<<" after "<<label<<"\n"; return false; }
+            if (root_ids(st).empty()) { std::cerr << "[fuzz] fail: no roots after " << label << "\n"; return false; }
+            for (const auto& rid : root_ids(st)) {
+                if (!has_node(st, rid) || !parent_id(st, rid).empty()) { std::cerr << "[fuzz] invalid root id="<<rid<<" after "<<label<<"\n"; return false; }
             }
             std::unordered_set<std::string> seen;
             std::function<void(const std::string&)> dfs = [&](const std::string& id){
                 if (!seen.insert(id).second) return; // already seen
-                const auto& node = st.nodes.at(id);
-                for (const auto& cid : node.children) {
-                    auto itc = st.nodes.find(cid);
-                    if (itc == st.nodes.end()) { std::cerr << "[fuzz] missing child node id="<<cid<<"\n"; ok=false; continue; }
-                    if (itc->second.parentId != node.id) { std::cerr << "[fuzz] bad parent link child="<<cid<<" parent="<<itc->second.parentId<<" expected="<<node.id<<"\n"; ok=false; }
+                for (const auto& cid : child_ids(st, id)) {
+                    if (!has_node(st, cid)) { std::cerr << "[fuzz] missing child node id="<<cid<<"\n"; ok=false; continue; }
+                    if (parent_id(st, cid) != id) { std::cerr << "[fuzz] bad parent link child="<<cid<<" parent="<<parent_id(st, cid)<<" expected="<<id<<"\n"; ok=false; }
                     dfs(cid);
                 }
             };
-            for (const auto& rid : st.rootOrder) dfs(rid);
-            if (seen.size() != st.nodes.size()) {
-                std::cerr << "[fuzz] orphans: seen="<<seen.size()<<" nodes="<<st.nodes.size()<<" after "<<label<<"\n";
-                for (const auto& kv : st.nodes) {
-                    if (!seen.count(kv.first)) {
-                        std::cerr << "  orphan id="<<kv.first<<" parentId="<<kv.second.parentId<<" text='"<<kv.second.text<<"'\n";
+            for (const auto& rid : root_ids(st)) dfs(rid);
+            if (seen.size() != node_count(st)) {
+                std::cerr << "[fuzz] orphans: seen="<<seen.size()<<" nodes="<<node_count(st)<<" after "<<label<<"\n";
+                for (const auto& id : node_ids(st)) {
+                    if (!seen.count(id)) {
+                        std::cerr << "  orphan id="<<id<<" parentId="<<parent_id(st, id)<<" text='"<<text_of(st, id)<<"'\n";
                     }
                 }
                 ok = false;
             }
             // containment counts
             std::unordered_map<std::string,int> contain_count;
-            for (const auto& rid : st.rootOrder) contain_count[rid] += 1;
-            for (const auto& kv : st.nodes) for (const auto& cid : kv.second.children) contain_count[cid] += 1;
-            for (const auto& kv : st.nodes) {
-                int c = contain_count[kv.first];
-                if (c != 1) { std::cerr << "[fuzz] bad contain count id="<<kv.first<<" count="<<c<<"\n"; ok=false; }
+            for (const auto& rid : root_ids(st)) contain_count[rid] += 1;
+            for (const auto& id : node_ids(st)) for (const auto& cid : child_ids(st, id)) contain_count[cid] += 1;
+            for (const auto& id : node_ids(st)) {
+                int c = contain_count[id];
+                if (c != 1) { std::cerr << "[fuzz] bad contain count id="<<id<<" count="<<c<<"\n"; ok=false; }
             }
             return ok;
         };
@@ -370,7 +458,7 @@ int main() {
             std::string id = random_id(s);
             switch (c) {
                 case 0: // SplitAtCaret
-                    s.caret = std::min<int>(1, (int)s.nodes[id].text.size());
+                    s.caret = std::min<int>(1, (int)text_of(s, id).size());
                     s = apply_command(s, Command{ CommandType::SplitAtCaret, id, s.caret });
                     if (!check_nonfatal(s, "SplitAtCaret")) return 1;
                     break;
@@ -400,7 +488,7 @@ int main() {
                     if (!check_nonfatal(s, "DeleteEmptyAtId")) return 1;
                     break;
                 case 7: // MergeNextSiblingIntoCurrent
-                    if (!s.nodes[id].children.empty()) {
+                    if (!child_ids(s, id).empty()) {
                         // precondition not met; skip
                         continue;
                     }
@@ -419,59 +507,1688 @@ int main() {
     {
         reset(s);
         // Build: roots n1, n2; under n2 -> c1 (n3); under c1 -> g1 (n4)
-        s.nodes["n1"].text = "R1";
+        set_text(s, "n1", "R1");
         s = apply_and_check(s, Command{ CommandType::InsertEmptySiblingAfter, "n1" }, +1); // n2
-        s.nodes["n2"].text = "R2";
+        set_text(s, "n2", "R2");
         s = apply_and_check(s, Command{ CommandType::InsertEmptySiblingAfter, "n2" }, +1); // n3
         std::string n3id2 = s.focusedId;
-        s.nodes[n3id2].text = "C1";
+        set_text(s, n3id2, "C1");
         s = apply_and_check(s, Command{ CommandType::Indent, n3id2 }); // n3 under n2
         s = apply_and_check(s, Command{ CommandType::InsertEmptySiblingAfter, n3id2 }, +1); // n4
         std::string n4id2 = s.focusedId;
-        s.nodes[n4id2].text = "G1";
+        set_text(s, n4id2, "G1");
         s = apply_and_check(s, Command{ CommandType::Indent, n4id2 }); // n4 under n3
         // Sanity: n2.children = [n3]; n3.children = [n4]
-        assert_true(s.nodes["n2"].children.size() == 1 && s.nodes["n2"].children[0] == n3id2, "n3 under n2");
-        assert_true(s.nodes[n3id2].children.size() == 1 && s.nodes[n3id2].children[0] == n4id2, "n4 under n3");
+        assert_true(child_ids(s, "n2").size() == 1 && child_ids(s, "n2")[0] == n3id2, "n3 under n2");
+        assert_true(child_ids(s, n3id2).size() == 1 && child_ids(s, n3id2)[0] == n4id2, "n4 under n3");
 
         // Deep hoist n4 to before n3 (under n2)
         s = apply_and_check(s, Command{ CommandType::MoveUp, n4id2 });
-        assert_true(s.nodes[n4id2].parentId == "n2", "n4 hoisted to parent=n2");
-        assert_true(s.nodes["n2"].children.size() == 2 && s.nodes["n2"].children[0] == n4id2 && s.nodes["n2"].children[1] == n3id2, "n4 before n3 under n2");
+        assert_true(parent_id(s, n4id2) == "n2", "n4 hoisted to parent=n2");
+        assert_true(child_ids(s, "n2").size() == 2 && child_ids(s, "n2")[0] == n4id2 && child_ids(s, "n2")[1] == n3id2, "n4 before n3 under n2");
         // Hoist n4 again to root before n2
         s = apply_and_check(s, Command{ CommandType::MoveUp, n4id2 });
-        assert_true(s.nodes[n4id2].parentId.empty(), "n4 hoisted to root");
+        assert_true(parent_id(s, n4id2).empty(), "n4 hoisted to root");
         // n4 inserted before n2 in rootOrder
-        auto itn2 = std::find(s.rootOrder.begin(), s.rootOrder.end(), std::string("n2"));
-        auto itn4 = std::find(s.rootOrder.begin(), s.rootOrder.end(), n4id2);
+        auto roots = root_ids(s);
+        auto itn2 = std::find(roots.begin(), roots.end(), std::string("n2"));
+        auto itn4 = std::find(roots.begin(), roots.end(), n4id2);
         assert_true(itn4 < itn2, "n4 appears before n2 at root");
         // MoveUp n4 again swaps with previous root until first
         s = apply_and_check(s, Command{ CommandType::MoveUp, n4id2 });
-        assert_true(s.rootOrder.front() == n4id2, "n4 moved to first root");
+        assert_true(root_ids(s).front() == n4id2, "n4 moved to first root");
 
         // Deep sink: Build a separate chain under n1 then sink twice
         reset(s);
         // roots n1, n2
-        s.nodes["n1"].text = "R1";
+        set_text(s, "n1", "R1");
         s = apply_and_check(s, Command{ CommandType::InsertEmptySiblingAfter, "n1" }, +1); // n2
-        s.nodes["n2"].text = "R2";
+        set_text(s, "n2", "R2");
         // under n1 -> a (n3) -> b (n4)
         s = apply_and_check(s, Command{ CommandType::InsertEmptySiblingAfter, "n1" }, +1); // n3
-        std::string n3b = s.focusedId; s.nodes[n3b].text = "A"; s = apply_and_check(s, Command{ CommandType::Indent, n3b }); // under n1
+        std::string n3b = s.focusedId; set_text(s, n3b, "A"); s = apply_and_check(s, Command{ CommandType::Indent, n3b }); // under n1
         s = apply_and_check(s, Command{ CommandType::InsertEmptySiblingAfter, n3b }, +1); // n4
-        std::string n4b = s.focusedId; s.nodes[n4b].text = "B"; s = apply_and_check(s, Command{ CommandType::Indent, n4b }); // under n3b
+        std::string n4b = s.focusedId; set_text(s, n4b, "B"); s = apply_and_check(s, Command{ CommandType::Indent, n4b }); // under n3b
         // Make n1 last root to enable second sink step
         // Current rootOrder likely [n1, n2]; moveDown n1 -> [n2, n1]
         s = apply_and_check(s, Command{ CommandType::MoveDown, "n1" });
-        assert_true(s.rootOrder.back() == "n1", "n1 is last root");
+        assert_true(root_ids(s).back() == "n1", "n1 is last root");
         // Sink n4b: last in its siblings -> becomes next sibling of its parent (n3b) under n1
         s = apply_and_check(s, Command{ CommandType::MoveDown, n4b });
-        auto& ch = s.nodes["n1"].children;
+        auto ch = child_ids(s, "n1");
         assert_true(ch.size() == 2 && ch[0] == n3b && ch[1] == n4b, "n4b sunk after n3b under n1");
         // Sink n4b again: last under n1 and n1 is last root -> becomes next sibling of n1 at root
         s = apply_and_check(s, Command{ CommandType::MoveDown, n4b });
-        assert_true(s.nodes[n4b].parentId.empty(), "n4b sunk to root after n1");
-        assert_true(s.rootOrder.back() == n4b, "n4b at end of roots after sink");
+        assert_true(parent_id(s, n4b).empty(), "n4b sunk to root after n1");
+        assert_true(root_ids(s).back() == n4b, "n4b at end of roots after sink");
+    }
+
+    // 13) Persistence: old states stay valid and untouched nodes are shared
+    {
+        reset(s);
+        set_text(s, "n1", "A");
+        for (int i = 0; i < 200; ++i) {
+            s = apply_command(s, Command{ CommandType::InsertEmptySiblingAfter, s.focusedId });
+            set_text(s, s.focusedId, "x");
+        }
+        const State before = s;
+        std::string last = root_ids(s).back();
+        State after = apply_and_check(s, Command{ CommandType::Indent, last });
+        // old version unchanged
+        assert_true(parent_id(before, last).empty(), "old state keeps old parent");
+        assert_eq_size(root_ids(before).size(), 201, "old state keeps root count");
+        assert_true(child_ids(before, root_ids(before)[199]).empty(), "old state keeps old children");
+        verify_invariants(before);
+        // new version changed
+        assert_eq(parent_id(after, last), root_ids(before)[199], "new state reparented");
+        assert_eq_size(root_ids(after).size(), 200, "new state root count");
+        // untouched nodes are the same objects in both versions
+        assert_true(&before.nodes.get(find_node(before, "n1")) == &after.nodes.get(find_node(after, "n1")), "untouched node shared");
+        assert_true(&before.nodes.get(find_node(before, last)) != &after.nodes.get(find_node(after, last)), "touched node copied");
+        // a command that only moves focus shares every node and container
+        State focused = apply_command(after, Command{ CommandType::SetFocus, "n1", 0 });
+        assert_true(focused.nodes.shares_storage_with(after.nodes), "SetFocus shares node map");
+        // erasing from a later version leaves earlier versions intact
+        State trimmed = after;
+        set_text(trimmed, "n2", "");
+        trimmed = apply_and_check(trimmed, Command{ CommandType::DeleteEmptyAtId, "n2" }, -1);
+        assert_true(has_node(after, "n2"), "deleted node still in old version");
+        assert_eq_size(node_count(after), 201, "old version size unchanged");
+        size_t iterated = 0;
+        trimmed.nodes.for_each([&](NodeHandle, const Node&) { ++iterated; });
+        assert_eq_size(iterated, node_count(trimmed), "iteration visits every node");
+    }
+
+    // 14) In-place API: identical results to the pure API, plus a change record
+    {
+        reset(s);
+        State inplace = s;
+        std::mt19937 rng(12345);
+        for (int i = 0; i < 2000; ++i) {
+            std::vector<std::string> ids = node_ids(s);
+            std::string id = ids[std::uniform_int_distribution<size_t>(0, ids.size() - 1)(rng)];
+            int kind = std::uniform_int_distribution<int>(0, 9)(rng);
+            if (kind == 6 && (rng() & 1)) {
+                // make some nodes deletable
+                set_text(s, id, "");
+                set_text(inplace, id, "");
+            }
+            Command cmd{ static_cast<CommandType>(kind), id, 1 };
+            if (cmd.type == CommandType::SetScopeRoot && (rng() & 1)) cmd.scopeRootId = id;
+            State prev = s;
+            s = apply_command(s, cmd);
+            ChangeSet ch = apply_command_inplace(inplace, cmd);
+            assert_true(same_state(s, inplace), "pure and in-place paths agree");
+            if (ch.empty()) assert_true(same_state(prev, s), "empty change set means no change");
+            for (const auto& rid : ch.removed) assert_true(!has_node(s, rid), "removed ids are gone");
+            for (const auto& cid : ch.created) assert_true(has_node(s, cid), "created ids exist");
+        }
+        verify_invariants(inplace);
+
+        // Change record contents for a few structural commands
+        reset(s);
+        set_text(s, "n1", "AB");
+        ChangeSet ch = apply_command_inplace(s, Command{ CommandType::SplitAtCaret, "n1", 1 }); // n2
+        assert_true(ch.created.size() == 1 && ch.created[0] == "n2", "split creates n2");
+        assert_true(contains(ch.touched, "n1") && ch.rootOrderChanged && ch.focusChanged, "split touches n1 and roots");
+        ch = apply_command_inplace(s, Command{ CommandType::Indent, "n2" });
+        assert_true(contains(ch.touched, "n1") && contains(ch.touched, "n2"), "indent touches node and new parent");
+        assert_true(ch.rootOrderChanged && ch.created.empty() && ch.removed.empty(), "indent changes roots only");
+        ch = apply_command_inplace(s, Command{ CommandType::Indent, "n2" });
+        assert_true(ch.empty(), "no-op indent reports no change");
+        set_text(s, "n2", "");
+        ch = apply_command_inplace(s, Command{ CommandType::DeleteEmptyAtId, "n2" });
+        assert_true(ch.removed.size() == 1 && ch.removed[0] == "n2" && !contains(ch.touched, "n2"), "delete reports removal");
+        assert_true(contains(ch.touched, "n1") && !ch.rootOrderChanged, "delete touches parent");
+        verify_invariants(s);
+    }
+
+    // 15) Node handles: interned ids, generation checks on slot reuse
+    {
+        reset(s);
+        s = apply_and_check(s, Command{ CommandType::InsertEmptySiblingAfter, "n1" }, +1); // n2
+        NodeHandle h2 = find_node(s, "n2");
+        assert_true(h2.valid() && id_of(s, h2) == "n2", "handle resolves to its id");
+        assert_true(!find_node(s, "missing").valid(), "unknown id gives null handle");
+        State older = s;
+        s = apply_and_check(s, Command{ CommandType::DeleteEmptyAtId, "n2" }, -1);
+        assert_true(!s.nodes.contains(h2), "handle is stale after delete");
+        assert_true(id_of(s, h2).empty(), "stale handle has no id");
+        s = apply_and_check(s, Command{ CommandType::InsertEmptySiblingAfter, "n1" }, +1); // n3 reuses n2's slot
+        NodeHandle h3 = find_node(s, "n3");
+        assert_true(h3.index == h2.index && h3.gen != h2.gen, "freed slot reused with new generation");
+        assert_true(!s.nodes.contains(h2), "old handle does not alias the new node");
+        assert_true(older.nodes.contains(h2) && id_of(older, h2) == "n2", "older state still resolves old handle");
+
+        // the id index holds no keys: full-hash collisions land in one bucket
+        PersistentHashIndex<int> idx;
+        for (int i = 0; i < 40; ++i) idx.insert(i < 20 ? 7 : static_cast<size_t>(i) << 59, i);
+        PersistentHashIndex<int> kept = idx;
+        assert_true(idx.erase(7, [](int v) { return v == 5; }) && !idx.erase(7, [](int v) { return v == 5; }), "erase removes one colliding value");
+        assert_true(!idx.find(7, [](int v) { return v == 5; }) && *idx.find(7, [](int v) { return v == 19; }) == 19, "other colliding values stay");
+        assert_true(*idx.find(size_t(33) << 59, [](int v) { return v == 33; }) == 33, "shared-prefix hash found");
+        assert_true(kept.size() == 40 && idx.size() == 39 && kept.find(7, [](int v) { return v == 5; }), "copy keeps the erased value");
+        for (int i = 0; i < 40; ++i) idx.erase(i < 20 ? 7 : static_cast<size_t>(i) << 59, [i](int v) { return v == i; });
+        assert_true(idx.empty() && !idx.find(7, [](int) { return true; }), "index empties");
+    }
+
+    // 16) Wide sibling lists: index lookups, label exhaustion and long reorders
+    {
+        reset(s);
+        // parent n1 with many children, built by always inserting right after n2
+        s = apply_command(s, Command{ CommandType::InsertEmptySiblingAfter, "n1" }); // n2
+        s = apply_command(s, Command{ CommandType::Indent, "n2" });
+        for (int i = 0; i < 300; ++i) {
+            apply_command_inplace(s, Command{ CommandType::InsertEmptySiblingAfter, "n2" });
+        }
+        auto kids = child_ids(s, "n1");
+        assert_eq_size(kids.size(), 301, "wide list size");
+        assert_eq(kids[0], "n2", "anchor stays first");
+        assert_eq(kids[1], "n302", "newest insert right after anchor");
+        assert_eq(kids[300], "n3", "oldest insert last");
+        verify_invariants(s);
+        // walk the first child to the end and back with MoveDown/MoveUp
+        for (int i = 0; i < 300; ++i) apply_command_inplace(s, Command{ CommandType::MoveDown, "n2" });
+        assert_eq_size(index_in_siblings(s, find_node(s, "n2")), 300, "n2 moved to the end");
+        for (int i = 0; i < 150; ++i) apply_command_inplace(s, Command{ CommandType::MoveUp, "n2" });
+        assert_eq_size(index_in_siblings(s, find_node(s, "n2")), 150, "n2 moved back to the middle");
+        verify_invariants(s);
+        // repeated inserts in front of the first child also exhaust labels
+        for (int i = 0; i < 100; ++i) {
+            std::string first = child_ids(s, "n1")[0];
+            apply_command_inplace(s, Command{ CommandType::MoveUp, first });  // hoist to root before n1
+            apply_command_inplace(s, Command{ CommandType::MoveDown, first }); // sink back after n1
+            apply_command_inplace(s, Command{ CommandType::MoveUp, first });  // swap before n1 again
+            apply_command_inplace(s, Command{ CommandType::MoveDown, first }); // back after n1
+        }
+        verify_invariants(s);
+
+        // splitting and merging a node with many children records each child once, in linear time
+        StateBuilder builder;
+        const NodeHandle top = builder.add(make_new_id(builder.state()), "topline", 0);
+        for (int i = 0; i < 50000; ++i) builder.add(make_new_id(builder.state()), "", 1);
+        State wide = builder.finish();
+        const std::string topId = id_of(wide, top);
+        wide.focusedId = topId;
+        ChangeSet ch = apply_command_inplace(wide, Command{ CommandType::SplitAtCaret, topId, 3 });
+        assert_eq_size(ch.touched.size(), 50001, "split touches every child and the node");
+        assert_eq_size(std::unordered_set<std::string>(ch.touched.begin(), ch.touched.end()).size(), 50001, "split touched ids are distinct");
+        ch = apply_command_inplace(wide, Command{ CommandType::MergeNextSiblingIntoCurrent, topId });
+        assert_eq_size(ch.touched.size(), 50001, "merge touches every adopted child and the node");
+        assert_eq_size(std::unordered_set<std::string>(ch.touched.begin(), ch.touched.end()).size(), 50001, "merge touched ids are distinct");
+        assert_true(ch.removed.size() == 1 && child_ids(wide, topId).size() == 50000 && text_of(wide, topId) == "topline", "merge restores the node");
+    }
+
+    // 17) Visible-order index: ranks and positions under edits and scope
+    {
+        reset(s);
+        std::mt19937 rng(17);
+        std::vector<CommandType> ops = { CommandType::InsertEmptySiblingAfter, CommandType::Indent,
+                                         CommandType::Outdent, CommandType::MoveUp, CommandType::MoveDown,
+                                         CommandType::SplitAtCaret, CommandType::DeleteEmptyAtId,
+                                         CommandType::MergeNextSiblingIntoCurrent };
+        for (int step = 0; step < 400; ++step) {
+            auto ids = node_ids(s);
+            const std::string& id = ids[rng() % ids.size()];
+            if (rng() % 4 == 0) set_text(s, id, "ab");
+            apply_command_inplace(s, Command{ ops[rng() % ops.size()], id, 1 });
+            if (step % 20 == 0) verify_invariants(s);
+        }
+        verify_invariants(s);
+        // scoped: ranks are relative to the scope root; nodes outside it are invisible
+        auto ids = node_ids(s);
+        std::string scopeId;
+        for (const auto& id : ids) {
+            if (!child_ids(s, id).empty()) { scopeId = id; break; }
+        }
+        assert_true(!scopeId.empty(), "fuzz produced a parent");
+        s = apply_command(s, Command{ CommandType::SetScopeRoot, "", -1, scopeId });
+        verify_visible_index(s);
+        NodeHandle scope = find_node(s, scopeId);
+        assert_true(visible_at(s, 0) == scope, "scope root is row 0");
+        assert_true(!prev_visible(s, scope), "nothing before the scope root");
+        for (const auto& rid : root_ids(s)) {
+            if (rid != scopeId && !visible_rank(s, find_node(s, rid)).has_value()) {
+                assert_true(!next_visible(s, find_node(s, rid)), "outside scope has no next");
+            }
+        }
+        s = apply_command(s, Command{ CommandType::SetScopeRoot, "", -1, std::string("missing") });
+        assert_eq_size(visible_count(s), 0, "missing scope root shows nothing");
+        assert_true(!visible_at(s, 0), "missing scope root has no rows");
+    }
+
+    // 18) Collapsed nodes: hidden from the visible order, focus and editing rules
+    {
+        reset(s);
+        // n1 [n2 [n3, n4]], n5
+        s = apply_command(s, Command{ CommandType::InsertEmptySiblingAfter, "n1" }); // n2
+        s = apply_command(s, Command{ CommandType::InsertEmptySiblingAfter, "n2" }); // n3
+        s = apply_command(s, Command{ CommandType::InsertEmptySiblingAfter, "n3" }); // n4
+        s = apply_command(s, Command{ CommandType::InsertEmptySiblingAfter, "n4" }); // n5
+        s = apply_command(s, Command{ CommandType::Indent, "n2" });
+        s = apply_command(s, Command{ CommandType::Indent, "n3" });
+        s = apply_command(s, Command{ CommandType::Indent, "n3" });
+        s = apply_command(s, Command{ CommandType::Indent, "n4" });
+        s = apply_command(s, Command{ CommandType::Indent, "n4" });
+        s = apply_command(s, Command{ CommandType::SetFocus, "n4", 0 });
+        assert_eq_size(visible_count(s), 5, "all expanded");
+
+        State before = s;
+        s = apply_command(s, Command{ CommandType::ToggleCollapse, "n2" });
+        assert_true(is_collapsed(s, "n2") && !is_collapsed(before, "n2"), "toggle sets flag on the new state only");
+        auto vis = visible_order_ids(s);
+        assert_eq_size(vis.size(), 3, "collapsed children hidden");
+        assert_eq(vis[2], "n5", "n5 follows collapsed n2");
+        assert_eq(s.focusedId, "n2", "focus leaves the hidden subtree");
+        assert_eq(next_visible_id(s, "n2"), "n5", "next skips hidden children");
+        assert_eq(prev_visible_id(s, "n5"), "n2", "prev stops at collapsed node");
+        assert_true(!visible_rank(s, find_node(s, "n3")).has_value(), "hidden node has no rank");
+        assert_eq(next_visible_id(s, "n3"), "", "hidden node has no next");
+        assert_eq_size(visible_count(before), 5, "old state unaffected");
+        verify_invariants(s);
+
+        // collapsing the whole root hides everything below it; expanding restores it
+        s = apply_command(s, Command{ CommandType::ToggleCollapse, "n1" });
+        assert_eq_size(visible_count(s), 2, "collapsed root");
+        s = apply_command(s, Command{ CommandType::ToggleCollapse, "n1" });
+        assert_eq_size(visible_count(s), 3, "inner collapse kept while root toggles");
+        verify_invariants(s);
+
+        // drilling into a collapsed node still shows its children
+        s = apply_command(s, Command{ CommandType::SetScopeRoot, "", -1, std::string("n2") });
+        assert_eq_size(visible_count(s), 3, "scoped collapsed root shows children");
+        assert_eq(next_visible_id(s, "n2"), "n3", "scope root descends even when collapsed");
+        verify_visible_index(s);
+        s = apply_command(s, Command{ CommandType::SetScopeRoot, "", -1, std::nullopt });
+
+        // indenting into a collapsed sibling expands it
+        s = apply_command(s, Command{ CommandType::Outdent, "n2" }); // roots: n1, n2, n5
+        s = apply_command(s, Command{ CommandType::Indent, "n5" });
+        assert_true(!is_collapsed(s, "n2"), "indent target expands");
+        assert_eq(parent_id(s, "n5"), "n2", "n5 moved under n2");
+        verify_invariants(s);
+
+        // split hands the collapsed flag to the node that receives the children
+        s = apply_command(s, Command{ CommandType::ToggleCollapse, "n2" });
+        set_text(s, "n2", "ab");
+        s = apply_command(s, Command{ CommandType::SplitAtCaret, "n2", 1 });
+        std::string fresh = s.focusedId;
+        assert_true(!is_collapsed(s, "n2") && is_collapsed(s, fresh), "collapsed flag follows children");
+        verify_invariants(s);
+        // merge adopts the flag back
+        s = apply_command(s, Command{ CommandType::MergeNextSiblingIntoCurrent, "n2" });
+        assert_true(is_collapsed(s, "n2"), "merge keeps children collapsed");
+        verify_invariants(s);
+
+        // random edits with collapses keep the cached sizes exact
+        std::mt19937 rng(18);
+        std::vector<CommandType> ops = { CommandType::InsertEmptySiblingAfter, CommandType::Indent,
+                                         CommandType::Outdent, CommandType::MoveUp, CommandType::MoveDown,
+                                         CommandType::SplitAtCaret, CommandType::DeleteEmptyAtId,
+                                         CommandType::MergeNextSiblingIntoCurrent, CommandType::ToggleCollapse };
+        for (int step = 0; step < 400; ++step) {
+            auto ids = node_ids(s);
+            const std::string& id = ids[rng() % ids.size()];
+            if (rng() % 4 == 0) set_text(s, id, "ab");
+            apply_command_inplace(s, Command{ ops[rng() % ops.size()], id, 1 });
+            if (step % 20 == 0) verify_invariants(s);
+        }
+        verify_invariants(s);
+    }
+
+    // 19) Very deep outlines: traversal and navigation without recursion
+    {
+        const size_t depth = 100000;
+        State deep = initial_state();
+        // build the chain bottom-up so each link touches only detached nodes
+        NodeHandle child = create_node(deep, "leaf");
+        NodeHandle leaf = child;
+        for (size_t d = 1; d < depth; ++d) {
+            NodeHandle parent = create_node(deep, "");
+            append_child(deep, parent, child);
+            child = parent;
+        }
+        append_child(deep, NodeHandle{}, child);
+        assert_eq_size(visible_count(deep), depth + 1, "deep chain plus initial root");
+        size_t rows = 0;
+        size_t maxDepth = 0;
+        for (const VisibleRow& row : visible_rows(deep)) {
+            ++rows;
+            maxDepth = std::max(maxDepth, row.depth);
+        }
+        assert_eq_size(rows, depth + 1, "deep traversal visits every row");
+        assert_eq_size(maxDepth, depth - 1, "deepest row depth");
+        assert_eq_size(visible_order_ids(deep).size(), depth + 1, "deep visible ids");
+        auto r = visible_rank(deep, leaf);
+        assert_true(r.has_value() && *r == depth, "deep leaf is the last row");
+        assert_true(visible_at(deep, depth) == leaf, "deep leaf by position");
+        assert_true(!next_visible(deep, leaf), "deep leaf has no next");
+        assert_true(prev_visible(deep, child) == find_node(deep, "n1"), "top of chain follows n1");
+        assert_eq_size(ancestors_to_root(deep, id_of(deep, leaf)).size(), depth, "deep ancestry");
+        // drill into the chain and walk back up from the leaf
+        deep = apply_command(deep, Command{ CommandType::SetScopeRoot, "", -1, id_of(deep, child) });
+        assert_eq_size(visible_count(deep), depth, "scoped deep chain");
+        assert_eq_size(visible_rows_from(deep, leaf).begin()->depth, depth - 1, "depth relative to scope");
+        deep = apply_command(deep, Command{ CommandType::ToggleCollapse, id_of(deep, child) });
+        assert_eq_size(visible_count(deep), depth, "collapsed scope root still shows the chain");
+    }
+
+    // 20) Viewport windows: a slice of the visible rows with depth, text and child counts
+    {
+        reset(s);
+        for (int i = 0; i < 50; ++i) apply_command_inplace(s, Command{ CommandType::InsertEmptySiblingAfter, "" });
+        for (int i = 3; i <= 51; i += 3) apply_command_inplace(s, Command{ CommandType::Indent, "n" + std::to_string(i) });
+        set_text(s, "n10", "ten");
+        auto vis = visible_order_ids(s);
+        auto win = visible_window(s, 5, 10);
+        assert_eq_size(win.size(), 10, "window size");
+        for (size_t i = 0; i < win.size(); ++i) {
+            assert_eq(win[i].id, vis[5 + i], "window follows visible order");
+            assert_eq(win[i].text, text_of(s, win[i].id), "window text");
+            assert_eq_size(win[i].childCount, child_ids(s, win[i].id).size(), "window child count");
+            assert_eq_size(win[i].depth, parent_id(s, win[i].id).empty() ? 0 : 1, "window depth");
+        }
+        assert_eq_size(visible_window(s, vis.size() - 3, 10).size(), 3, "window clamps at the end");
+        assert_eq_size(visible_window(s, vis.size(), 10).size(), 0, "window past the end is empty");
+        const size_t huge = size_t(1) << 40;
+        assert_eq_size(visible_window(s, 0, huge).size(), vis.size(), "huge count is clamped, not allocated");
+        assert_eq_size(visible_window(s, huge, huge).size(), 0, "huge offset is empty");
+        assert_eq_size(visible_window_from(s, "n10", huge).size(), vis.size() - visible_rank(s, find_node(s, "n10")).value(), "huge anchored count is clamped");
+        auto anchored = visible_window_from(s, "n10", 4);
+        assert_eq(anchored[0].id, "n10", "anchored window starts at anchor");
+        assert_eq(anchored[0].text, "ten", "anchored window text");
+        assert_eq(anchored[1].id, vis[*visible_rank(s, find_node(s, "n10")) + 1], "anchored window continues");
+        // scoped and collapsed
+        s = apply_command(s, Command{ CommandType::ToggleCollapse, "n2" });
+        auto coll = visible_window_from(s, "n2", 2);
+        assert_true(coll[0].collapsed && coll[0].childCount == 1, "collapsed row keeps its child count");
+        assert_eq(coll[1].id, "n4", "collapsed children are skipped");
+        assert_eq_size(visible_window_from(s, "n3", 5).size(), 0, "hidden anchor gives no rows");
+        s = apply_command(s, Command{ CommandType::SetScopeRoot, "", -1, std::string("n2") });
+        auto scoped = visible_window(s, 0, 10);
+        assert_eq_size(scoped.size(), 2, "scoped window");
+        assert_true(scoped[0].id == "n2" && scoped[0].depth == 0 && scoped[1].depth == 1, "scoped depths");
+    }
+
+    // 21) Batched commands: one transition, one merged change record
+    {
+        reset(s);
+        set_text(s, "n1", "ab");
+        std::vector<Command> batch = { Command{ CommandType::SplitAtCaret, "n1", 1 } };
+        for (int i = 0; i < 200; ++i) batch.push_back(Command{ CommandType::InsertEmptySiblingAfter, "" });
+        batch.push_back(Command{ CommandType::Indent, "" });
+        batch.push_back(Command{ CommandType::DeleteEmptyAtId, "n150" });
+        batch.push_back(Command{ CommandType::MoveUp, "n3" });
+        State seq = s;
+        for (const auto& c : batch) seq = apply_command(seq, c);
+        ChangeSet ch;
+        State batched = apply_commands(s, batch, &ch);
+        assert_true(same_state(seq, batched), "batch matches sequential application");
+        assert_eq_size(node_count(s), 1, "pure batch leaves input untouched");
+        verify_invariants(batched);
+        assert_eq_size(ch.created.size(), 200, "created minus the one deleted in-batch");
+        assert_true(!contains(ch.created, "n150") && !contains(ch.removed, "n150"), "born and removed in batch is invisible");
+        assert_true(ch.removed.empty(), "nothing pre-existing removed");
+        assert_true(contains(ch.touched, "n1") && !contains(ch.touched, "n3"), "touched excludes created nodes");
+        assert_true(ch.rootOrderChanged && ch.focusChanged, "flags merged");
+        // removal of a pre-existing node drops it from touched
+        ChangeSet del = apply_commands_inplace(batched, { Command{ CommandType::SetFocus, "n5", 0 },
+                                                          Command{ CommandType::Indent, "n5" },
+                                                          Command{ CommandType::Outdent, "n5" },
+                                                          Command{ CommandType::DeleteEmptyAtId, "n5" } });
+        assert_true(contains(del.removed, "n5") && !contains(del.touched, "n5"), "removed wins over touched");
+        assert_true(apply_commands_inplace(batched, {}).empty(), "empty batch changes nothing");
+    }
+
+    // 22) InsertLinesAfter: native multi-line paste
+    {
+        reset(s);
+        s = apply_command(s, Command{ CommandType::InsertEmptySiblingAfter, "n1" }); // n2
+        s = apply_command(s, Command{ CommandType::Indent, "n2" });
+        s = apply_command(s, Command{ CommandType::InsertEmptySiblingAfter, "n2" }); // n3
+        // equivalent to a loop of single inserts with text
+        State looped = s;
+        std::vector<std::string> lines = { "alpha", "", "gamma\tdelta", "omega" };
+        std::string after = "n2";
+        for (const auto& line : lines) {
+            looped = apply_command(looped, Command{ CommandType::InsertEmptySiblingAfter, after });
+            after = looped.focusedId;
+            set_text(looped, after, line);
+        }
+        looped = apply_command(looped, Command{ CommandType::SetFocus, after, 5 });
+        ChangeSet ch;
+        State pasted = apply_commands(s, { Command{ CommandType::InsertLinesAfter, "n2", -1, std::nullopt, "alpha\r\n\rgamma\tdelta\nomega" } }, &ch);
+        assert_true(same_state(looped, pasted), "paste matches a loop of inserts");
+        assert_eq(pasted.focusedId, "n7", "focus on last inserted line");
+        assert_true(pasted.caret == 5, "caret at end of last line");
+        assert_eq_size(ch.created.size(), 4, "paste created one node per line");
+        assert_true(contains(ch.touched, "n1") && !ch.rootOrderChanged, "paste touches the container");
+        verify_invariants(pasted);
+        // a single line still inserts one sibling
+        State one = apply_command(s, Command{ CommandType::InsertLinesAfter, "n3", -1, std::nullopt, "x" });
+        assert_eq(child_ids(one, "n1").back(), "n4", "single line appended");
+        verify_invariants(one);
+
+        // repeated pastes into the same gap force relabels that reserve room for the run
+        State big = s;
+        for (int round = 0; round < 40; ++round) {
+            std::string text;
+            for (int i = 0; i < 500; ++i) text += "line\n";
+            apply_command_inplace(big, Command{ CommandType::InsertLinesAfter, "n2", -1, std::nullopt, text });
+        }
+        assert_eq_size(child_ids(big, "n1").size(), 2 + 40 * 501, "all pasted lines present");
+        assert_eq(child_ids(big, "n1").back(), "n3", "pastes land before the following sibling");
+        verify_invariants(big);
+
+        // a 100k-line paste is a single splice
+        std::string log;
+        for (int i = 0; i < 100000; ++i) log += "entry " + std::to_string(i) + "\n";
+        log.pop_back();
+        State huge = apply_command(s, Command{ CommandType::InsertLinesAfter, "n1", -1, std::nullopt, log });
+        assert_eq_size(root_ids(huge).size(), 100001, "100k roots pasted");
+        assert_eq(text_of(huge, huge.focusedId), "entry 99999", "focus on the last pasted line");
+        assert_eq_size(visible_count(huge), 100003, "visible sizes include the paste");
+        assert_true(visible_at(huge, 3) == find_node(huge, "n4"), "first pasted row follows n1's subtree");
+    }
+
+    // 23) Undo/redo history: discrete structural steps, coalesced typing, byte budget
+    {
+        reset(s);
+        History h;
+        State start = s;
+        h.apply(s, Command{ CommandType::SetText, "n1", 1, std::nullopt, "a" }, 0);
+        h.apply(s, Command{ CommandType::SetText, "n1", 2, std::nullopt, "ab" }, 300);
+        h.apply(s, Command{ CommandType::SetText, "n1", 3, std::nullopt, "abc" }, 600);
+        assert_eq_size(h.undo_depth(), 1, "typing burst coalesces");
+        State typed = s;
+        ChangeSet ins = h.apply(s, Command{ CommandType::InsertEmptySiblingAfter, "n1" }, 700);
+        assert_eq_size(h.undo_depth(), 2, "structural command is its own step");
+        h.apply(s, Command{ CommandType::SetText, "n2", 1, std::nullopt, "x" }, 800);
+        assert_eq_size(h.undo_depth(), 3, "typing in another node is a new step");
+        h.apply(s, Command{ CommandType::SetFocus, "n1", 0 }, 900);
+        h.apply(s, Command{ CommandType::SetText, "n1", -1, std::nullopt, "abc" }, 950);
+        assert_eq_size(h.undo_depth(), 3, "focus moves and no-op edits are not steps");
+        State done = s;
+
+        h.undo(s);
+        assert_eq(text_of(s, "n2"), "", "undo typing");
+        ChangeSet un = h.undo(s);
+        assert_true(!has_node(s, "n2"), "undo insert");
+        assert_true(contains(un.removed, "n2") && un.created.empty() && un.rootOrderChanged, "undo change record is inverted");
+        assert_true(same_state(s, typed), "undo restores the exact earlier state");
+        h.undo(s);
+        assert_true(same_state(s, start), "undo whole typing burst at once");
+        assert_true(!h.can_undo() && h.undo(s).empty(), "nothing left to undo");
+        h.redo(s);
+        ChangeSet re = h.redo(s);
+        assert_true(re.created == ins.created, "redo change record matches the original");
+        h.redo(s);
+        assert_true(same_state(s, done), "redo returns to the latest state");
+        assert_true(!h.can_redo(), "redo stack drained");
+        h.undo(s);
+        h.apply(s, Command{ CommandType::Indent, "n2" }, 2000);
+        assert_true(!h.can_redo(), "new edit clears redo");
+        assert_eq(parent_id(s, "n2"), "n1", "edit applied");
+
+        // a pause splits typing into separate steps; redo never coalesces with new typing
+        History paused(History::kDefaultByteBudget, 500);
+        reset(s);
+        paused.apply(s, Command{ CommandType::SetText, "n1", 1, std::nullopt, "a" }, 0);
+        paused.apply(s, Command{ CommandType::SetText, "n1", 2, std::nullopt, "ab" }, 2000);
+        assert_eq_size(paused.undo_depth(), 2, "pause splits bursts");
+        paused.undo(s);
+        paused.redo(s);
+        paused.apply(s, Command{ CommandType::SetText, "n1", 3, std::nullopt, "abc" }, 2100);
+        assert_eq_size(paused.undo_depth(), 3, "redone step does not absorb typing");
+
+        // scope survives undo as a view setting while its node exists
+        paused.apply(s, Command{ CommandType::SetScopeRoot, "", -1, std::string("n1") }, 2200);
+        paused.undo(s);
+        assert_true(s.scopeRootId == std::optional<std::string>("n1"), "scope kept across undo");
+
+        // batches are one step
+        History batch;
+        reset(s);
+        batch.apply_batch(s, { Command{ CommandType::InsertLinesAfter, "n1", -1, std::nullopt, "a\nb\nc" },
+                               Command{ CommandType::Indent, "" } });
+        assert_eq_size(batch.undo_depth(), 1, "batch is one step");
+        batch.undo(s);
+        assert_eq_size(node_count(s), 1, "batch undone at once");
+
+        // shortening the focused text pulls the caret in, and undo/redo restore a valid one
+        History shorten(History::kDefaultByteBudget, 500);
+        reset(s);
+        shorten.apply(s, Command{ CommandType::SetText, "n1", 5, std::nullopt, "Hello" }, 0);
+        shorten.apply(s, Command{ CommandType::SetText, "n1", -1, std::nullopt, "Hi" }, 2000);
+        assert_true(s.caret == 2 && validate(s).empty(), "caret clamped to the shorter text");
+        shorten.undo(s);
+        assert_true(text_of(s, "n1") == "Hello" && s.caret == 5 && validate(s).empty(), "undo restores text and caret");
+        shorten.redo(s);
+        assert_true(s.caret == 2 && validate(s).empty(), "redo keeps the caret inside");
+        apply_command_inplace(s, Command{ CommandType::SetText, "n1", 9, std::nullopt, "Hey" });
+        assert_true(s.caret == 3 && validate(s).empty(), "explicit caret clamped too");
+
+        // memory stays bounded: a long session evicts the oldest steps
+        History bounded(64 * 1024);
+        reset(s);
+        for (int i = 0; i < 2000; ++i) {
+            bounded.apply(s, Command{ CommandType::InsertEmptySiblingAfter, "" }, static_cast<uint64_t>(i));
+            assert_true(bounded.bytes() <= 64 * 1024, "history within its byte budget");
+        }
+        assert_true(bounded.undo_depth() > 0 && bounded.undo_depth() < 2000, "oldest steps evicted");
+        size_t depth = bounded.undo_depth();
+        while (bounded.can_undo()) bounded.undo(s);
+        assert_eq_size(node_count(s), 2001 - depth, "undo stops at the oldest retained step");
+        verify_invariants(s);
+        bounded.set_byte_budget(0);
+        assert_true(!bounded.can_undo() && !bounded.can_redo() && bounded.bytes() == 0, "zero budget drops everything");
+
+        // a text edit deep in a chain copies every ancestor, and the budget counts them
+        const size_t chainDepth = 1000;
+        State chain = initial_state();
+        NodeHandle link = create_node(chain, "bottom");
+        const std::string bottom = id_of(chain, link);
+        for (size_t d = 1; d < chainDepth; ++d) {
+            NodeHandle parent = create_node(chain, "");
+            append_child(chain, parent, link);
+            link = parent;
+        }
+        append_child(chain, NodeHandle{}, link);
+        const size_t perEdit = chainDepth * ChildIndex::bytes_per_update(1); // the ancestors' index paths alone
+        History deepHistory(10 * perEdit, 0);
+        for (int i = 0; i < 50; ++i) {
+#if BULLET_ENGINE_INSTRUMENT
+            const size_t copiedBefore = instrument_detail::counters.copiedBytes;
+            const size_t bytesBefore = deepHistory.bytes();
+            const size_t stepsBefore = deepHistory.undo_depth();
+#endif
+            deepHistory.apply(chain, Command{ CommandType::SetText, bottom, -1, std::nullopt, std::string(i + 1, 'x') },
+                              static_cast<uint64_t>(10 * i));
+#if BULLET_ENGINE_INSTRUMENT
+            if (deepHistory.undo_depth() == stepsBefore + 1) { // nothing evicted
+                assert_true(deepHistory.bytes() - bytesBefore >= instrument_detail::counters.copiedBytes - copiedBefore,
+                            "step estimate covers the bytes the edit copied");
+            }
+#endif
+            assert_true(deepHistory.bytes() <= 10 * perEdit, "deep history within its byte budget");
+        }
+        assert_true(deepHistory.bytes() >= deepHistory.undo_depth() * perEdit, "each deep step charges its ancestors");
+        assert_true(deepHistory.undo_depth() <= 10, "deep steps evicted by their real cost");
+    }
+
+    // 24) Binary snapshots: round trip, zero-copy view, lazy document
+    {
+        reset(s);
+        std::mt19937 rng(24);
+        std::vector<CommandType> ops = { CommandType::InsertEmptySiblingAfter, CommandType::Indent,
+                                         CommandType::Outdent, CommandType::MoveDown, CommandType::SplitAtCaret,
+                                         CommandType::ToggleCollapse };
+        for (int step = 0; step < 600; ++step) {
+            auto ids = node_ids(s);
+            const std::string& id = ids[rng() % ids.size()];
+            apply_command_inplace(s, Command{ CommandType::SetText, id, -1, std::nullopt, "text " + id + "\twith \xC3\xA9" });
+            apply_command_inplace(s, Command{ ops[rng() % ops.size()], id, 2 });
+        }
+        apply_command_inplace(s, Command{ CommandType::SetScopeRoot, "", -1, root_ids(s)[0] });
+        apply_command_inplace(s, Command{ CommandType::SetFocus, node_ids(s)[3], 4 });
+
+        SnapshotView view = SnapshotView::from_bytes(encode_snapshot(s));
+        assert_eq_size(view.node_count(), node_count(s), "view node count");
+        assert_eq(std::string(view.focused_id()), s.focusedId, "view focus");
+        assert_true(view.caret() == 4 && view.id_counter() == s.idCounter, "view caret and id counter");
+        assert_eq(std::string(*view.scope_root_id()), *s.scopeRootId, "view scope");
+        for (const auto& id : node_ids(s)) {
+            uint32_t i = view.find(id);
+            assert_true(i != SnapshotView::kNone, "view finds every id");
+            assert_eq(std::string(view.id(i)), id, "view id");
+            assert_eq(std::string(view.text(i)), text_of(s, id), "view text");
+            assert_eq_size(view.child_count(i), child_ids(s, id).size(), "view child count");
+            assert_true(view.collapsed(i) == is_collapsed(s, id), "view collapsed flag");
+            uint32_t p = view.parent(i);
+            assert_eq(p == SnapshotView::kNone ? std::string() : std::string(view.id(p)), parent_id(s, id), "view parent");
+        }
+        assert_true(view.find("nope") == SnapshotView::kNone, "view misses unknown id");
+        State back = view.materialize();
+        assert_true(same_state(s, back), "snapshot round trip");
+        assert_eq_size(visible_count(back), visible_count(s), "round trip keeps visible sizes");
+        verify_invariants(back);
+
+        // file-backed, memory-mapped, served lazily
+        std::string path = (std::filesystem::temp_directory_path() / "bullet_engine_snapshot_test.bin").string();
+        write_snapshot(s, path);
+        SnapshotDocument doc(SnapshotView::open(path));
+        assert_true(!doc.materialized(), "document opens without materializing");
+        assert_true(doc.root_ids() == root_ids(s) && doc.node_count() == node_count(s), "lazy roots and count");
+        std::string someParent = parent_id(s, node_ids(s).back());
+        if (!someParent.empty()) assert_true(doc.child_ids(someParent) == child_ids(s, someParent), "lazy children");
+        assert_eq(doc.text_of(s.focusedId), text_of(s, s.focusedId), "lazy text");
+        assert_true(!doc.materialized(), "reads keep the document lazy");
+        doc.apply(Command{ CommandType::InsertEmptySiblingAfter, "" });
+        assert_true(doc.materialized(), "first mutation materializes");
+        assert_eq_size(doc.node_count(), node_count(s) + 1, "mutation applied to the materialized state");
+        std::remove(path.c_str());
+
+        // an empty initial document and damaged inputs
+        assert_true(same_state(SnapshotView::from_bytes(encode_snapshot(initial_state())).materialize(), initial_state()), "initial state round trip");
+        std::string bytes = encode_snapshot(s);
+        auto rejects = [](std::string b) {
+            try { SnapshotView::from_bytes(std::move(b)); } catch (const SnapshotError&) { return true; }
+            return false;
+        };
+        assert_true(rejects(bytes.substr(0, bytes.size() - 1)), "truncated snapshot rejected");
+        std::string badMagic = bytes;
+        badMagic[0] = 'X';
+        assert_true(rejects(badMagic), "bad magic rejected");
+        assert_true(rejects(std::string()), "empty input rejected");
+        bool missing = false;
+        try { SnapshotView::open(path); } catch (const SnapshotError&) { missing = true; }
+        assert_true(missing, "missing file rejected");
+
+        // corrupt node records throw instead of reading out of bounds or looping
+        const std::string small = encode_snapshot(import_outline("a\n  b\nc\n")); // records: a, b, c
+        auto poke = [](std::string b, size_t at, uint64_t value, int width = 4) {
+            for (int k = 0; k < width; ++k) b[at + k] = static_cast<char>((value >> (8 * k)) & 0xFF);
+            return b;
+        };
+        auto peek = [](const std::string& b, size_t at) {
+            uint32_t v;
+            std::memcpy(&v, b.data() + at, sizeof(v));
+            return v;
+        };
+        auto patched = [&](uint32_t node, size_t field, uint32_t value) {
+            return SnapshotDocument(SnapshotView::from_bytes(poke(small, 80 + node * 32 + field * 4, value)));
+        };
+        auto throws = [](const std::function<void()>& f) {
+            try { f(); } catch (const SnapshotError&) { return true; }
+            return false;
+        };
+        assert_true(throws([&] { patched(0, 2, 0).root_ids(); }), "sibling loop rejected");
+        assert_true(throws([&] { patched(1, 1, 99).child_ids("n2"); }), "child out of range rejected");
+        assert_true(throws([&] { patched(0, 3, 0xFFFFFFF0u).child_ids("n1"); }), "child count past the table rejected");
+        assert_true(throws([&] { patched(2, 0, 2).state(); }), "parent after the node rejected");
+        assert_true(throws([&] { PackedTexts::from_snapshot(patched(2, 0, 7).view()); }), "packed texts reject a bad parent");
+        assert_true(patched(0, 0, SnapshotView::kNone).root_ids() == std::vector<std::string>({ "n1", "n3" }), "intact records still read");
+
+        // section sizes that only fit the file once their sum wraps
+        uint64_t slots, stringBytes; // header offsets 32 and 40
+        std::memcpy(&slots, small.data() + 32, 8);
+        std::memcpy(&stringBytes, small.data() + 40, 8);
+        assert_true(rejects(poke(poke(small, 32, uint64_t(1) << 62, 8), 40, stringBytes + slots * 4, 8)), "wrapping table sizes rejected");
+
+        // materializing checks what the builder would otherwise trust
+        auto builds = [](std::string b) {
+            try { SnapshotView::from_bytes(std::move(b)).materialize(); } catch (const SnapshotError&) { return false; }
+            return true;
+        };
+        const size_t rec = 80 + 2 * 32; // record of c
+        assert_true(!builds(poke(poke(small, rec + 20, peek(small, 80 + 20)), rec + 24, peek(small, 80 + 24))), "duplicate id rejected");
+        const std::string four = encode_snapshot(import_outline("a\n  b\nc\n  d\n")); // records: a, b, c, d
+        assert_true(builds(four), "intact snapshot builds");
+        assert_true(!builds(poke(four, 80 + 3 * 32, 1)), "parent off the open path rejected");
+        assert_true(!builds(poke(four, 68, 1)), "missing focus rejected"); // focusLength: "n" is no id
+        assert_true(!builds(poke(poke(poke(four, 60, 1), 72, peek(four, 64)), 76, 1)), "missing scope rejected");
+    }
+
+    // 25) Command journal: replay after restart, torn tails, compaction
+    {
+        const std::string base = (std::filesystem::temp_directory_path() / "bullet_engine_journal_test").string();
+        auto cleanup = [&] {
+            for (const char* ext : { ".snap", ".log", ".snap.tmp", ".log.tmp" }) std::remove((base + ext).c_str());
+        };
+        cleanup();
+
+        State expected;
+        {
+            Journal j(base);
+            State s = j.recover();
+            assert_true(same_state(s, initial_state()), "fresh journal recovers the initial state");
+            std::string first = s.focusedId;
+            j.apply(s, Command{ CommandType::SetText, first, -1, std::nullopt, "alpha" });
+            j.apply(s, Command{ CommandType::InsertLinesAfter, first, -1, std::nullopt, "b\nc\nd" });
+            j.apply(s, Command{ CommandType::Indent, s.focusedId });
+            j.apply(s, Command{ CommandType::SetFocus, s.focusedId, 1 });
+            j.apply(s, Command{ CommandType::ToggleCollapse, root_ids(s)[2] });
+            j.apply_batch(s, { Command{ CommandType::SplitAtCaret, first, 2 }, Command{ CommandType::MoveDown, first } });
+            expected = s;
+        } // destructor flushes the group
+        {
+            Journal j(base);
+            State s = j.recover();
+            assert_true(same_state(s, expected), "replay reproduces the state");
+            assert_eq(s.focusedId, expected.focusedId, "replay restores focus");
+            assert_true(s.caret == expected.caret && s.idCounter == expected.idCounter, "replay restores caret and id counter");
+            verify_invariants(s);
+        }
+
+        // a torn tail is ignored and cut off
+        const auto goodSize = std::filesystem::file_size(base + ".log");
+        {
+            std::ofstream out(base + ".log", std::ios::binary | std::ios::app);
+            out << std::string("\x10\x00\x00\x00garbage", 11);
+        }
+        {
+            Journal j(base);
+            State s = j.recover();
+            assert_true(same_state(s, expected), "torn tail ignored");
+            assert_true(std::filesystem::file_size(base + ".log") == goodSize, "torn tail truncated");
+            j.apply(s, Command{ CommandType::InsertEmptySiblingAfter, s.focusedId });
+            expected = s;
+        }
+        {
+            Journal j(base);
+            assert_true(same_state(j.recover(), expected), "appends after truncation replay");
+        }
+
+        // a small threshold compacts into a snapshot; a stale log is discarded
+        {
+            JournalOptions opts;
+            opts.sync = SyncPolicy::Always;
+            opts.compactBytes = 512;
+            Journal j(base, opts);
+            State s = j.recover();
+            for (int i = 0; i < 40; ++i) j.apply(s, Command{ CommandType::SetText, s.focusedId, -1, std::nullopt, "line " + std::to_string(i) });
+            assert_true(std::filesystem::exists(base + ".snap"), "compaction wrote a snapshot");
+            assert_true(j.log_bytes() <= opts.compactBytes, "compaction reset the log");
+            expected = s;
+        }
+        {
+            Journal j(base);
+            assert_true(same_state(j.recover(), expected), "snapshot plus log recovers");
+        }
+        {
+            Journal j(base);
+            State s = j.recover();
+            j.apply(s, Command{ CommandType::SetText, s.focusedId, -1, std::nullopt, "post" });
+            j.flush();
+            std::string staleLog;
+            {
+                std::ifstream in(base + ".log", std::ios::binary);
+                staleLog.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            }
+            j.compact(s);
+            expected = s;
+            // crash between the snapshot rename and the log reset: the old log survives
+            std::ofstream(base + ".log", std::ios::binary | std::ios::trunc) << staleLog;
+        }
+        {
+            Journal j(base);
+            State s = j.recover();
+            assert_true(same_state(s, expected), "stale log not replayed over the newer snapshot");
+            assert_eq(text_of(s, s.focusedId), "post", "snapshot carries the compacted edit");
+            j.apply(s, Command{ CommandType::SetText, s.focusedId, -1, std::nullopt, "kept" });
+        }
+
+        // a damaged or future-version header is refused, and the log is left for inspection
+        std::string goodLog;
+        {
+            std::ifstream in(base + ".log", std::ios::binary);
+            goodLog.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+        auto refused = [&](const std::string& log) {
+            std::ofstream(base + ".log", std::ios::binary | std::ios::trunc) << log;
+            bool threw = false;
+            try {
+                Journal j(base);
+                j.recover();
+            } catch (const JournalError&) {
+                threw = true;
+            }
+            std::ifstream in(base + ".log", std::ios::binary);
+            return threw && std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()) == log;
+        };
+        std::string damaged = goodLog;
+        damaged[0] = 'X';
+        assert_true(refused(damaged), "bad magic refused");
+        damaged = goodLog;
+        damaged[8] = 2;
+        assert_true(refused(damaged), "future version refused");
+        assert_true(refused(goodLog.substr(0, 10)), "short header refused");
+        std::ofstream(base + ".log", std::ios::binary | std::ios::trunc) << goodLog;
+        {
+            Journal j(base);
+            State s = j.recover();
+            assert_eq(text_of(s, s.focusedId), "kept", "restored log replays its commands");
+        }
+        cleanup();
+    }
+
+    // 26) Streaming import of indented text and Markdown outlines
+    {
+        const std::string text = "a\n  b\n    c\n  d\n\ne\n\tf\r\n        g\n";
+        State s = import_outline(text);
+        verify_invariants(s);
+        assert_eq_size(node_count(s), 7, "one node per non-blank line");
+        auto byText = [](const State& st, const std::string& t) {
+            for (const auto& id : node_ids(st)) if (text_of(st, id) == t) return id;
+            return std::string();
+        };
+        auto texts = [](const State& st, const std::vector<std::string>& ids) {
+            std::vector<std::string> out;
+            for (const auto& id : ids) out.push_back(text_of(st, id));
+            return out;
+        };
+        assert_true(texts(s, root_ids(s)) == std::vector<std::string>{ "a", "e" }, "roots");
+        assert_true(texts(s, child_ids(s, byText(s, "a"))) == std::vector<std::string>{ "b", "d" }, "indented children");
+        assert_true(texts(s, child_ids(s, byText(s, "b"))) == std::vector<std::string>{ "c" }, "nested child");
+        assert_true(texts(s, child_ids(s, byText(s, "e"))) == std::vector<std::string>{ "f" }, "tab indent, CRLF");
+        assert_eq(parent_id(s, byText(s, "g")), byText(s, "f"), "deeper jump nests under the previous line");
+        assert_eq(s.focusedId, root_ids(s)[0], "focus on the first node");
+        assert_true(s.caret == 0 && !s.scopeRootId, "caret at start, no scope");
+        assert_eq(make_new_id(s), "n8", "id counter continues after the import");
+
+        // chunk boundaries anywhere give the same outline
+        for (size_t chunk : { 1u, 2u, 3u, 7u }) {
+            OutlineImporter importer;
+            for (size_t i = 0; i < text.size(); i += chunk) importer.feed(std::string_view(text).substr(i, chunk));
+            assert_true(same_state(importer.finish(), import_outline(text)), "chunked import");
+        }
+        assert_true(same_state(import_outline(" \n\n"), initial_state()), "blank input gives the initial state");
+        assert_eq_size(node_count(import_outline("x\ny")), 2, "last line without a newline");
+
+        ImportOptions md;
+        md.format = OutlineFormat::Markdown;
+        State m = import_outline("# Title\nintro\n- one\n  * two\n    1. three\n- \n## Sub #\n+ four\n# Next\n10) five\n", md);
+        verify_invariants(m);
+        assert_true(texts(m, root_ids(m)) == std::vector<std::string>{ "Title", "Next" }, "headings are roots");
+        assert_true(texts(m, child_ids(m, byText(m, "Title"))) == std::vector<std::string>{ "intro", "one", "", "Sub" }, "lines under a heading");
+        assert_true(texts(m, child_ids(m, byText(m, "one"))) == std::vector<std::string>{ "two" }, "markers stripped, nesting kept");
+        assert_true(texts(m, child_ids(m, byText(m, "two"))) == std::vector<std::string>{ "three" }, "ordered items");
+        assert_true(texts(m, child_ids(m, byText(m, "Sub"))) == std::vector<std::string>{ "four" }, "subheading children");
+        assert_true(texts(m, child_ids(m, byText(m, "Next"))) == std::vector<std::string>{ "five" }, "heading closes the previous section");
+
+        // a large import is one linear pass
+        std::string big;
+        for (int i = 0; i < 200000; ++i) big.append(static_cast<size_t>(i % 7) * 2, ' ').append("line ").append(std::to_string(i)).push_back('\n');
+        State large = import_outline(big);
+        assert_eq_size(node_count(large), 200000, "large import node count");
+        assert_eq_size(visible_count(large), 200000, "large import visible sizes");
+        assert_eq(text_of(large, visible_order_ids(large)[123456]), "line 123456", "large import keeps line order");
+        // flat and wide levels are linked in runs as they go, across several runs
+        std::string flat;
+        for (int i = 0; i < 5000; ++i) flat.append("r").append(std::to_string(i)).push_back('\n');
+        flat.append("wide\n");
+        for (int i = 0; i < 3000; ++i) flat.append("  w").append(std::to_string(i)).push_back('\n');
+        State wide = import_outline(flat);
+        const std::vector<std::string> flatRoots = root_ids(wide);
+        assert_true(flatRoots.size() == 5001 && text_of(wide, flatRoots[4321]) == "r4321", "flat roots in order");
+        const std::vector<std::string> wideKids = child_ids(wide, flatRoots.back());
+        assert_true(wideKids.size() == 3000 && text_of(wide, wideKids[2999]) == "w2999", "wide children in order");
+        assert_true(validate(wide).empty() && descendant_count(wide, flatRoots.back()) == 3000, "runs keep every cached size");
+
+        std::string path = (std::filesystem::temp_directory_path() / "bullet_engine_import_test.md").string();
+        std::ofstream(path, std::ios::binary) << "# h\n- a\n  - b\n";
+        State fromFile = import_outline_file(path, md);
+        assert_eq_size(node_count(fromFile), 3, "file import");
+        std::remove(path.c_str());
+        bool missing = false;
+        try { import_outline_file(path); } catch (const ImportError&) { missing = true; }
+        assert_true(missing, "missing import file rejected");
+    }
+
+    // 27) Streaming export: text, Markdown, OPML and JSON, scoped and chunked
+    {
+        State s = import_outline("a\n  b \"<&>\"\n    c\n  d\ne\n");
+        const std::string a = root_ids(s)[0], e = root_ids(s)[1];
+        const std::string b = child_ids(s, a)[0], c = child_ids(s, b)[0], d = child_ids(s, a)[1];
+        ExportOptions opts;
+        assert_eq(export_outline_string(s, opts), "a\n  b \"<&>\"\n    c\n  d\ne\n", "indented text");
+        opts.format = ExportFormat::Markdown;
+        const std::string md = export_outline_string(s, opts);
+        assert_eq(md, "- a\n  - b \"<&>\"\n    - c\n  - d\n- e\n", "markdown");
+        ImportOptions mdIn;
+        mdIn.format = OutlineFormat::Markdown;
+        assert_true(same_state(import_outline(md, mdIn), s), "markdown round trip");
+
+        opts.format = ExportFormat::Opml;
+        opts.title = "T&T";
+        assert_eq(export_outline_string(s, opts),
+                  "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<opml version=\"2.0\">\n<head><title>T&amp;T</title></head>\n<body>\n"
+                  "  <outline text=\"a\">\n    <outline text=\"b &quot;&lt;&amp;&gt;&quot;\">\n      <outline text=\"c\"/>\n    </outline>\n"
+                  "    <outline text=\"d\"/>\n  </outline>\n  <outline text=\"e\"/>\n</body>\n</opml>\n",
+                  "opml");
+
+        set_text(s, e, "tab\there\n");
+        apply_command_inplace(s, Command{ CommandType::ToggleCollapse, b });
+        apply_command_inplace(s, Command{ CommandType::SetFocus, d, 1 });
+        opts.format = ExportFormat::Json;
+        assert_eq(export_outline_string(s, opts),
+                  "{\"nodes\":{\"" + a + "\":{\"id\":\"" + a + "\",\"parentId\":null,\"text\":\"a\",\"children\":[\"" + b + "\",\"" + d + "\"]},"
+                  "\"" + b + "\":{\"id\":\"" + b + "\",\"parentId\":\"" + a + "\",\"text\":\"b \\\"<&>\\\"\",\"children\":[\"" + c + "\"],\"collapsed\":true},"
+                  "\"" + c + "\":{\"id\":\"" + c + "\",\"parentId\":\"" + b + "\",\"text\":\"c\",\"children\":[]},"
+                  "\"" + d + "\":{\"id\":\"" + d + "\",\"parentId\":\"" + a + "\",\"text\":\"d\",\"children\":[]},"
+                  "\"" + e + "\":{\"id\":\"" + e + "\",\"parentId\":null,\"text\":\"tab\\there\\n\",\"children\":[]}},"
+                  "\"rootOrder\":[\"" + a + "\",\"" + e + "\"],\"focusedId\":\"" + d + "\",\"caret\":1}\n",
+                  "json");
+
+        // scope and visibility filters
+        opts.format = ExportFormat::IndentedText;
+        assert_eq(export_outline_string(s, opts), "a\n  b \"<&>\"\n    c\n  d\ntab\there \n", "line breaks become spaces");
+        opts.visibleOnly = true;
+        assert_eq(export_outline_string(s, opts), "a\n  b \"<&>\"\n  d\ntab\there \n", "collapsed children left out");
+        apply_command_inplace(s, Command{ CommandType::SetScopeRoot, "", -1, b });
+        assert_eq(export_outline_string(s, opts), "b \"<&>\"\n  c\n", "a collapsed scope root still exports its children");
+        opts.format = ExportFormat::Json;
+        assert_eq(export_outline_string(s, opts),
+                  "{\"nodes\":{\"" + b + "\":{\"id\":\"" + b + "\",\"parentId\":null,\"text\":\"b \\\"<&>\\\"\",\"children\":[\"" + c + "\"],\"collapsed\":true},"
+                  "\"" + c + "\":{\"id\":\"" + c + "\",\"parentId\":\"" + b + "\",\"text\":\"c\",\"children\":[]}},"
+                  "\"rootOrder\":[\"" + b + "\"],\"focusedId\":\"" + b + "\",\"caret\":0}\n",
+                  "scoped json stands alone");
+        opts.wholeTree = true;
+        opts.visibleOnly = false;
+        const std::string whole = export_outline_string(s, opts);
+        assert_true(whole.find("\"scopeRootId\":\"" + b + "\"") != std::string::npos, "whole-tree json keeps the scope");
+
+        // chunking never changes the output
+        opts.chunkBytes = 7;
+        std::string joined;
+        size_t chunks = 0;
+        export_outline(s, [&](std::string_view part) { joined.append(part.data(), part.size()); ++chunks; }, opts);
+        assert_eq(joined, whole, "chunked output");
+        assert_true(chunks > whole.size() / 16, "output arrives in chunks");
+
+        // very deep outlines export without recursion
+        std::string deep;
+        for (size_t i = 0; i < 600; ++i) deep.append(i, ' ').append("x\n");
+        ExportOptions flat;
+        flat.indent = " ";
+        assert_eq(export_outline_string(import_outline(deep), flat), deep, "deep text round trip");
+        StateBuilder builder;
+        for (size_t i = 0; i < 100000; ++i) builder.add(make_new_id(builder.state()), "x", i);
+        State veryDeep = builder.finish();
+        veryDeep.focusedId = root_ids(veryDeep)[0];
+        flat.format = ExportFormat::Opml;
+        flat.indent.clear(); // indentation would make deep output quadratic
+        size_t closes = 0;
+        const std::string opml = export_outline_string(veryDeep, flat);
+        for (size_t pos = 0; (pos = opml.find("</outline>", pos)) != std::string::npos; ++pos) ++closes;
+        assert_eq_size(closes, 99999, "every non-leaf closes");
+
+        std::string path = (std::filesystem::temp_directory_path() / "bullet_engine_export_test.md").string();
+        ExportOptions toFile;
+        toFile.wholeTree = true;
+        toFile.format = ExportFormat::Markdown;
+        export_outline_file(s, path, toFile);
+        assert_eq_size(node_count(import_outline_file(path, mdIn)), node_count(s), "file export");
+        std::remove(path.c_str());
+    }
+
+    // 28) Rope text: caret-local edits on long texts, shared buffers, InsertText/DeleteText
+    {
+        // fuzz the rope against std::string
+        std::mt19937 rng(2024);
+        std::string ref(5000, 'a');
+        for (size_t i = 0; i < ref.size(); ++i) ref[i] = static_cast<char>('a' + i % 26);
+        Text t(ref);
+        assert_true(t.is_rope() && t == ref, "long text becomes a rope");
+        for (int step = 0; step < 3000; ++step) {
+            const size_t pos = rng() % (ref.size() + 1);
+            switch (rng() % 4) {
+            case 0: {
+                std::string ins(1 + rng() % (step % 50 == 0 ? 3000 : 5), static_cast<char>('A' + step % 26));
+                t.insert(pos, ins);
+                ref.insert(pos, ins);
+                break;
+            }
+            case 1: {
+                size_t n = rng() % 40;
+                t.erase(pos, n);
+                ref.erase(pos, n);
+                break;
+            }
+            case 2: {
+                size_t n = rng() % 2000;
+                assert_true(t.substr(pos, n) == ref.substr(pos, n), "rope substr");
+                break;
+            }
+            default: {
+                Text tail = t.substr(pos);
+                t.erase(pos);
+                ref.erase(pos);
+                t.append(tail);
+                ref += tail.str();
+                break;
+            }
+            }
+            if (ref.size() < 2000) {
+                t.append(Text(std::string(4000, 'z')));
+                ref.append(4000, 'z');
+            }
+            assert_eq_size(t.size(), ref.size(), "rope size");
+        }
+        assert_eq(t.str(), ref, "rope contents after fuzz");
+
+        // copies share storage; edits leave the original alone
+        Text doc(std::string(300000, 'x'));
+        Text copy = doc;
+        assert_true(copy.shares_storage_with(doc), "copies share the rope");
+        copy.insert(150000, "HELLO");
+        assert_true(doc.size() == 300000 && doc.str().find('H') == std::string::npos, "original unchanged");
+        assert_true(copy.substr(150000, 5) == std::string("HELLO"), "copy edited");
+        for (int i = 0; i < 10000; ++i) copy.insert(150005 + static_cast<size_t>(i), "k"); // typing
+        assert_true(copy.piece_count() < 200, "typing folds into small pieces");
+        Text shortText("abc");
+        shortText.append(Text("def"));
+        assert_true(!shortText.is_rope() && shortText == std::string("abcdef"), "short texts stay inline");
+        copy.erase(300);
+        assert_true(!copy.is_rope() && copy.size() == 300, "a shrunken rope goes back inline");
+
+        // commands on a long node
+        State s = initial_state();
+        const std::string id = s.focusedId;
+        const std::string big(200000, 'b');
+        apply_command_inplace(s, Command{ CommandType::SetText, id, -1, std::nullopt, big });
+        State before = s;
+        ChangeSet ch = apply_command_inplace(s, Command{ CommandType::InsertText, id, 100000, std::nullopt, "<ins>" });
+        assert_true(ch.touched == std::vector<std::string>{ id }, "insert touches the node");
+        assert_true(s.focusedId == id && s.caret == 100005, "caret after the insertion");
+        assert_eq(text_of(s, id).substr(99998, 9), "bb<ins>bb", "inserted at the caret");
+        assert_eq_size(text_of(before, id).size(), 200000, "earlier state keeps its text");
+        apply_command_inplace(s, Command{ CommandType::InsertText, id, -1, std::nullopt, "!" });
+        assert_eq(text_of(s, id).substr(100000, 6), "<ins>!", "negative caret uses the current caret");
+        ch = apply_command_inplace(s, Command{ CommandType::DeleteText, id, 100000, std::nullopt, "", 6 });
+        assert_true(ch.touched.size() == 1 && s.caret == 100000, "delete at caret");
+        assert_eq(text_of(s, id), big, "delete restores the text");
+        ch = apply_command_inplace(s, Command{ CommandType::DeleteText, id, 200000, std::nullopt, "", 5 });
+        assert_true(ch.touched.empty(), "delete past the end is a no-op");
+        ch = apply_command_inplace(s, Command{ CommandType::InsertText, id, 0, std::nullopt, "" });
+        assert_true(ch.touched.empty() && s.caret == 0, "empty insert only moves the caret");
+
+        // split and merge keep working on ropes
+        apply_command_inplace(s, Command{ CommandType::SplitAtCaret, id, 50000 });
+        const std::string second = s.focusedId;
+        assert_true(text_of(s, id).size() == 50000 && text_of(s, second).size() == 150000, "split a rope");
+        apply_command_inplace(s, Command{ CommandType::MergeNextSiblingIntoCurrent, id });
+        assert_eq(text_of(s, id), big, "merge ropes");
+        verify_invariants(s);
+        assert_true(same_state(SnapshotView::from_bytes(encode_snapshot(s)).materialize(), s), "rope snapshot round trip");
+        ExportOptions raw;
+        assert_eq_size(export_outline_string(s, raw).size(), big.size() + 1, "rope export");
+
+        // typing bursts coalesce; the journal replays the new commands
+        History h;
+        h.apply(s, Command{ CommandType::InsertText, id, 10, std::nullopt, "x" }, 1000);
+        h.apply(s, Command{ CommandType::InsertText, id, 11, std::nullopt, "y" }, 1100);
+        h.apply(s, Command{ CommandType::DeleteText, id, 10, std::nullopt, "", 1 }, 1200);
+        assert_eq_size(h.undo_depth(), 1, "text edits coalesce");
+        assert_true(h.bytes() < 64 * 1024, "a rope edit step does not retain the whole text");
+        h.undo(s);
+        assert_eq(text_of(s, id), big, "undo the burst");
+
+        const std::string base = (std::filesystem::temp_directory_path() / "bullet_engine_rope_journal").string();
+        std::remove((base + ".snap").c_str());
+        std::remove((base + ".log").c_str());
+        State expected;
+        {
+            Journal j(base);
+            State js = j.recover();
+            j.apply(js, Command{ CommandType::InsertText, js.focusedId, 0, std::nullopt, "hello world" });
+            j.apply(js, Command{ CommandType::DeleteText, js.focusedId, 5, std::nullopt, "", 6 });
+            expected = js;
+        }
+        {
+            Journal j(base);
+            State js = j.recover();
+            assert_true(same_state(js, expected) && text_of(js, js.focusedId) == "hello", "journal replays text edits");
+        }
+        std::remove((base + ".snap").c_str());
+        std::remove((base + ".log").c_str());
+    }
+
+    // 29) Search index: trigram lookups kept current through change sets
+    {
+        State s = import_outline("Alpha project\n  beta TASK\n    gamma task notes\n  Tasks list\nomega\n  taskforce\n");
+        SearchIndex index(s);
+        assert_eq_size(index.indexed_count(), 6, "every node indexed");
+        assert_true(index.memory_bytes() > 0, "memory reported");
+        auto texts = [](const State& st, const std::vector<std::string>& ids) {
+            std::vector<std::string> out;
+            for (const auto& id : ids) out.push_back(text_of(st, id));
+            return out;
+        };
+        assert_true(texts(s, index.search(s, "task")) ==
+                        std::vector<std::string>{ "beta TASK", "gamma task notes", "Tasks list", "taskforce" },
+                    "case-insensitive matches in document order");
+        assert_true(index.search(s, "zzz").empty() && index.search(s, "").empty(), "no match, empty query");
+        assert_true(texts(s, index.search(s, "ga")) == std::vector<std::string>{ "gamma task notes", "omega" }, "short query scans");
+        SearchOptions first;
+        first.limit = 1;
+        assert_true(texts(s, index.search(s, "TASK", first)) == std::vector<std::string>{ "beta TASK" }, "limit");
+
+        const std::string alpha = root_ids(s)[0], beta = child_ids(s, alpha)[0];
+        apply_command_inplace(s, Command{ CommandType::ToggleCollapse, beta });
+        SearchOptions shownOnly;
+        shownOnly.includeHidden = false;
+        assert_true(texts(s, index.search(s, "task", shownOnly)) == std::vector<std::string>{ "beta TASK", "Tasks list", "taskforce" }, "hidden matches left out");
+        apply_command_inplace(s, Command{ CommandType::SetScopeRoot, "", -1, beta });
+        assert_true(texts(s, index.search(s, "task", shownOnly)) == std::vector<std::string>{ "beta TASK", "gamma task notes" }, "a collapsed view root shows its children");
+        SearchOptions scoped;
+        scoped.scoped = true;
+        assert_true(texts(s, index.search(s, "task", scoped)) == std::vector<std::string>{ "beta TASK", "gamma task notes" }, "scoped search");
+
+        // random edits, the index updated from each change set, against a scan
+        std::function<void(const State&, NodeHandle, std::vector<std::string>&)> preorder =
+            [&](const State& st, NodeHandle h, std::vector<std::string>& out) {
+                out.push_back(id_of(st, h));
+                for (const auto& c : child_ids(st, id_of(st, h))) preorder(st, find_node(st, c), out);
+            };
+        auto scan = [&](const State& st, std::string q) {
+            for (char& c : q) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            std::vector<std::string> all, out;
+            for (const auto& r : root_ids(st)) preorder(st, find_node(st, r), all);
+            for (const auto& id : all) {
+                std::string t = text_of(st, id);
+                for (char& c : t) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+                if (t.find(q) != std::string::npos) out.push_back(id);
+            }
+            return out;
+        };
+        std::mt19937 rng(7);
+        State f = import_outline("abc\n  abd\n  xabcx\nbcd\n");
+        SearchIndex live(f);
+        History history;
+        const char* words[] = { "abc", "bcd", "ABD", "x", "cab", "abcabc" };
+        for (int step = 0; step < 1500; ++step) {
+            std::vector<std::string> ids = node_ids(f);
+            const std::string id = ids[rng() % ids.size()];
+            Command cmd{ CommandType::SetFocus, id };
+            switch (rng() % 9) {
+            case 0: cmd = Command{ CommandType::SplitAtCaret, id, static_cast<int>(rng() % 5) }; break;
+            case 1: cmd = Command{ CommandType::MergeNextSiblingIntoCurrent, id }; break;
+            case 2: cmd = Command{ CommandType::InsertText, id, static_cast<int>(rng() % 4), std::nullopt, words[rng() % 6] }; break;
+            case 3: cmd = Command{ CommandType::DeleteText, id, static_cast<int>(rng() % 4), std::nullopt, "", static_cast<int>(rng() % 3) }; break;
+            case 4: cmd = Command{ CommandType::SetText, id, -1, std::nullopt, rng() % 4 ? words[rng() % 6] : "" }; break;
+            case 5: cmd = Command{ CommandType::DeleteEmptyAtId, id }; break;
+            case 6: cmd = Command{ CommandType::Indent, id }; break;
+            case 7: cmd = Command{ CommandType::InsertLinesAfter, id, -1, std::nullopt, "cab\nzz abc" }; break;
+            default: break;
+            }
+            ChangeSet ch = (step % 50 == 49) ? history.undo(f) : history.apply(f, cmd, static_cast<uint64_t>(step) * 5000);
+            live.update(f, ch);
+            for (const char* q : { "abc", "BCD", "ab", "cabc" }) {
+                if (live.search(f, q) != scan(f, q)) {
+                    std::cerr << "search mismatch at step " << step << " for " << q << "\n";
+                    assert_true(false, "incremental index matches a scan");
+                }
+            }
+        }
+        assert_true(live.indexed_count() >= node_count(f), "removed nodes are dropped lazily");
+
+        // broad queries walk the document and stop at the limit
+        std::string many;
+        for (int i = 0; i < 3000; ++i) many += std::string(i % 3 ? "  " : "") + "Item " + std::to_string(i) + "\n";
+        State m = import_outline(many);
+        for (size_t i = 0; i < 300; ++i) apply_command_inplace(m, Command{ CommandType::ToggleCollapse, root_ids(m)[i * 3] });
+        SearchIndex mi(m);
+        const std::vector<std::string> all = scan(m, "item");
+        assert_eq_size(all.size(), 3000, "broad query scan");
+        assert_true(mi.search(m, "ITEM") == all, "broad query in document order");
+        SearchOptions ten;
+        ten.limit = 10;
+        assert_true(mi.search(m, "item", ten) == std::vector<std::string>(all.begin(), all.begin() + 10), "broad query limit");
+        std::vector<std::string> visibleMatches;
+        for (const auto& id : visible_order_ids(m)) visibleMatches.push_back(id);
+        assert_true(mi.search(m, "item", shownOnly) == visibleMatches, "broad query skips collapsed subtrees");
+        const std::string scopeRoot = root_ids(m)[500];
+        apply_command_inplace(m, Command{ CommandType::SetScopeRoot, "", -1, scopeRoot });
+        std::vector<std::string> inScope{ scopeRoot };
+        for (const auto& c : child_ids(m, scopeRoot)) inScope.push_back(c);
+        assert_true(mi.search(m, "item", scoped) == inScope, "broad scoped query");
+
+        // common trigrams, rare conjunction: the probe falls back to the postings
+        std::string pairs;
+        for (int i = 0; i < 80000; ++i) pairs += i % 2 ? "aaab\n" : "baaa\n";
+        pairs += "baaab\n";
+        State p = import_outline(pairs);
+        SearchIndex pi(p);
+        assert_true(texts(p, pi.search(p, "baaab", ten)) == std::vector<std::string>{ "baaab" }, "probe then postings");
+        assert_eq_size(pi.search(p, "aaab", ten).size(), 10, "probe satisfies a broad query");
+        assert_eq_size(SearchIndex(f).indexed_count(), node_count(f), "a rebuild indexes exactly the live nodes");
+    }
+
+    // 30) Packed-text scan: SIMD kernels against a naive find, case folding, scope
+    {
+        State s = import_outline("Alpha project\n  beta TASK\n    gamma task notes\n  Tasks list\nomega\n  taskforce\n");
+        PackedTexts packed = PackedTexts::from_state(s);
+        assert_eq_size(packed.node_count(), 6, "every node packed");
+        assert_eq(std::string(packed.text(2)), "gamma task notes", "texts in preorder");
+        ScanOptions ci;
+        ci.caseInsensitive = true;
+        std::vector<std::string> hitTexts;
+        for (const auto& hit : scan(packed, "TASK", ci)) hitTexts.push_back(text_of(s, hit.id) + "@" + std::to_string(hit.offset));
+        assert_true(hitTexts == std::vector<std::string>{ "beta TASK@5", "gamma task notes@6", "Tasks list@0", "taskforce@0" }, "case-insensitive hits with offsets");
+        assert_eq_size(scan(packed, "task").size(), 2, "exact case");
+        assert_true(scan(packed, "aomega").empty() && scan(packed, "").empty(), "no match across nodes, empty pattern");
+        ScanOptions scoped = ci;
+        scoped.scopeId = child_ids(s, root_ids(s)[0])[0];
+        assert_eq_size(scan(packed, "task", scoped).size(), 2, "scope covers the subtree");
+        scoped.scopeId = "missing";
+        assert_true(scan(packed, "task", scoped).empty(), "unknown scope");
+        std::string snapBytes = encode_snapshot(s);
+        PackedTexts fromSnap = PackedTexts::from_snapshot(SnapshotView::from_bytes(snapBytes));
+        assert_true(fromSnap.bytes() == packed.bytes() && fromSnap.subtree("missing") == std::nullopt, "snapshot packs the same texts");
+        assert_true(fromSnap.subtree(root_ids(s)[1]) == packed.subtree(root_ids(s)[1]), "snapshot depths");
+
+        // every kernel against a naive find, with hits on and across block edges
+        std::mt19937 rng(30);
+        std::string outline;
+        for (int i = 0; i < 400; ++i) {
+            outline += std::string((rng() % 3) * 2, ' ');
+            const size_t len = rng() % 90;
+            for (size_t k = 0; k < len; ++k) outline += "abAB c"[rng() % 6];
+            outline += "\n";
+        }
+        State r = import_outline(outline);
+        const std::string longId = root_ids(r)[0];
+        apply_command_inplace(r, Command{ CommandType::SetText, longId, -1, std::nullopt, std::string(3000, 'a') });
+        apply_command_inplace(r, Command{ CommandType::InsertText, longId, 1500, std::nullopt, "bAb c" });
+        assert_true(find_node(r, longId) && r.nodes.get(find_node(r, longId)).text.is_rope(), "a rope text is packed too");
+        PackedTexts rp = PackedTexts::from_state(r);
+        for (const char* q : { "a", "ab", "aba", "Ab", "bab", "abcab", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", "b c a" }) {
+            for (bool fold : { false, true }) {
+                std::string fq = q;
+                if (fold) for (char& c : fq) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+                std::vector<std::pair<std::string, size_t>> want;
+                for (size_t i = 0; i < rp.node_count(); ++i) {
+                    std::string t = text_of(r, rp.id(i));
+                    if (fold) for (char& c : t) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+                    for (size_t at = t.find(fq); at != std::string::npos; at = t.find(fq, at + 1)) want.emplace_back(rp.id(i), at);
+                }
+                for (ScanKernel k : { ScanKernel::Scalar, ScanKernel::Sse2, ScanKernel::Avx2 }) {
+                    ScanOptions o;
+                    o.caseInsensitive = fold;
+                    o.kernel = k;
+                    std::vector<std::pair<std::string, size_t>> got;
+                    for (const auto& hit : scan(rp, q, o)) got.emplace_back(hit.id, hit.offset);
+                    if (got != want) {
+                        std::cerr << "scan mismatch for '" << q << "' with " << scan_kernel_name(k) << "\n";
+                        assert_true(false, "kernel matches a naive find");
+                    }
+                    o.limit = 3;
+                    assert_eq_size(scan(rp, q, o).size(), std::min<size_t>(3, want.size()), "scan limit");
+                }
+            }
+        }
+    }
+
+    // 31) Slab pool: tree nodes come from pooled blocks and go back when a state is dropped
+    {
+        std::vector<int, PoolAllocator<int>> small;
+        for (int i = 0; i < 1000; ++i) small.push_back(i); // grows through the classes and past kPoolMaxBlock
+        assert_eq_size(static_cast<size_t>(small[999]), 999, "pooled vector");
+        const size_t before = pool_stats().usedBytes;
+        size_t peakSlabs = 0;
+        {
+            std::string lines;
+            for (int i = 0; i < 5000; ++i) lines += std::string(i % 2 ? "  " : "") + "node " + std::to_string(i) + "\n";
+            State big = import_outline(lines);
+            State copy = big;
+            apply_command_inplace(copy, Command{ CommandType::SplitAtCaret, root_ids(copy)[7], 2 });
+#ifndef BULLET_ENGINE_NO_POOL
+            assert_true(pool_stats().usedBytes > before + 5000 * 64, "index and map nodes are pooled");
+            assert_true(pool_stats().slabBytes >= pool_stats().usedBytes, "slabs cover the blocks in use");
+#endif
+            peakSlabs = pool_stats().slabs;
+        }
+        assert_eq_size(pool_stats().usedBytes, before, "dropping the states returns every block");
+#ifndef BULLET_ENGINE_NO_POOL
+        assert_true(pool_stats().slabs < peakSlabs, "emptied slabs go back to the system");
+#endif
+        // blocks freed on another thread return through its cache when it exits
+        {
+            auto shared = std::make_shared<State>(import_outline("a\n  b\n  c\nd\n"));
+            std::thread([moved = std::move(shared)]() mutable { moved.reset(); }).join();
+            assert_eq_size(pool_stats().usedBytes, before, "an exiting thread hands back its cached blocks");
+        }
+    }
+
+    // 32) Command instrumentation: per-type aggregation, observer samples when compiled in
+    {
+        CommandMetrics metrics;
+        CommandSample fast;
+        fast.type = CommandType::SetText;
+        fast.transformNs = 500;
+        fast.allocations = 2;
+        CommandSample slow = fast;
+        slow.transformNs = 3500;
+        slow.cloneNs = 1000;
+        slow.cloneBytes = 4096;
+        slow.nodesTouched = 3;
+        metrics.on_command(fast);
+        metrics.on_command(slow);
+        CommandStats st = metrics.stats(CommandType::SetText);
+        assert_eq_size(st.count, 2, "samples counted");
+        assert_eq_size(st.totalNs, 5000, "clone and transform time summed");
+        assert_eq_size(st.maxNs, 4500, "slowest sample");
+        assert_true(st.cloneBytes == 4096 && st.nodesTouched == 3 && st.allocations == 4, "sizes summed");
+        assert_true(st.latency[0] == 1 && st.latency[3] == 1, "under 1 us, and 4.5 us in [4, 8)");
+        assert_eq_size(metrics.stats(CommandType::Indent).count, 0, "other types untouched");
+        const std::string json = metrics.to_json();
+        assert_true(json.find("\"SetText\":{\"count\":2,") != std::string::npos && json.find("Indent") == std::string::npos, "json lists seen types");
+        metrics.reset();
+        assert_eq(metrics.to_json(), "{}", "reset");
+        assert_eq(command_type_name(CommandType::MergeNextSiblingIntoCurrent), "MergeNextSiblingIntoCurrent", "type names");
+
+        State s = import_outline("a\n  b\n  c\nd\n");
+        const std::string b = child_ids(s, root_ids(s)[0])[0];
+        assert_true(set_command_observer(&metrics) == nullptr, "no observer installed before");
+        State next = apply_command(s, Command{ CommandType::SplitAtCaret, b, 0 });
+        apply_command_inplace(next, Command{ CommandType::Indent, child_ids(next, root_ids(next)[0])[2] });
+        apply_commands_inplace(next, { Command{ CommandType::SetText, b, -1, std::nullopt, "x" }, Command{ CommandType::SetText, b, -1, std::nullopt, "y" } });
+        assert_true(set_command_observer(nullptr) == &metrics, "observer detached");
+        apply_command_inplace(next, Command{ CommandType::SetText, b, -1, std::nullopt, "z" });
+        if (kInstrumentationEnabled) {
+            const CommandStats split = metrics.stats(CommandType::SplitAtCaret);
+            assert_eq_size(split.count, 1, "pure command reported");
+            assert_true(split.nodesTouched >= 2 && split.allocations > 0, "split touches nodes and allocates");
+            assert_true(split.cloneBytes > 0, "the shared state is copied on write");
+            assert_eq_size(metrics.stats(CommandType::Indent).count, 1, "in-place command reported");
+            assert_eq_size(metrics.stats(CommandType::SetText).count, 2, "batched commands reported one by one, none after detaching");
+        } else {
+            assert_eq(metrics.to_json(), "{}", "no samples without BULLET_ENGINE_INSTRUMENT");
+        }
+    }
+
+    // 33) Multi-document host: work-stealing pool, per-document strands, published snapshots
+    {
+        TaskPool pool(4);
+        assert_eq_size(pool.size(), 4, "pool threads");
+        std::atomic<int> ran{ 0 };
+        for (int i = 0; i < 200; ++i) {
+            pool.post([&pool, &ran] {
+                for (int k = 0; k < 5; ++k) pool.post([&ran] { ran.fetch_add(1); });
+                ran.fetch_add(1);
+            });
+        }
+        pool.wait_idle();
+        assert_eq_size(static_cast<size_t>(ran.load()), 1200, "tasks and the tasks they post all ran");
+
+        DocumentHost host(pool);
+        const int kDocs = 16, kEdits = 100;
+        std::vector<std::string> names, rootIds;
+        for (int d = 0; d < kDocs; ++d) {
+            names.push_back("doc" + std::to_string(d));
+            State s = import_outline("r\n");
+            rootIds.push_back(root_ids(s)[0]);
+            assert_true(host.open(names.back(), s) != nullptr, "open");
+        }
+        assert_true(host.open("doc0", State{}) == nullptr, "ids are unique");
+        assert_true(!host.submit("missing", Command{ CommandType::SetText, "", -1, std::nullopt, "x" }), "unknown id");
+        assert_eq_size(host.document_count(), kDocs, "document count");
+        const State initial = *host.snapshot("doc3");
+
+        std::string expected = "r";
+        for (int k = 0; k < kEdits; ++k) expected += std::to_string(k) + ",";
+        std::atomic<size_t> completions{ 0 };
+        std::atomic<bool> writing{ true };
+        std::vector<std::thread> readers;
+        for (int r = 0; r < 2; ++r) {
+            readers.emplace_back([&, r] {
+                for (unsigned i = r; writing.load(); ++i) {
+                    const int d = static_cast<int>(i % kDocs);
+                    const StateHandle::ReadGuard snap = host.find(names[d])->read();
+                    verify_invariants(*snap);
+                    const std::string text = text_of(*snap, rootIds[d]);
+                    assert_true(expected.compare(0, text.size(), text) == 0, "readers see a prefix of the edits, in order");
+                }
+            });
+        }
+        std::vector<std::thread> writers;
+        for (int w = 0; w < 4; ++w) {
+            writers.emplace_back([&, w] {
+                for (int k = 0; k < kEdits; ++k) {
+                    for (int d = w; d < kDocs; d += 4) {
+                        const auto done = [&completions](const ChangeSet&) { completions.fetch_add(1); };
+                        host.submit(names[d], Command{ CommandType::InsertText, rootIds[d], 1 << 30, std::nullopt, std::to_string(k) + "," }, done);
+                        if (k % 10 == 9) {
+                            host.submit(names[d], { Command{ CommandType::InsertEmptySiblingAfter, rootIds[d] }, Command{ CommandType::SetText, "", -1, std::nullopt, "s" } }, done);
+                        }
+                    }
+                }
+            });
+        }
+        for (std::thread& t : writers) t.join();
+        host.drain();
+        writing = false;
+        for (std::thread& t : readers) t.join();
+
+        assert_eq_size(completions.load(), kDocs * (kEdits + kEdits / 10), "one completion per submission");
+        for (int d = 0; d < kDocs; ++d) {
+            const std::optional<State> snap = host.snapshot(names[d]);
+            verify_invariants(*snap);
+            assert_eq(text_of(*snap, rootIds[d]), expected, "strand keeps submission order");
+            assert_eq_size(node_count(*snap), 1 + kEdits / 10, "siblings inserted");
+            assert_eq_size(host.find(names[d])->version(), kEdits + 2 * (kEdits / 10), "version counts commands");
+        }
+        assert_eq(text_of(initial, rootIds[3]), "r", "a held snapshot is unaffected by later commands");
+
+        std::shared_ptr<Document> doc = host.find("doc5");
+        assert_true(host.close("doc5") && !host.close("doc5") && !host.find("doc5"), "close");
+        host.submit(doc, { Command{ CommandType::SetText, rootIds[5], -1, std::nullopt, "closed" } });
+        host.drain();
+        assert_eq(text_of(doc->snapshot(), rootIds[5]), "closed", "a held document still runs commands");
+        assert_true(!host.snapshot("doc5"), "closed ids have no snapshot");
+    }
+
+    // 34) StateHandle: lock-free pins against a single writer, epoch reclamation
+    {
+        const size_t poolBefore = pool_stats().usedBytes;
+        {
+            StateHandle h(import_outline("a\n"));
+            const std::string a = root_ids(h.working())[0];
+            assert_eq_size(h.version(), 0, "initial version");
+            {
+                const StateHandle::ReadGuard pinned = h.read();
+                h.apply(Command{ CommandType::SetText, a, -1, std::nullopt, "b" });
+                h.apply({ Command{ CommandType::InsertText, a, 1, std::nullopt, "c" } });
+                assert_eq(text_of(*pinned, a), "a", "a pinned version is read in place, unchanged");
+                assert_eq_size(pinned.version(), 0, "pinned version number");
+                assert_eq_size(h.retired(), 2, "versions after the pin wait for it");
+                assert_eq(text_of(*h.read(), a), "bc", "new pins see the latest version");
+            }
+            h.publish();
+            assert_eq_size(h.retired(), 0, "released pins let the writer reclaim");
+            assert_eq_size(h.version(), 3, "one version per publish");
+
+            const State kept = h.snapshot();
+            h.working() = import_outline("x\n");
+            assert_eq(text_of(*h.read(), a), "bc", "working edits are private until published");
+            h.publish();
+            assert_eq_size(h.retired(), 0, "a snapshot copy does not pin");
+            assert_eq(text_of(kept, a), "bc", "the snapshot copy stays valid");
+            h.publish(kept);
+
+            const int kEdits = 3000;
+            std::vector<size_t> lengthAt{ 2 }; // text length per version, from the current one on
+            for (int k = 0; k < kEdits; ++k) lengthAt.push_back(lengthAt.back() + std::to_string(k).size() + 1);
+            std::string expected = "bc";
+            for (int k = 0; k < kEdits; ++k) expected += std::to_string(k) + ",";
+            const uint64_t base = h.version();
+            std::atomic<bool> writing{ true };
+            std::vector<std::thread> readers;
+            for (int r = 0; r < 3; ++r) {
+                readers.emplace_back([&] {
+                    uint64_t last = 0;
+                    for (unsigned i = 0; writing.load(); ++i) {
+                        const StateHandle::ReadGuard g = h.read();
+                        assert_true(g.version() >= last, "versions never go back");
+                        last = g.version();
+                        const std::string text = text_of(*g, a);
+                        assert_eq_size(text.size(), lengthAt[g.version() - base], "text matches its version");
+                        assert_true(expected.compare(0, text.size(), text) == 0, "edits land in order");
+                        if (i % 64 == 0) verify_invariants(*g);
+                    }
+                });
+            }
+            for (int k = 0; k < kEdits; ++k) h.apply(Command{ CommandType::InsertText, a, 1 << 30, std::nullopt, std::to_string(k) + "," });
+            writing = false;
+            for (std::thread& t : readers) t.join();
+            h.publish();
+            assert_eq_size(h.retired(), 0, "every replaced version reclaimed");
+            assert_eq(text_of(*h.read(), a), expected, "writer's edits all published");
+
+            // more readers than slots: the extra ones wait for a pin to be released
+            const size_t kCrowd = StateHandle::kReaderSlots + 8;
+            std::atomic<size_t> pinned{ 0 };
+            std::atomic<bool> hold{ true };
+            std::vector<std::thread> crowd;
+            for (size_t r = 0; r < kCrowd; ++r) {
+                crowd.emplace_back([&] {
+                    const StateHandle::ReadGuard g = h.read();
+                    ++pinned;
+                    while (hold.load()) std::this_thread::yield();
+                    assert_eq(text_of(*g, a), expected, "a late pin reads the current version");
+                });
+            }
+            while (pinned.load() < StateHandle::kReaderSlots) std::this_thread::yield();
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            assert_eq_size(pinned.load(), StateHandle::kReaderSlots, "pins never exceed the slots");
+            hold = false;
+            for (std::thread& t : crowd) t.join();
+            assert_eq_size(pinned.load(), kCrowd, "every waiting reader gets a slot");
+        }
+        assert_eq_size(pool_stats().usedBytes, poolBefore, "versions and their nodes are freed");
+    }
+
+    // 35) Parallel whole-tree walks: subtree aggregation, validate() reporting every violation
+    {
+        TaskPool pool(4);
+        StateBuilder builder;
+        const NodeHandle wide = builder.add(make_new_id(builder.state()), "wide", 0);
+        for (int i = 0; i < 30000; ++i) {
+            builder.add(make_new_id(builder.state()), "c" + std::to_string(i), 1);
+            if (i % 3 == 0) builder.add(make_new_id(builder.state()), "g", 2);
+        }
+        const NodeHandle deep = builder.add(make_new_id(builder.state()), "deep", 0);
+        for (int i = 0; i < 20000; ++i) builder.add(make_new_id(builder.state()), "d", i + 1);
+        State big = builder.finish();
+        big.focusedId = root_ids(big)[0];
+        size_t bytes = 0;
+        big.nodes.for_each([&](NodeHandle, const Node& n) { bytes += n.text.size(); });
+
+        for (TaskPool* p : { static_cast<TaskPool*>(nullptr), &pool }) {
+            const SubtreeStats all = subtree_stats(big, {}, p);
+            assert_true(all.nodes == 60002 && all.depth == 20001 && all.textBytes == bytes, "forest stats");
+            const SubtreeStats w = subtree_stats(big, wide, p);
+            assert_true(w.nodes == 40001 && w.depth == 3, "wide subtree stats");
+            const SubtreeStats leaf = subtree_stats(big, big.nodes.get(deep).children.first, p);
+            assert_true(leaf.nodes == 20000 && leaf.depth == 20000 && leaf.textBytes == 20000, "chain subtree stats");
+            assert_true(validate(big, p).empty(), "a valid forest has no violations");
+
+            std::vector<std::atomic<int>> visits(big.nodes.slot_limit());
+            std::atomic<size_t> depthSum{ 0 };
+            parallel_for_each_node(big, p, [&](NodeHandle h, const Node&, size_t depth) {
+                visits[h.index].fetch_add(1);
+                depthSum.fetch_add(depth);
+            });
+            size_t once = 0;
+            for (const auto& v : visits) once += v.load() == 1;
+            assert_eq_size(once, 60002, "every node visited once");
+            assert_eq_size(depthSum.load(), 50000 + size_t(20000) * 20001 / 2, "depths");
+        }
+        assert_true(subtree_stats(State{}).nodes == 0 && subtree_stats(State{}).depth == 0, "empty forest");
+
+        const auto has = [](const std::vector<Violation>& vs, const std::string& id, const std::string& what) {
+            for (const Violation& v : vs) {
+                if (v.id == id && v.message.find(what) != std::string::npos) return true;
+            }
+            return false;
+        };
+        const NodeHandle c7 = sibling_at(big.nodes.get(wide).children, 7);
+        State bad = big;
+        bad.nodes.mut(c7).parent = deep;
+        std::vector<Violation> vs = validate(bad, &pool);
+        assert_true(vs.size() == 1 && has(vs, id_of(big, c7), "parent link"), "wrong parent reported");
+        bad = big;
+        bad.nodes.mut(c7).visibleSize = 5;
+        vs = validate(bad, &pool);
+        assert_true(vs.size() == 2 && has(vs, id_of(big, c7), "visibleSize does not match") && has(vs, id_of(big, c7), "index weight"), "wrong size reported");
+        bad = big;
+        const std::string lost = id_of(bad, create_node(bad, "lost"));
+        bad.focusedId = "nope";
+        vs = validate(bad, &pool);
+        assert_true(vs.size() == 2 && has(vs, lost, "unreachable") && has(vs, "nope", "focusedId"), "orphan and focus reported");
+
+        State small = import_outline("a\n  b\n  c\nd\n");
+        const NodeHandle a = find_node(small, root_ids(small)[0]);
+        const NodeHandle c = small.nodes.get(a).children.last;
+        small.nodes.mut(c).next = small.nodes.get(a).children.first;  // b -> c -> b ...
+        small.nodes.mut(c).children = small.nodes.get(a).children;    // ... and c contains b, c again
+        small.caret = 99;
+        vs = validate(small);
+        assert_true(has(vs, "n3", "longer than its index") && has(vs, "n2", "reached more than once") && has(vs, "n3", "visibleSize"), "cycles are reported, not followed");
+        assert_true(has(vs, small.focusedId, "caret"), "caret reported");
+        vs = validate(State{});
+        assert_true(has(vs, "", "no roots"), "empty state reported");
+    }
+
+    // 36) Cached subtree aggregates follow every edit
+    {
+        const auto agrees = [](const State& st) {
+            bool ok = true;
+            st.nodes.for_each([&](NodeHandle h, const Node&) {
+                const SubtreeStats got = subtree_aggregates(st, id_of(st, h));
+                const SubtreeStats want = subtree_stats(st, h);
+                ok = ok && got.nodes == want.nodes && got.depth == want.depth && got.textBytes == want.textBytes;
+            });
+            const SubtreeStats all = subtree_aggregates(st, "");
+            const SubtreeStats walked = subtree_stats(st);
+            return ok && all.nodes == walked.nodes && all.depth == walked.depth && all.textBytes == walked.textBytes;
+        };
+        State s = import_outline("a\n  b\n    c\n  d\ne\n"); // n1..n5
+        assert_true(agrees(s), "imported aggregates");
+        SubtreeStats a = subtree_aggregates(s, "n1");
+        assert_true(a.nodes == 4 && a.depth == 3 && a.textBytes == 4, "a's subtree");
+        assert_eq_size(descendant_count(s, "n1"), 3, "descendants of a");
+        assert_eq_size(descendant_count(s, "n3"), 0, "leaf has none");
+        const SubtreeStats none = subtree_aggregates(s, "nope");
+        assert_true(none.nodes == 0 && none.depth == 0 && none.textBytes == 0 && descendant_count(s, "nope") == 0, "unknown id");
+
+        s = apply_and_check(s, Command{ CommandType::Indent, "n5" });     // e under a, after d
+        assert_eq_size(descendant_count(s, "n1"), 4, "indent adds to the new parent");
+        s = apply_and_check(s, Command{ CommandType::Indent, "n5" });     // e under d
+        assert_true(subtree_aggregates(s, "n4").depth == 2 && subtree_aggregates(s, "n1").depth == 3, "indent deepens d");
+        s = apply_and_check(s, Command{ CommandType::Outdent, "n3" });    // c beside b
+        assert_true(subtree_aggregates(s, "n2").depth == 1 && descendant_count(s, "n1") == 4, "outdent moves c up");
+        s = apply_and_check(s, Command{ CommandType::MoveUp, "n4" });
+        s = apply_and_check(s, Command{ CommandType::MoveDown, "n2" });
+        assert_true(agrees(s), "moves keep the aggregates");
+        s = apply_and_check(s, Command{ CommandType::SetText, "n4", 0, std::nullopt, "delta" });
+        s = apply_and_check(s, Command{ CommandType::InsertText, "n5", 1, std::nullopt, "psilon" });
+        s = apply_and_check(s, Command{ CommandType::DeleteText, "n4", 1, std::nullopt, "", 2 });
+        assert_true(subtree_aggregates(s, "n4").textBytes == 3 + 7 && subtree_aggregates(s, "n1").textBytes == 13, "text edits reach the ancestors");
+        s = apply_and_check(s, Command{ CommandType::SplitAtCaret, "n4", 1 }, +1);
+        assert_true(agrees(s), "split keeps the aggregates");
+        s = apply_and_check(s, Command{ CommandType::MergeNextSiblingIntoCurrent, "n4" }, -1);
+        assert_true(subtree_aggregates(s, "n4").textBytes == 3 + 7 && descendant_count(s, "n4") == 1, "merge restores d");
+        s = apply_and_check(s, Command{ CommandType::ToggleCollapse, "n4" });
+        assert_eq_size(descendant_count(s, "n4"), 1, "collapse hides rows, not descendants");
+        s = apply_and_check(s, Command{ CommandType::InsertLinesAfter, "n5", -1, std::nullopt, "x\ny\nz" }, +3);
+        assert_true(descendant_count(s, "n4") == 4 && agrees(s), "paste counts");
+        s = apply_and_check(s, Command{ CommandType::SetText, "n5", 0, std::nullopt, "" });
+        const std::string last = child_ids(s, "n4").back();
+        s = apply_and_check(s, Command{ CommandType::SetText, last, 0, std::nullopt, "" });
+        s = apply_and_check(s, Command{ CommandType::DeleteEmptyAtId, last }, -1);
+        assert_true(descendant_count(s, "n4") == 3 && agrees(s), "delete counts");
+        s = apply_and_check(s, Command{ CommandType::ToggleCollapse, "n4" });
+        for (const ViewRow& row : visible_window(s, 0, 20)) {
+            assert_eq_size(row.descendantCount, descendant_count(s, row.id), "window rows carry descendants");
+        }
+
+        // A deep chain: edits at the bottom reach the top.
+        StateBuilder builder;
+        for (int i = 0; i < 2000; ++i) builder.add(make_new_id(builder.state()), "x", i);
+        State chain = builder.finish();
+        const std::string top = root_ids(chain)[0];
+        chain.focusedId = top;
+        NodeHandle leaf = find_node(chain, top);
+        while (chain.nodes.get(leaf).children.first) leaf = chain.nodes.get(leaf).children.first;
+        const std::string leafId = id_of(chain, leaf);
+        apply_command_inplace(chain, Command{ CommandType::InsertText, leafId, 1, std::nullopt, "yz" });
+        a = subtree_aggregates(chain, top);
+        assert_true(a.nodes == 2000 && a.depth == 2000 && a.textBytes == 2002, "chain top sees the leaf's edit");
+        apply_command_inplace(chain, Command{ CommandType::Outdent, leafId });
+        assert_true(subtree_aggregates(chain, top).depth == 1999 && subtree_aggregates(chain, "").depth == 1999, "chain height drops");
+        assert_true(validate(chain).empty(), "chain stays valid");
     }
 
     std::cout << "All engine tests passed.\n";